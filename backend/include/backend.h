@@ -130,6 +130,31 @@ struct BackendResult* tdisk_pre_remove(int argc, char *args[], struct Options *o
  **/
 struct BackendResult* performance_improvement(int argc, char *args[], struct Options *options);
 
+/**
+  * C version of get_usage. Look at the C++ version for more details.
+ **/
+struct BackendResult* get_usage(int argc, char *args[], struct Options *options);
+
+/**
+  * C version of get_stats. Look at the C++ version for more details.
+ **/
+struct BackendResult* get_stats(int argc, char *args[], struct Options *options);
+
+/**
+  * C version of io_capture. Look at the C++ version for more details.
+ **/
+struct BackendResult* io_capture(int argc, char *args[], struct Options *options);
+
+/**
+  * C version of miss_ratio_curve. Look at the C++ version for more details.
+ **/
+struct BackendResult* miss_ratio_curve(int argc, char *args[], struct Options *options);
+
+/**
+  * C version of pin_file. Look at the C++ version for more details.
+ **/
+struct BackendResult* pin_file(int argc, char *args[], struct Options *options);
+
 /************************* Options ****************************/
 
 /**
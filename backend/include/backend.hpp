@@ -122,12 +122,15 @@ namespace td
 
 	/**
 	  * Gets the sector information for the given logical
-	  * sector of the given tDisk
+	  * sector of the given tDisk. If several logical sectors
+	  * are given, they are looked up at once
 	  * @param args:
 	  *  - tDisk minor number (e.g. 0) or path (e.g. /dev/td0)
 	  *  - Logical sector number (e.g. 1234)
+	  *  - Optional additional logical sector numbers
 	  * @param options: The command options (e.g. output-format)
 	  * @return A stringified version of td::c::f_sector_index
+	  * or an array of them
 	 **/
 	BackendResult get_sector_index(const std::vector<std::string> &args, Options &options);
 
@@ -170,12 +173,12 @@ namespace td
 	BackendResult get_device_info(const std::vector<std::string> &args, Options &options);
 
 	/**
-	  * Returns debug information about the tdisk. When the current
-	  * debug id is given, then the next debug info is returned
+	  * Drains the trace records of the tdisk and returns the
+	  * latency breakdown of the requests since the last call
 	  * @param args:
 	  *  - tDisk minor number (e.g. 0) or path (e.g. /dev/td0)
-	  *  - (Optional: The current debug id)
 	  * @param options: The command options (e.g. output-format)
+	  * @return td::tDiskLatencyBreakdown
 	 **/
 	BackendResult get_debug_info(const std::vector<std::string> &args, Options &options);
 
@@ -264,6 +267,64 @@ namespace td
 	 **/
 	BackendResult get_internal_device_usage(const std::vector<std::string> &args, Options &options);
 
+	/**
+	  * Returns the used and free blocks and the heat histogram
+	  * of all internal devices. It is cheap enough to be polled
+	  * @param args:
+	  *  - tDisk
+	  * @param options: The command options (e.g. output-format)
+	  * @return An array of td::c::f_device_usage
+	 **/
+	BackendResult get_usage(const std::vector<std::string> &args, Options &options);
+
+	/**
+	  * Returns the performance counters of the given tDisk:
+	  * The amount of requests, migrations and initial
+	  * placements and the latency histogram of all requests.
+	  * The counters of the internal devices are part of
+	  * get_device_info
+	  * @param args:
+	  *  - tDisk
+	  * @param options: The command options (e.g. output-format)
+	  * @return td::c::f_tdisk_stats
+	 **/
+	BackendResult get_stats(const std::vector<std::string> &args, Options &options);
+
+	/**
+	  * Starts or stops capturing the requests of the given
+	  * tDisk or saves the captured requests to a file. The
+	  * file can be replayed using trace-replay
+	  * @param args:
+	  *  - tDisk
+	  *  - action (start, stop or save)
+	  *  - file (only for save, the requests are appended)
+	  * @param options: The command options (e.g. output-format)
+	 **/
+	BackendResult io_capture(const std::vector<std::string> &args, Options &options);
+
+	/**
+	  * Starts or stops tracking the reuse distances of the
+	  * given tDisk or shows the estimated hit ratio of the
+	  * fastest device depending on its size
+	  * @param args:
+	  *  - tDisk
+	  *  - action (start, stop or show)
+	  * @param options: The command options (e.g. output-format)
+	  * @return td::tDiskMissRatioCurve (only for show)
+	 **/
+	BackendResult miss_ratio_curve(const std::vector<std::string> &args, Options &options);
+
+	/**
+	  * Pins all ranges of the given file to the given tier.
+	  * The file must be stored on the tDisk
+	  * @param args:
+	  *  - tDisk
+	  *  - file
+	  *  - tier (1 is the fastest device, "never-promote" or "none")
+	  * @param options: The command options (e.g. output-format)
+	 **/
+	BackendResult pin_file(const std::vector<std::string> &args, Options &options);
+
 } //end namespace td
 
 #endif //BACKEND_HPP
@@ -64,6 +64,7 @@ public:
 			minornumber(-1),
 			blocksize(),
 			percentCache(),
+			heatTracking(),
 			devices()
 		{}
 
@@ -96,6 +97,12 @@ public:
 		 **/
 		unsigned int percentCache;
 
+		/**
+		  * How the access count of the sectors is tracked
+		  * ("exact" or "sketch")
+		 **/
+		std::string heatTracking;
+
 		/**
 		  * The internal devices of the tDisk
 		 **/
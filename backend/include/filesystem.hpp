@@ -38,6 +38,14 @@ namespace fs
 	 **/
 	std::vector<FileAssignment> getFilesOnDisk(const std::string &disk, std::vector<std::pair<unsigned long long,unsigned long long> > positions, bool calculatePercentage, bool filesOnly);
 
+	/**
+	  * Returns the ranges (position and length in bytes) where
+	  * the given file is stored on the given block device. If the
+	  * file is stored on a partition of the device, the positions
+	  * are relative to the start of the device
+	 **/
+	std::vector<std::pair<unsigned long long,unsigned long long> > getFileExtents(const std::string &file, const std::string &device);
+
 	/**
 	  * This function iterates over all files on the given filesystem
 	  * and calls callback for every file. The callback takes
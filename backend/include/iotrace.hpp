@@ -0,0 +1,92 @@
+/**
+  *
+  * tDisk backend
+  * @author Thomas Sparber (2015-2016)
+  *
+ **/
+
+#ifndef IOTRACE_HPP
+#define IOTRACE_HPP
+
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <tdisk.hpp>
+
+namespace td
+{
+
+/**
+  * A captured I/O trace is stored as text. Each line
+  * holds one request:
+  * <time in ns> <position in bytes> <length in bytes> <R|W> <priority>
+  * The priority is the I/O priority class (NONE, RT, BE or IDLE).
+  * It is optional, older traces don't contain it.
+ **/
+namespace iotrace
+{
+
+	/**
+	  * The names of the I/O priority classes
+	  * indexed by F_TDISK_IO_PRIO_*
+	 **/
+	static const char *const priorities[] = { "NONE", "RT", "BE", "IDLE" };
+
+	/**
+	  * Writes the given captured requests to the given stream
+	 **/
+	inline void write(std::ostream &out, const std::vector<f_io_record> &records)
+	{
+		for(const f_io_record &record : records)
+		{
+			out<<record.time<<" "<<record.position<<" "<<record.length<<" "
+				<<(record.direction == F_TDISK_IO_WRITE ? "W" : "R")<<" "
+				<<(record.priority <= F_TDISK_IO_PRIO_IDLE ? priorities[record.priority] : priorities[F_TDISK_IO_PRIO_NONE])<<"\n";
+		}
+	}
+
+	/**
+	  * Reads the captured requests of the given stream.
+	  * Empty lines and lines starting with # are skipped
+	  * @return false if the stream contains an invalid line
+	 **/
+	inline bool read(std::istream &in, std::vector<f_io_record> &records)
+	{
+		std::string line;
+
+		while(std::getline(in, line))
+		{
+			if(line.empty() || line[0] == '#')continue;
+
+			std::istringstream ss(line);
+			f_io_record record;
+			std::string direction;
+			std::string priority;
+
+			if(!(ss>>record.time>>record.position>>record.length>>direction))return false;
+			if(direction != "R" && direction != "W")return false;
+
+			record.direction = (direction == "W") ? F_TDISK_IO_WRITE : F_TDISK_IO_READ;
+			record.priority = F_TDISK_IO_PRIO_NONE;
+
+			if(ss>>priority)
+			{
+				while(record.priority <= F_TDISK_IO_PRIO_IDLE && priority != priorities[record.priority])
+					record.priority++;
+
+				if(record.priority > F_TDISK_IO_PRIO_IDLE)return false;
+			}
+			records.push_back(record);
+		}
+
+		return true;
+	}
+
+} //end namespace iotrace
+
+} //end namespace td
+
+#endif //IOTRACE_HPP
@@ -0,0 +1,147 @@
+/**
+  *
+  * tDisk backend
+  * @author Thomas Sparber (2015-2016)
+  *
+ **/
+
+#ifndef LATENCYBREAKDOWN_HPP
+#define LATENCYBREAKDOWN_HPP
+
+#include <string>
+#include <vector>
+
+#include <resultformatter.hpp>
+
+namespace td
+{
+
+/**
+  * This struct represents the latency of one type of
+  * trace records, e.g. the index lookups
+ **/
+struct TraceLatency
+{
+	/**
+	  * Default constructor
+	 **/
+	TraceLatency(const std::string &str_type, unsigned long long ull_count, double d_average, double d_max, double d_share) :
+		type(str_type),
+		count(ull_count),
+		average(d_average),
+		max(d_max),
+		share(d_share)
+	{}
+
+	/** The type of the trace records **/
+	std::string type;
+
+	/** The amount of trace records **/
+	unsigned long long count;
+
+	/** The average duration in microseconds **/
+	double average;
+
+	/** The max duration in microseconds **/
+	double max;
+
+	/** The share of the total request time in percent **/
+	double share;
+
+}; //end struct TraceLatency
+
+/**
+  * This struct represents the latency breakdown of
+  * the drained trace records of a tDisk
+ **/
+struct tDiskLatencyBreakdown
+{
+	/**
+	  * Default constructor
+	 **/
+	tDiskLatencyBreakdown(unsigned long long ull_records, unsigned long long ull_lost, unsigned long long ull_requested_bytes) :
+		records(ull_records),
+		lost(ull_lost),
+		requested_bytes(ull_requested_bytes),
+		latencies()
+	{}
+
+	/**
+	  * Adds the latency of the given type
+	 **/
+	void addLatency(const std::string &type, unsigned long long count, double average, double max, double share)
+	{
+		latencies.emplace_back(type, count, average, max, share);
+	}
+
+	/** The amount of drained trace records **/
+	unsigned long long records;
+
+	/** The amount of trace records which were overwritten before they were drained **/
+	unsigned long long lost;
+
+	/** The amount of requested bytes **/
+	unsigned long long requested_bytes;
+
+	/**
+	  * Contains the latency of each type of trace records
+	 **/
+	std::vector<TraceLatency> latencies;
+
+}; //end struct tDiskLatencyBreakdown
+
+/**
+  * Stringifies the given TraceLatency using the given format
+ **/
+template <> inline void createResultString(std::ostream &ss, const TraceLatency &latency, unsigned int hierarchy, const utils::ci_string &outputFormat)
+{
+	if(outputFormat == "json")
+	{
+		ss<<"{\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, latency, type, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, latency, count, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, latency, average, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, latency, max, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, latency, share, hierarchy+1, outputFormat); ss<<"\n";
+		insertTab(ss, hierarchy); ss<<"}";
+	}
+	else if(outputFormat == "text")
+	{
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, latency, type, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, latency, count, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, latency, average, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, latency, max, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, latency, share, hierarchy+1, outputFormat); ss<<"\n";
+	}
+	else
+		throw FormatException("Invalid output-format ", outputFormat);
+}
+
+/**
+  * Stringifies the given tDiskLatencyBreakdown using the given format
+ **/
+template <> inline void createResultString(std::ostream &ss, const tDiskLatencyBreakdown &breakdown, unsigned int hierarchy, const utils::ci_string &outputFormat)
+{
+	if(outputFormat == "json")
+	{
+		ss<<"{\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, breakdown, records, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, breakdown, lost, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, breakdown, requested_bytes, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, breakdown, latencies, hierarchy+1, outputFormat); ss<<"\n";
+		insertTab(ss, hierarchy); ss<<"}";
+	}
+	else if(outputFormat == "text")
+	{
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, breakdown, records, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, breakdown, lost, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, breakdown, requested_bytes, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, breakdown, latencies, hierarchy+1, outputFormat); ss<<"\n";
+	}
+	else
+		throw FormatException("Invalid output-format ", outputFormat);
+}
+
+}; //end namespace td
+
+#endif //LATENCYBREAKDOWN_HPP
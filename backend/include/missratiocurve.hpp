@@ -0,0 +1,199 @@
+/**
+  *
+  * tDisk backend
+  * @author Thomas Sparber (2015-2016)
+  *
+ **/
+
+#ifndef MISSRATIOCURVE_HPP
+#define MISSRATIOCURVE_HPP
+
+#include <vector>
+
+#include <resultformatter.hpp>
+
+namespace td
+{
+
+/**
+  * This struct represents the estimated hit ratio
+  * for one size of the fastest device
+ **/
+struct MissRatioPoint
+{
+	/**
+	  * Default constructor
+	 **/
+	MissRatioPoint(unsigned long long ull_size, double d_read_hit_ratio, double d_hit_ratio) :
+		size(ull_size),
+		read_hit_ratio(d_read_hit_ratio),
+		hit_ratio(d_hit_ratio)
+	{}
+
+	/** The size of the fastest device in bytes **/
+	unsigned long long size;
+
+	/** The estimated hit ratio of the reads in percent **/
+	double read_hit_ratio;
+
+	/** The estimated hit ratio of all accesses in percent **/
+	double hit_ratio;
+
+}; //end struct MissRatioPoint
+
+/**
+  * This struct represents the size the fastest device
+  * needs to serve the given share of the reads
+ **/
+struct CapacityEstimate
+{
+	/**
+	  * Default constructor
+	 **/
+	CapacityEstimate(double d_read_hit_ratio, unsigned long long ull_size) :
+		read_hit_ratio(d_read_hit_ratio),
+		size(ull_size)
+	{}
+
+	/** The desired hit ratio of the reads in percent **/
+	double read_hit_ratio;
+
+	/** The needed size of the fastest device in bytes **/
+	unsigned long long size;
+
+}; //end struct CapacityEstimate
+
+/**
+  * This struct represents the estimated hit ratio of the
+  * fastest device of a tDisk depending on its size. It is
+  * calculated using the tracked reuse distances
+ **/
+struct tDiskMissRatioCurve
+{
+	/**
+	  * Default constructor
+	 **/
+	tDiskMissRatioCurve(unsigned long long ull_sampling_interval, unsigned long long ull_sampled_blocks, unsigned long long ull_reads, unsigned long long ull_writes) :
+		sampling_interval(ull_sampling_interval),
+		sampled_blocks(ull_sampled_blocks),
+		reads(ull_reads),
+		writes(ull_writes),
+		points(),
+		estimates()
+	{}
+
+	/**
+	  * Adds the estimated hit ratio for the given size
+	 **/
+	void addPoint(unsigned long long size, double read_hit_ratio, double hit_ratio)
+	{
+		points.emplace_back(size, read_hit_ratio, hit_ratio);
+	}
+
+	/**
+	  * Adds the size which is needed for the given hit ratio
+	 **/
+	void addEstimate(double read_hit_ratio, unsigned long long size)
+	{
+		estimates.emplace_back(read_hit_ratio, size);
+	}
+
+	/** One of sampling_interval blocks is tracked **/
+	unsigned long long sampling_interval;
+
+	/** The amount of blocks which are currently tracked **/
+	unsigned long long sampled_blocks;
+
+	/** The estimated amount of block reads and writes **/
+	unsigned long long reads;
+	unsigned long long writes;
+
+	/**
+	  * The estimated hit ratios, sorted by size
+	 **/
+	std::vector<MissRatioPoint> points;
+
+	/**
+	  * The sizes which are needed for common hit ratios.
+	  * Hit ratios which can't be reached are omitted
+	 **/
+	std::vector<CapacityEstimate> estimates;
+
+}; //end struct tDiskMissRatioCurve
+
+/**
+  * Stringifies the given MissRatioPoint using the given format
+ **/
+template <> inline void createResultString(std::ostream &ss, const MissRatioPoint &point, unsigned int hierarchy, const utils::ci_string &outputFormat)
+{
+	if(outputFormat == "json")
+	{
+		ss<<"{\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, point, size, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, point, read_hit_ratio, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, point, hit_ratio, hierarchy+1, outputFormat); ss<<"\n";
+		insertTab(ss, hierarchy); ss<<"}";
+	}
+	else if(outputFormat == "text")
+	{
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, point, size, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, point, read_hit_ratio, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, point, hit_ratio, hierarchy+1, outputFormat); ss<<"\n";
+	}
+	else
+		throw FormatException("Invalid output-format ", outputFormat);
+}
+
+/**
+  * Stringifies the given CapacityEstimate using the given format
+ **/
+template <> inline void createResultString(std::ostream &ss, const CapacityEstimate &estimate, unsigned int hierarchy, const utils::ci_string &outputFormat)
+{
+	if(outputFormat == "json")
+	{
+		ss<<"{\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, estimate, read_hit_ratio, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, estimate, size, hierarchy+1, outputFormat); ss<<"\n";
+		insertTab(ss, hierarchy); ss<<"}";
+	}
+	else if(outputFormat == "text")
+	{
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, estimate, read_hit_ratio, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, estimate, size, hierarchy+1, outputFormat); ss<<"\n";
+	}
+	else
+		throw FormatException("Invalid output-format ", outputFormat);
+}
+
+/**
+  * Stringifies the given tDiskMissRatioCurve using the given format
+ **/
+template <> inline void createResultString(std::ostream &ss, const tDiskMissRatioCurve &curve, unsigned int hierarchy, const utils::ci_string &outputFormat)
+{
+	if(outputFormat == "json")
+	{
+		ss<<"{\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, curve, sampling_interval, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, curve, sampled_blocks, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, curve, reads, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, curve, writes, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, curve, points, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, curve, estimates, hierarchy+1, outputFormat); ss<<"\n";
+		insertTab(ss, hierarchy); ss<<"}";
+	}
+	else if(outputFormat == "text")
+	{
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, curve, sampling_interval, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, curve, sampled_blocks, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, curve, reads, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, curve, writes, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, curve, points, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, curve, estimates, hierarchy+1, outputFormat); ss<<"\n";
+	}
+	else
+		throw FormatException("Invalid output-format ", outputFormat);
+}
+
+}; //end namespace td
+
+#endif //MISSRATIOCURVE_HPP
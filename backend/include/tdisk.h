@@ -17,6 +17,68 @@
  **/
 #define F_TDISK_MAX_INTERNAL_DEVICE_NAME 256
 
+/**
+  * Defines the max amount of sector indices which
+  * are transferred from the driver at once
+ **/
+#define F_TDISK_MAX_SECTOR_ENTRIES 65536
+
+/**
+  * Defines the amount of buckets of the heat histogram
+  * (@see f_device_usage)
+ **/
+#define F_TDISK_HEAT_HISTOGRAM_BUCKETS 16
+
+/**
+  * Defines the amount of buckets of the latency histograms
+  * (@see f_device_stats and f_tdisk_stats)
+ **/
+#define F_TDISK_LATENCY_BUCKETS 24
+
+/**
+  * Defines the max amount of trace records which
+  * are transferred from the driver at once
+ **/
+#define F_TDISK_MAX_TRACE_RECORDS 65536
+
+/**
+  * Defines the max amount of captured requests which
+  * are transferred from the driver at once
+ **/
+#define F_TDISK_MAX_IO_RECORDS 65536
+
+/**
+  * The direction of a captured request (@see f_io_record)
+ **/
+#define F_TDISK_IO_READ 0
+#define F_TDISK_IO_WRITE 1
+
+/**
+  * The I/O priority class of a captured request
+  * (@see f_io_record)
+ **/
+#define F_TDISK_IO_PRIO_NONE 0
+#define F_TDISK_IO_PRIO_RT 1
+#define F_TDISK_IO_PRIO_BE 2
+#define F_TDISK_IO_PRIO_IDLE 3
+
+/**
+  * Defines the amount of buckets of the reuse distance
+  * histograms (@see f_mrc)
+ **/
+#define F_TDISK_MRC_BUCKETS 128
+
+/**
+  * The types of trace records (@see f_trace_record)
+ **/
+#define F_TDISK_TRACE_REQUEST_START 1
+#define F_TDISK_TRACE_REQUEST_END 2
+#define F_TDISK_TRACE_INDEX_LOOKUP 3
+#define F_TDISK_TRACE_REMAP 4
+#define F_TDISK_TRACE_MIGRATION 5
+#define F_TDISK_TRACE_DEVICE_IO 6
+#define F_TDISK_TRACE_PLUGIN_ROUND_TRIP 7
+
 /**
   * Frontend version
   * Defines the type on an internal device
@@ -32,6 +94,21 @@ enum f_internal_device_type
 	
 }; //end enum internal_device_type
 
+/**
+  * Frontend version
+  * Defines how the access count (heat) of the sectors is tracked
+ **/
+enum f_heat_tracking
+{
+
+	/** Every access of every sector is counted **/
+	f_heat_tracking_exact,
+
+	/** The accesses are estimated using a count-min sketch. **/
+	f_heat_tracking_sketch
+
+}; //end enum f_heat_tracking
+
 /**
   * Frontend version
   * This struct represents performance indicators of a
@@ -58,6 +135,21 @@ struct f_device_performance
 	uint32_t mod_stdev_write;
 }; //end struct f_device_performance
 
+/**
+  * Frontend version
+  * This struct holds the performance counters of an
+  * internal device. hit_ratio is the share of all accesses
+  * of the tDisk which were served by this device.
+  * latency_histogram[i] counts the accesses which took
+  * 2^(i-1)...2^i-1 microseconds
+ **/
+struct f_device_stats
+{
+	uint64_t hits;
+	double hit_ratio;
+	uint64_t latency_histogram[F_TDISK_LATENCY_BUCKETS];
+}; //end struct f_device_stats
+
 /**
   * Frontend version
   * This struct is used to transfer internal device
@@ -73,8 +165,38 @@ struct f_internal_device_info
 	struct f_device_performance performance;
 	uint64_t bytes_read;
 	uint64_t bytes_written;
+	struct f_device_stats stats;
 }; //end struct f_internal_device_info
 
+/**
+  * Frontend version
+  * This struct holds the performance counters of a tDisk.
+  * latency_histogram[i] counts the requests which took
+  * 2^(i-1)...2^i-1 microseconds
+ **/
+struct f_tdisk_stats
+{
+	uint64_t requests;
+	uint64_t migrations;
+	uint64_t migrated_bytes;
+	uint64_t initial_placements;
+	uint64_t latency_histogram[F_TDISK_LATENCY_BUCKETS];
+}; //end struct f_tdisk_stats
+
+/**
+  * Frontend version
+  * This struct summarizes the blocks of an internal device.
+  * heat_histogram[0] counts the used blocks which were never
+  * accessed, heat_histogram[i] the used blocks with an access
+  * count of 2^(i-1)...2^i-1
+ **/
+struct f_device_usage
+{
+	uint64_t used_blocks;
+	uint64_t free_blocks;
+	uint64_t heat_histogram[F_TDISK_HEAT_HISTOGRAM_BUCKETS];
+}; //end struct f_device_usage
+
 /**
   * Frontend version
   * A index represents the physical location of a logical sector
@@ -108,29 +230,82 @@ struct f_sector_info
 
 /**
   * Frontend version
-  * This struct is used to retrieve debug information from a tdisk
+  * This struct represents one trace record of a tDisk.
+  * value is the length in bytes for F_TDISK_TRACE_REQUEST_START
+  * records and the duration in nanoseconds for all others
+ **/
+struct f_trace_record
+{
+	/** The time when the record was written in nanoseconds **/
+	uint64_t time;
+
+	/** The sector the record belongs to **/
+	uint64_t sector;
+
+	/** The duration or length, depending on the type **/
+	uint32_t value;
+
+	/** The CPU which wrote the record **/
+	unsigned int cpu;
+
+	/** The type of the record (@see F_TDISK_TRACE_REQUEST_START) **/
+	unsigned int type;
+
+	/** The internal device the record belongs to or 0 **/
+	unsigned int disk;
+
+}; //end struct f_trace_record
+
+/**
+  * Frontend version
+  * This struct represents one captured request of a tDisk
  **/
-struct f_tdisk_debug_info
+struct f_io_record
 {
-	/** The id of the debug info **/
-	uint64_t id;
+	/** The time when the request was started in nanoseconds **/
+	uint64_t time;
 
-	/** The current source file **/
-	char file[256];
+	/** The position of the request in bytes **/
+	uint64_t position;
+
+	/** The length of the request in bytes **/
+	uint32_t length;
+
+	/** F_TDISK_IO_READ or F_TDISK_IO_WRITE **/
+	unsigned int direction;
+
+	/** F_TDISK_IO_PRIO_NONE, _RT, _BE or _IDLE **/
+	unsigned int priority;
+
+}; //end struct f_io_record
+
+/**
+  * Frontend version
+  * This struct holds the reuse distance histograms of a tDisk.
+  * histogram[i] counts the accesses whose reuse distance is
+  * i*bucket_blocks...(i+1)*bucket_blocks-1 blocks. These accesses
+  * are hits on a fast device with more than (i+1)*bucket_blocks
+  * blocks. All counts are already scaled by the sampling rate
+ **/
+struct f_mrc
+{
+	/** The size of each bucket in blocks **/
+	uint64_t bucket_blocks;
 
-	/** The current line in the file **/
-	int line;
+	/** One of 2^sampling_shift blocks is tracked **/
+	unsigned int sampling_shift;
 
-	/** The current function **/
-	char function[256];
+	/** The amount of blocks which are currently tracked **/
+	unsigned int sampled_blocks;
 
-	/** A custom message **/
-	char message[256];
+	/** The accesses which are misses for any size of the fast device **/
+	uint64_t read_misses;
+	uint64_t write_misses;
 
-	/** The time of the debugging info **/
-	double time;
+	uint64_t read_histogram[F_TDISK_MRC_BUCKETS];
+	uint64_t write_histogram[F_TDISK_MRC_BUCKETS];
 
-}; //end struct tdisk_debug_info
+}; //end struct f_mrc
 
 
 /**
@@ -153,9 +328,10 @@ int tdisk_get_devices(char **devices, int size, int length);
   * @param out_name The name of the new device will be stored here
   * @param blocksize The blocksize of the new device
   * @param percent_cache The amount in percentage of the total storage of cache buffer
+  * @param heat_tracking How the access count of the sectors is tracked
   * @returns The minor number of the new device or a negative error code
  **/
-int tdisk_add(char *out_name, unsigned int blocksize, unsigned int percent_cache);
+int tdisk_add(char *out_name, unsigned int blocksize, unsigned int percent_cache, enum f_heat_tracking heat_tracking);
 
 /**
   * Adds a new device with the given minor number to the system.
@@ -163,9 +339,10 @@ int tdisk_add(char *out_name, unsigned int blocksize, unsigned int percent_cache
   * @param minor The minor number of the new device
   * @param blocksize The blocksize of the new device
   * @param percent_cache The amount in percentage of the total storage of cache buffer
+  * @param heat_tracking How the access count of the sectors is tracked
   * @returns The minor number of the new device or a negative error code
  **/
-int tdisk_add_specific(char *out_name, int minor, unsigned int blocksize, unsigned int percent_cache);
+int tdisk_add_specific(char *out_name, int minor, unsigned int blocksize, unsigned int percent_cache, enum f_heat_tracking heat_tracking);
 
 /**
   * Removes the device with the given minor number from the system.
@@ -177,10 +354,12 @@ int tdisk_remove(int device);
   * @param device The tDisk where to add the new internal device
   * @param new_disk The new internal device to be added to the tDisk.
   * @param format Defines whether the disk should be formatted
+  * @param compress Defines whether the blocks should be stored compressed.
+  * Once enabled, it is stored on the disk and stays enabled.
   * If it is a file path it is added as file. If not it is added as a
   * plugin.
  **/
-int tdisk_add_disk(const char *device, const char *new_disk, int format);
+int tdisk_add_disk(const char *device, const char *new_disk, int format, int compress);
 
 /**
   * Removes the internal device with the given id
@@ -216,25 +395,122 @@ int tdisk_get_sector_index(const char *device, uint64_t logical_sector, struct f
  **/
 int tdisk_get_all_sector_indices(const char *device, struct f_sector_info *out, uint64_t size);
 
+/**
+  * Returns infomration about the sector indices in the order
+  * of their access count, starting at the given sorted index.
+  * The indices are transferred in chunks of
+  * F_TDISK_MAX_SECTOR_ENTRIES
+  * @param device The tDisk to get the sector incides from
+  * @param first The first sorted index
+  * @param out An array of f_sector_info to store the infomration
+  * @param size The size of the array
+ **/
+int tdisk_get_sector_indices(const char *device, uint64_t first, struct f_sector_info *out, uint64_t size);
+
+/**
+  * Gets information about all the given logical sectors
+  * at once
+  * @param device The tDisk to get the sector incides from
+  * @param logical_sectors The logical sectors to look up
+  * @param out An array of f_sector_index to store the infomration
+  * @param size The size of both arrays
+ **/
+int tdisk_lookup_sector_indices(const char *device, const uint64_t *logical_sectors, struct f_sector_index *out, uint64_t size);
+
 /**
   * Resets the access count of all sectors
  **/
 int tdisk_clear_access_count(const char *device);
 
+/**
+  * Frontend version
+  * A range which is pinned to this tier is stored on the
+  * slowest devices. Pinning to F_TDISK_PIN_NONE removes the pins
+ **/
+#define F_TDISK_PIN_NONE 0
+#define F_TDISK_PIN_NEVER_PROMOTE ((uint32_t)-1)
+
+/**
+  * Frontend version
+  * The maximum amount of pinned ranges of a tDisk
+ **/
+#define F_TDISK_MAX_PINS 32
+
+/**
+  * Pins the given range of the tDisk to a minimum tier
+  * @param device The tDisk
+  * @param offset The start of the range in bytes
+  * @param length The length of the range in bytes
+  * @param tier The tier (1 is the fastest internal device),
+  * F_TDISK_PIN_NEVER_PROMOTE or F_TDISK_PIN_NONE
+ **/
+int tdisk_pin_range(const char *device, uint64_t offset, uint64_t length, uint32_t tier);
+
 /**
   * Gets the amount of internal devices for the given tDisk
  **/
 int tdisk_get_internal_devices_count(const char *device, unsigned int *out);
 
+/**
+  * Gets the usage of all internal devices at once. It is
+  * calculated by the driver, so it is cheap to poll.
+  * @param device The tDisk to get the usage from
+  * @param out An array of f_device_usage to store the usage
+  * @param size The size of the array
+  * @param count Is set to the amount of internal devices
+ **/
+int tdisk_get_usage(const char *device, struct f_device_usage *out, unsigned int size, unsigned int *count);
+
+/**
+  * Gets the performance counters of the given tDisk
+ **/
+int tdisk_get_stats(const char *device, struct f_tdisk_stats *out);
+
+/**
+  * Starts (enable != 0) or stops capturing the requests of
+  * the given tDisk. Starting the capture drops the requests
+  * which were not drained yet
+ **/
+int tdisk_set_io_capture(const char *device, int enable);
+
+/**
+  * Drains the captured requests of the given tDisk
+  * @param device The tDisk to get the captured requests from
+  * @param out An array of f_io_record to store the requests
+  * @param size The size of the array
+  * @param count Is set to the amount of drained requests
+  * @param lost Is set to the amount of requests which were not
+  * captured since the capture was started because the driver
+  * ran out of space
+ **/
+int tdisk_get_io_capture(const char *device, struct f_io_record *out, unsigned int size, unsigned int *count, uint64_t *lost);
+
+/**
+  * Starts (enable != 0) or stops tracking the reuse distances
+  * of the given tDisk. Starting the tracking resets the histograms
+ **/
+int tdisk_set_mrc_tracking(const char *device, int enable);
+
+/**
+  * Gets the reuse distance histograms of the given tDisk
+ **/
+int tdisk_get_mrc(const char *device, struct f_mrc *out);
+
 /**
   * Gets device information of the device with the given id
  **/
 int tdisk_get_device_info(const char *device, unsigned int disk, struct f_internal_device_info *out);
 
 /**
-  * Gets debug information about the given tDisk
+  * Drains the trace records of the given tDisk
+  * @param device The tDisk to get the trace records from
+  * @param out An array of f_trace_record to store the records
+  * @param size The size of the array
+  * @param count Is set to the amount of drained records
+  * @param lost Is set to the amount of records which were
+  * overwritten before they could be drained
  **/
-int tdisk_get_debug_info(const char *device, uint64_t current_id, struct f_tdisk_debug_info *out);
+int tdisk_get_debug_info(const char *device, struct f_trace_record *out, unsigned int size, unsigned int *count, uint64_t *lost);
 
 /**
   * Gets the measure shift.
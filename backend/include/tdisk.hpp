@@ -18,6 +18,8 @@
 #include <filesystem.hpp>
 #include <logger.hpp>
 #include <performance.hpp>
+#include <latencybreakdown.hpp>
+#include <missratiocurve.hpp>
 #include <performanceimprovement.hpp>
 #include <resultformatter.hpp>
 #include <tdiskexception.hpp>
@@ -36,8 +38,14 @@ namespace c
 } //end namespace c
 
 using c::f_device_performance;
+using c::f_device_usage;
+using c::f_device_stats;
+using c::f_tdisk_stats;
+using c::f_heat_tracking;
 using c::f_internal_device_info;
-using c::f_tdisk_debug_info;
+using c::f_trace_record;
+using c::f_io_record;
+using c::f_mrc;
 using c::f_internal_device_type;
 using c::f_sector_index;
 using c::f_sector_info;
@@ -87,17 +95,31 @@ public:
 	  * Creates a new tDIsk with the given minornumber and blocksize
 	  * @param i_minornumber The minornumber for the new tDisk
 	  * @param blocksize The blocksize for the new tDisk
+	  * @param heatTracking How the access count of the sectors is tracked
 	  * @returns The newly created tDisk
 	 **/
-	static tDisk create(int minornumber, unsigned int blocksize, unsigned int percentCache);
+	static tDisk create(int minornumber, unsigned int blocksize, unsigned int percentCache, f_heat_tracking heatTracking);
 
 	/**
 	  * Creates a new tDisk with the given blocksize. The next available
 	  * minornumber is taken
 	  * @param blocksize The blocksize for the new tDisk
+	  * @param heatTracking How the access count of the sectors is tracked
 	  * @returns The new tDisk
 	 **/
-	static tDisk create(unsigned int blocksize, unsigned int percentCache);
+	static tDisk create(unsigned int blocksize, unsigned int percentCache, f_heat_tracking heatTracking);
+
+	/**
+	  * Converts the given heat tracking name ("exact" or "sketch")
+	  * An empty string means the default (exact)
+	 **/
+	static f_heat_tracking getHeatTracking(const std::string &name);
+
+	/**
+	  * Converts the given tier ("none", "never-promote" or the
+	  * number of the tier where 1 is the fastest device)
+	 **/
+	static unsigned int getPinTier(const std::string &tier);
 
 	/**
 	  * Removes the tDisk with the given minornumber from the system
@@ -243,8 +265,10 @@ public:
 	  * Adds the given internal disk to the tDisk
 	  * @param path The disk to be added. If the file doesn't exist it
 	  * is treated as a plugin name
+	  * @param compress Whether the blocks of the disk should be
+	  * stored compressed. Once enabled, it stays enabled
 	 **/
-	void addDisk(const std::string &path, bool format);
+	void addDisk(const std::string &path, bool format, bool compress=false);
 
 	/**
 	  * Removes the given internal disk from the tDisk
@@ -272,6 +296,12 @@ public:
 	 **/
 	f_sector_index getSectorIndex(unsigned long long logicalSector) const;
 
+	/**
+	  * Returns information about all the given logical
+	  * sectors using one single request
+	 **/
+	std::vector<f_sector_index> getSectorIndices(const std::vector<unsigned long long> &logicalSectors) const;
+
 	/**
 	  * Return information about all logical sectors
 	 **/
@@ -282,6 +312,20 @@ public:
 	 **/
 	void clearAccessCount();
 
+	/**
+	  * Pins the given range (in bytes) to the given tier
+	  * @see getPinTier
+	 **/
+	void pinRange(unsigned long long offset, unsigned long long length, unsigned int tier);
+
+	/**
+	  * Pins all ranges of the given file to the given tier.
+	  * The file must be stored on the tDisk. If not all of
+	  * its ranges can be pinned, none of them stays pinned
+	  * @returns The amount of pinned ranges
+	 **/
+	std::size_t pinFile(const std::string &file, unsigned int tier);
+
 	/**
 	  * Returns the amount of current internal devices
 	 **/
@@ -312,9 +356,55 @@ public:
 	std::vector<double> getInternalDeviceUsage() const;
 
 	/**
-	  * Returns the (next) debug info for the tDisk
+	  * Returns the used and free blocks and the heat histogram
+	  * of all internal devices. They are calculated by the driver
+	 **/
+	std::vector<f_device_usage> getUsage() const;
+
+	/**
+	  * Returns the performance counters of the tDisk
+	 **/
+	f_tdisk_stats getStats() const;
+
+	/**
+	  * Drains all trace records of the tDisk
+	  * @param lost Is set to the amount of records which were
+	  * overwritten before they could be drained
 	 **/
-	f_tdisk_debug_info getDebugInfo(uint64_t currentId=0) const;
+	std::vector<f_trace_record> getDebugInfo(uint64_t &lost) const;
+
+	/**
+	  * Drains all trace records of the tDisk and sums up
+	  * the time which was spent for the different steps
+	  * of the requests.
+	 **/
+	tDiskLatencyBreakdown getLatencyBreakdown() const;
+
+	/**
+	  * Starts or stops capturing the requests of the tDisk
+	 **/
+	void setIOCapture(bool enable);
+
+	/**
+	  * Drains all captured requests of the tDisk
+	  * @param lost Is set to the amount of requests which were
+	  * not captured because the driver ran out of space
+	 **/
+	std::vector<f_io_record> getIOCapture(uint64_t &lost) const;
+
+	/**
+	  * Starts or stops tracking the reuse distances of the tDisk.
+	  * Starting the tracking resets the miss ratio curve
+	 **/
+	void setMRCTracking(bool enable);
+
+	/**
+	  * Returns the estimated hit ratio of the fastest device
+	  * depending on its size. It is calculated using the
+	  * reuse distances which were tracked since the tracking
+	  * was started
+	 **/
+	tDiskMissRatioCurve getMissRatioCurve() const;
 
 	/**
 	  * Returns all files which are stored on the given internal device
@@ -373,15 +463,25 @@ template <> void createResultString(std::ostream &ss, const f_device_performance
  **/
 template <> void createResultString(std::ostream &ss, const enum f_internal_device_type &type, unsigned int hierarchy, const utils::ci_string &outputFormat);
 
+/**
+  * Stringifies the given f_device_stats using the given format
+ **/
+template <> void createResultString(std::ostream &ss, const f_device_stats &stats, unsigned int hierarchy, const utils::ci_string &outputFormat);
+
 /**
   * Stringifies the given f_internal_device_info using the given format
  **/
 template <> void createResultString(std::ostream &ss, const f_internal_device_info &info, unsigned int hierarchy, const utils::ci_string &outputFormat);
 
 /**
-  * Stringifies the given f_tdisk_debug_info using the given format
+  * Stringifies the given f_device_usage using the given format
+ **/
+template <> void createResultString(std::ostream &ss, const f_device_usage &usage, unsigned int hierarchy, const utils::ci_string &outputFormat);
+
+/**
+  * Stringifies the given f_tdisk_stats using the given format
  **/
-template <> void createResultString(std::ostream &ss, const f_tdisk_debug_info &info, unsigned int hierarchy, const utils::ci_string &outputFormat);
+template <> void createResultString(std::ostream &ss, const f_tdisk_stats &stats, unsigned int hierarchy, const utils::ci_string &outputFormat);
 
 /**
   * Stringifies the given tDisk using the given format
@@ -79,6 +79,27 @@ inline void addNlArg(nl_msg *msg, const std::vector<char> &data)
 	if(ret)throw PluginException("Can't add argument buffer to message: ", nl_geterror(ret));
 }
 
+template <int type, typename std::enable_if<type == c::NLTD_PLUGIN_MAX_LENGTH, bool>::type* = nullptr>
+inline void addNlArg(nl_msg *msg, const uint32_t &maxLength)
+{
+	int ret = nla_put_u32(msg, c::NLTD_PLUGIN_MAX_LENGTH, maxLength);
+	if(ret)throw PluginException("Can't add argument max length to message: ", nl_geterror(ret));
+}
+
+template <int type, typename std::enable_if<type == c::NLTD_PLUGIN_WINDOW, bool>::type* = nullptr>
+inline void addNlArg(nl_msg *msg, const uint32_t &window)
+{
+	int ret = nla_put_u32(msg, c::NLTD_PLUGIN_WINDOW, window);
+	if(ret)throw PluginException("Can't add argument window to message: ", nl_geterror(ret));
+}
+
+template <int type, typename std::enable_if<type == c::NLTD_PLUGIN_RING, bool>::type* = nullptr>
+inline void addNlArg(nl_msg *msg, const uint32_t &ring)
+{
+	int ret = nla_put_u32(msg, c::NLTD_PLUGIN_RING, ring);
+	if(ret)throw PluginException("Can't add argument ring to message: ", nl_geterror(ret));
+}
+
 inline void addNlArgs(nl_msg*) {}
 
 template <c::nl_tdisk_attr type, class T>
@@ -112,6 +133,15 @@ inline std::size_t getNlArgumentSize(const int&) { return 4; }
 template <int type, typename std::enable_if<type == c::NLTD_REQ_BUFFER, bool>::type* = nullptr>
 inline std::size_t getNlArgumentSize(const std::vector<char> &data) { return data.size(); }
 
+template <int type, typename std::enable_if<type == c::NLTD_PLUGIN_MAX_LENGTH, bool>::type* = nullptr>
+inline std::size_t getNlArgumentSize(const uint32_t&) { return 4; }
+
+template <int type, typename std::enable_if<type == c::NLTD_PLUGIN_WINDOW, bool>::type* = nullptr>
+inline std::size_t getNlArgumentSize(const uint32_t&) { return 4; }
+
+template <int type, typename std::enable_if<type == c::NLTD_PLUGIN_RING, bool>::type* = nullptr>
+inline std::size_t getNlArgumentSize(const uint32_t&) { return 4; }
+
 inline std::size_t getNlArgumentsSize() { return 0; }
 
 template <c::nl_tdisk_attr type, class T>
@@ -26,7 +26,7 @@ class Plugin
 {
 
 public:
-	Plugin(const std::string &name="", unsigned long long maxWriteBytesJoin=0, unsigned int writeQueues=1, unsigned int maxHistoryBuffer=0, bool registerInKernel=false);
+	Plugin(const std::string &name="", unsigned long long maxWriteBytesJoin=0, unsigned int writeQueues=1, unsigned int maxHistoryBuffer=0, bool registerInKernel=false, unsigned int maxMessageLength=0, unsigned int window=0, bool useRing=true);
 
 	Plugin(Plugin &&other) = delete;
 
@@ -71,6 +71,10 @@ public:
 protected:
 	bool messageReceived(uint32_t sequenceNumber, PluginOperation operation, unsigned long long offset, std::vector<char> &data, std::size_t length);
 
+	bool handleRequest(PluginOperation operation, unsigned long long offset, char *data, std::size_t length);
+
+	bool processRing();
+
 	bool sendFinishedMessage(uint32_t sequenceNumber, std::vector<char> &data, bool success);
 
 	bool writeBufferedData(WriteBuffer &writeBuffer);
@@ -83,10 +87,32 @@ protected:
 	}
 
 private:
+	bool setupRing();
+
+	void closeRing();
+
 	std::string name;
+
+	//The max length of the data of a message and the max amount
+	//of outstanding messages the kernel module sends to the plugin.
+	//0 means the max which is supported by the kernel module
+	unsigned int maxMessageLength;
+	unsigned int window;
+
+	//Whether the requests should be transferred using the shared
+	//ring of the kernel module instead of netlink messages. If
+	//the ring can't be set up, netlink is used anyways
+	bool useRing;
+
 	mutable struct nl_sock *socket;
 	int familyId;
 	bool running;
+
+	//The device and the mapping of the shared ring
+	int ringFd;
+	char *ring;
+	std::size_t ringSize;
+
 	std::vector<WriteBuffer> writeBuffers;
 	HistoryBuffer history;
 
@@ -4,9 +4,15 @@
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
 #include <netlink/genl/mngt.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <poll.h>
 #include <set>
 #include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <thread>
 #include <unistd.h>
 #include <vector>
@@ -106,11 +112,17 @@ int worker_function(nl_msg *msg, void *arg)
 
 } //end namespace td
 
-Plugin::Plugin(const string &str_name, unsigned long long maxWriteBytesJoin, unsigned int writeQueues, unsigned int maxHistoryBuffer, bool b_registerInKernel) :
+Plugin::Plugin(const string &str_name, unsigned long long maxWriteBytesJoin, unsigned int writeQueues, unsigned int maxHistoryBuffer, bool b_registerInKernel, unsigned int ui_maxMessageLength, unsigned int ui_window, bool b_useRing) :
 	name(str_name),
+	maxMessageLength((ui_maxMessageLength == 0) ? NLTD_MAX_MESSAGE_LENGTH : ui_maxMessageLength),
+	window((ui_window == 0) ? NLTD_MAX_WINDOW : ui_window),
+	useRing(b_useRing),
 	socket(nullptr),
 	familyId(),
 	running(false),
+	ringFd(-1),
+	ring(nullptr),
+	ringSize(0),
 	writeBuffers(writeQueues, maxWriteBytesJoin),
 	history(maxHistoryBuffer)
 {
@@ -140,16 +152,74 @@ void Plugin::registerInKernel()
 	nl_socket_modify_err_cb(socket, NL_CB_DEBUG, nullptr, nullptr);
 	nl_socket_set_buffer_size(socket, 2097152, 2097152);
 
+	//The messages can be larger than the default receive buffer
+	nl_socket_set_msg_buf_size(socket, maxMessageLength + 4096);
+
 	genl_connect(socket);
 	familyId = genl_ctrl_resolve(socket, NLTD_NAME);
 
 	signal(SIGINT, signalHandler);
 
+	//The ring needs to exist when the plugin registers
+	const uint32_t withRing = (useRing && setupRing()) ? 1 : 0;
+
+	const uint32_t length = maxMessageLength;
+	const uint32_t outstanding = window;
 	sendNlMessage(socket, NLTD_CMD_REGISTER, 0, familyId,
-		createArg<NLTD_PLUGIN_NAME>(name)
+		createArg<NLTD_PLUGIN_NAME>(name),
+		createArg<NLTD_PLUGIN_MAX_LENGTH>(length),
+		createArg<NLTD_PLUGIN_WINDOW>(outstanding),
+		createArg<NLTD_PLUGIN_RING>(withRing)
 	);
 }
 
+bool Plugin::setupRing()
+{
+	ringFd = open(NLTD_RING_DEVICE, O_RDWR);
+	if(ringFd < 0)
+	{
+		cerr<<"Can't open "<<NLTD_RING_DEVICE<<": "<<strerror(errno)<<". Using netlink"<<endl;
+		return false;
+	}
+
+	nltd_ring_setup setup;
+	memset(&setup, 0, sizeof(nltd_ring_setup));
+	strncpy(setup.name, name.c_str(), NLTD_MAX_NAME - 1);
+	setup.entries = window;
+	setup.slot_size = maxMessageLength;
+
+	if(ioctl(ringFd, TDISK_PLUGIN_RING_SETUP, &setup) < 0)
+	{
+		cerr<<"Can't set up the ring: "<<strerror(errno)<<". Using netlink"<<endl;
+		closeRing();
+		return false;
+	}
+
+	void *mapping = mmap(nullptr, (std::size_t)setup.size, PROT_READ | PROT_WRITE, MAP_SHARED, ringFd, 0);
+	if(mapping == MAP_FAILED)
+	{
+		cerr<<"Can't map the ring: "<<strerror(errno)<<". Using netlink"<<endl;
+		closeRing();
+		return false;
+	}
+
+	ring = (char*)mapping;
+	ringSize = (std::size_t)setup.size;
+
+	cout<<"Using ring with "<<setup.entries<<" entries of "<<setup.slot_size<<" bytes"<<endl;
+	return true;
+}
+
+void Plugin::closeRing()
+{
+	if(ring)munmap(ring, ringSize);
+	ring = nullptr;
+	ringSize = 0;
+
+	if(ringFd >= 0)close(ringFd);
+	ringFd = -1;
+}
+
 bool Plugin::unregister()
 {
 	stop();
@@ -162,6 +232,9 @@ bool Plugin::unregister()
 
 		nl_socket_free(socket);
 		socket = nullptr;
+
+		//The kernel module uses netlink again
+		closeRing();
 		return true;
 	}
 
@@ -199,18 +272,84 @@ void Plugin::listen()
 
 bool Plugin::poll(unsigned int time)
 {
-	struct pollfd fd;
-	fd.fd = nl_socket_get_fd(socket);;
-	fd.events = POLLIN;
-	const int result = ::poll(&fd, 1, time);
+	//A negative fd is ignored if there is no ring
+	struct pollfd fds[2];
+	fds[0].fd = nl_socket_get_fd(socket);
+	fds[0].events = POLLIN;
+	fds[1].fd = ringFd;
+	fds[1].events = POLLIN;
+	const int result = ::poll(fds, 2, (int)time);
 	return (result > 0);
 }
 
 int Plugin::receive()
 {
+	if(ring)
+	{
+		if(!processRing())return -NLE_FAILURE;
+
+		//Don't wait for a netlink message if the
+		//ring was the reason for the wakeup
+		struct pollfd fd;
+		fd.fd = nl_socket_get_fd(socket);
+		fd.events = POLLIN;
+		if(::poll(&fd, 1, 0) <= 0)return 0;
+	}
+
 	return nl_recvmsgs_default(socket);
 }
 
+bool Plugin::processRing()
+{
+	nltd_ring_header *header = (nltd_ring_header*)ring;
+	const nltd_ring_sqe *sq = (const nltd_ring_sqe*)(ring + header->sq_offset);
+	nltd_ring_cqe *cq = (nltd_ring_cqe*)(ring + header->cq_offset);
+	char *slots = ring + header->data_offset;
+	const uint32_t mask = header->entries - 1;
+
+	while(true)
+	{
+		uint32_t head = header->sq_head;
+		uint32_t cqTail = header->cq_tail;
+
+		//The entries need to be read after the tail
+		const uint32_t tail = __atomic_load_n(&header->sq_tail, __ATOMIC_ACQUIRE);
+		if(head == tail)return true;
+
+		for(; head != tail; ++head, ++cqTail)
+		{
+			const nltd_ring_sqe sqe = sq[head & mask];
+			const std::size_t length = std::min((std::size_t)sqe.length, (std::size_t)header->slot_size);
+			char *data = slots + (std::size_t)(sqe.slot & mask) * header->slot_size;
+
+			//The data is read and written directly in the slot
+			bool success = false;
+			if(sqe.cmd == NLTD_CMD_READ)success = handleRequest(PluginOperation::read, sqe.offset, data, length);
+			else if(sqe.cmd == NLTD_CMD_WRITE)success = handleRequest(PluginOperation::write, sqe.offset, data, length);
+			else if(sqe.cmd == NLTD_CMD_SIZE)success = handleRequest(PluginOperation::size, sqe.offset, data, length);
+			else cerr<<"Invalid message type "<<sqe.cmd<<endl;
+
+			nltd_ring_cqe &cqe = cq[cqTail & mask];
+			cqe.request_number = sqe.request_number;
+			cqe.ret = success ? 0 : -1;
+			cqe.length = (sqe.cmd == NLTD_CMD_WRITE) ? 0 : (uint32_t)length;
+			cqe.slot = sqe.slot;
+		}
+
+		//The completion entries need to be
+		//visible before the new tail
+		__atomic_store_n(&header->sq_head, head, __ATOMIC_RELEASE);
+		__atomic_store_n(&header->cq_tail, cqTail, __ATOMIC_RELEASE);
+
+		//One call finishes the whole batch
+		if(ioctl(ringFd, TDISK_PLUGIN_RING_COMPLETE) < 0)
+		{
+			cerr<<"Error finishing ring requests: "<<strerror(errno)<<endl;
+			return false;
+		}
+	}
+}
+
 bool Plugin::writeBufferedData(WriteBuffer &writeBuffer)
 {
 	unsigned long long oldPos;
@@ -225,16 +364,49 @@ bool Plugin::messageReceived(uint32_t sequenceNumber, PluginOperation operation,
 	if(operation == PluginOperation::read)
 	{
 		if(data.size() != length)data = vector<char>(length);
+		success = handleRequest(operation, offset, &data[0], length);
+	}
+	else if(operation == PluginOperation::write)
+	{
+		if(data.size() != length)
+		{
+			cerr<<"Invalid data size given: "<<data.size()<<"/"<<length<<endl;
+			success = false;
+		}
+		else
+		{
+			success = handleRequest(operation, offset, &data[0], length);
+			data.clear();
+		}
+	}
+	else if(operation == PluginOperation::size)
+	{
+		data = vector<char>(length);
+		success = handleRequest(operation, offset, &data[0], length);
+	}
+	else
+	{
+		cerr<<"Invalid message type "<<(char)operation<<endl;
+		success = false;
+	}
+
+	return sendFinishedMessage(sequenceNumber, data, success);
+}
 
+bool Plugin::handleRequest(PluginOperation operation, unsigned long long offset, char *data, std::size_t length)
+{
+	bool success = false;
+	if(operation == PluginOperation::read)
+	{
 		//Check read history
-		if(history.get(offset, &data[0], length))success = true;
+		if(history.get(offset, data, length))success = true;
 
 		if(!success)
 		{
 			//Check write buffers
 			for(WriteBuffer &writeBuffer : writeBuffers)
 			{
-				if(writeBuffer.read(offset, &data[0], length))
+				if(writeBuffer.read(offset, data, length))
 				{
 					success = true;
 					break;
@@ -245,65 +417,55 @@ bool Plugin::messageReceived(uint32_t sequenceNumber, PluginOperation operation,
 		//Finally, call actual read function
 		if(!success)
 		{
-			success = read(offset, &data[0], length);
-			if(success)history.set(offset, &data[0], length);
+			success = read(offset, data, length);
+			if(success)history.set(offset, data, length);
 		}
 	}
 	else if(operation == PluginOperation::write)
 	{
-		if(data.size() != length)
+		//Find suitable write buffer
+		WriteBuffer *suitableWriteBuffer = nullptr;
+		for(WriteBuffer &writeBuffer : writeBuffers)
 		{
-			cerr<<"Invalid data size given: "<<data.size()<<"/"<<length<<endl;
-			success = false;
+			if(writeBuffer.canBeCombined(offset, data, length))
+			{
+				suitableWriteBuffer = &writeBuffer;
+				break;
+			}
 		}
-		else
+
+		//Empty oldest WriteBuffer if nothing suitable was found
+		if(!suitableWriteBuffer)
 		{
-			//Find suitable write buffer
-			WriteBuffer *suitableWriteBuffer = nullptr;
+			//cout<<"Need to empty write buffer. Not matching data"<<endl;
+
+			//Use oldest WriteBuffer
 			for(WriteBuffer &writeBuffer : writeBuffers)
 			{
-				if(writeBuffer.canBeCombined(offset, &data[0], length))
+				if(!suitableWriteBuffer ||
+					writeBuffer.age() > suitableWriteBuffer->age() ||
+					(writeBuffer.age() == suitableWriteBuffer->age() && writeBuffer.size() > suitableWriteBuffer->size()))
 				{
 					suitableWriteBuffer = &writeBuffer;
-					break;
-				}
-			}
-
-			//Empty oldest WriteBuffer if nothing suitable was found
-			if(!suitableWriteBuffer)
-			{
-				//cout<<"Need to empty write buffer. Not matching data"<<endl;
-
-				//Use oldest WriteBuffer
-				for(WriteBuffer &writeBuffer : writeBuffers)
-				{
-					if(!suitableWriteBuffer ||
-						writeBuffer.age() > suitableWriteBuffer->age() ||
-						(writeBuffer.age() == suitableWriteBuffer->age() && writeBuffer.size() > suitableWriteBuffer->size()))
-					{
-						suitableWriteBuffer = &writeBuffer;
-					}
 				}
-
-				writeBufferedData(*suitableWriteBuffer);	//TODO check return value
 			}
 
-			//Save data in WriteBuffer
-			if(suitableWriteBuffer->append(offset, &data[0], length))
-			{
-				//Save data to actual plugin
-				success = writeBufferedData(*suitableWriteBuffer);
-			}
-			else success = true;
+			writeBufferedData(*suitableWriteBuffer);	//TODO check return value
+		}
 
-			if(success)history.set(offset, &data[0], length);
-			data.clear();
+		//Save data in WriteBuffer
+		if(suitableWriteBuffer->append(offset, data, length))
+		{
+			//Save data to actual plugin
+			success = writeBufferedData(*suitableWriteBuffer);
 		}
+		else success = true;
+
+		if(success)history.set(offset, data, length);
 	}
 	else if(operation == PluginOperation::size)
 	{
-		data = vector<char>(length);
-		snprintf(&data[0], length, "%llu", getSize());
+		snprintf(data, length, "%llu", getSize());
 		success = true;
 	}
 	else
@@ -312,13 +474,7 @@ bool Plugin::messageReceived(uint32_t sequenceNumber, PluginOperation operation,
 		success = false;
 	}
 
-	/*if(data.size() != (std::size_t)length)
-	{
-		cerr<<"Data size mismach: "<<data.size()<<"/"<<length<<endl;
-		success = false;
-	}*/
-
-	return sendFinishedMessage(sequenceNumber, data, success);
+	return success;
 }
 
 bool Plugin::sendFinishedMessage(uint32_t sequenceNumber, vector<char> &data, bool success)
@@ -8,22 +8,33 @@
 namespace td
 {
 
+/**
+  * This plugin doesn't store anything. It only counts the
+  * requests, so it can be used to measure the overhead of
+  * the communication with the kernel module.
+ **/
 class BlackholeTDisk : public Plugin
 {
 
 public:
-	BlackholeTDisk(unsigned long long llu_size) :
-		Plugin("blackhole"),
-		size(llu_size)
+	BlackholeTDisk(unsigned long long llu_size, bool b_useRing=true) :
+		Plugin("blackhole", 0, 1, 0, false, 0, 0, b_useRing),
+		size(llu_size),
+		requests(0),
+		bytes(0)
 	{}
 
-	virtual bool read(unsigned long long /*offset*/, char */*data*/, std::size_t /*length*/) const
+	virtual bool read(unsigned long long /*offset*/, char */*data*/, std::size_t length) const
 	{
+		requests++;
+		bytes += length;
 		return true;
 	}
 
-	virtual bool write(unsigned long long /*offset*/, const char */*data*/, std::size_t /*length*/)
+	virtual bool write(unsigned long long /*offset*/, const char */*data*/, std::size_t length)
 	{
+		requests++;
+		bytes += length;
 		return true;
 	}
 
@@ -33,9 +44,23 @@ public:
 		return size;
 	}
 
+	unsigned long long getRequests() const
+	{
+		return requests;
+	}
+
+	unsigned long long getBytes() const
+	{
+		return bytes;
+	}
+
 private:
 	unsigned long long size;
 
+	//The amount of handled reads and writes
+	mutable unsigned long long requests;
+	mutable unsigned long long bytes;
+
 }; //end class BlackholeTDisk	
 
 } //end namespace td
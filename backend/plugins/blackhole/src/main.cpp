@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <string>
 
@@ -13,9 +14,18 @@ using namespace td;
 
 int main(int argc, char *args[])
 {
-	BlackholeTDisk api(1024LLU * 1024 * 1024 * 1024);
+	//The ring can be disabled to compare it with netlink
+	const bool useRing = !(argc > 1 && string(args[1]) == "netlink");
+
+	BlackholeTDisk api(1024LLU * 1024 * 1024 * 1024, useRing);
 	api.registerInKernel();
+
+	const auto start = std::chrono::steady_clock::now();
 	api.listen();
+	const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+	cout<<"Handled "<<api.getRequests()<<" requests ("<<api.getBytes()<<" bytes) in "<<duration.count()<<" s"<<endl;
+	if(duration.count() > 0)cout<<(double)api.getRequests() / duration.count()<<" requests/s"<<endl;
 
 	return 0;
 }
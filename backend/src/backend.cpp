@@ -6,6 +6,7 @@
  **/
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <typeinfo>
 
@@ -16,6 +17,7 @@
 #include <device.hpp>
 #include <deviceadvisor.hpp>
 #include <fileassignment.hpp>
+#include <iotrace.hpp>
 #include <logger.hpp>
 #include <performance.hpp>
 #include <resultformatter.hpp>
@@ -181,6 +183,7 @@ BackendResult td::create_tDisk(const vector<string> &args, Options &options)
 	else number = -1;
 
 	int percentCache = 10;
+	const string heatTracking = options.getStringOptionValue("heat-tracking");
 	
 	if(number == -1)
 	{
@@ -213,10 +216,10 @@ BackendResult td::create_tDisk(const vector<string> &args, Options &options)
 	if(!options.getOptionBoolValue("config-only"))
 	{
 		try {
-			if(number >= 0)disk = tDisk::create(number, (unsigned int)blocksize, percentCache);
-			else disk = tDisk::create((unsigned int)blocksize, percentCache);
+			if(number >= 0)disk = tDisk::create(number, (unsigned int)blocksize, percentCache, tDisk::getHeatTracking(heatTracking));
+			else disk = tDisk::create((unsigned int)blocksize, percentCache, tDisk::getHeatTracking(heatTracking));
 
-			for(size_t i = devicesIndex; i < args.size(); ++i)disk.addDisk(args[i], true);
+			for(size_t i = devicesIndex; i < args.size(); ++i)disk.addDisk(args[i], true, options.getOptionBoolValue("compress"));
 		} catch(const tDiskOfflineException &e) {
 			r.warning(BackendResultType::driver, e.what());
 		} catch(const tDiskException &e) {
@@ -234,6 +237,7 @@ BackendResult td::create_tDisk(const vector<string> &args, Options &options)
 			newDevice.minornumber = number;
 			newDevice.blocksize = blocksize;
 			newDevice.percentCache = percentCache;
+			newDevice.heatTracking = heatTracking;
 			for(size_t i = devicesIndex; i < args.size(); ++i)newDevice.devices.push_back(args[i]);
 			config.addDevice(std::move(newDevice));
 
@@ -284,6 +288,7 @@ BackendResult td::add_tDisk(const vector<string> &args, Options &options)
 	}
 
 	int percentCache = 10;
+	const string heatTracking = options.getStringOptionValue("heat-tracking");
 	
 	if(number == -1)
 	{
@@ -316,8 +321,8 @@ BackendResult td::add_tDisk(const vector<string> &args, Options &options)
 	if(!options.getOptionBoolValue("config-only"))
 	{
 		try {
-			if(number >= 0)disk = tDisk::create(number, blocksize, percentCache);
-			else disk = tDisk::create(blocksize, percentCache);
+			if(number >= 0)disk = tDisk::create(number, blocksize, percentCache, tDisk::getHeatTracking(heatTracking));
+			else disk = tDisk::create(blocksize, percentCache, tDisk::getHeatTracking(heatTracking));
 		} catch(const tDiskOfflineException &e) {
 			r.warning(BackendResultType::driver, e.what());
 		} catch(const tDiskException &e) {
@@ -335,6 +340,7 @@ BackendResult td::add_tDisk(const vector<string> &args, Options &options)
 			newDevice.minornumber = number;
 			newDevice.blocksize = blocksize;
 			newDevice.percentCache = percentCache;
+			newDevice.heatTracking = heatTracking;
 			config.addDevice(std::move(newDevice));
 
 			config.save(options.getStringOptionValue("configfile"));
@@ -483,7 +489,7 @@ BackendResult td::add_disk(const vector<string> &args, Options &options)
 		try {
 			for(std::size_t i = 1; i < args.size(); ++i)
 			{
-				d.addDisk(args[i], false);
+				d.addDisk(args[i], false, options.getOptionBoolValue("compress"));
 				r.message(BackendResultType::driver, concat("Successfully added disk ", args[i]));
 			}
 		} catch (const tDiskOfflineException &e) {
@@ -573,18 +579,33 @@ BackendResult td::get_sector_index(const vector<string> &args, Options &options)
 		return std::move(r);
 	}
 
-	//Read requested logical sector
-	uint64_t logicalSector;
-	if(!utils::convertTo(args[1], logicalSector))
+	//Read requested logical sectors
+	vector<unsigned long long> logicalSectors;
+	for(std::size_t i = 1; i < args.size(); ++i)
 	{
-		r.error(BackendResultType::general, utils::concat(args[1], " is not a valid number"));
-		return std::move(r);
+		uint64_t logicalSector;
+		if(!utils::convertTo(args[i], logicalSector))
+		{
+			r.error(BackendResultType::general, utils::concat(args[i], " is not a valid number"));
+			return std::move(r);
+		}
+		logicalSectors.push_back(logicalSector);
 	}
 	
 	try {
 		tDisk d = tDisk::get(args[0]);
-		f_sector_index index = d.getSectorIndex(logicalSector);
-		r.result(index, options.getOptionValue("output-format"));
+
+		//Several sectors are looked up at once
+		if(logicalSectors.size() == 1)
+		{
+			f_sector_index index = d.getSectorIndex(logicalSectors.front());
+			r.result(index, options.getOptionValue("output-format"));
+		}
+		else
+		{
+			vector<f_sector_index> indices = d.getSectorIndices(logicalSectors);
+			r.result(indices, options.getOptionValue("output-format"));
+		}
 	} catch (const tDiskException &e) {
 		r.error(BackendResultType::driver, e.what());
 	}
@@ -693,26 +714,15 @@ BackendResult td::get_debug_info(const vector<string> &args, Options &options)
 	BackendResult r;
 	if(args.size() < 1)
 	{
-		r.error(BackendResultType::general, "\"get_device_info\" needs the td device and and optional info id\n");
+		r.error(BackendResultType::general, "\"get_debug_info\" needs the td device\n");
 		return std::move(r);
 	}
 
-	uint64_t id = 0;
-	if(args.size() > 1)
-	{
-		//Read debug id
-		if(!utils::convertTo(args[1], id))
-		{
-			r.error(BackendResultType::general, utils::concat("Invalid number ", args[1], " for debug id"));
-			return std::move(r);
-		}
-	}
-
 	try {
 		tDisk d = tDisk::get(args[0]);
-		f_tdisk_debug_info info = d.getDebugInfo(id);
+		const tDiskLatencyBreakdown &breakdown = d.getLatencyBreakdown();
 
-		r.result(info, options.getOptionValue("output-format"));
+		r.result(breakdown, options.getOptionValue("output-format"));
 	} catch (const tDiskException &e) {
 		r.error(BackendResultType::driver, e.what());
 	}
@@ -751,7 +761,7 @@ BackendResult td::load_config_file(const vector<string> &args, Options &options)
 
 			//Load tDisk
 			try {
-				tDisk disk = tDisk::create(config.minornumber, config.blocksize, config.percentCache);
+				tDisk disk = tDisk::create(config.minornumber, config.blocksize, config.percentCache, tDisk::getHeatTracking(config.heatTracking));
 
 				for(const string device : config.devices)
 					disk.addDisk(device, false);
@@ -950,3 +960,161 @@ BackendResult td::get_internal_device_usage(const vector<string> &args, Options
 	
 	return std::move(r);
 }
+
+BackendResult td::get_usage(const vector<string> &args, Options &options)
+{
+	BackendResult r;
+	if(args.empty())
+	{
+		r.error(BackendResultType::general, "\"get_usage\" needs the td device");
+		return std::move(r);
+	}
+
+	try {
+		tDisk d = tDisk::get(args[0]);
+		const vector<f_device_usage> &usage = d.getUsage();
+		r.result(usage, options.getOptionValue("output-format"));
+	} catch (const tDiskException &e) {
+		r.error(BackendResultType::driver, e.what());
+	}
+	
+	return std::move(r);
+}
+
+BackendResult td::get_stats(const vector<string> &args, Options &options)
+{
+	BackendResult r;
+	if(args.empty())
+	{
+		r.error(BackendResultType::general, "\"get_stats\" needs the td device");
+		return std::move(r);
+	}
+
+	try {
+		tDisk d = tDisk::get(args[0]);
+		const f_tdisk_stats &stats = d.getStats();
+		r.result(stats, options.getOptionValue("output-format"));
+	} catch (const tDiskException &e) {
+		r.error(BackendResultType::driver, e.what());
+	}
+	
+	return std::move(r);
+}
+
+BackendResult td::io_capture(const vector<string> &args, Options &/*options*/)
+{
+	BackendResult r;
+	if(args.size() < 2)
+	{
+		r.error(BackendResultType::general, "\"io_capture\" needs the td device and the action (start, stop or save)");
+		return std::move(r);
+	}
+
+	const utils::ci_string action = args[1].c_str();
+	if(action == "save" && args.size() < 3)
+	{
+		r.error(BackendResultType::general, "\"io_capture save\" needs the file to store the captured requests");
+		return std::move(r);
+	}
+
+	try {
+		tDisk d = tDisk::get(args[0]);
+
+		if(action == "start")
+		{
+			d.setIOCapture(true);
+			r.message(BackendResultType::general, concat("Started capturing the requests of ", args[0]));
+		}
+		else if(action == "stop")
+		{
+			d.setIOCapture(false);
+			r.message(BackendResultType::general, concat("Stopped capturing the requests of ", args[0]));
+		}
+		else if(action == "save")
+		{
+			uint64_t lost;
+			const vector<f_io_record> &records = d.getIOCapture(lost);
+
+			std::ofstream file(args[2], std::ios_base::out | std::ios_base::app);
+			if(!file)
+			{
+				r.error(BackendResultType::general, concat("Can't open file ", args[2]));
+				return std::move(r);
+			}
+
+			iotrace::write(file, records);
+			r.message(BackendResultType::general, concat("Saved ", records.size(), " requests to ", args[2]));
+			if(lost != 0)r.warning(BackendResultType::driver, concat(lost, " requests could not be captured because they were not saved in time"));
+		}
+		else
+		{
+			r.error(BackendResultType::general, concat("Invalid action ", args[1], " for \"io_capture\""));
+		}
+	} catch (const tDiskException &e) {
+		r.error(BackendResultType::driver, e.what());
+	}
+
+	return std::move(r);
+}
+
+BackendResult td::miss_ratio_curve(const vector<string> &args, Options &options)
+{
+	BackendResult r;
+	if(args.size() < 2)
+	{
+		r.error(BackendResultType::general, "\"miss_ratio_curve\" needs the td device and the action (start, stop or show)");
+		return std::move(r);
+	}
+
+	const utils::ci_string action = args[1].c_str();
+
+	try {
+		tDisk d = tDisk::get(args[0]);
+
+		if(action == "start")
+		{
+			d.setMRCTracking(true);
+			r.message(BackendResultType::general, concat("Started tracking the reuse distances of ", args[0]));
+		}
+		else if(action == "stop")
+		{
+			d.setMRCTracking(false);
+			r.message(BackendResultType::general, concat("Stopped tracking the reuse distances of ", args[0]));
+		}
+		else if(action == "show")
+		{
+			const tDiskMissRatioCurve &curve = d.getMissRatioCurve();
+			r.result(curve, options.getOptionValue("output-format"));
+			if(curve.reads + curve.writes == 0)r.warning(BackendResultType::driver, concat("No accesses were tracked. Use \"miss_ratio_curve ", args[0], " start\" first"));
+		}
+		else
+		{
+			r.error(BackendResultType::general, concat("Invalid action ", args[1], " for \"miss_ratio_curve\""));
+		}
+	} catch (const tDiskException &e) {
+		r.error(BackendResultType::driver, e.what());
+	}
+
+	return std::move(r);
+}
+
+BackendResult td::pin_file(const vector<string> &args, Options &/*options*/)
+{
+	BackendResult r;
+	if(args.size() < 3)
+	{
+		r.error(BackendResultType::general, "\"pin_file\" needs the td device, the file and the tier");
+		return std::move(r);
+	}
+
+	try {
+		tDisk d = tDisk::get(args[0]);
+		std::size_t ranges = d.pinFile(args[1], tDisk::getPinTier(args[2]));
+
+		r.message(BackendResultType::general, concat("Pinned ", ranges, " ranges of ", args[1], " to tier ", args[2]));
+	} catch (const tDiskException &e) {
+		r.error(BackendResultType::driver, e.what());
+	}
+
+	return std::move(r);
+}
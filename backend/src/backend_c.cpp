@@ -68,6 +68,11 @@ C_FUNCTION_IMPLEMENTATION(get_files_on_disk)
 C_FUNCTION_IMPLEMENTATION(tdisk_post_create)
 C_FUNCTION_IMPLEMENTATION(tdisk_pre_remove)
 C_FUNCTION_IMPLEMENTATION(performance_improvement)
+C_FUNCTION_IMPLEMENTATION(get_usage)
+C_FUNCTION_IMPLEMENTATION(get_stats)
+C_FUNCTION_IMPLEMENTATION(io_capture)
+C_FUNCTION_IMPLEMENTATION(miss_ratio_curve)
+C_FUNCTION_IMPLEMENTATION(pin_file)
 
 Options* create_options()
 {
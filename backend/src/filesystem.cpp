@@ -14,10 +14,13 @@
 
 #ifdef __linux__
 #include <fcntl.h>
+#include <fstream>
+#include <linux/fiemap.h>
 #include <linux/fs.h>
 #include <parted/parted.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h> 
 #endif //__linux__
@@ -157,8 +160,106 @@ void fs::getDevices(vector<Device> &out)
 	}
 }
 
+/**
+  * Returns the start in bytes of the partition with the given
+  * device number on the given disk or throws an exception if
+  * the partition doesn't belong to the disk
+ **/
+static unsigned long long getPartitionStart(dev_t partition, dev_t disk)
+{
+	const string sysfs = utils::concat("/sys/dev/block/", major(partition), ":", minor(partition));
+
+	std::ifstream parentFile(sysfs + "/../dev");
+	string parent;
+	parentFile>>parent;
+	if(parent != utils::concat(major(disk), ":", minor(disk)))
+		throw BackendException("Device ", major(partition), ":", minor(partition), " is not a partition of ", major(disk), ":", minor(disk));
+
+	std::ifstream startFile(sysfs + "/start");
+	unsigned long long start;
+	if(!(startFile>>start))
+		throw BackendException("Can't get start of partition ", major(partition), ":", minor(partition));
+
+	//The start is given in 512 byte sectors
+	return start << 9;
+}
+
+vector<pair<unsigned long long,unsigned long long> > fs::getFileExtents(const string &file, const string &device)
+{
+	struct stat deviceInfo;
+	if(stat(device.c_str(), &deviceInfo) != 0 || !S_ISBLK(deviceInfo.st_mode))
+		throw BackendException("\"", device, "\" is not a block device");
+
+	struct stat fileInfo;
+	if(stat(file.c_str(), &fileInfo) != 0)
+		throw BackendException("Can't get file info for \"", file, "\": ", strerror(errno));
+
+	unsigned long long start = 0;
+	if(fileInfo.st_dev != deviceInfo.st_rdev)
+		start = getPartitionStart(fileInfo.st_dev, deviceInfo.st_rdev);
+
+	int fd = open(file.c_str(), O_RDONLY);
+	if(fd == -1)throw BackendException("Can't open file \"", file, "\": ", strerror(errno));
+
+	const unsigned int maxExtents = 256;
+	vector<char> buffer(sizeof(struct fiemap) + maxExtents * sizeof(struct fiemap_extent));
+	struct fiemap *map = reinterpret_cast<struct fiemap*>(buffer.data());
+
+	vector<pair<unsigned long long,unsigned long long> > extents;
+	unsigned long long logical = 0;
+	bool last = false;
+
+	while(!last)
+	{
+		memset(map, 0, buffer.size());
+		map->fm_start = logical;
+		map->fm_length = FIEMAP_MAX_OFFSET - logical;
+		map->fm_flags = FIEMAP_FLAG_SYNC;
+		map->fm_extent_count = maxExtents;
+
+		if(ioctl(fd, FS_IOC_FIEMAP, map) == -1)
+		{
+			const string error = strerror(errno);
+			close(fd);
+			throw BackendException("Can't get extents of file \"", file, "\": ", error);
+		}
+
+		if(map->fm_mapped_extents == 0)break;
+
+		for(unsigned int i = 0; i < map->fm_mapped_extents; ++i)
+		{
+			const struct fiemap_extent &extent = map->fm_extents[i];
+
+			logical = extent.fe_logical + extent.fe_length;
+			if(extent.fe_flags & FIEMAP_EXTENT_LAST)last = true;
+
+			//The physical position of these extents is not a
+			//position on the block device
+			if(extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_ENCODED))
+				continue;
+
+			const unsigned long long position = start + extent.fe_physical;
+
+			//Merge consecutive extents
+			if(!extents.empty() && extents.back().first + extents.back().second == position)
+				extents.back().second += extent.fe_length;
+			else
+				extents.push_back(make_pair(position, (unsigned long long)extent.fe_length));
+		}
+	}
+
+	close(fd);
+
+	return std::move(extents);
+}
+
 #else
 
+vector<pair<unsigned long long,unsigned long long> > fs::getFileExtents(const string &file, const string &/*device*/)
+{
+	throw BackendException("Can't get extents of file \"", file, "\" on this system");
+}
+
 fs::Device fs::getDevice(const string &name)
 {
 	fs::Device device;
@@ -98,7 +98,8 @@ vector<Command> commands {
 	
 	Command("get_sector_index", get_sector_index,
 		"Gets information about the given sector index. It needs the tDisk\n"
-		"minornumber/path and logical sector (0-max_sectors) as argument"),
+		"minornumber/path and logical sector (0-max_sectors) as argument.\n"
+		"Several logical sectors can be given to look them up at once"),
 	
 	Command("get_all_sector_indices", get_all_sector_indices,
 		"Returns infomration about all sector indices. It needs the tDisk\n"
@@ -117,9 +118,9 @@ vector<Command> commands {
 		"the tDisk minornumber/path and device id as argument"),
 	
 	Command("get_debug_info", get_debug_info,
-		"Gets debug information about the given tDisk. It needs the tDisk\n"
-		"minornumber/path and an optional current debug id to get the next\n"
-		"info"),
+		"Drains the trace records of the given tDisk and prints the latency\n"
+		"breakdown of the requests since the last call. It needs the tDisk\n"
+		"minornumber/path as argument"),
 	
 	Command("load_config_file", load_config_file,
 		"Loads the given config file. It needs the path to the config file as\n"
@@ -153,7 +154,37 @@ vector<Command> commands {
 
 	Command("get_internal_device_usage", get_internal_device_usage,
 		"Returns the dis usage in percent of the internal devices. It needs\n"
-		"the desired tDisk as argument")
+		"the desired tDisk as argument"),
+
+	Command("get_usage", get_usage,
+		"Returns the used and free blocks and a histogram of the access\n"
+		"counts of all internal devices. It needs the desired tDisk as\n"
+		"argument"),
+
+	Command("get_stats", get_stats,
+		"Returns the amount of requests, migrations and initial placements\n"
+		"and a latency histogram of all requests of the given tDisk. It\n"
+		"needs the desired tDisk as argument"),
+
+	Command("io_capture", io_capture,
+		"Captures the requests of the given tDisk. It needs the tDisk and\n"
+		"the action as argument. \"start\" and \"stop\" start and stop the\n"
+		"capture, \"save\" appends the captured requests to the given file.\n"
+		"The file can be replayed using tests/trace-replay"),
+
+	Command("miss_ratio_curve", miss_ratio_curve,
+		"Estimates the hit ratio of the fastest device depending on its\n"
+		"size using the reuse distances of the accessed blocks. It needs\n"
+		"the tDisk and the action as argument. \"start\" and \"stop\" start\n"
+		"and stop tracking the reuse distances, \"show\" prints the hit\n"
+		"ratios and the sizes needed to serve 50...99% of the reads"),
+
+	Command("pin_file", pin_file,
+		"Pins all blocks of the given file to a tier so that they are always\n"
+		"stored on this or a faster device. It needs the tDisk, the file and\n"
+		"the tier (1 is the fastest device) as argument. The tier\n"
+		"\"never-promote\" keeps the file on the slowest devices and \"none\"\n"
+		"removes the pins")
 };
 
 vector<string> configfiles = {
@@ -199,6 +230,25 @@ int main(int argc, char *args[])
 		{ "no", "yes" }
 	));
 
+	options.addOption(Option(
+		"heat-tracking",
+		"Defines how the access count of the sectors of a new tDisk is\n"
+		"tracked. \"sketch\" counts only candidate hot sectors exactly.\n"
+		"The access count is still stored in the index of every sector,\n"
+		"so this doesn't reduce the memory usage of the tDisk.",
+		{ "exact", "sketch" }
+	));
+
+	options.addOption(Option(
+		"compress",
+		"A flag whether the blocks of newly added internal devices should be\n"
+		"stored compressed. This is meant for the slowest device.\n"
+		"Every block still takes a full slot, so the size of the tDisk\n"
+		"doesn't grow. Only sparse files and thin devices get the saved\n"
+		"space back.",
+		{ "no", "yes" }
+	));
+
 	BackendResult result = handleCommand(argc, args);
 
 	const string &errors = result.errors();
@@ -28,6 +28,38 @@
 	#warning Interface changed: TDISK_MAX_INTERNAL_DEVICE_NAME != F_TDISK_MAX_INTERNAL_DEVICE_NAME
 #endif
 
+#if TDISK_MAX_SECTOR_ENTRIES != F_TDISK_MAX_SECTOR_ENTRIES
+	#warning Interface changed: TDISK_MAX_SECTOR_ENTRIES != F_TDISK_MAX_SECTOR_ENTRIES
+#endif
+
+#if TDISK_HEAT_HISTOGRAM_BUCKETS != F_TDISK_HEAT_HISTOGRAM_BUCKETS
+	#warning Interface changed: TDISK_HEAT_HISTOGRAM_BUCKETS != F_TDISK_HEAT_HISTOGRAM_BUCKETS
+#endif
+
+#if TDISK_LATENCY_BUCKETS != F_TDISK_LATENCY_BUCKETS
+	#warning Interface changed: TDISK_LATENCY_BUCKETS != F_TDISK_LATENCY_BUCKETS
+#endif
+
+#if TDISK_MAX_TRACE_RECORDS != F_TDISK_MAX_TRACE_RECORDS
+	#warning Interface changed: TDISK_MAX_TRACE_RECORDS != F_TDISK_MAX_TRACE_RECORDS
+#endif
+
+#if TDISK_MAX_IO_RECORDS != F_TDISK_MAX_IO_RECORDS
+	#warning Interface changed: TDISK_MAX_IO_RECORDS != F_TDISK_MAX_IO_RECORDS
+#endif
+
+#if TDISK_IO_WRITE != F_TDISK_IO_WRITE
+	#warning Interface changed: TDISK_IO_WRITE != F_TDISK_IO_WRITE
+#endif
+
+#if TDISK_MRC_BUCKETS != F_TDISK_MRC_BUCKETS
+	#warning Interface changed: TDISK_MRC_BUCKETS != F_TDISK_MRC_BUCKETS
+#endif
+
+#if TDISK_TRACE_PLUGIN_ROUND_TRIP != F_TDISK_TRACE_PLUGIN_ROUND_TRIP
+	#warning Interface changed: TDISK_TRACE_PLUGIN_ROUND_TRIP != F_TDISK_TRACE_PLUGIN_ROUND_TRIP
+#endif
+
 #define CONTROL_FILE "/dev/td-control"
 
 inline static void set_sector_index(struct f_sector_index *target, const struct physical_sector_index *source)
@@ -38,11 +70,12 @@ inline static void set_sector_index(struct f_sector_index *target, const struct
 	target->used = source->used;
 }
 
-inline static void set_sector_info(struct f_sector_info *target, const struct sector_info *source)
+inline static void set_sector_entry(struct f_sector_index *target, const struct tdisk_sector_entry *source)
 {
-	target->logical_sector = source->logical_sector;
-	target->access_sorted_index = source->access_sorted_index;
-	set_sector_index(&target->physical_sector, &source->physical_sector);
+	target->disk = source->disk;
+	target->sector = source->sector;
+	target->access_count = source->access_count;
+	target->used = source->used;
 }
 
 inline static void set_device_performance(struct f_device_performance *target, const struct device_performance *source)
@@ -70,14 +103,14 @@ inline static void set_internal_device_info(struct f_internal_device_info *targe
 	set_device_performance(&target->performance, &source->performance);
 }
 
-inline static void set_tdisk_debug_info(struct f_tdisk_debug_info *target, const struct tdisk_debug_info *source)
+inline static void set_trace_record(struct f_trace_record *target, const struct tdisk_trace_record *source)
 {
-	target->id = source->id;
-	strncpy(target->file, source->file, sizeof(target->file));
-	target->line = source->line;
-	strncpy(target->function, source->function, sizeof(target->function));
-	strncpy(target->message, source->message, sizeof(target->message));
-	target->time = (double)((long double)source->time / source->hz);
+	target->time = source->time;
+	target->sector = source->sector;
+	target->value = source->value;
+	target->cpu = source->cpu;
+	target->type = source->type;
+	target->disk = source->disk;
 }
 
 int check_td_control()
@@ -147,12 +180,12 @@ int tdisk_get_devices(char **devices, int size, int length)
 	}
 }
 
-int tdisk_add(char *out_name, unsigned int blocksize, unsigned int percent_cache)
+int tdisk_add(char *out_name, unsigned int blocksize, unsigned int percent_cache, enum f_heat_tracking heat_tracking)
 {
-	return tdisk_add_specific(out_name, -1, blocksize, percent_cache);
+	return tdisk_add_specific(out_name, -1, blocksize, percent_cache, heat_tracking);
 }
 
-int tdisk_add_specific(char *out_name, int minor, unsigned int blocksize, unsigned int percent_cache)
+int tdisk_add_specific(char *out_name, int minor, unsigned int blocksize, unsigned int percent_cache, enum f_heat_tracking heat_tracking)
 {
 	int controller;
 	int device;
@@ -165,7 +198,8 @@ int tdisk_add_specific(char *out_name, int minor, unsigned int blocksize, unsign
 	struct tdisk_add_parameters params = {
 		.minornumber = minor,
 		.blocksize = blocksize,
-		.percent_cache = percent_cache
+		.percent_cache = percent_cache,
+		.heat_tracking = (heat_tracking == f_heat_tracking_sketch) ? heat_tracking_sketch : heat_tracking_exact
 	};
 
 	device = ioctl(controller, TDISK_CTL_ADD, &params);
@@ -195,7 +229,7 @@ int tdisk_remove(int device)
 	return ret;
 }
 
-int tdisk_add_disk(const char *device, const char *new_disk, int format)
+int tdisk_add_disk(const char *device, const char *new_disk, int format, int compress)
 {
 	int exists;
 	int dev;
@@ -223,6 +257,7 @@ int tdisk_add_disk(const char *device, const char *new_disk, int format)
 	strncpy(parameters.name, new_disk, TDISK_MAX_INTERNAL_DEVICE_NAME);	//TODO??
 	strncpy(parameters.path, new_disk, TDISK_MAX_INTERNAL_DEVICE_NAME);
 	parameters.format = format;
+	parameters.compress = compress;
 
 	dev = open(device, O_RDWR);
 	if(dev < 0)
@@ -335,10 +370,170 @@ int tdisk_get_sector_index(const char *device, uint64_t logical_sector, struct f
 
 int tdisk_get_all_sector_indices(const char *device, struct f_sector_info *out, uint64_t size)
 {
-	uint64_t i;
+	return tdisk_get_sector_indices(device, 0, out, size);
+}
+
+int tdisk_get_sector_indices(const char *device, uint64_t first, struct f_sector_info *out, uint64_t size)
+{
+	uint64_t done = 0;
+	int dev;
+	int ret = 0;
+	struct tdisk_sector_entry *entries = malloc(sizeof(struct tdisk_sector_entry) * TDISK_MAX_SECTOR_ENTRIES);
+	if(!entries)return -ENOMEM;
+
+	if(!check_td_control())
+	{
+		free(entries);
+		return -ENODEV;
+	}
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)
+	{
+		free(entries);
+		return -EACCES;
+	}
+
+	//The indices are transferred in chunks
+	while(done < size)
+	{
+		uint32_t i;
+		struct tdisk_sector_indices request;
+
+		request.first = first + done;
+		request.count = (size - done < TDISK_MAX_SECTOR_ENTRIES) ? (uint32_t)(size - done) : TDISK_MAX_SECTOR_ENTRIES;
+		request.mode = TDISK_SECTORS_SORTED;
+		request.entries = (uint64_t)(uintptr_t)entries;
+
+		ret = ioctl(dev, TDISK_GET_SECTOR_INDICES, &request);
+		if(ret)break;
+
+		//The tDisk has less sectors than requested
+		if(request.count == 0)
+		{
+			ret = -EINVAL;
+			break;
+		}
+
+		for(i = 0; i < request.count; ++i)
+		{
+			out[done+i].logical_sector = entries[i].logical_sector;
+			out[done+i].access_sorted_index = request.first + i;
+			set_sector_entry(&out[done+i].physical_sector, &entries[i]);
+		}
+
+		done += request.count;
+	}
+
+	free(entries);
+
+	close(dev);
+
+	return ret;
+}
+
+int tdisk_lookup_sector_indices(const char *device, const uint64_t *logical_sectors, struct f_sector_index *out, uint64_t size)
+{
+	uint64_t done = 0;
+	int dev;
+	int ret = 0;
+	struct tdisk_sector_entry *entries = malloc(sizeof(struct tdisk_sector_entry) * TDISK_MAX_SECTOR_ENTRIES);
+	if(!entries)return -ENOMEM;
+
+	if(!check_td_control())
+	{
+		free(entries);
+		return -ENODEV;
+	}
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)
+	{
+		free(entries);
+		return -EACCES;
+	}
+
+	//The sectors are looked up in chunks
+	while(done < size && !ret)
+	{
+		uint32_t i;
+		struct tdisk_sector_indices request;
+
+		request.first = 0;
+		request.count = (size - done < TDISK_MAX_SECTOR_ENTRIES) ? (uint32_t)(size - done) : TDISK_MAX_SECTOR_ENTRIES;
+		request.mode = TDISK_SECTORS_LIST;
+		request.entries = (uint64_t)(uintptr_t)entries;
+
+		for(i = 0; i < request.count; ++i)
+		{
+			//The driver stores logical sectors as 32 bit values
+			if(logical_sectors[done+i] > UINT32_MAX)ret = -EINVAL;
+			entries[i].logical_sector = (uint32_t)logical_sectors[done+i];
+		}
+		if(ret)break;
+
+		ret = ioctl(dev, TDISK_GET_SECTOR_INDICES, &request);
+		if(ret)break;
+
+		for(i = 0; i < request.count; ++i)
+			set_sector_entry(&out[done+i], &entries[i]);
+
+		done += request.count;
+	}
+
+	free(entries);
+
+	close(dev);
+
+	return ret;
+}
+
+int tdisk_clear_access_count(const char *device)
+{
 	int dev;
 	int ret;
-	struct sector_info *temp = malloc((size_t)(sizeof(struct sector_info) * size));
+
+	if(!check_td_control())return -ENODEV;
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)return -EACCES;
+
+	ret = ioctl(dev, TDISK_CLEAR_ACCESS_COUNT);
+
+	close(dev);
+
+	return ret;
+}
+
+int tdisk_pin_range(const char *device, uint64_t offset, uint64_t length, uint32_t tier)
+{
+	int dev;
+	int ret;
+	struct tdisk_pin pin;
+
+	if(!check_td_control())return -ENODEV;
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)return -EACCES;
+
+	pin.offset = offset;
+	pin.length = length;
+	pin.tier = tier;
+	ret = ioctl(dev, TDISK_PIN_RANGE, &pin);
+
+	close(dev);
+
+	return ret;
+}
+
+int tdisk_get_usage(const char *device, struct f_device_usage *out, unsigned int size, unsigned int *count)
+{
+	unsigned int i;
+	unsigned int j;
+	int dev;
+	int ret;
+	struct tdisk_usage usage;
+	struct tdisk_device_usage *temp = malloc(sizeof(struct tdisk_device_usage) * (size ? size : 1));
 	if(!temp)return -ENOMEM;
 
 	if(!check_td_control())
@@ -354,10 +549,23 @@ int tdisk_get_all_sector_indices(const char *device, struct f_sector_info *out,
 		return -EACCES;
 	}
 
-	ret = ioctl(dev, TDISK_GET_ALL_SECTOR_INDICES, temp);
-	
-	for(i = 0; i < size; ++i)
-		set_sector_info(&out[i], &temp[i]);
+	usage.count = size;
+	usage.reserved = 0;
+	usage.devices = (uint64_t)(uintptr_t)temp;
+	ret = ioctl(dev, TDISK_GET_USAGE, &usage);
+
+	if(!ret)
+	{
+		for(i = 0; i < size && i < usage.count; ++i)
+		{
+			out[i].used_blocks = temp[i].used_blocks;
+			out[i].free_blocks = temp[i].free_blocks;
+			for(j = 0; j < F_TDISK_HEAT_HISTOGRAM_BUCKETS; ++j)
+				out[i].heat_histogram[j] = temp[i].heat_histogram[j];
+		}
+
+		(*count) = usage.count;
+	}
 
 	free(temp);
 
@@ -366,7 +574,7 @@ int tdisk_get_all_sector_indices(const char *device, struct f_sector_info *out,
 	return ret;
 }
 
-int tdisk_clear_access_count(const char *device)
+int tdisk_set_io_capture(const char *device, int enable)
 {
 	int dev;
 	int ret;
@@ -376,7 +584,117 @@ int tdisk_clear_access_count(const char *device)
 	dev = open(device, O_RDWR);
 	if(dev < 0)return -EACCES;
 
-	ret = ioctl(dev, TDISK_CLEAR_ACCESS_COUNT);
+	ret = ioctl(dev, TDISK_SET_IO_CAPTURE, enable ? 1 : 0);
+
+	close(dev);
+
+	return ret;
+}
+
+int tdisk_get_io_capture(const char *device, struct f_io_record *out, unsigned int size, unsigned int *count, uint64_t *lost)
+{
+	unsigned int i;
+	int dev;
+	int ret;
+	struct tdisk_io_capture capture;
+	struct tdisk_io_record *temp = malloc(sizeof(struct tdisk_io_record) * (size ? size : 1));
+	if(!temp)return -ENOMEM;
+
+	if(!check_td_control())
+	{
+		free(temp);
+		return -ENODEV;
+	}
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)
+	{
+		free(temp);
+		return -EACCES;
+	}
+
+	capture.count = size;
+	capture.reserved = 0;
+	capture.records = (uint64_t)(uintptr_t)temp;
+	ret = ioctl(dev, TDISK_GET_IO_CAPTURE, &capture);
+
+	if(!ret)
+	{
+		for(i = 0; i < capture.count; ++i)
+		{
+			out[i].time = temp[i].time;
+			out[i].position = temp[i].position;
+			out[i].length = temp[i].length;
+			out[i].direction = temp[i].direction;
+			out[i].priority = temp[i].priority;
+		}
+
+		(*count) = capture.count;
+		(*lost) = capture.lost;
+	}
+
+	free(temp);
+
+	close(dev);
+
+	return ret;
+}
+
+int tdisk_set_mrc_tracking(const char *device, int enable)
+{
+	int dev;
+	int ret;
+
+	if(!check_td_control())return -ENODEV;
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)return -EACCES;
+
+	ret = ioctl(dev, TDISK_SET_MRC_TRACKING, enable ? 1 : 0);
+
+	close(dev);
+
+	return ret;
+}
+
+int tdisk_get_mrc(const char *device, struct f_mrc *out)
+{
+	unsigned int i;
+	int dev;
+	int ret;
+	struct tdisk_mrc *mrc = malloc(sizeof(struct tdisk_mrc));
+	if(!mrc)return -ENOMEM;
+
+	if(!check_td_control())
+	{
+		free(mrc);
+		return -ENODEV;
+	}
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)
+	{
+		free(mrc);
+		return -EACCES;
+	}
+
+	ret = ioctl(dev, TDISK_GET_MRC, mrc);
+
+	if(!ret)
+	{
+		out->bucket_blocks = mrc->bucket_blocks;
+		out->sampling_shift = mrc->sampling_shift;
+		out->sampled_blocks = mrc->sampled_blocks;
+		out->read_misses = mrc->read_misses;
+		out->write_misses = mrc->write_misses;
+		for(i = 0; i < F_TDISK_MRC_BUCKETS; ++i)
+		{
+			out->read_histogram[i] = mrc->read_histogram[i];
+			out->write_histogram[i] = mrc->write_histogram[i];
+		}
+	}
+
+	free(mrc);
 
 	close(dev);
 
@@ -402,6 +720,73 @@ int tdisk_get_internal_devices_count(const char *device, unsigned int *out)
 	return ret;
 }
 
+int tdisk_get_stats(const char *device, struct f_tdisk_stats *out)
+{
+	unsigned int i;
+	int dev;
+	int ret;
+	struct tdisk_stats stats;
+
+	if(!check_td_control())return -ENODEV;
+
+	dev = open(device, O_RDWR);
+	if(dev < 0)return -EACCES;
+
+	stats.count = 0;
+	stats.reserved = 0;
+	stats.devices = 0;
+	ret = ioctl(dev, TDISK_GET_STATS, &stats);
+
+	if(!ret)
+	{
+		out->requests = stats.requests;
+		out->migrations = stats.migrations;
+		out->migrated_bytes = stats.migrated_bytes;
+		out->initial_placements = stats.initial_placements;
+		for(i = 0; i < F_TDISK_LATENCY_BUCKETS; ++i)
+			out->latency_histogram[i] = stats.latency_histogram[i];
+	}
+
+	close(dev);
+
+	return ret;
+}
+
+/**
+  * Reads the performance counters of the given disk. They are
+  * optional, so the stats are left empty if the driver was
+  * built without them.
+ **/
+inline static void get_device_stats(int dev, unsigned int disk, struct f_device_stats *out)
+{
+	unsigned int i;
+	uint64_t total_hits = 0;
+	struct tdisk_stats stats;
+	struct tdisk_device_stats *temp;
+
+	memset(out, 0, sizeof(struct f_device_stats));
+
+	temp = malloc(sizeof(struct tdisk_device_stats) * TDISK_MAX_PHYSICAL_DISKS);
+	if(!temp)return;
+
+	stats.count = TDISK_MAX_PHYSICAL_DISKS;
+	stats.reserved = 0;
+	stats.devices = (uint64_t)(uintptr_t)temp;
+
+	if(!ioctl(dev, TDISK_GET_STATS, &stats) && disk != 0 && disk <= stats.count)
+	{
+		for(i = 0; i < stats.count; ++i)
+			total_hits += temp[i].hits;
+
+		out->hits = temp[disk-1].hits;
+		out->hit_ratio = total_hits ? (double)temp[disk-1].hits / (double)total_hits : 0;
+		for(i = 0; i < F_TDISK_LATENCY_BUCKETS; ++i)
+			out->latency_histogram[i] = temp[disk-1].latency_histogram[i];
+	}
+
+	free(temp);
+}
+
 int tdisk_get_device_info(const char *device, unsigned int disk, struct f_internal_device_info *out)
 {
 	int dev;
@@ -416,26 +801,50 @@ int tdisk_get_device_info(const char *device, unsigned int disk, struct f_intern
 	temp.disk = (tdisk_index)disk;
 	ret = ioctl(dev, TDISK_GET_DEVICE_INFO, &temp);
 	set_internal_device_info(out, &temp);
+	if(!ret)get_device_stats(dev, disk, &out->stats);
 
 	close(dev);
 
 	return ret;
 }
 
-int tdisk_get_debug_info(const char *device, uint64_t current_id, struct f_tdisk_debug_info *out)
+int tdisk_get_debug_info(const char *device, struct f_trace_record *out, unsigned int size, unsigned int *count, uint64_t *lost)
 {
+	unsigned int i;
 	int dev;
 	int ret;
-	struct tdisk_debug_info temp;
+	struct tdisk_debug_info info;
+	struct tdisk_trace_record *temp = malloc(sizeof(struct tdisk_trace_record) * (size ? size : 1));
+	if(!temp)return -ENOMEM;
 
-	if(!check_td_control())return -ENODEV;
+	if(!check_td_control())
+	{
+		free(temp);
+		return -ENODEV;
+	}
 
 	dev = open(device, O_RDWR);
-	if(dev < 0)return -EACCES;
+	if(dev < 0)
+	{
+		free(temp);
+		return -EACCES;
+	}
+
+	info.count = size;
+	info.reserved = 0;
+	info.records = (uint64_t)(uintptr_t)temp;
+	ret = ioctl(dev, TDISK_GET_DEBUG_INFO, &info);
+
+	if(!ret)
+	{
+		for(i = 0; i < info.count; ++i)
+			set_trace_record(&out[i], &temp[i]);
 
-	temp.id = current_id;
-	ret = ioctl(dev, TDISK_GET_DEBUG_INFO, &temp);
-	set_tdisk_debug_info(out, &temp);
+		(*count) = info.count;
+		(*lost) = info.lost;
+	}
+
+	free(temp);
 
 	close(dev);
 
@@ -5,9 +5,12 @@
   *
  **/
 
+#include <map>
+
 #include <tdisk.hpp>
 
 using std::make_pair;
+using std::map;
 using std::ostream;
 using std::pair;
 using std::sort;
@@ -98,10 +101,10 @@ int tDisk::getMinorNumber(const string &name)
 	return number;
 }
 
-tDisk tDisk::create(int i_minornumber, unsigned int blocksize, unsigned int percentCache)
+tDisk tDisk::create(int i_minornumber, unsigned int blocksize, unsigned int percentCache, f_heat_tracking heatTracking)
 {
 	char temp[256];
-	int ret = c::tdisk_add_specific(temp, i_minornumber, blocksize, percentCache);
+	int ret = c::tdisk_add_specific(temp, i_minornumber, blocksize, percentCache, heatTracking);
 	try {
 		handleError(ret);
 	} catch(const tDiskOfflineException &e) {
@@ -116,10 +119,10 @@ tDisk tDisk::create(int i_minornumber, unsigned int blocksize, unsigned int perc
 	return tDisk(i_minornumber, temp);
 }
 
-tDisk tDisk::create(unsigned int blocksize, unsigned int percentCache)
+tDisk tDisk::create(unsigned int blocksize, unsigned int percentCache, f_heat_tracking heatTracking)
 {
 	char temp[256];
-	int ret = c::tdisk_add(temp, blocksize, percentCache);
+	int ret = c::tdisk_add(temp, blocksize, percentCache, heatTracking);
 	try {
 		handleError(ret);
 	} catch(const tDiskOfflineException &e) {
@@ -131,6 +134,29 @@ tDisk tDisk::create(unsigned int blocksize, unsigned int percentCache)
 	return tDisk(ret, temp);
 }
 
+f_heat_tracking tDisk::getHeatTracking(const string &name)
+{
+	const utils::ci_string str = name.c_str();
+
+	if(str == "" || str == "exact")return c::f_heat_tracking_exact;
+	if(str == "sketch")return c::f_heat_tracking_sketch;
+
+	throw tDiskException("Invalid heat tracking ", name);
+}
+
+unsigned int tDisk::getPinTier(const string &tier)
+{
+	const utils::ci_string str = tier.c_str();
+
+	if(str == "none")return F_TDISK_PIN_NONE;
+	if(str == "never-promote")return F_TDISK_PIN_NEVER_PROMOTE;
+
+	unsigned int number;
+	if(utils::convertTo(tier, number) && number != F_TDISK_PIN_NONE)return number;
+
+	throw tDiskException("Invalid tier ", tier);
+}
+
 void tDisk::remove(int i_minornumber)
 {
 	int ret = c::tdisk_remove(i_minornumber);
@@ -177,9 +203,9 @@ bool tDisk::checkOnline() const
 	return online;
 }
 
-void tDisk::addDisk(const string &path, bool format)
+void tDisk::addDisk(const string &path, bool format, bool compress)
 {
-	int ret = c::tdisk_add_disk(name.c_str(), path.c_str(), format);
+	int ret = c::tdisk_add_disk(name.c_str(), path.c_str(), format, compress);
 
 	try {
 		handleError(ret);
@@ -273,6 +299,26 @@ f_sector_index tDisk::getSectorIndex(unsigned long long logicalSector) const
 	return std::move(index);
 }
 
+vector<f_sector_index> tDisk::getSectorIndices(const vector<unsigned long long> &logicalSectors) const
+{
+	vector<uint64_t> sectors(logicalSectors.begin(), logicalSectors.end());
+	vector<f_sector_index> indices(sectors.size());
+	if(sectors.empty())return std::move(indices);
+
+	int ret = c::tdisk_lookup_sector_indices(name.c_str(), &sectors[0], &indices[0], sectors.size());
+
+	try {
+		handleError(ret);
+	} catch (const tDiskOfflineException &e) {
+		throw tDiskOfflineException("Can't get sector indices for tDisk ", name, ": ", e.what());
+	} catch (const tDiskException &e) {
+		throw tDiskException("Can't get sector indices for tDisk ", name, ": ", e.what());
+	}
+
+	online = true;
+	return std::move(indices);
+}
+
 vector<f_sector_info> tDisk::getAllSectorIndices() const
 {
 	unsigned long long max_sectors = getMaxSectors();
@@ -309,6 +355,56 @@ void tDisk::clearAccessCount()
 	online = true;
 }
 
+void tDisk::pinRange(unsigned long long offset, unsigned long long length, unsigned int tier)
+{
+	int ret = c::tdisk_pin_range(name.c_str(), offset, length, tier);
+
+	try {
+		handleError(ret);
+	} catch (const tDiskOfflineException &e) {
+		throw tDiskOfflineException("Can't pin range ", offset, "-", offset+length, " of tDisk ", name, ": ", e.what());
+	} catch (const tDiskException &e) {
+		throw tDiskException("Can't pin range ", offset, "-", offset+length, " of tDisk ", name, ": ", e.what());
+	}
+
+	online = true;
+}
+
+std::size_t tDisk::pinFile(const string &file, unsigned int tier)
+{
+	vector<pair<unsigned long long,unsigned long long> > extents;
+
+	try {
+		extents = fs::getFileExtents(file, getPath());
+	} catch (const tDiskException &e) {
+		throw tDiskException("Can't pin file ", file, ": ", e.what());
+	}
+
+	//Each extent needs its own pin
+	if(extents.size() > F_TDISK_MAX_PINS)
+		throw tDiskException("Can't pin file ", file, ": It has ", extents.size(), " ranges but only ", F_TDISK_MAX_PINS, " can be pinned");
+
+	for(std::size_t i = 0; i < extents.size(); ++i)
+	{
+		try {
+			pinRange(extents[i].first, extents[i].second, tier);
+		} catch (const tDiskException &e) {
+			//The ranges which were already pinned are
+			//unpinned so that the file is not pinned partially
+			for(std::size_t j = 0; j < i; ++j)
+			{
+				try {
+					pinRange(extents[j].first, extents[j].second, F_TDISK_PIN_NONE);
+				} catch (const tDiskException &) {}
+			}
+
+			throw;
+		}
+	}
+
+	return extents.size();
+}
+
 unsigned int tDisk::getInternalDevicesCount() const
 {
 	unsigned int devices;
@@ -343,21 +439,196 @@ f_internal_device_info tDisk::getDeviceInfo(unsigned int device) const
 	return std::move(info);
 }
 
-f_tdisk_debug_info tDisk::getDebugInfo(uint64_t currentId) const
+vector<f_trace_record> tDisk::getDebugInfo(uint64_t &lost) const
 {
-	f_tdisk_debug_info info;
-	int ret = tdisk_get_debug_info(name.c_str(), currentId, &info);
+	vector<f_trace_record> records;
+	unsigned int count = F_TDISK_MAX_TRACE_RECORDS;
+	lost = 0;
+
+	//The records are drained in chunks until the rings are empty
+	while(count == F_TDISK_MAX_TRACE_RECORDS)
+	{
+		uint64_t chunkLost = 0;
+		std::size_t offset = records.size();
+		records.resize(offset + F_TDISK_MAX_TRACE_RECORDS);
+
+		int ret = tdisk_get_debug_info(name.c_str(), &records[offset], F_TDISK_MAX_TRACE_RECORDS, &count, &chunkLost);
+
+		try {
+			handleError(ret);
+		} catch (const tDiskOfflineException &e) {
+			throw tDiskOfflineException("Can't get debug info for tDisk ", name, ": ", e.what());
+		} catch (const tDiskException &e) {
+			throw tDiskException("Can't get debug info for tDisk ", name, ": ", e.what());
+		}
+
+		records.resize(offset + count);
+		lost += chunkLost;
+	}
+
+	online = true;
+	return std::move(records);
+}
+
+void tDisk::setIOCapture(bool enable)
+{
+	int ret = c::tdisk_set_io_capture(name.c_str(), enable ? 1 : 0);
 
 	try {
 		handleError(ret);
 	} catch (const tDiskOfflineException &e) {
-		throw tDiskOfflineException("Can't get debug info for tDisk ", name, ": ", e.what());
+		throw tDiskOfflineException("Can't ", enable ? "start" : "stop", " I/O capture for tDisk ", name, ": ", e.what());
 	} catch (const tDiskException &e) {
-		throw tDiskException("Can't get debug info for tDisk ", name, ": ", e.what());
+		throw tDiskException("Can't ", enable ? "start" : "stop", " I/O capture for tDisk ", name, ": ", e.what());
 	}
 
 	online = true;
-	return std::move(info);
+}
+
+vector<f_io_record> tDisk::getIOCapture(uint64_t &lost) const
+{
+	vector<f_io_record> records;
+	unsigned int count = F_TDISK_MAX_IO_RECORDS;
+	lost = 0;
+
+	//The records are drained in chunks until the ring is empty
+	while(count == F_TDISK_MAX_IO_RECORDS)
+	{
+		std::size_t offset = records.size();
+		records.resize(offset + F_TDISK_MAX_IO_RECORDS);
+
+		int ret = c::tdisk_get_io_capture(name.c_str(), &records[offset], F_TDISK_MAX_IO_RECORDS, &count, &lost);
+
+		try {
+			handleError(ret);
+		} catch (const tDiskOfflineException &e) {
+			throw tDiskOfflineException("Can't get captured I/O for tDisk ", name, ": ", e.what());
+		} catch (const tDiskException &e) {
+			throw tDiskException("Can't get captured I/O for tDisk ", name, ": ", e.what());
+		}
+
+		records.resize(offset + count);
+	}
+
+	online = true;
+	return std::move(records);
+}
+
+void tDisk::setMRCTracking(bool enable)
+{
+	int ret = c::tdisk_set_mrc_tracking(name.c_str(), enable ? 1 : 0);
+
+	try {
+		handleError(ret);
+	} catch (const tDiskOfflineException &e) {
+		throw tDiskOfflineException("Can't ", enable ? "start" : "stop", " reuse distance tracking for tDisk ", name, ": ", e.what());
+	} catch (const tDiskException &e) {
+		throw tDiskException("Can't ", enable ? "start" : "stop", " reuse distance tracking for tDisk ", name, ": ", e.what());
+	}
+
+	online = true;
+}
+
+tDiskMissRatioCurve tDisk::getMissRatioCurve() const
+{
+	const vector<double> targets = { 50, 80, 90, 95, 99 };
+	f_mrc mrc;
+
+	int ret = c::tdisk_get_mrc(name.c_str(), &mrc);
+
+	try {
+		handleError(ret);
+	} catch (const tDiskOfflineException &e) {
+		throw tDiskOfflineException("Can't get miss ratio curve for tDisk ", name, ": ", e.what());
+	} catch (const tDiskException &e) {
+		throw tDiskException("Can't get miss ratio curve for tDisk ", name, ": ", e.what());
+	}
+
+	online = true;
+
+	const unsigned long long blocksize = getBlocksize();
+	unsigned long long reads = mrc.read_misses;
+	unsigned long long writes = mrc.write_misses;
+	for(std::size_t i = 0; i < F_TDISK_MRC_BUCKETS; ++i)
+	{
+		reads += mrc.read_histogram[i];
+		writes += mrc.write_histogram[i];
+	}
+
+	tDiskMissRatioCurve curve(1ULL << mrc.sampling_shift, mrc.sampled_blocks, reads, writes);
+
+	//An access is a hit on a fast device which holds
+	//more blocks than its reuse distance
+	unsigned long long readHits = 0;
+	unsigned long long hits = 0;
+	std::size_t target = 0;
+	for(std::size_t i = 0; i < F_TDISK_MRC_BUCKETS; ++i)
+	{
+		if(mrc.read_histogram[i] == 0 && mrc.write_histogram[i] == 0)continue;
+
+		readHits += mrc.read_histogram[i];
+		hits += mrc.read_histogram[i] + mrc.write_histogram[i];
+
+		const unsigned long long deviceSize = (i + 1) * mrc.bucket_blocks * blocksize;
+		const double readHitRatio = (reads == 0) ? 0 : (double)readHits / (double)reads * 100;
+		const double hitRatio = (reads + writes == 0) ? 0 : (double)hits / (double)(reads + writes) * 100;
+		curve.addPoint(deviceSize, readHitRatio, hitRatio);
+
+		while(target < targets.size() && readHitRatio >= targets[target])
+			curve.addEstimate(targets[target++], deviceSize);
+	}
+
+	return std::move(curve);
+}
+
+tDiskLatencyBreakdown tDisk::getLatencyBreakdown() const
+{
+	const vector<pair<unsigned int,string> > types = {
+		{ F_TDISK_TRACE_REQUEST_END, "request" },
+		{ F_TDISK_TRACE_INDEX_LOOKUP, "index_lookup" },
+		{ F_TDISK_TRACE_DEVICE_IO, "device_io" },
+		{ F_TDISK_TRACE_PLUGIN_ROUND_TRIP, "plugin_round_trip" },
+		{ F_TDISK_TRACE_MIGRATION, "migration" },
+		{ F_TDISK_TRACE_REMAP, "remap" }
+	};
+
+	uint64_t lost;
+	const vector<f_trace_record> &records = getDebugInfo(lost);
+
+	unsigned long long requestedBytes = 0;
+	map<unsigned int,unsigned long long> count;
+	map<unsigned int,unsigned long long> total;
+	map<unsigned int,unsigned long long> max;
+
+	for(const f_trace_record &record : records)
+	{
+		if(record.type == F_TDISK_TRACE_REQUEST_START)
+		{
+			requestedBytes += record.value;
+			continue;
+		}
+
+		count[record.type]++;
+		total[record.type] += record.value;
+		max[record.type] = std::max(max[record.type], (unsigned long long)record.value);
+	}
+
+	tDiskLatencyBreakdown breakdown(records.size(), lost, requestedBytes);
+	const unsigned long long requestTime = total[F_TDISK_TRACE_REQUEST_END];
+
+	for(const pair<unsigned int,string> &type : types)
+	{
+		const unsigned long long c = count[type.first];
+		breakdown.addLatency(
+			type.second,
+			c,
+			c == 0 ? 0 : (double)total[type.first] / (double)c / 1000,
+			(double)max[type.first] / 1000,
+			requestTime == 0 ? 0 : (double)total[type.first] / (double)requestTime * 100
+		);
+	}
+
+	return std::move(breakdown);
 }
 
 vector<FileAssignment> tDisk::getFilesOnDevice(unsigned int device, bool getPercentages, bool filesOnly)
@@ -434,45 +705,59 @@ tDiskPerformanceImprovement tDisk::getPerformanceImprovement(std::size_t amountF
 
 vector<double> tDisk::getInternalDeviceUsage() const
 {
-	unsigned long long max_sectors = getMaxSectors();
+	vector<double> percent;
 
-	performance::start("getAllSectorIndices");
-	vector<f_sector_info> indices((std::size_t)max_sectors);
-	int ret = c::tdisk_get_all_sector_indices(name.c_str(), &indices[0], max_sectors);
-	performance::stop("getAllSectorIndices");
+	for(const f_device_usage &usage : getUsage())
+	{
+		unsigned long long totalSectors = usage.used_blocks + usage.free_blocks;
+		percent.push_back(totalSectors == 0 ? 0 : (double)usage.used_blocks / (double)totalSectors);
+	}
+
+	return std::move(percent);
+}
+
+vector<f_device_usage> tDisk::getUsage() const
+{
+	unsigned int count = getInternalDevicesCount();
+	vector<f_device_usage> usage(count);
+
+	performance::start("getUsage");
+	int ret = c::tdisk_get_usage(name.c_str(), usage.empty() ? nullptr : &usage[0], count, &count);
+	performance::stop("getUsage");
 
 	try {
 		handleError(ret);
 	} catch (const tDiskOfflineException &e) {
-		throw tDiskOfflineException("Can't all sector indices for tDisk ", name, ": ", e.what());
+		throw tDiskOfflineException("Can't get usage for tDisk ", name, ": ", e.what());
 	} catch (const tDiskException &e) {
-		throw tDiskException("Can't all sector indices for tDisk ", name, ": ", e.what());
+		throw tDiskException("Can't get usage for tDisk ", name, ": ", e.what());
 	}
 
-	vector<double> percent;
-	vector<unsigned long long> totalSectors;
+	//An internal device could be added meanwhile
+	if(count < usage.size())usage.resize(count);
 
-	for(const f_sector_info &info : indices)
-	{
-		if(info.physical_sector.disk == 0)continue;
+	online = true;
+	return std::move(usage);
+}
 
-		while(percent.size() < info.physical_sector.disk)
-		{
-			percent.push_back(0);
-			totalSectors.push_back(0);
-		}
+f_tdisk_stats tDisk::getStats() const
+{
+	f_tdisk_stats stats;
 
-		totalSectors[info.physical_sector.disk-1]++;
-		if(info.physical_sector.used)percent[info.physical_sector.disk-1]++;
-	}
+	performance::start("getStats");
+	int ret = c::tdisk_get_stats(name.c_str(), &stats);
+	performance::stop("getStats");
 
-	for(std::size_t i = 0; i < percent.size(); ++i)
-	{
-		percent[i] = percent[i] / (double)totalSectors[i];
+	try {
+		handleError(ret);
+	} catch (const tDiskOfflineException &e) {
+		throw tDiskOfflineException("Can't get stats for tDisk ", name, ": ", e.what());
+	} catch (const tDiskException &e) {
+		throw tDiskException("Can't get stats for tDisk ", name, ": ", e.what());
 	}
 
 	online = true;
-	return std::move(percent);
+	return std::move(stats);
 }
 
 template <> void td::createResultString(ostream &ss, const f_sector_index &index, unsigned int hierarchy, const utils::ci_string &outputFormat)
@@ -566,6 +851,28 @@ template <> void td::createResultString(ostream &ss, const enum f_internal_devic
 	}
 }
 
+template <> void td::createResultString(ostream &ss, const f_device_stats &stats, unsigned int hierarchy, const utils::ci_string &outputFormat)
+{
+	vector<unsigned long long> latency_histogram(stats.latency_histogram, stats.latency_histogram + F_TDISK_LATENCY_BUCKETS);
+
+	if(outputFormat == "json")
+	{
+		ss<<"{\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, stats, hits, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, stats, hit_ratio, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_NONMEMBER_JSON(ss, latency_histogram, hierarchy+1, outputFormat); ss<<"\n";
+		insertTab(ss, hierarchy); ss<<"}";
+	}
+	else if(outputFormat == "text")
+	{
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, stats, hits, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, stats, hit_ratio, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_NONMEMBER_TEXT(ss, latency_histogram, hierarchy+1, outputFormat); ss<<"\n";
+	}
+	else
+		throw FormatException("Invalid output-format ", outputFormat);
+}
+
 template <> void td::createResultString(ostream &ss, const f_internal_device_info &info, unsigned int hierarchy, const utils::ci_string &outputFormat)
 {
 	if(outputFormat == "json")
@@ -578,7 +885,8 @@ template <> void td::createResultString(ostream &ss, const f_internal_device_inf
 			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, bytes_read, hierarchy+1, outputFormat); ss<<",\n";
 			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, bytes_written, hierarchy+1, outputFormat); ss<<",\n";
 			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, type, hierarchy+1, outputFormat); ss<<",\n";
-			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, performance, hierarchy+1, outputFormat); ss<<"\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, performance, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, stats, hierarchy+1, outputFormat); ss<<"\n";
 		insertTab(ss, hierarchy); ss<<"}";
 	}
 	else if(outputFormat == "text")
@@ -591,32 +899,55 @@ template <> void td::createResultString(ostream &ss, const f_internal_device_inf
 		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, bytes_written, hierarchy+1, outputFormat); ss<<"\n";
 		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, type, hierarchy+1, outputFormat); ss<<"\n";
 		createResultString(ss, info.performance, hierarchy+1, outputFormat); ss<<"\n";
+		createResultString(ss, info.stats, hierarchy+1, outputFormat); ss<<"\n";
+	}
+	else
+		throw FormatException("Invalid output-format ", outputFormat);
+}
+
+template <> void td::createResultString(ostream &ss, const f_device_usage &usage, unsigned int hierarchy, const utils::ci_string &outputFormat)
+{
+	vector<unsigned long long> heat_histogram(usage.heat_histogram, usage.heat_histogram + F_TDISK_HEAT_HISTOGRAM_BUCKETS);
+
+	if(outputFormat == "json")
+	{
+		ss<<"{\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, usage, used_blocks, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, usage, free_blocks, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_NONMEMBER_JSON(ss, heat_histogram, hierarchy+1, outputFormat); ss<<"\n";
+		insertTab(ss, hierarchy); ss<<"}";
+	}
+	else if(outputFormat == "text")
+	{
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, usage, used_blocks, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, usage, free_blocks, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_NONMEMBER_TEXT(ss, heat_histogram, hierarchy+1, outputFormat); ss<<"\n";
 	}
 	else
 		throw FormatException("Invalid output-format ", outputFormat);
 }
 
-template <> void td::createResultString(ostream &ss, const f_tdisk_debug_info &info, unsigned int hierarchy, const utils::ci_string &outputFormat)
+template <> void td::createResultString(ostream &ss, const f_tdisk_stats &stats, unsigned int hierarchy, const utils::ci_string &outputFormat)
 {
+	vector<unsigned long long> latency_histogram(stats.latency_histogram, stats.latency_histogram + F_TDISK_LATENCY_BUCKETS);
+
 	if(outputFormat == "json")
 	{
 		ss<<"{\n";
-			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, id, hierarchy+1, outputFormat); ss<<",\n";
-			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, file, hierarchy+1, outputFormat); ss<<",\n";
-			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, line, hierarchy+1, outputFormat); ss<<",\n";
-			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, function, hierarchy+1, outputFormat); ss<<",\n";
-			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, message, hierarchy+1, outputFormat); ss<<",\n";
-			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, info, time, hierarchy+1, outputFormat); ss<<"\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, stats, requests, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, stats, migrations, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, stats, migrated_bytes, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_MEMBER_JSON(ss, stats, initial_placements, hierarchy+1, outputFormat); ss<<",\n";
+			insertTab(ss, hierarchy+1); CREATE_RESULT_STRING_NONMEMBER_JSON(ss, latency_histogram, hierarchy+1, outputFormat); ss<<"\n";
 		insertTab(ss, hierarchy); ss<<"}";
 	}
 	else if(outputFormat == "text")
 	{
-		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, id, hierarchy+1, outputFormat); ss<<"\n";
-		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, file, hierarchy+1, outputFormat); ss<<"\n";
-		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, line, hierarchy+1, outputFormat); ss<<"\n";
-		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, function, hierarchy+1, outputFormat); ss<<"\n";
-		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, message, hierarchy+1, outputFormat); ss<<"\n";
-		CREATE_RESULT_STRING_MEMBER_TEXT(ss, info, time, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, stats, requests, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, stats, migrations, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, stats, migrated_bytes, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_MEMBER_TEXT(ss, stats, initial_placements, hierarchy+1, outputFormat); ss<<"\n";
+		CREATE_RESULT_STRING_NONMEMBER_TEXT(ss, latency_histogram, hierarchy+1, outputFormat); ss<<"\n";
 	}
 	else
 		throw FormatException("Invalid output-format ", outputFormat);
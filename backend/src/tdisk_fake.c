@@ -33,19 +33,21 @@ int tdisk_get_devices(char **devices, int size, int length)
 	return 2;
 }
 
-int tdisk_add(char *out_name, unsigned int blocksize, unsigned int percent_cache)
+int tdisk_add(char *out_name, unsigned int blocksize, unsigned int percent_cache, enum f_heat_tracking heat_tracking)
 {
 	UNUSED(blocksize);
 	UNUSED(percent_cache);
+	UNUSED(heat_tracking);
 
 	sprintf(out_name, "/dev/td0");
 	return 0;
 }
 
-int tdisk_add_specific(char *out_name, int minor, unsigned int blocksize, unsigned int percent_cache)
+int tdisk_add_specific(char *out_name, int minor, unsigned int blocksize, unsigned int percent_cache, enum f_heat_tracking heat_tracking)
 {
 	UNUSED(blocksize);
 	UNUSED(percent_cache);
+	UNUSED(heat_tracking);
 
 	sprintf(out_name, "/dev/td%d", minor);
 	return minor;
@@ -58,11 +60,12 @@ int tdisk_remove(int device)
 	return 0;
 }
 
-int tdisk_add_disk(const char *device, const char *new_disk, int format)
+int tdisk_add_disk(const char *device, const char *new_disk, int format, int compress)
 {
 	UNUSED(device);
 	UNUSED(new_disk);
 	UNUSED(format);
+	UNUSED(compress);
 
 	return 0;
 }
@@ -75,6 +78,16 @@ int tdisk_remove_disk(const char *device, unsigned int disk)
 	return 0;
 }
 
+int tdisk_pin_range(const char *device, uint64_t offset, uint64_t length, uint32_t tier)
+{
+	UNUSED(device);
+	UNUSED(offset);
+	UNUSED(length);
+	UNUSED(tier);
+
+	return 0;
+}
+
 int tdisk_get_max_sectors(const char *device, uint64_t *out)
 {
 	UNUSED(device);
@@ -133,6 +146,36 @@ int tdisk_get_all_sector_indices(const char *device, struct f_sector_info *out,
 	return 0;
 }
 
+int tdisk_get_sector_indices(const char *device, uint64_t first, struct f_sector_info *out, uint64_t size)
+{
+	UNUSED(device);
+
+	uint64_t i;
+
+	srand((unsigned)time(NULL));
+	for(i = 0; i < size; ++i)
+	{
+		out[i].logical_sector = first+i;
+		out[i].access_sorted_index = first+i;
+		out[i].physical_sector.disk = (unsigned int) (rand() % 3) + 1;
+		out[i].physical_sector.sector = (uint64_t) (rand() % 1024);
+		out[i].physical_sector.access_count = (uint16_t) (rand() % 32768);
+		out[i].physical_sector.used = (rand() % 100) == 0;
+	}
+
+	return 0;
+}
+
+int tdisk_lookup_sector_indices(const char *device, const uint64_t *logical_sectors, struct f_sector_index *out, uint64_t size)
+{
+	uint64_t i;
+
+	for(i = 0; i < size; ++i)
+		tdisk_get_sector_index(device, logical_sectors[i], &out[i]);
+
+	return 0;
+}
+
 int tdisk_clear_access_count(const char *device)
 {
 	UNUSED(device);
@@ -140,6 +183,101 @@ int tdisk_clear_access_count(const char *device)
 	return 0;
 }
 
+int tdisk_get_usage(const char *device, struct f_device_usage *out, unsigned int size, unsigned int *count)
+{
+	UNUSED(device);
+
+	unsigned int i;
+	unsigned int j;
+
+	srand((unsigned)time(NULL));
+	for(i = 0; i < size && i < 3; ++i)
+	{
+		out[i].used_blocks = (uint64_t) (rand() % 1024);
+		out[i].free_blocks = (uint64_t) (rand() % 1024);
+		for(j = 0; j < F_TDISK_HEAT_HISTOGRAM_BUCKETS; ++j)
+			out[i].heat_histogram[j] = out[i].used_blocks >> (j + 1);
+	}
+
+	(*count) = 3;
+	return 0;
+}
+
+int tdisk_get_stats(const char *device, struct f_tdisk_stats *out)
+{
+	UNUSED(device);
+
+	unsigned int i;
+
+	srand((unsigned)time(NULL));
+	out->requests = (uint64_t) (rand() % 1000000);
+	out->migrations = (uint64_t) (rand() % 1000);
+	out->migrated_bytes = out->migrations * 16384;
+	out->initial_placements = (uint64_t) (rand() % 1000);
+	for(i = 0; i < F_TDISK_LATENCY_BUCKETS; ++i)
+		out->latency_histogram[i] = out->requests >> (i + 1);
+
+	return 0;
+}
+
+int tdisk_set_io_capture(const char *device, int enable)
+{
+	UNUSED(device);
+	UNUSED(enable);
+
+	return 0;
+}
+
+int tdisk_get_io_capture(const char *device, struct f_io_record *out, unsigned int size, unsigned int *count, uint64_t *lost)
+{
+	UNUSED(device);
+
+	unsigned int i;
+
+	srand((unsigned)time(NULL));
+	for(i = 0; i < size && i < 1000; ++i)
+	{
+		out[i].time = (uint64_t)i * 1000000;
+		out[i].position = (uint64_t) (rand() % 1024) * 16384;
+		out[i].length = 16384;
+		out[i].direction = (rand() % 4 == 0) ? F_TDISK_IO_WRITE : F_TDISK_IO_READ;
+		out[i].priority = F_TDISK_IO_PRIO_NONE;
+	}
+
+	(*count) = i;
+	(*lost) = 0;
+	return 0;
+}
+
+int tdisk_set_mrc_tracking(const char *device, int enable)
+{
+	UNUSED(device);
+	UNUSED(enable);
+
+	return 0;
+}
+
+int tdisk_get_mrc(const char *device, struct f_mrc *out)
+{
+	UNUSED(device);
+
+	unsigned int i;
+
+	srand((unsigned)time(NULL));
+	out->bucket_blocks = 512;
+	out->sampling_shift = 4;
+	out->sampled_blocks = (unsigned int) (rand() % 8192);
+	out->read_misses = (uint64_t) (rand() % 100000);
+	out->write_misses = (uint64_t) (rand() % 100000);
+	for(i = 0; i < F_TDISK_MRC_BUCKETS; ++i)
+	{
+		out->read_histogram[i] = (uint64_t) (rand() % 100000) >> (i / 8);
+		out->write_histogram[i] = (uint64_t) (rand() % 100000) >> (i / 8);
+	}
+
+	return 0;
+}
+
 int tdisk_get_internal_devices_count(const char *device, unsigned int *out)
 {
 	UNUSED(device);
@@ -152,6 +290,8 @@ int tdisk_get_device_info(const char *device, unsigned int disk, struct f_intern
 {
 	UNUSED(device);
 
+	unsigned int i;
+
 	srand((unsigned)time(NULL));
 
 	out->disk = disk;
@@ -188,21 +328,33 @@ int tdisk_get_device_info(const char *device, unsigned int disk, struct f_intern
 	out->performance.mod_avg_write = (uint32_t) (rand() % 16384);
 	out->performance.mod_stdev_write = (uint32_t) (rand() % 16384);
 
+	out->stats.hits = (uint64_t) (rand() % 1000000);
+	out->stats.hit_ratio = 1.0 / 3;
+	for(i = 0; i < F_TDISK_LATENCY_BUCKETS; ++i)
+		out->stats.latency_histogram[i] = out->stats.hits >> (i + 1);
+
 	return 0;
 }
 
-int tdisk_get_debug_info(const char *device, uint64_t current_id, struct f_tdisk_debug_info *out)
+int tdisk_get_debug_info(const char *device, struct f_trace_record *out, unsigned int size, unsigned int *count, uint64_t *lost)
 {
 	UNUSED(device);
-	UNUSED(current_id);
-	
-	out->id = 0;
-	snprintf(out->file, sizeof(out->file), "fakefile.c");
-	out->line = 100;
-	snprintf(out->function, sizeof(out->function), "fake-function");
-	snprintf(out->message, sizeof(out->message), "This is a fake message");
-	out->time = 10;
-	
+
+	unsigned int i;
+
+	srand((unsigned)time(NULL));
+	for(i = 0; i < size && i < 70; ++i)
+	{
+		out[i].time = (uint64_t)i * 1000;
+		out[i].sector = (uint64_t) (i / 7);
+		out[i].type = i % 7 + 1;
+		out[i].value = (out[i].type == F_TDISK_TRACE_REQUEST_START) ? 16384 : (uint32_t) (rand() % 100000);
+		out[i].cpu = 0;
+		out[i].disk = (out[i].type == F_TDISK_TRACE_REQUEST_START || out[i].type == F_TDISK_TRACE_REQUEST_END) ? 0 : 1;
+	}
+
+	(*count) = i;
+	(*lost) = 0;
 	return 0;
 }
 
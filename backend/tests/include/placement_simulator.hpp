@@ -0,0 +1,1052 @@
+#ifndef PLACEMENT_SIMULATOR_HPP
+#define PLACEMENT_SIMULATOR_HPP
+
+#include <algorithm>
+#include <bitset>
+#include <climits>
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <input_processor.hpp>
+#include <tdisk.hpp>
+
+/**
+  * The constants of the driver which are used by
+  * the simulated placement policies (@see tdisk.c)
+ **/
+namespace driver
+{
+
+	//MAX_ACCESS_COUNT
+	const unsigned int maxAccessCount = 0x1FFF;
+
+	//HEAT_WEIGHT_RT, HEAT_WEIGHT_BE and HEAT_WEIGHT_IDLE
+	const unsigned int heatWeightRT = 4;
+	const unsigned int heatWeightBE = 1;
+	const unsigned int heatWeightIdle = 0;
+
+	//CACHE_RESERVE_WINDOW (in ns), CACHE_RESERVE_DECAY_SHIFT
+	//and CACHE_RESERVE_HEADROOM
+	const unsigned long long cacheReserveWindow = 60ULL * 1000000000ULL;
+	const unsigned int cacheReserveDecayShift = 3;
+	const unsigned long long cacheReserveHeadroom = 2;
+
+	//SKETCH_AGING_INTERVAL and REGIONS_AGING_INTERVAL (in ns)
+	const unsigned long long sketchAgingInterval = 600ULL * 1000000000ULL;
+	const unsigned long long regionsAgingInterval = 600ULL * 1000000000ULL;
+
+	//TDISK_SKETCH_DEPTH, TDISK_SKETCH_WIDTH and TDISK_SKETCH_HOT_THRESHOLD
+	const unsigned int sketchDepth = 4;
+	const unsigned int sketchWidth = 1 << 12;
+	const unsigned int sketchHotThreshold = 4;
+
+	//TDISK_MAX_REGIONS
+	const unsigned int maxRegions = 8;
+
+	//WRITE_BACK_CACHE_SCAN
+	const unsigned long long writeBackCacheScan = 1024;
+
+	//The driver gets the requests in segments of one page
+	const unsigned long long pageSize = 4096;
+
+} //end namespace driver
+
+/**
+  * The configuration and the results of one simulated
+  * internal device
+ **/
+struct SimulatedTier
+{
+
+	SimulatedTier(unsigned long long ull_blocks, double d_latency, double d_throughput) :
+		blocks(ull_blocks),
+		latency(d_latency),
+		throughput(d_throughput),
+		usedBlocks(0),
+		hits(0),
+		bytes(0),
+		time(0)
+	{}
+
+	//The size of the tier in blocks
+	unsigned long long blocks;
+
+	//The access latency in microseconds
+	double latency;
+
+	//The throughput in bytes per microsecond
+	double throughput;
+
+	unsigned long long usedBlocks;
+	unsigned long long hits;
+	unsigned long long bytes;
+
+	//The simulated time in microseconds
+	double time;
+
+}; //end struct SimulatedTier
+
+/**
+  * This class replays captured requests using the placement
+  * policies of the driver. The whole index of the driver is
+  * simulated: All blocks of the tiers are mapped to logical
+  * sectors in the order of the tiers, the last percentCache
+  * percent are the cache sectors. Each access of a request
+  * segment adds the heat of its I/O priority to the access
+  * count of the block (optionally filtered by the count-min
+  * sketch) and marks the accessed regions of the block.
+  * Blocks which are used the first time are placed on the
+  * fastest tier with unused blocks, entirely overwritten
+  * blocks are staged in the cache sectors of faster tiers.
+  * When the tDisk is idle, the optimizer writes the staged
+  * blocks back, sorts the sectors (reserved cache sectors
+  * first, then by heat), assigns them to the tiers (pinned
+  * sectors first, never promoted sectors last) and swaps one
+  * misplaced sector at a time.
+  * The tiers need to be given fastest first. The indices
+  * which the driver stores on each device are not simulated.
+ **/
+class PlacementSimulator
+{
+
+public:
+
+	PlacementSimulator(unsigned int ui_blocksize, const std::vector<SimulatedTier> &v_tiers, unsigned int ui_percentCache, td::f_heat_tracking heatTracking, unsigned long long ull_idleTime, unsigned int ui_movesPerIdle) :
+		blocksize(ui_blocksize),
+		idleTime(ull_idleTime),
+		movesPerIdle(ui_movesPerIdle),
+		tiers(v_tiers),
+		sizeBlocks(0),
+		cacheSectors(0),
+		maxSectors(0),
+		regionCount(std::min(driver::maxRegions, (unsigned int)(ui_blocksize / driver::pageSize))),
+		regionSize(0),
+		sectors(),
+		unusedSectors(v_tiers.size()),
+		sortedSectors(),
+		pins(),
+		sketch(),
+		sketchAgingStart(0),
+		regionsAgingStart(0),
+		reserveSectors(0),
+		allocationBurst(0),
+		allocatedSectors(0),
+		reserveWindowStart(0),
+		stagedSectors(),
+		stagedCount(0),
+		stagingCursor(0),
+		destagingCursor(0),
+		accessCountResort(false),
+		assignmentValid(false),
+		assignedTiers(),
+		misplaced(),
+		lastTime(0),
+		requests(0),
+		initialPlacements(0),
+		stagedBlocks(0),
+		migrations(0),
+		migratedBytes(0),
+		time(0)
+	{
+		for(std::size_t tier = 0; tier < tiers.size(); ++tier)
+		{
+			//Each internal device adds its blocks to the end
+			//of the index and a part of them to the cache
+			for(unsigned long long block = 0; block < tiers[tier].blocks; ++block)
+			{
+				unusedSectors[tier].insert(unusedSectors[tier].end(), maxSectors);
+				sectors.push_back(Sector{ tier, 0, false, 0 });
+				sortedSectors.push_back(maxSectors++);
+			}
+
+			cacheSectors += tiers[tier].blocks * ui_percentCache / 100;
+		}
+
+		sizeBlocks = maxSectors - cacheSectors;
+		stagedSectors.assign(cacheSectors, 0);
+
+		//Until enough sectors were used, all cache sectors are reserved
+		reserveSectors = cacheSectors;
+		allocationBurst = cacheSectors;
+
+		if(regionCount == 0)regionCount = 1;
+		regionSize = blocksize / regionCount;
+
+		if(heatTracking == td::c::f_heat_tracking_sketch)
+			sketch.assign(driver::sketchDepth * driver::sketchWidth, 0);
+	}
+
+	/**
+	  * Pins the given range (in bytes) to the given
+	  * tier like the driver does (@see tDisk::pinRange)
+	 **/
+	void pinRange(unsigned long long offset, unsigned long long length, unsigned int tier)
+	{
+		const unsigned long long size = sizeBlocks * blocksize;
+
+		if(length == 0 || offset >= size || length > size - offset)throw InputException("Invalid pin range ", offset, "+", length);
+		if(tier != F_TDISK_PIN_NEVER_PROMOTE && tier > tiers.size())throw InputException("Invalid pin tier ", tier);
+
+		const unsigned long long first = offset / blocksize;
+		const unsigned long long last = (offset + length - 1) / blocksize;
+
+		//Pinning replaces the pins of all overlapping ranges
+		for(std::size_t i = 0; i < pins.size(); )
+		{
+			if(pins[i].first <= last && pins[i].last >= first)
+			{
+				pins[i] = pins.back();
+				pins.pop_back();
+			}
+			else ++i;
+		}
+
+		if(tier == F_TDISK_PIN_NONE)return;
+		if(pins.size() == F_TDISK_MAX_PINS)throw InputException("Only ", F_TDISK_MAX_PINS, " ranges can be pinned");
+
+		pins.push_back(Pin{ first, last, tier });
+	}
+
+	/**
+	  * Replays the given request. The requests
+	  * need to be replayed in order
+	 **/
+	void replay(const td::f_io_record &record)
+	{
+		if(requests == 0)
+		{
+			sketchAgingStart = record.time;
+			regionsAgingStart = record.time;
+			reserveWindowStart = record.time;
+		}
+		else if(record.time > lastTime && record.time - lastTime >= idleTime)
+			optimize(lastTime + idleTime);
+
+		lastTime = record.time;
+		requests++;
+
+		updateCacheReserve(record.time);
+
+		const unsigned int heat = requestHeat(record.priority);
+		const bool write = (record.direction == F_TDISK_IO_WRITE);
+		unsigned long long position = record.position;
+		const unsigned long long end = record.position + record.length;
+
+		//The driver handles each segment of a request separately
+		while(position < end)
+		{
+			const unsigned long long block = position / blocksize;
+			const unsigned long long offset = position % blocksize;
+			const unsigned long long length = std::min(end, std::min((position / driver::pageSize + 1) * driver::pageSize, (block + 1) * blocksize)) - position;
+
+			//Staging needs the whole block to be overwritten
+			access(block, (unsigned int)offset, length, write && offset == 0 && position + blocksize <= end, heat);
+			position += length;
+		}
+
+		//The sectors need to be sorted again after each request
+		accessCountResort = false;
+		assignmentValid = false;
+	}
+
+	const std::vector<SimulatedTier>& getTiers() const
+	{
+		return tiers;
+	}
+
+	unsigned long long getRequests() const
+	{
+		return requests;
+	}
+
+	unsigned long long getInitialPlacements() const
+	{
+		return initialPlacements;
+	}
+
+	unsigned long long getStagedBlocks() const
+	{
+		return stagedBlocks;
+	}
+
+	unsigned long long getMigrations() const
+	{
+		return migrations;
+	}
+
+	unsigned long long getMigratedBytes() const
+	{
+		return migratedBytes;
+	}
+
+	/**
+	  * Returns the simulated time of all requests in microseconds
+	 **/
+	double getTime() const
+	{
+		return time;
+	}
+
+private:
+
+	/**
+	  * The simulated index of a logical sector
+	 **/
+	struct Sector
+	{
+		std::size_t tier;
+		unsigned int accessCount;
+		bool used;
+
+		//The accessed regions (@see touchRegions)
+		unsigned char regions;
+	}; //end struct Sector
+
+	/**
+	  * A pinned range of logical sectors
+	 **/
+	struct Pin
+	{
+		unsigned long long first;
+		unsigned long long last;
+		unsigned int tier;
+	}; //end struct Pin
+
+	//The access count and the logical sector
+	typedef std::pair<unsigned int,unsigned long long> CountedSector;
+
+	/**
+	  * Accesses the given range of the given block
+	 **/
+	void access(unsigned long long block, unsigned int offset, unsigned long long length, bool overwritten, unsigned int heat)
+	{
+		if(block >= sizeBlocks)throw InputException("The trace accesses block ", block, " but the tDisk has only ", sizeBlocks, " blocks");
+
+		Sector &sector = sectors[block];
+		const bool used = sector.used;
+		bool countExactly = true;
+
+		//Using the heat sketch, only the accesses of
+		//candidate hot sectors are counted
+		if(!sketch.empty() && heat != 0)
+			countExactly = sketchAdd(block);
+
+		if(!used)
+		{
+			sector.used = true;
+			unusedSectors[sector.tier].erase(block);
+			tiers[sector.tier].usedBlocks++;
+			addAccessCount(sector, heat);
+			allocatedSectors++;
+		}
+		else if(countExactly && heat != 0)
+			addAccessCount(sector, heat);
+
+		touchRegions(sector, offset, length);
+
+		if(!used && getPin(block) != F_TDISK_PIN_NEVER_PROMOTE)
+		{
+			//Initial placement on the fastest tier with unused blocks
+			for(std::size_t tier = 0; tier < sector.tier; ++tier)
+			{
+				if(unusedSectors[tier].empty())continue;
+
+				swapIndices(block, *unusedSectors[tier].begin());
+				initialPlacements++;
+				break;
+			}
+		}
+
+		if(used && overwritten && getPin(block) != F_TDISK_PIN_NEVER_PROMOTE)
+			stageSector(block);
+
+		SimulatedTier &tier = tiers[sector.tier];
+		const double duration = tier.latency + (double)length / tier.throughput;
+		tier.hits++;
+		tier.bytes += length;
+		tier.time += duration;
+		time += duration;
+	}
+
+	/**
+	  * Returns the heat of a request with the given priority class
+	 **/
+	static unsigned int requestHeat(unsigned int priority)
+	{
+		switch(priority)
+		{
+		case F_TDISK_IO_PRIO_RT:
+			return driver::heatWeightRT;
+		case F_TDISK_IO_PRIO_IDLE:
+			return driver::heatWeightIdle;
+		default:
+			return driver::heatWeightBE;
+		}
+	}
+
+	/**
+	  * Adds the given heat to the access count of the given
+	  * sector. If the access count reaches its maximum, the
+	  * access counts of all sectors are reduced
+	 **/
+	void addAccessCount(Sector &sector, unsigned int heat)
+	{
+		sector.accessCount = std::min(sector.accessCount + heat, driver::maxAccessCount);
+		if(sector.accessCount != driver::maxAccessCount)return;
+
+		unsigned int minAccessCount = driver::maxAccessCount;
+		for(unsigned long long i = 0; i < sizeBlocks; ++i)
+			minAccessCount = std::min(minAccessCount, sectors[i].accessCount);
+
+		//Needs to be at least 2
+		minAccessCount = std::max(minAccessCount, 2U);
+
+		for(unsigned long long i = 0; i < sizeBlocks; ++i)
+			sectors[i].accessCount /= minAccessCount;
+	}
+
+	/**
+	  * Marks the regions of the given sector which are
+	  * covered by the given range as accessed
+	 **/
+	void touchRegions(Sector &sector, unsigned int offset, unsigned long long length)
+	{
+		if(regionCount <= 1)return;
+
+		const unsigned int first = offset / regionSize;
+		const unsigned int last = (unsigned int)((offset + length - 1) / regionSize);
+		sector.regions = (unsigned char)(sector.regions | (((1U << (last + 1)) - 1) & ~((1U << first) - 1)));
+	}
+
+	/**
+	  * Returns the tier the given logical sector is
+	  * pinned to or F_TDISK_PIN_NONE
+	 **/
+	unsigned int getPin(unsigned long long logicalSector) const
+	{
+		for(const Pin &pin : pins)
+		{
+			if(logicalSector >= pin.first && logicalSector <= pin.last)
+				return pin.tier;
+		}
+
+		return F_TDISK_PIN_NONE;
+	}
+
+	static std::uint32_t rol32(std::uint32_t word, unsigned int shift)
+	{
+		return (word << shift) | (word >> (32 - shift));
+	}
+
+	/**
+	  * The jhash_1word function of the kernel which
+	  * is used to hash the sectors in the sketch
+	 **/
+	static std::uint32_t jhash1Word(std::uint32_t a, std::uint32_t initval)
+	{
+		std::uint32_t b = initval + 0xdeadbeef + (1 << 2);
+		std::uint32_t c = b;
+		a += b;
+
+		c ^= b; c -= rol32(b, 14);
+		a ^= c; a -= rol32(c, 11);
+		b ^= a; b -= rol32(a, 25);
+		c ^= b; c -= rol32(b, 16);
+		a ^= c; a -= rol32(c, 4);
+		b ^= a; b -= rol32(a, 14);
+		c ^= b; c -= rol32(b, 24);
+
+		return c;
+	}
+
+	/**
+	  * Counts an access of the given sector in the heat sketch
+	  * using conservative update. Returns true if the sector
+	  * is a candidate hot sector.
+	 **/
+	bool sketchAdd(unsigned long long logicalSector)
+	{
+		std::size_t columns[driver::sketchDepth];
+		std::uint16_t estimate = UINT16_MAX;
+
+		for(unsigned int row = 0; row < driver::sketchDepth; ++row)
+		{
+			columns[row] = row * driver::sketchWidth + (jhash1Word((std::uint32_t)logicalSector, row) & (driver::sketchWidth - 1));
+			estimate = std::min(estimate, sketch[columns[row]]);
+		}
+
+		if(estimate != UINT16_MAX)
+		{
+			for(unsigned int row = 0; row < driver::sketchDepth; ++row)
+			{
+				if(sketch[columns[row]] == estimate)
+					sketch[columns[row]]++;
+			}
+
+			estimate++;
+		}
+
+		return (estimate >= driver::sketchHotThreshold);
+	}
+
+	/**
+	  * Returns the heat of the given sector which is used to
+	  * sort the sectors. Blocks where only some regions are
+	  * accessed only get the part of their accessed regions.
+	 **/
+	unsigned int sectorHeat(const Sector &sector) const
+	{
+		if(regionCount > 1 && sector.regions != 0)
+			return sector.accessCount * (unsigned int)std::bitset<8>(sector.regions).count() / regionCount;
+
+		return sector.accessCount;
+	}
+
+	/**
+	  * Checks whether the given logical sector is a cache sector
+	  * which should be stored on the fastest tier
+	 **/
+	bool isReservedCacheSector(unsigned long long logicalSector) const
+	{
+		return (logicalSector >= sizeBlocks && logicalSector < sizeBlocks + reserveSectors);
+	}
+
+	/**
+	  * Returns true if sector a needs to be stored on a
+	  * faster tier than sector b
+	 **/
+	bool compareSectors(unsigned long long a, unsigned long long b) const
+	{
+		const bool cacheA = isReservedCacheSector(a);
+		const bool cacheB = isReservedCacheSector(b);
+
+		if(cacheA || cacheB)return (cacheA && !cacheB);
+
+		return sectorHeat(sectors[a]) > sectorHeat(sectors[b]);
+	}
+
+	/**
+	  * Calculates the amount of cache sectors which are kept on
+	  * the fastest tier using the highest amount of newly used
+	  * sectors per window which slowly decays
+	 **/
+	void updateCacheReserve(unsigned long long now)
+	{
+		if(now < reserveWindowStart + driver::cacheReserveWindow)return;
+		reserveWindowStart = now;
+
+		allocationBurst -= allocationBurst >> driver::cacheReserveDecayShift;
+		if(allocatedSectors > allocationBurst)allocationBurst = allocatedSectors;
+		allocatedSectors = 0;
+
+		const unsigned long long reserve = std::min(allocationBurst * driver::cacheReserveHeadroom, cacheSectors);
+
+		if(reserve != reserveSectors)
+		{
+			reserveSectors = reserve;
+
+			//The sectors need to be sorted and assigned again
+			accessCountResort = false;
+			assignmentValid = false;
+		}
+	}
+
+	/**
+	  * Sets the tier of the given logical sector
+	 **/
+	void setTier(unsigned long long logicalSector, std::size_t tier)
+	{
+		Sector &sector = sectors[logicalSector];
+
+		if(sector.used)
+		{
+			tiers[sector.tier].usedBlocks--;
+			tiers[tier].usedBlocks++;
+		}
+		else
+		{
+			unusedSectors[sector.tier].erase(logicalSector);
+			unusedSectors[tier].insert(logicalSector);
+		}
+
+		sector.tier = tier;
+	}
+
+	/**
+	  * Swaps the tiers of the given logical sectors
+	 **/
+	void swapIndices(unsigned long long a, unsigned long long b)
+	{
+		const std::size_t tierA = sectors[a].tier;
+
+		setTier(a, sectors[b].tier);
+		setTier(b, tierA);
+	}
+
+	/**
+	  * Stages the given sector in a free cache sector of a
+	  * faster tier. Returns true if the sector was staged.
+	 **/
+	bool stageSector(unsigned long long logicalSector)
+	{
+		const std::size_t tier = sectors[logicalSector].tier;
+
+		if(cacheSectors == 0 || stagedCount >= cacheSectors || tier == 0)return false;
+
+		for(unsigned long long checked = 0; checked < cacheSectors && checked < driver::writeBackCacheScan; ++checked)
+		{
+			const unsigned long long slot = stagingCursor;
+			const Sector &cacheSector = sectors[sizeBlocks + slot];
+
+			if(++stagingCursor == cacheSectors)stagingCursor = 0;
+
+			//The cache sector must be free and stored on a faster tier
+			if(stagedSectors[slot] != 0 || cacheSector.used || cacheSector.tier >= tier)continue;
+
+			swapIndices(logicalSector, sizeBlocks + slot);
+			stagedSectors[slot] = logicalSector + 1;
+			stagedCount++;
+			stagedBlocks++;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	  * Writes one staged sector back to its original location
+	  * which is now held by the cache sector
+	 **/
+	void destageOneSector()
+	{
+		unsigned long long slot;
+
+		for(slot = 0; slot < cacheSectors; ++slot)
+		{
+			if(stagedSectors[destagingCursor] != 0)break;
+			if(++destagingCursor == cacheSectors)destagingCursor = 0;
+		}
+
+		if(slot == cacheSectors)
+		{
+			stagedCount = 0;
+			return;
+		}
+
+		const unsigned long long logicalSector = stagedSectors[destagingCursor] - 1;
+		const unsigned long long cacheSector = sizeBlocks + destagingCursor;
+		stagedSectors[destagingCursor] = 0;
+		stagedCount--;
+
+		//It is only written back if its original
+		//location is still slower than the current one
+		if(sectors[cacheSector].tier <= sectors[logicalSector].tier)return;
+
+		swapIndices(logicalSector, cacheSector);
+		migrations++;
+		migratedBytes += blocksize;
+	}
+
+	/**
+	  * Returns the misplaced sectors which are assigned to the
+	  * first tier but stored on the second tier
+	 **/
+	std::set<CountedSector>& getMisplaced(std::size_t assigned, std::size_t stored, bool cache)
+	{
+		return misplaced[(assigned * tiers.size() + stored) * 2 + (cache ? 1 : 0)];
+	}
+
+	/**
+	  * Assigns the given sector to the given tier
+	 **/
+	void assignSector(unsigned long long logicalSector, std::size_t tier, std::vector<unsigned long long> &available)
+	{
+		available[tier]--;
+		assignedTiers[logicalSector] = tier;
+	}
+
+	/**
+	  * Assigns the sorted sectors to the tiers and swaps
+	  * the assignments of misplaced sectors with the same
+	  * access count to avoid needless migrations
+	 **/
+	void assignSectors()
+	{
+		const std::size_t count = tiers.size();
+		std::vector<unsigned long long> available;
+		std::vector<std::vector<unsigned long long> > groups(count);
+		std::vector<std::size_t> groupPositions(maxSectors);
+
+		for(const SimulatedTier &tier : tiers)
+			available.push_back(tier.blocks);
+
+		assignedTiers.assign(maxSectors, count);
+		misplaced.assign(count * count * 2, std::set<CountedSector>());
+
+		//Sectors which are pinned to a tier are assigned to
+		//the slowest tier which is at least as fast as the
+		//pinned tier and has space left
+		for(std::size_t i = 0; i < sortedSectors.size() && !pins.empty(); ++i)
+		{
+			const unsigned int pin = getPin(sortedSectors[i]);
+			if(pin == F_TDISK_PIN_NONE || pin == F_TDISK_PIN_NEVER_PROMOTE)continue;
+
+			for(std::size_t tier = std::min((std::size_t)pin, count); tier > 0; --tier)
+			{
+				if(available[tier-1] != 0)
+				{
+					assignSector(sortedSectors[i], tier - 1, available);
+					break;
+				}
+			}
+		}
+
+		//Sectors which should never be promoted are
+		//assigned in a second pass to the slowest blocks
+		std::size_t tier = 0;
+		for(unsigned int pass = 1; pass <= 2; ++pass)
+		{
+			for(unsigned long long logicalSector : sortedSectors)
+			{
+				if(assignedTiers[logicalSector] != count)continue;
+				if(!pins.empty() && (getPin(logicalSector) == F_TDISK_PIN_NEVER_PROMOTE) != (pass == 2))continue;
+
+				while(tier + 1 < count && available[tier] == 0)++tier;
+				assignSector(logicalSector, tier, available);
+			}
+
+			if(pins.empty())break;
+		}
+
+		for(unsigned long long logicalSector = 0; logicalSector < maxSectors; ++logicalSector)
+		{
+			const std::size_t assigned = assignedTiers[logicalSector];
+			const Sector &sector = sectors[logicalSector];
+
+			groupPositions[logicalSector] = groups[assigned].size();
+			groups[assigned].push_back(logicalSector);
+
+			if(sector.tier != assigned)
+				getMisplaced(assigned, sector.tier, isReservedCacheSector(logicalSector)).insert(CountedSector(sector.accessCount, logicalSector));
+		}
+
+		//If a misplaced sector can be swapped with a sector
+		//which has an acceptable access count and is stored on
+		//the tier of the first one, only the assignments are
+		//swapped. The assignment of pinned sectors is fixed
+		for(std::size_t current = 0; current < count; ++current)
+		{
+			for(std::size_t i = 0; i < groups[current].size(); ++i)
+			{
+				const unsigned long long logicalSector = groups[current][i];
+				const Sector &sector = sectors[logicalSector];
+				const bool cache = isReservedCacheSector(logicalSector);
+				CountedSector toSwap;
+
+				if(sector.tier == current || (!pins.empty() && getPin(logicalSector) != F_TDISK_PIN_NONE))continue;
+
+				std::set<CountedSector> &candidates = getMisplaced(sector.tier, current, cache);
+				const unsigned int limit = cache ? (sector.tier < current ? driver::maxAccessCount : 0) : sector.accessCount;
+
+				if(sector.tier < current)
+				{
+					//The sector is stored on a faster tier
+					if(!findHighest(candidates, limit, toSwap))continue;
+				}
+				else
+				{
+					if(!findLowest(candidates, limit, toSwap))continue;
+				}
+
+				if(!pins.empty() && getPin(toSwap.second) != F_TDISK_PIN_NONE)continue;
+
+				getMisplaced(current, sector.tier, cache).erase(CountedSector(sector.accessCount, logicalSector));
+				candidates.erase(toSwap);
+
+				assignedTiers[logicalSector] = sector.tier;
+				assignedTiers[toSwap.second] = current;
+
+				const std::size_t position = groupPositions[toSwap.second];
+				groups[sector.tier][position] = logicalSector;
+				groups[current][i] = toSwap.second;
+				groupPositions[logicalSector] = position;
+				groupPositions[toSwap.second] = i;
+			}
+		}
+	}
+
+	/**
+	  * Finds the sector with the highest access count which is
+	  * at most the given limit. The lowest sector is used if
+	  * several sectors have the same access count
+	 **/
+	static bool findHighest(const std::set<CountedSector> &candidates, unsigned int limit, CountedSector &found)
+	{
+		std::set<CountedSector>::const_iterator it = candidates.upper_bound(CountedSector(limit, ULLONG_MAX));
+		if(it == candidates.begin())return false;
+
+		found = *candidates.lower_bound(CountedSector((--it)->first, 0));
+		return true;
+	}
+
+	/**
+	  * Finds the sector with the lowest access count which is
+	  * at least the given minimum. The lowest sector is used if
+	  * several sectors have the same access count
+	 **/
+	static bool findLowest(const std::set<CountedSector> &candidates, unsigned int minimum, CountedSector &found)
+	{
+		std::set<CountedSector>::const_iterator it = candidates.lower_bound(CountedSector(minimum, 0));
+		if(it == candidates.end())return false;
+
+		found = *it;
+		return true;
+	}
+
+	/**
+	  * Finds the sector with the lowest access count which is
+	  * assigned to the first tier but stored on the second tier
+	 **/
+	bool findLowestMisplaced(std::size_t assigned, std::size_t stored, CountedSector &found)
+	{
+		bool ret = false;
+
+		for(unsigned int cache = 0; cache < 2; ++cache)
+		{
+			CountedSector current;
+
+			if(findLowest(getMisplaced(assigned, stored, cache != 0), 0, current) && (!ret || current < found))
+			{
+				found = current;
+				ret = true;
+			}
+		}
+
+		return ret;
+	}
+
+	/**
+	  * Swaps the sector with the highest access count which is
+	  * assigned to the fastest possible tier with a sector
+	  * which is stored on this tier but assigned to the tier
+	  * of the first one. Returns false if nothing was swapped.
+	 **/
+	bool moveOneSector()
+	{
+		const std::size_t count = tiers.size();
+
+		if(!assignmentValid)
+		{
+			assignSectors();
+			assignmentValid = true;
+		}
+
+		for(std::size_t current = 0; current < count; ++current)
+		{
+			CountedSector highest;
+			CountedSector toSwap;
+			bool found = false;
+
+			for(std::size_t stored = 0; stored < count; ++stored)
+			{
+				for(unsigned int cache = 0; cache < 2 && stored != current; ++cache)
+				{
+					CountedSector candidate;
+
+					if(findHighest(getMisplaced(current, stored, cache != 0), driver::maxAccessCount, candidate) &&
+						(!found || candidate.first > highest.first || (candidate.first == highest.first && candidate.second < highest.second)))
+					{
+						highest = candidate;
+						found = true;
+					}
+				}
+			}
+
+			//All sectors are correctly stored
+			if(!found)continue;
+
+			//Looking at the tier where the highest sector is
+			//stored for a sector that belongs to the current
+			//tier. If there is none, the slower tiers are used
+			std::size_t other = sectors[highest.second].tier;
+			found = findLowestMisplaced(other, current, toSwap);
+
+			while(!found && other + 1 < count)
+			{
+				if(++other != current)
+					found = findLowestMisplaced(other, current, toSwap);
+			}
+
+			if(!found)continue;
+
+			swapSectors(highest.second, toSwap.second);
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	  * Swaps the given sectors. Only the used sectors
+	  * contain data which is copied
+	 **/
+	void swapSectors(unsigned long long a, unsigned long long b)
+	{
+		const unsigned long long sectorPair[] = { a, b };
+
+		for(unsigned long long logicalSector : sectorPair)
+		{
+			const Sector &sector = sectors[logicalSector];
+			getMisplaced(assignedTiers[logicalSector], sector.tier, isReservedCacheSector(logicalSector)).erase(CountedSector(sector.accessCount, logicalSector));
+		}
+
+		swapIndices(a, b);
+
+		unsigned int copiedBlocks = 0;
+		for(unsigned long long logicalSector : sectorPair)
+		{
+			const Sector &sector = sectors[logicalSector];
+
+			if(sector.tier != assignedTiers[logicalSector])
+				getMisplaced(assignedTiers[logicalSector], sector.tier, isReservedCacheSector(logicalSector)).insert(CountedSector(sector.accessCount, logicalSector));
+
+			if(sector.used)copiedBlocks++;
+		}
+
+		if(copiedBlocks != 0)
+		{
+			migrations++;
+			migratedBytes += (unsigned long long)copiedBlocks * blocksize;
+		}
+	}
+
+	/**
+	  * Halves all counters of the heat sketch if the
+	  * aging interval is over
+	 **/
+	void ageSketch(unsigned long long now)
+	{
+		if(sketch.empty() || now < sketchAgingStart + driver::sketchAgingInterval)return;
+
+		for(std::uint16_t &counter : sketch)
+			counter = (std::uint16_t)(counter >> 1);
+
+		sketchAgingStart = now;
+	}
+
+	/**
+	  * Forgets the accessed regions of all sectors
+	  * if the aging interval is over
+	 **/
+	void ageRegions(unsigned long long now)
+	{
+		if(regionCount <= 1 || now < regionsAgingStart + driver::regionsAgingInterval)return;
+
+		for(Sector &sector : sectors)
+			sector.regions = 0;
+
+		regionsAgingStart = now;
+	}
+
+	/**
+	  * Does one step of the optimizer of the driver.
+	  * Returns false if there is nothing to do.
+	 **/
+	bool optimizeStep(unsigned long long now)
+	{
+		updateCacheReserve(now);
+
+		//Staged sectors are written back before
+		//anything else is optimized
+		if(stagedCount != 0)
+		{
+			destageOneSector();
+			return true;
+		}
+
+		if(!accessCountResort)
+		{
+			ageSketch(now);
+			ageRegions(now);
+
+			//The driver sorts until nothing changes anymore
+			auto compare = [this](unsigned long long a, unsigned long long b) { return compareSectors(a, b); };
+			if(std::is_sorted(sortedSectors.begin(), sortedSectors.end(), compare))
+			{
+				accessCountResort = true;
+				assignmentValid = false;
+			}
+			else std::stable_sort(sortedSectors.begin(), sortedSectors.end(), compare);
+
+			return true;
+		}
+
+		accessCountResort = moveOneSector();
+		return accessCountResort;
+	}
+
+	/**
+	  * Does up to movesPerIdle steps of the optimizer
+	 **/
+	void optimize(unsigned long long now)
+	{
+		for(unsigned int i = 0; i < movesPerIdle; ++i)
+		{
+			if(!optimizeStep(now))break;
+		}
+	}
+
+	unsigned int blocksize;
+	unsigned long long idleTime;
+	unsigned int movesPerIdle;
+	std::vector<SimulatedTier> tiers;
+
+	//The simulated index (@see struct tdisk)
+	unsigned long long sizeBlocks;
+	unsigned long long cacheSectors;
+	unsigned long long maxSectors;
+	unsigned int regionCount;
+	unsigned int regionSize;
+	std::vector<Sector> sectors;
+	std::vector<std::set<unsigned long long> > unusedSectors;
+	std::vector<unsigned long long> sortedSectors;
+	std::vector<Pin> pins;
+
+	//The count-min sketch, empty if the heat is tracked exactly
+	std::vector<std::uint16_t> sketch;
+	unsigned long long sketchAgingStart;
+	unsigned long long regionsAgingStart;
+
+	//The adaptive cache reserve
+	unsigned long long reserveSectors;
+	unsigned long long allocationBurst;
+	unsigned long long allocatedSectors;
+	unsigned long long reserveWindowStart;
+
+	//The write back cache, the staged logical sector
+	//(+1) of each cache sector
+	std::vector<unsigned long long> stagedSectors;
+	unsigned long long stagedCount;
+	unsigned long long stagingCursor;
+	unsigned long long destagingCursor;
+
+	//The assignment of the sectors to the tiers
+	bool accessCountResort;
+	bool assignmentValid;
+	std::vector<std::size_t> assignedTiers;
+	std::vector<std::set<CountedSector> > misplaced;
+
+	unsigned long long lastTime;
+	unsigned long long requests;
+	unsigned long long initialPlacements;
+	unsigned long long stagedBlocks;
+	unsigned long long migrations;
+	unsigned long long migratedBytes;
+	double time;
+
+}; //end class PlacementSimulator
+
+#endif //PLACEMENT_SIMULATOR_HPP
@@ -0,0 +1,162 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <input_processor.hpp>
+#include <iotrace.hpp>
+#include <placement_simulator.hpp>
+#include <tdisk.hpp>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::string;
+using std::vector;
+
+using namespace td;
+
+void doReplay();
+vector<double> getValues(const string &name, std::size_t expected);
+void pinRanges(PlacementSimulator &simulator);
+
+vector<InputDefinition> inputs {
+	InputDefinition("trace",		"Which captured trace (backend command io_capture) should be replayed?"),
+	InputDefinition("blocksize",	"Blocksize of the tDisk (in byte)?", "16384"),
+	InputDefinition("sizes",		"Sizes of the internal devices, fastest first (in MB, comma separated)?"),
+	InputDefinition("latencies",	"Access latencies of the internal devices (in us, comma separated)?"),
+	InputDefinition("throughputs",	"Throughputs of the internal devices (in MB/s, comma separated)?"),
+	InputDefinition("percentcache",	"How much of the internal devices is used as cache (in percent)?", "10"),
+	InputDefinition("heattracking",	"How is the access count of the blocks tracked?", { "exact", "sketch" }, "exact"),
+	InputDefinition("pins",			"Which ranges are pinned (offset:length:tier in byte, comma separated)?", "none"),
+	InputDefinition("idletime",		"After how long without requests is the tDisk idle (in ms)?", "100"),
+	InputDefinition("moves",		"How many blocks can be moved per idle period?", "64")
+};
+
+int main(int argc, char *args[])
+{
+	cout<<"This program replays a captured I/O trace using the placement strategy of"<<endl;
+	cout<<"the driver and reports the hit ratio of each internal device, the"<<endl;
+	cout<<"migrated bytes and the simulated latency."<<endl;
+	cout<<endl;
+
+	try {
+		setInputQuestions(inputs, argc, args);
+		askRemainingInputQuestions(inputs);
+
+		doReplay();
+	} catch(const InputException &e) {
+		cerr<<"Error: "<<e.message<<endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+vector<double> getValues(const string &name, std::size_t expected)
+{
+	vector<string> parts;
+	vector<double> values;
+
+	utils::split(getValue<string>(inputs, name), ',', parts, false);
+	for(const string &part : parts)
+	{
+		double value;
+		if(!utils::convertTo(part, value) || value <= 0)throw InputException("Invalid value \"", part, "\" for ", name);
+		values.push_back(value);
+	}
+
+	if(expected != 0 && values.size() != expected)throw InputException("Expected ", expected, " values for ", name, " but got ", values.size());
+	if(values.empty())throw InputException("No values given for ", name);
+
+	return values;
+}
+
+void pinRanges(PlacementSimulator &simulator)
+{
+	const string pins = getValue<string>(inputs, "pins");
+	vector<string> parts;
+
+	if(pins == "none")return;
+
+	utils::split(pins, ',', parts, false);
+	for(const string &part : parts)
+	{
+		vector<string> values;
+		uint64_t offset;
+		uint64_t length;
+
+		utils::split(part, ':', values, false);
+		if(values.size() != 3 || !utils::convertTo(values[0], offset) || !utils::convertTo(values[1], length))throw InputException("Invalid pin \"", part, "\"");
+
+		try {
+			simulator.pinRange(offset, length, tDisk::getPinTier(values[2]));
+		} catch(const tDiskException &e) {
+			throw InputException(e.what());
+		}
+	}
+}
+
+void doReplay()
+{
+	string traceFile = getValue<string>(inputs, "trace");
+	unsigned int blocksize = getValue<unsigned int>(inputs, "blocksize");
+	unsigned long long idleTime = getValue<unsigned long long>(inputs, "idletime") * 1000000;
+	unsigned int moves = getValue<unsigned int>(inputs, "moves");
+	unsigned int percentCache = getValue<unsigned int>(inputs, "percentcache");
+	f_heat_tracking heatTracking = tDisk::getHeatTracking(getValue<string>(inputs, "heattracking"));
+
+	if(blocksize == 0)throw InputException("Invalid blocksize 0");
+	if(percentCache >= 100)throw InputException("Invalid cache percentage ", percentCache);
+
+	const vector<double> &sizes = getValues("sizes", 0);
+	const vector<double> &latencies = getValues("latencies", sizes.size());
+	const vector<double> &throughputs = getValues("throughputs", sizes.size());
+
+	vector<SimulatedTier> tiers;
+	for(std::size_t i = 0; i < sizes.size(); ++i)
+	{
+		//MB/s is the same as bytes per microsecond
+		unsigned long long blocks = (unsigned long long)(sizes[i] * 1024 * 1024) / blocksize;
+		tiers.emplace_back(blocks, latencies[i], throughputs[i]);
+	}
+
+	ifstream file(traceFile);
+	if(!file)throw InputException("Error opening file ", traceFile);
+
+	vector<f_io_record> records;
+	if(!iotrace::read(file, records))throw InputException("Invalid trace file ", traceFile);
+	if(records.empty())throw InputException("The trace ", traceFile, " is empty");
+
+	PlacementSimulator simulator(blocksize, tiers, percentCache, heatTracking, idleTime, moves);
+	pinRanges(simulator);
+
+	for(const f_io_record &record : records)
+		simulator.replay(record);
+
+	unsigned long long totalHits = 0;
+	for(const SimulatedTier &tier : simulator.getTiers())
+		totalHits += tier.hits;
+
+	cout<<"Replayed "<<simulator.getRequests()<<" requests"<<endl;
+	cout<<endl;
+
+	for(std::size_t i = 0; i < simulator.getTiers().size(); ++i)
+	{
+		const SimulatedTier &tier = simulator.getTiers()[i];
+
+		cout<<"Device "<<(i+1)<<":"<<endl;
+		cout<<"\tHits: "<<tier.hits<<" ("<<(totalHits == 0 ? 0 : (double)tier.hits / (double)totalHits * 100)<<"%)"<<endl;
+		cout<<"\tBytes: "<<tier.bytes<<endl;
+		cout<<"\tUsed blocks: "<<tier.usedBlocks<<"/"<<tier.blocks<<endl;
+		cout<<"\tSimulated time: "<<tier.time / 1000<<" ms"<<endl;
+	}
+
+	cout<<endl;
+	cout<<"Initial placements: "<<simulator.getInitialPlacements()<<endl;
+	cout<<"Staged blocks: "<<simulator.getStagedBlocks()<<endl;
+	cout<<"Migrations: "<<simulator.getMigrations()<<endl;
+	cout<<"Migrated bytes: "<<simulator.getMigratedBytes()<<endl;
+	cout<<"Simulated latency: "<<simulator.getTime() / 1000<<" ms (AVG "<<simulator.getTime() / (double)simulator.getRequests()<<" us per request)"<<endl;
+}
@@ -24,6 +24,15 @@
 #define USE_PLUGINS
 #endif //USE_NETLINK
 
+/**
+  * Defines whether plugins can use a shared ring instead
+  * of netlink messages to transfer the requests
+  * Netlink support is required for this
+ **/
+#ifdef USE_NETLINK
+#define USE_PLUGIN_RING
+#endif //USE_NETLINK
+
 /**
   * Defines whether the driver should be able to use
   * files or block devices as internal devices
@@ -55,6 +64,82 @@
  **/
 #define USE_INITIAL_OPTIMIZATION
 
+/**
+  * Defines whether writes to sectors stored on slow disks should
+  * be staged in the cache sectors of faster disks. The staged
+  * sectors are written back to their original location when the
+  * tDisk is idle. The cache is only used if percent_cache is not 0
+ **/
+#define USE_WRITE_BACK_CACHE
+
+/**
+  * Defines whether the amount of cache sectors which are kept
+  * on the fastest disk should depend on the amount of newly used
+  * sectors. If it is disabled, all cache sectors are kept there
+ **/
+#define ADAPTIVE_CACHE_RESERVE
+
+/**
+  * Defines whether the access count of used sectors should be
+  * buffered per CPU. The buffered accesses are added to the
+  * sector indices when the tDisk is idle. This prevents that
+  * CPUs fight for the cache lines of the sector indices
+ **/
+#define USE_PERCPU_HEAT
+
+/**
+  * Defines whether the accessed regions inside of each block
+  * should be tracked. Blocks where only a small part is hot
+  * get less weight when they are sorted and their hot pages
+  * are kept in a page granular read cache instead
+ **/
+#define USE_SUB_BLOCK_HEAT
+
+/**
+  * Defines whether internal devices can store their blocks
+  * compressed. This is meant for the slowest device where
+  * most of the data is cold. Compression needs to be enabled
+  * per device when it is added
+ **/
+#define USE_COMPRESSION
+
+/**
+  * Defines whether tDisks which store internal devices on the
+  * same physical disk share a migration budget. Only the tDisk
+  * with the most misplaced blocks moves sectors on such a disk
+  * and the amount of moved bytes per second is limited
+ **/
+#define USE_MIGRATION_BUDGET
+
+/**
+  * Defines whether the sector indices whose access count changed
+  * should be written to the internal devices periodically when the
+  * tDisk is idle. This way, the heat survives a restart even if
+  * the tDisk was not removed properly
+ **/
+#define USE_HEAT_SNAPSHOT
+
+/**
+  * Defines whether performance counters and latency histograms
+  * of the tDisk and its internal devices should be recorded.
+  * They are counted per CPU
+ **/
+#define USE_PERF_COUNTERS
+
+/**
+  * Defines whether the requests of a tDisk can be captured.
+  * The captured requests can be replayed offline to evaluate
+  * changes of the placement of the sectors
+ **/
+#define USE_IO_CAPTURE
+
+/**
+  * Defines whether the reuse distances of a sample of the
+  * blocks can be tracked. They are used to estimate the hit
+  * ratio for different sizes of the fastest device
+ **/
+#define USE_MISS_RATIO_CURVE
+
 //#define ASYNC_OPERATIONS
 
 #endif //CONFIG_H
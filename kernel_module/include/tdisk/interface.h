@@ -14,7 +14,7 @@
 #include <linux/types.h>
 
 #define DRIVER_NAME "tDisk"
-#define DRIVER_MAJOR_VERSION 1
+#define DRIVER_MAJOR_VERSION 2
 #define DRIVER_MINOR_VERSION 0
 
 #define TO_XSTRING(s) TO_STRING(s)
@@ -52,15 +52,26 @@ enum {
 	TD_FLAGS_AUTOCLEAR	= 4
 };
 
+/**
+  * Defines how the access count (heat) of the sectors is tracked
+ **/
+enum heat_tracking
+{
+	heat_tracking_exact = 0,	//Every access of every sector is counted
+	heat_tracking_sketch = 1	//The accesses are estimated using a count-min sketch and only candidate hot sectors are counted. The index size stays the same
+};
+
 /**
   * This struct is used when a tDisk with a specific
-  * minornumber should be added. It just bundles two variables
+  * minornumber should be added. It just bundles the
+  * parameters of the new tDisk
  **/
 struct tdisk_add_parameters
 {
 	int minornumber;
 	unsigned int blocksize;
 	unsigned int percent_cache;
+	unsigned int heat_tracking;	//@see enum heat_tracking
 }; //end tdisk_add_parameters
 
 /**
@@ -83,6 +94,7 @@ struct internal_device_add_parameters
 	unsigned int fd;
 	int format;
 	enum internal_device_type type;
+	int compress;	//Whether the blocks should be stored compressed
 }; //end struct internal_device_add_parameters
 
 /**
@@ -170,34 +182,321 @@ struct tdisk_info {
 };
 
 
-/****************** tDisk debugging *****************/
+/**
+  * This struct is used to pin a range of the tDisk to a tier.
+  * Tier 1 is the fastest internal device. The range is always
+  * stored on the given tier or a faster one.
+  * TDISK_PIN_NEVER_PROMOTE keeps the range on the slowest devices
+  * and TDISK_PIN_NONE removes the pins of the range.
+ **/
+struct tdisk_pin
+{
+	//The range in bytes
+	__u64 offset;
+	__u64 length;
+
+	__u32 tier;
+}; //end struct tdisk_pin
+
+#define TDISK_PIN_NONE 0
+#define TDISK_PIN_NEVER_PROMOTE ((__u32)-1)
 
 /**
-  * This struct is used to store information about the current
-  * operations of a tdisk
+  * The maximum amount of pinned ranges of a tDisk
  **/
-struct tdisk_debug_info
+#define TDISK_MAX_PINS 32
+
+/**
+  * A compact version of struct sector_info which is used
+  * to transfer many sector indices at once
+  * (@see struct tdisk_sector_indices)
+ **/
+struct tdisk_sector_entry
+{
+	__u32 logical_sector;
+	__u32 sector;
+	__u16 access_count;
+	tdisk_index disk;
+	__u8 used;
+}; //end struct tdisk_sector_entry
+
+/**
+  * This struct is used to get many sector indices with a
+  * single call. Using TDISK_SECTORS_SORTED, the sectors
+  * first...first+count-1 in the order of their access count
+  * are returned. Using TDISK_SECTORS_LIST, the logical_sector
+  * of each entry needs to be set and the remaining fields are
+  * filled in. At most TDISK_MAX_SECTOR_ENTRIES are transferred,
+  * count is set to the actual amount of entries.
+ **/
+struct tdisk_sector_indices
+{
+	__u64 first;
+	__u32 count;
+	__u32 mode;
+
+	//Pointer to an array of struct tdisk_sector_entry
+	__u64 entries;
+}; //end struct tdisk_sector_indices
+
+#define TDISK_SECTORS_SORTED 0
+#define TDISK_SECTORS_LIST 1
+
+#define TDISK_MAX_SECTOR_ENTRIES 65536
+
+/**
+  * The amount of buckets of the heat histogram. Bucket 0
+  * counts the blocks which were never accessed, bucket i
+  * the blocks with an access count of 2^(i-1)...2^i-1
+ **/
+#define TDISK_HEAT_HISTOGRAM_BUCKETS 16
+
+/**
+  * This struct summarizes the blocks of one internal device
+  * (@see struct tdisk_usage)
+ **/
+struct tdisk_device_usage
+{
+	__u64 used_blocks;
+	__u64 free_blocks;
+
+	//The access counts of the used blocks
+	__u64 heat_histogram[TDISK_HEAT_HISTOGRAM_BUCKETS];
+}; //end struct tdisk_device_usage
+
+/**
+  * This struct is used to get the usage of all internal
+  * devices with a single call. count needs to be set to
+  * the size of the devices array and is set to the
+  * amount of internal devices.
+ **/
+struct tdisk_usage
+{
+	__u32 count;
+
+	//Keeps the layout equal for 32 and 64 bit
+	__u32 reserved;
+
+	//Pointer to an array of struct tdisk_device_usage
+	__u64 devices;
+}; //end struct tdisk_usage
+
+/**
+  * The amount of buckets of the latency histograms. Bucket 0
+  * counts the operations which took less than a microsecond,
+  * bucket i the ones which took 2^(i-1)...2^i-1 microseconds
+ **/
+#define TDISK_LATENCY_BUCKETS 24
+
+/**
+  * The performance counters of an internal device
+ **/
+struct tdisk_device_stats
 {
-	/** The id of the debug info **/
-	__u64 id;
+	//The amount of block accesses which were served
+	//by this internal device
+	__u64 hits;
 
-	/** The current source file **/
-	char file[256];
+	//The latency of the block accesses
+	__u64 latency_histogram[TDISK_LATENCY_BUCKETS];
+}; //end struct tdisk_device_stats
 
-	/** The current line in the file **/
-	int line;
+/**
+  * This struct is used to get the performance counters of
+  * the tDisk and all internal devices with a single call.
+  * count needs to be set to the size of the devices array
+  * and is set to the amount of internal devices.
+ **/
+struct tdisk_stats
+{
+	__u64 requests;
+
+	//The blocks which were moved to another internal device
+	__u64 migrations;
+	__u64 migrated_bytes;
+
+	//The new blocks which were placed on a faster device
+	__u64 initial_placements;
+
+	//The latency of the requests
+	__u64 latency_histogram[TDISK_LATENCY_BUCKETS];
+
+	__u32 count;
+
+	//Keeps the layout equal for 32 and 64 bit
+	__u32 reserved;
+
+	//Pointer to an array of struct tdisk_device_stats
+	__u64 devices;
+}; //end struct tdisk_stats
+
+/**
+  * The size of the ring which holds the captured requests.
+  * This is also the max amount of captured requests which
+  * are transferred at once
+ **/
+#define TDISK_MAX_IO_RECORDS 65536
 
-	/** The current function **/
-	char function[256];
+/**
+  * The direction of a captured request
+ **/
+#define TDISK_IO_READ	0
+#define TDISK_IO_WRITE	1
 
-	/** A custom message **/
-	char message[256];
+/**
+  * The I/O priority class of a captured request.
+  * The values are the same as IOPRIO_CLASS_*
+ **/
+#define TDISK_IO_PRIO_NONE	0
+#define TDISK_IO_PRIO_RT	1
+#define TDISK_IO_PRIO_BE	2
+#define TDISK_IO_PRIO_IDLE	3
 
-	/** The time of the debugging info in jiffies **/
+/**
+  * This struct represents one captured request
+ **/
+struct tdisk_io_record
+{
+	//The time when the request was started in nanoseconds
 	__u64 time;
 
-	/** The value of HZ (x HZ = 1 sec) **/
-	int hz;
+	//The position and length of the request in bytes
+	__u64 position;
+	__u32 length;
+
+	//TDISK_IO_READ or TDISK_IO_WRITE
+	__u32 direction;
+
+	//TDISK_IO_PRIO_NONE, _RT, _BE or _IDLE
+	__u32 priority;
+
+	//Keeps the layout equal for 32 and 64 bit
+	__u32 reserved;
+}; //end struct tdisk_io_record
+
+/**
+  * This struct is used to drain the captured requests.
+  * count needs to be set to the size of the records
+  * array and is set to the amount of drained records.
+ **/
+struct tdisk_io_capture
+{
+	//The amount of requests which were not captured
+	//since the capture was started because the ring
+	//was full
+	__u64 lost;
+
+	__u32 count;
+
+	//Keeps the layout equal for 32 and 64 bit
+	__u32 reserved;
+
+	//Pointer to an array of struct tdisk_io_record
+	__u64 records;
+}; //end struct tdisk_io_capture
+
+/**
+  * The amount of buckets of the reuse distance histograms
+ **/
+#define TDISK_MRC_BUCKETS 128
+
+/**
+  * This struct holds the reuse distance histograms of a
+  * tDisk. The reuse distance of an access is the amount of
+  * other blocks which were accessed since the last access of
+  * the same block. An access is a hit on a fast device which
+  * can hold more blocks than its reuse distance (LRU).
+  * Bucket i counts the accesses with a reuse distance of
+  * i*bucket_blocks...(i+1)*bucket_blocks-1. Only a sample of
+  * the blocks is tracked, all counts are already scaled
+  * by the sampling rate.
+ **/
+struct tdisk_mrc
+{
+	//The size of each bucket in blocks
+	__u64 bucket_blocks;
+
+	//One of 2^sampling_shift blocks is tracked
+	__u32 sampling_shift;
+
+	//The amount of blocks which are currently tracked
+	__u32 sampled_blocks;
+
+	//The accesses which are misses for any size of the
+	//fast device: The first access of each block and
+	//reuse distances beyond the last bucket
+	__u64 read_misses;
+	__u64 write_misses;
+
+	__u64 read_histogram[TDISK_MRC_BUCKETS];
+	__u64 write_histogram[TDISK_MRC_BUCKETS];
+}; //end struct tdisk_mrc
+
+
+/****************** tDisk debugging *****************/
+
+/**
+  * The types of trace records
+ **/
+#define TDISK_TRACE_REQUEST_START		1	//sector: position in 512 byte sectors, value: length in bytes
+#define TDISK_TRACE_REQUEST_END			2	//sector: position in 512 byte sectors, value: duration
+#define TDISK_TRACE_INDEX_LOOKUP		3	//sector: logical sector, value: duration
+#define TDISK_TRACE_REMAP				4	//sector: logical sector, disk: the new disk
+#define TDISK_TRACE_MIGRATION			5	//sector: logical sector, value: duration
+#define TDISK_TRACE_DEVICE_IO			6	//sector: logical sector, value: duration
+#define TDISK_TRACE_PLUGIN_ROUND_TRIP	7	//sector: logical sector, value: duration
+
+/**
+  * The max amount of trace records which are transferred at once
+ **/
+#define TDISK_MAX_TRACE_RECORDS 65536
+
+/**
+  * This struct represents one trace record of the tDisk.
+  * All durations are in nanoseconds.
+ **/
+struct tdisk_trace_record
+{
+	/** The time when the record was written in nanoseconds **/
+	__u64 time;
+
+	/** The sequence number of the record on its CPU **/
+	__u64 sequence;
+
+	/** The sector the record belongs to **/
+	__u64 sector;
+
+	/** The duration or length, depending on the type **/
+	__u32 value;
+
+	/** The CPU which wrote the record **/
+	__u16 cpu;
+
+	/** The type of the record (@see TDISK_TRACE_REQUEST_START) **/
+	__u8 type;
+
+	/** The internal device the record belongs to or 0 **/
+	tdisk_index disk;
+
+}; //end struct tdisk_trace_record
+
+/**
+  * This struct is used to drain the trace records of the
+  * tDisk. count needs to be set to the size of the records
+  * array and is set to the amount of drained records.
+ **/
+struct tdisk_debug_info
+{
+	/** The amount of records which were overwritten before they were drained **/
+	__u64 lost;
+
+	__u32 count;
+
+	//Keeps the layout equal for 32 and 64 bit
+	__u32 reserved;
+
+	//Pointer to an array of struct tdisk_trace_record
+	__u64 records;
 
 }; //end struct tdisk_debug_info
 
@@ -212,12 +511,24 @@ struct tdisk_debug_info
 #define TDISK_CLEAR_ACCESS_COUNT		0x4C05
 #define TDISK_GET_DEBUG_INFO			0x4C06
 #define TDISK_REMOVE_DISK				0x4C07
+#define TDISK_PIN_RANGE					0x4C08
+#define TDISK_GET_SECTOR_INDICES		0x4C09
+#define TDISK_GET_USAGE					0x4C0A
+#define TDISK_GET_STATS					0x4C0B
+#define TDISK_SET_IO_CAPTURE			0x4C0C
+#define TDISK_GET_IO_CAPTURE			0x4C0D
+#define TDISK_SET_MRC_TRACKING			0x4C0E
+#define TDISK_GET_MRC					0x4C0F
 
 // /dev/td-control interface
 #define TDISK_CTL_ADD			0x4C80
 #define TDISK_CTL_REMOVE		0x4C81
 #define TDISK_CTL_GET_FREE		0x4C82
 
+// /dev/td-plugin interface
+#define TDISK_PLUGIN_RING_SETUP		0x4CA0
+#define TDISK_PLUGIN_RING_COMPLETE	0x4CA1
+
 
 /****************** Netlink interfaces **************/
 
@@ -239,6 +550,9 @@ enum nl_tdisk_attr {
 	NLTD_REQ_LENGTH,
 	NLTD_REQ_RET,
 	NLTD_REQ_BUFFER,
+	NLTD_PLUGIN_MAX_LENGTH,
+	NLTD_PLUGIN_WINDOW,
+	NLTD_PLUGIN_RING,
 	__NLTD_MAX,
 };
 #define NLTD_MAX (__NLTD_MAX - 1)
@@ -249,4 +563,113 @@ enum nl_tdisk_attr {
 
 #define NLTD_MAX_NAME TDISK_MAX_INTERNAL_DEVICE_NAME
 
+/**
+  * The max length of the data of a READ or WRITE message.
+  * The length of a netlink attribute is stored in 16 bit.
+  * A plugin can ask for less using NLTD_PLUGIN_MAX_LENGTH
+  * when it registers. Plugins which don't send it get
+  * messages of up to one page.
+ **/
+#define NLTD_MAX_MESSAGE_LENGTH 32768
+
+/**
+  * The max amount of outstanding messages of a synchronous
+  * plugin operation. A plugin can ask for less using
+  * NLTD_PLUGIN_WINDOW when it registers. Plugins which
+  * don't send it get one message at a time.
+ **/
+#define NLTD_MAX_WINDOW 64
+
+/**
+  * The device which is used to set up the shared ring of a
+  * plugin. Instead of netlink messages, the requests and their
+  * answers are then transferred using the ring. The data is
+  * stored in the data slots of the ring, so it is copied only
+  * once by the kernel module.
+  * The plugin sets up the ring using TDISK_PLUGIN_RING_SETUP,
+  * maps it using mmap and registers with NLTD_PLUGIN_RING.
+  * The device is readable (poll) if there are new submission
+  * entries. After the plugin added completion entries, it
+  * calls TDISK_PLUGIN_RING_COMPLETE.
+ **/
+#define NLTD_RING_DEVICE "/dev/td-plugin"
+
+/**
+  * The max amount of entries and the max size of a
+  * data slot of a ring
+ **/
+#define NLTD_RING_MAX_ENTRIES 256
+#define NLTD_RING_MAX_SLOT_SIZE 131072
+
+/**
+  * This struct is used to set up the ring of a plugin
+  * (TDISK_PLUGIN_RING_SETUP). entries and slot_size are
+  * set to the actual values, size is set to the size of
+  * the mapping.
+ **/
+struct nltd_ring_setup
+{
+	char name[NLTD_MAX_NAME];
+
+	//The amount of entries (power of 2)
+	__u32 entries;
+
+	//The size of each data slot in bytes
+	__u32 slot_size;
+
+	__u64 size;
+}; //end struct nltd_ring_setup
+
+/**
+  * The header at the beginning of the ring mapping. The
+  * submission entries, completion entries and data slots
+  * are stored at the given offsets. The indices are counted
+  * up and used modulo entries.
+ **/
+struct nltd_ring_header
+{
+	//The kernel module adds submission entries at the
+	//tail and the plugin removes them at the head
+	__u32 sq_tail;
+	__u32 sq_head;
+
+	//The plugin adds completion entries at the tail
+	//and the kernel module removes them at the head
+	__u32 cq_tail;
+	__u32 cq_head;
+
+	__u32 entries;
+	__u32 slot_size;
+	__u32 sq_offset;
+	__u32 cq_offset;
+	__u64 data_offset;
+}; //end struct nltd_ring_header
+
+/**
+  * A request to the plugin. The data of the request
+  * is stored in the given data slot.
+ **/
+struct nltd_ring_sqe
+{
+	__u64 offset;
+	__u32 request_number;
+	__u32 length;
+	__u32 slot;
+
+	//NLTD_CMD_READ, NLTD_CMD_WRITE or NLTD_CMD_SIZE
+	__u32 cmd;
+}; //end struct nltd_ring_sqe
+
+/**
+  * The answer of a request. The data of a read or size
+  * request is stored in the data slot of the request.
+ **/
+struct nltd_ring_cqe
+{
+	__u32 request_number;
+	__s32 ret;
+	__u32 length;
+	__u32 slot;
+}; //end struct nltd_ring_cqe
+
 #endif //TDISK_INTERFACE_H
@@ -8,6 +8,7 @@
 #include <tdisk/config.h>
 #include "helpers.h"
 #include "tdisk.h"
+#include "tdisk_compress.h"
 #include "tdisk_control.h"
 #include "tdisk_device_operations.h"
 #include "tdisk_performance.h"
@@ -17,6 +18,82 @@
 #define DEFAULT_WORKER_TIMEOUT (HZ)
 #define DEFAULT_SECONDARY_WORK_DELAY 2
 
+/**
+  * The time window in which newly used sectors are counted
+  * to calculate the cache reserve
+ **/
+#define CACHE_RESERVE_WINDOW (60*HZ)
+
+/**
+  * The highest amount of newly used sectors per window decays
+  * by 1/2^CACHE_RESERVE_DECAY_SHIFT every window
+ **/
+#define CACHE_RESERVE_DECAY_SHIFT 3
+
+/**
+  * The cache reserve is a multiple of the highest amount
+  * of newly used sectors per window
+ **/
+#define CACHE_RESERVE_HEADROOM 2
+
+/**
+  * The counters of the heat sketch are halved in this
+  * interval so that old accesses lose their weight
+ **/
+#define SKETCH_AGING_INTERVAL (600*HZ)
+
+/**
+  * The accessed regions of all blocks are forgotten in this
+  * interval so that the regions reflect the current accesses
+ **/
+#define REGIONS_AGING_INTERVAL (600*HZ)
+
+/**
+  * The amount of pages of the read cache (must be a power of 2)
+ **/
+#define READ_CACHE_SHIFT 10
+#define READ_CACHE_ENTRIES (1 << READ_CACHE_SHIFT)
+
+/**
+  * The minimum access count of a block before its
+  * pages are stored in the read cache
+ **/
+#define READ_CACHE_MIN_ACCESS_COUNT 4
+
+/**
+  * The heat which is added to the access count of a sector
+  * for each access, depending on the I/O priority class of
+  * the request. Idle requests don't make a sector hotter
+ **/
+#define HEAT_WEIGHT_RT 4
+#define HEAT_WEIGHT_BE 1
+#define HEAT_WEIGHT_IDLE 0
+
+/**
+  * The bytes which can be moved per interval on a physical
+  * disk which is shared by several internal devices
+ **/
+#define MIGRATION_BUDGET_BYTES (32*1024*1024)
+#define MIGRATION_BUDGET_INTERVAL (HZ)
+
+/**
+  * A tDisk keeps the right to move sectors on a shared disk
+  * as long as it tries to move sectors within this time
+ **/
+#define MIGRATION_CLAIM_TIMEOUT (HZ/2)
+
+/**
+  * The interval in which the changed sector indices are
+  * written to the internal devices (@see td_write_heat_snapshot)
+ **/
+#define HEAT_SNAPSHOT_INTERVAL (300*HZ)
+
+/**
+  * The maximum amount of sector indices which are
+  * written to an internal device in one operation
+ **/
+#define INDEX_WRITE_ENTRIES (4*TDISK_INDEX_PAGE_ENTRIES)
+
 /**
   * Actual internal device calculated using memory offset
  **/
@@ -27,30 +104,85 @@
  **/
 #define SECTOR_USED(sector) ((sector) & 1)
 
+/**
+  * The flag of the access count which marks a sector which is
+  * staged in the write back cache. For a cache sector it means
+  * that it holds the original location of a staged sector
+ **/
+#define SECTOR_STAGED_FLAG 0x8000
+
+/**
+  * The flag of the access count which marks a sector whose
+  * block is stored compressed. It belongs to the physical
+  * location and needs to be moved together with it
+ **/
+#define SECTOR_COMPRESSED_FLAG 0x4000
+
+/**
+  * The flags of the access count
+ **/
+#define SECTOR_FLAGS (SECTOR_STAGED_FLAG | SECTOR_COMPRESSED_FLAG)
+
+/**
+  * The highest access count which can be stored
+ **/
+#define MAX_ACCESS_COUNT (SECTOR_COMPRESSED_FLAG/2 - 1)
+
+/**
+  * Checks whether the sector is staged given the access count
+ **/
+#define SECTOR_STAGED(sector) ((sector) & SECTOR_STAGED_FLAG)
+
+/**
+  * Sets the given sector to be staged
+ **/
+#define SET_STAGED_SECTOR(sector) sector = (typeof(sector))((sector) | SECTOR_STAGED_FLAG)
+
+/**
+  * Sets the given sector to be not staged
+ **/
+#define SET_UNSTAGED_SECTOR(sector) sector = (typeof(sector))((sector) & ~SECTOR_STAGED_FLAG)
+
+/**
+  * Checks whether the block of the sector is stored
+  * compressed given the access count
+ **/
+#define SECTOR_COMPRESSED(sector) (((sector) & SECTOR_COMPRESSED_FLAG) != 0)
+
+/**
+  * Sets whether the block of the given sector is stored compressed
+ **/
+#define SET_COMPRESSED_SECTOR(sector, compressed) sector = (typeof(sector))(((sector) & ~SECTOR_COMPRESSED_FLAG) | ((compressed) ? SECTOR_COMPRESSED_FLAG : 0))
+
 /**
   * Increments the access count
  **/
-#define INC_ACCESS_COUNT(sector) (sector) = (typeof(sector))(((((sector)>>1)+1)<<1) | 1)
+#define INC_ACCESS_COUNT(sector) (sector) = (typeof(sector))(((sector) & SECTOR_FLAGS) | (((ACCESS_COUNT(sector)+1)<<1) | 1))
 
 /**
   * Gets the access count of the sector
  **/
-#define ACCESS_COUNT(sector) ((sector)>>1)
+#define ACCESS_COUNT(sector) (((sector) & ~SECTOR_FLAGS)>>1)
 
 /**
   * Resets the access count of the sector
  **/
-#define RESET_ACCESS_COUNT(sector) sector = (sector) & 1
+#define RESET_ACCESS_COUNT(sector) sector = (typeof(sector))((sector) & (SECTOR_FLAGS | 1))
 
 /**
   * Sets the given sector to be unused
  **/
 #define SET_UNUSED_SECTOR(sector) sector = (sector) & ~1
 
+/**
+  * Sets the given sector to be used
+ **/
+#define SET_USED_SECTOR(sector) sector = (typeof(sector))((sector) | 1)
+
 /**
   * Sets the access count of the given sector
  **/
-#define SET_ACCESS_COUNT(sector, count) sector = (typeof(sector))(((sector) & 1) | ((count)<<1))
+#define SET_ACCESS_COUNT(sector, count) sector = (typeof(sector))(((sector) & (SECTOR_FLAGS | 1)) | ((count)<<1))
 
 #ifndef MIN_NICE
 #define MIN_NICE 20
@@ -79,6 +211,13 @@ MODULE_ALIAS_BLOCKDEV_MAJOR(TD_MAJOR);
 
 DEFINE_IDR(td_index_idr);
 
+#ifdef USE_MIGRATION_BUDGET
+static DEFINE_SPINLOCK(td_migration_lock);
+static struct td_migration_budget td_migration_budgets[TDISK_MAX_MIGRATION_BUDGETS];
+#else
+#pragma message "Migration budget is disabled"
+#endif //USE_MIGRATION_BUDGET
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,8,0)
 #define REQ_FLUSH REQ_OP_FLUSH
 #define REQ_READ REQ_OP_READ
@@ -118,8 +257,81 @@ static int td_flush(struct tdisk *td)
 	return err;
 }
 
+#ifdef USE_PERF_COUNTERS
+
+/**
+  * Returns the bucket of the latency histograms for the
+  * time which elapsed since the given start time
+  * (@see TDISK_LATENCY_BUCKETS)
+ **/
+static unsigned int td_latency_bucket(const struct timespec *start)
+{
+	struct timespec end;
+	__s64 ns;
+
+	getnstimeofday(&end);
+	ns = (__s64)(end.tv_sec - start->tv_sec) * NSEC_PER_SEC + (end.tv_nsec - start->tv_nsec);
+	if(ns < NSEC_PER_USEC)return 0;
+
+	return min_t(unsigned int, fls64(__div64_32_nomod((__u64)ns, NSEC_PER_USEC)), TDISK_LATENCY_BUCKETS - 1);
+}
+
+/**
+  * Counts a block access which was served by the given
+  * internal device and was started at the given time
+ **/
+inline static void td_count_device_access(struct td_internal_device *device, const struct timespec *start)
+{
+	struct tdisk_device_stats *stats;
+
+	if(!device->stats)return;
+
+	stats = &device->stats[get_cpu()];
+	stats->hits++;
+	stats->latency_histogram[td_latency_bucket(start)]++;
+	put_cpu();
+}
+
+/**
+  * Returns the performance counters of the current CPU.
+  * put_cpu needs to be called after they were updated
+ **/
+inline static struct td_counters* td_get_cpu_counters(struct tdisk *td)
+{
+	return &td->counters[get_cpu()];
+}
+
+/**
+  * Counts a block which was moved to another internal device
+ **/
+inline static void td_count_migration(struct tdisk *td, __u64 bytes)
+{
+	struct td_counters *counters = td_get_cpu_counters(td);
+
+	counters->migrations++;
+	counters->migrated_bytes += bytes;
+	put_cpu();
+}
+
+#else
+#pragma message "Performance counters are disabled"
+#endif //USE_PERF_COUNTERS
+
+/**
+  * Returns the trace record type of an access to the given
+  * internal device
+ **/
+inline static __u8 td_device_trace_type(const struct td_internal_device *device)
+{
+	if(device->type == internal_device_type_plugin)return TDISK_TRACE_PLUGIN_ROUND_TRIP;
+	return TDISK_TRACE_DEVICE_IO;
+}
+
 /**
-  * Flushes the underlying devices of the tDisk
+  * Flushes the underlying devices of the tDisk. Only devices
+  * which were written since their last flush are flushed.
+  * The writeback of all of them is started first so that they
+  * are written concurrently. Afterwards they are waited for.
  **/
 static int td_flush_devices(struct tdisk *td)
 {
@@ -128,37 +340,147 @@ static int td_flush_devices(struct tdisk *td)
 
 	for(i = 0; i < td->internal_devices_count; ++i)
 	{
-		int internal_ret = flush_device(&td->internal_devices[i]);
+		if(td->internal_devices[i].dirty)
+			start_flush_device(&td->internal_devices[i]);
+	}
+
+	for(i = 0; i < td->internal_devices_count; ++i)
+	{
+		int internal_ret;
+
+		if(!td->internal_devices[i].dirty)continue;
+		td->internal_devices[i].dirty = false;
+
+		internal_ret = flush_device(&td->internal_devices[i]);
 
 		if(unlikely(internal_ret && internal_ret != -EINVAL))
+		{
+			td->internal_devices[i].dirty = true;
 			ret = -EIO;
+		}
 	}
 
 	return ret;
 }
 
 /**
-  * Writes all the sector indices to the device.
+  * Writes the sector indices of the given range of logical
+  * sectors to the device. Up to INDEX_WRITE_ENTRIES indices
+  * are written in one operation.
  **/
-static int td_write_all_indices(struct tdisk *td, struct td_internal_device *device)
+static int td_write_index_range(struct tdisk *td, struct td_internal_device *device, sector_t logical_sector, sector_t length_sectors)
 {
 	int ret = 0;
+	struct disk_sector_index *buffer;
+
+	//A single index can be written directly because the
+	//memory layout matches the disk layout up to the disk
+	BUILD_BUG_ON(offsetof(struct sector_index, disk) != offsetof(struct disk_sector_index, disk));
+	if(length_sectors == 1)
+	{
+		loff_t position = td->index_offset_byte + (loff_t)logical_sector * (loff_t)sizeof(struct disk_sector_index);
+		return write_data(device, td_index(td, logical_sector), position, sizeof(struct disk_sector_index));
+	}
+
+	buffer = kmalloc(sizeof(struct disk_sector_index) * INDEX_WRITE_ENTRIES, GFP_NOIO);
+	if(!buffer)return -ENOMEM;
+
+	while(length_sectors != 0 && !ret)
+	{
+		sector_t i = 0;
+		sector_t current_length = min_t(sector_t, length_sectors, INDEX_WRITE_ENTRIES);
+		loff_t position = td->index_offset_byte + (loff_t)logical_sector * (loff_t)sizeof(struct disk_sector_index);
+
+		//The indices are copied page by page
+		while(i < current_length)
+		{
+			sector_t j;
+			sector_t page_offset = (logical_sector + i) & (TDISK_INDEX_PAGE_ENTRIES - 1);
+			sector_t page_length = min_t(sector_t, current_length - i, TDISK_INDEX_PAGE_ENTRIES - page_offset);
+			const struct sector_index *page = td_index_page(td, logical_sector + i);
+
+			//Pages which were never used only contain unused indices
+			if(!page)
+			{
+				memset(&buffer[i], 0, (size_t)(sizeof(struct disk_sector_index) * page_length));
+				i += page_length;
+				continue;
+			}
+
+			for(j = 0; j < page_length; ++j, ++i)
+			{
+				buffer[i].sector = page[page_offset + j].sector;
+				buffer[i].access_count = page[page_offset + j].access_count;
+				buffer[i].disk = page[page_offset + j].disk;
+			}
+		}
 
-	loff_t skip = sizeof(struct tdisk_header);
-	void *data = td->indices;
-	loff_t length = td->header_size*td->blocksize - skip;
-	unsigned int u_length = (unsigned int)length;
+		ret = write_data(device, buffer, position, (unsigned int)(current_length * sizeof(struct disk_sector_index)));
 
-	//Header too big
-	//BUG_ON(length != u_length);
+		logical_sector += current_length;
+		length_sectors -= current_length;
+	}
+
+	kfree(buffer);
+
+	return ret;
+}
 
-	ret = write_data(device, data, skip, u_length);
+/**
+  * Writes all the sector indices to the device.
+ **/
+static int td_write_all_indices(struct tdisk *td, struct td_internal_device *device)
+{
+	int ret = td_write_index_range(td, device, 0, td->max_sectors);
 
-	if(ret)printk(KERN_ERR "tDisk: Error writing all disk indices: %d. Offset: %llu, length: %llu\n", ret, skip, length);
+	if(ret)printk(KERN_ERR "tDisk: Error writing all disk indices: %d. Sectors: %llu\n", ret, td->max_sectors);
 
 	return ret;
 }
 
+#ifdef USE_HEAT_SNAPSHOT
+
+/**
+  * Marks the heat of the given logical sector as changed
+  * so that it is written with the next heat snapshot
+ **/
+inline static void td_mark_heat_dirty(struct tdisk *td, sector_t logical_sector)
+{
+	unsigned long chunk = (unsigned long)(logical_sector >> td->heat_snapshot_shift);
+
+	//Most of the time the chunk is already marked
+	if(!test_bit(chunk, td->heat_snapshot_dirty))
+		set_bit(chunk, td->heat_snapshot_dirty);
+}
+
+/**
+  * Adapts the chunk size of the heat snapshot to the current
+  * max_sectors. Chunks which were marked before stay marked
+ **/
+static void td_resize_heat_snapshot(struct tdisk *td)
+{
+	unsigned long chunk;
+	unsigned int old_shift = td->heat_snapshot_shift;
+	unsigned int shift = ilog2(INDEX_WRITE_ENTRIES);
+
+	while((td->max_sectors >> shift) >= TDISK_HEAT_SNAPSHOT_CHUNKS)
+		++shift;
+
+	td->heat_snapshot_shift = shift;
+	if(shift <= old_shift)return;
+
+	//The marked chunks are merged into the bigger chunks
+	for_each_set_bit(chunk, td->heat_snapshot_dirty, TDISK_HEAT_SNAPSHOT_CHUNKS)
+	{
+		clear_bit(chunk, td->heat_snapshot_dirty);
+		set_bit(chunk >> (shift - old_shift), td->heat_snapshot_dirty);
+	}
+}
+
+#else
+#pragma message "Heat snapshot is disabled"
+#endif //USE_HEAT_SNAPSHOT
+
 #ifdef AUTO_RESET_ACCESS_COUNT
 
 /**
@@ -174,8 +496,8 @@ static void reset_access_count(struct tdisk *td, bool do_disk_operation)
 	//Find lowest access count
 	for(sector = 0; sector < td->size_blocks; ++sector)
 	{
-		if(ACCESS_COUNT(td->indices[sector].access_count) < min_access_count)
-			min_access_count = ACCESS_COUNT(td->indices[sector].access_count);
+		if(ACCESS_COUNT(td_peek_index(td, sector)->access_count) < min_access_count)
+			min_access_count = ACCESS_COUNT(td_peek_index(td, sector)->access_count);
 	}
 
 	//Needs to be at least 2
@@ -184,7 +506,8 @@ static void reset_access_count(struct tdisk *td, bool do_disk_operation)
 	//Divide all sector access count by lowest access count
 	for(sector = 0; sector < td->size_blocks; ++sector)
 	{
-		SET_ACCESS_COUNT(td->indices[sector].access_count, ACCESS_COUNT(td->indices[sector].access_count) / min_access_count);
+		if(!td_index_page(td, sector))continue;
+		SET_ACCESS_COUNT(td_index(td, sector)->access_count, ACCESS_COUNT(td_index(td, sector)->access_count) / min_access_count);
 	}
 
 	if(do_disk_operation)
@@ -195,6 +518,13 @@ static void reset_access_count(struct tdisk *td, bool do_disk_operation)
 			td_write_all_indices(td, &td->internal_devices[disk-1]);
 		}
 	}
+#ifdef USE_HEAT_SNAPSHOT
+	else
+	{
+		//The new access counts are stored by the next snapshot
+		bitmap_fill(td->heat_snapshot_dirty, TDISK_HEAT_SNAPSHOT_CHUNKS);
+	}
+#endif //USE_HEAT_SNAPSHOT
 }
 
 #else
@@ -202,992 +532,2905 @@ static void reset_access_count(struct tdisk *td, bool do_disk_operation)
 #endif //AUTO_RESET_ACCESS_COUNT
 
 /**
-  * Writes the given sector index to the given internal device
+  * Writes the sector indices of a range of logically
+  * consecutive sectors to the given internal device using
+  * one single write operation
  **/
-int td_write_index_to_disk(struct tdisk *td, sector_t logical_sector, tdisk_index disk)
+static int td_write_indices_to_disk(struct tdisk *td, sector_t logical_sector, sector_t length_sectors, tdisk_index disk)
 {
-	struct sector_index *actual;
-	loff_t position = td->index_offset_byte + (loff_t)logical_sector * (loff_t)sizeof(struct sector_index);
-	unsigned int length = sizeof(struct sector_index);
+	if(logical_sector + length_sectors > td->max_sectors)return 1;
 
-	if(position + length > td->header_size * td->blocksize)return 1;
-	actual = &td->indices[logical_sector];
+	return td_write_index_range(td, &td->internal_devices[disk-1], logical_sector, length_sectors);
+}
 
-	return write_data(&td->internal_devices[disk-1], actual, position, length);
+/**
+  * Writes the given sector index to the given internal device
+ **/
+int td_write_index_to_disk(struct tdisk *td, sector_t logical_sector, tdisk_index disk)
+{
+	return td_write_indices_to_disk(td, logical_sector, 1, disk);
 }
 
 /**
-  * Performs the given index operation. This can be:
-  *  - READ: reads the physical sector index for the given logical sector
-  *  - WRITE: stores the given physical sector index for the given logical
-  *    sector. The data are also stored to each physical disk
-  *  - COMPARE: Compares the given physical sector index with the actual one.
-  *    This is useful to compare individual disks for consistency.
-  * The flag do_disk_operation can be used to define whether the data
-  * should be written or not. Usually it is a good idea to write the data
-  * immediately to disk to prevent data loss, but in case there are multiple
-  * index operations to write it is better to write them all at once.
-  * The flag update_access_count can be used to define whether the access
-  * count of the specific sector should be updated. This is useful e.g. when
-  * sectors are moved - this shouldn't influence the access count variable.
-  * If the operation is READ, then the access_count of the sector is retured
-  * as it was before the operation. e.g. if the sector was unused, the sector
-  * is set to be used but the original value (unused) is retuned.
+  * Atomically adds the given heat to the access count of the
+  * given sector index and marks the sector as used. The access
+  * count saturates at its maximum value. The compare and exchange
+  * covers the disk as well, so a concurrent change of the disk
+  * is never overwritten. Returns the new access count.
  **/
-int td_perform_index_operation(struct tdisk *td, int direction, sector_t logical_sector, struct sector_index *physical_sector, bool do_disk_operation, bool update_access_count)
+inline static __u16 td_inc_access_count(struct sector_index *index, unsigned int heat)
 {
-	int ret = 0;
-	struct sector_index *actual;
-	loff_t position = td->index_offset_byte + (loff_t)logical_sector * (loff_t)sizeof(struct sector_index);
-	unsigned int length = sizeof(struct sector_index);
+	struct sector_index old_index;
+	struct sector_index new_index;
 
-	if(position + length > td->header_size * td->blocksize)return 1;
-	actual = &td->indices[logical_sector];
+	do
+	{
+		__u32 access_count;
+
+		old_index.state = READ_ONCE(index->state);
+		new_index.state = old_index.state;
+		access_count = ACCESS_COUNT(new_index.access_count) + heat;
+		if(access_count > MAX_ACCESS_COUNT)access_count = MAX_ACCESS_COUNT;
+		SET_ACCESS_COUNT(new_index.access_count, access_count);
+		SET_USED_SECTOR(new_index.access_count);
+	}
+	while(cmpxchg(&index->state, old_index.state, new_index.state) != old_index.state);
 
-	//MY_BUG_ON(direction == WRITE && physical_sector->disk == 0, PRINT_INT(physical_sector->disk), PRINT_ULL(logical_sector));
-	MY_BUG_ON(direction == READ && actual->disk == 0, PRINT_INT(actual->disk), PRINT_ULL(logical_sector));
+	return new_index.access_count;
+}
 
-	//index operation
-	if(direction == READ)
-		(*physical_sector) = (*actual);
-	else if(direction == COMPARE)
+/**
+  * Resets the access count of all sectors if the
+  * given access count is about to overflow
+ **/
+inline static void td_check_access_count(struct tdisk *td, __u16 access_count, bool do_disk_operation)
+{
+#ifdef AUTO_RESET_ACCESS_COUNT
+	//printk_ratelimited(KERN_DEBUG "tDisk: access count: %u max: %u\n", access_count, (typeof(access_count))-1);
+	if(ACCESS_COUNT(access_count) == MAX_ACCESS_COUNT)
 	{
-		if(physical_sector->disk != actual->disk || physical_sector->sector != actual->sector)
-			ret = -1;
+		printk(KERN_DEBUG "tDisk: Resetting tDisk access count\n");
+		reset_access_count(td, do_disk_operation);
 	}
-	else if(direction == WRITE)
-	{
-		tdisk_index disk;
+#else
+#pragma message "Reset auto access count is disabled"
+#endif //AUTO_RESET_ACCESS_COUNT
+}
 
-		//Memory operation
-		actual->disk = physical_sector->disk;
-		actual->sector = physical_sector->sector;
+#ifdef USE_PERCPU_HEAT
 
-		//Disk operations
-		if(do_disk_operation)
-		{
-			for(disk = 1; disk <= td->internal_devices_count; ++disk)
-			{
-				td_write_index_to_disk(td, logical_sector, disk);
-			}
-		}
-	}
+/**
+  * Atomically adds the given amount of accesses to the
+  * access count of the given sector index. The access count
+  * saturates at its maximum value. Unused sectors (e.g. which
+  * were discarded meanwhile) are not changed.
+  * Returns the new access count.
+ **/
+inline static __u16 td_add_access_count(struct sector_index *index, __u32 delta)
+{
+	struct sector_index old_index;
+	struct sector_index new_index;
 
-	//Increment access count
-	if(update_access_count)
+	do
 	{
-		INC_ACCESS_COUNT(actual->access_count);
+		__u32 access_count;
 
-#ifdef AUTO_RESET_ACCESS_COUNT
-		//printk_ratelimited(KERN_DEBUG "tDisk: access count: %u max: %u\n", actual->access_count, (typeof(actual->access_count))-1);
-		if(ACCESS_COUNT(actual->access_count) == (((typeof(actual->access_count))-1)>>1))
-		{
-			printk(KERN_DEBUG "tDisk: Resetting tDisk access count\n");
-			reset_access_count(td, do_disk_operation);
-		}
-#else
-#pragma message "Reset auto access count is disabled"
-#endif //AUTO_RESET_ACCESS_COUNT
+		old_index.state = READ_ONCE(index->state);
+		if(!SECTOR_USED(old_index.access_count))return old_index.access_count;
+
+		new_index.state = old_index.state;
+		access_count = ACCESS_COUNT(new_index.access_count) + delta;
+		if(access_count > MAX_ACCESS_COUNT)access_count = MAX_ACCESS_COUNT;
+		SET_ACCESS_COUNT(new_index.access_count, access_count);
 	}
+	while(cmpxchg(&index->state, old_index.state, new_index.state) != old_index.state);
 
-	return ret;
+	return new_index.access_count;
 }
 
 /**
-  * This is the heuristic function that calculates the
-  * speed of a device
+  * Adds the buffered accesses of the given heat slot to
+  * the sector index and frees the slot.
+  * Returns the new access count of the sector.
  **/
-inline static unsigned long long td_get_device_performance(const struct td_internal_device *d)
+static __u16 td_fold_heat_slot(struct tdisk *td, struct td_heat_slot *slot)
 {
-	return (d->performance.avg_read_time_cycles + d->performance.avg_write_time_cycles) >> 1;
+	sector_t logical_sector = (sector_t)slot->sector - 1;
+	__u32 delta = slot->delta;
+
+	slot->sector = 0;
+	slot->delta = 0;
+
+	if(logical_sector >= td->max_sectors)return 0;
+
+#ifdef USE_HEAT_SNAPSHOT
+	td_mark_heat_dirty(td, logical_sector);
+#endif //USE_HEAT_SNAPSHOT
+
+	return td_add_access_count(td_index(td, logical_sector), delta);
 }
 
 /**
-  * This function physically swaps the two given sectors.
-  * This means it reads the data of both sectors, stores
-  * sector a in sector b and vice versa and updates the
-  * indices
+  * Buffers the heat of an access of the given used sector in
+  * the heat buffer of the current CPU. If the slot is used by another
+  * sector its buffered accesses are added to the index first.
+  * Returns the new access count of that sector or 0.
  **/
-static bool td_swap_sectors(struct tdisk *td, sector_t logical_a, struct sector_index *a, sector_t logical_b, struct sector_index *b, bool do_disk_operation)
+static __u16 td_buffer_heat(struct tdisk *td, sector_t logical_sector, unsigned int heat)
 {
-	int ret;
-	loff_t pos_a;
-	loff_t pos_b;
-	loff_t pos_help_a;
-	loff_t pos_help_b;
-	tdisk_index disk_a;
-	tdisk_index disk_b;
-	sector_t sector_b;
-	sector_t sector_a;
-	u16 access_count_a;
-	u16 access_count_b;
-	u8 *buffer_a;
-	u8 *buffer_b;
+	struct td_heat_buffer *buffer = &td->heat_buffers[get_cpu()];
+	struct td_heat_slot *slot = &buffer->slots[hash_32((__u32)logical_sector, TDISK_HEAT_SLOTS_SHIFT)];
+	__u16 access_count = 0;
 
-	//Swap sectors in case disk b is better. This speeds up the swapping process
-	if(td_get_device_performance(&td->internal_devices[a->disk-1]) > td_get_device_performance(&td->internal_devices[b->disk-1]))
+	if(slot->sector == (__u32)(logical_sector + 1))
+		slot->delta += heat;
+	else
 	{
-		swap(a, b);
-		swap(logical_a, logical_b);
+		if(slot->sector != 0)
+			access_count = td_fold_heat_slot(td, slot);
+
+		slot->sector = (__u32)(logical_sector + 1);
+		slot->delta = heat;
 	}
 
-	disk_a = a->disk;
-	disk_b = b->disk;
-	sector_b = b->sector;
-	sector_a = a->sector;
-	access_count_a = a->access_count;
-	access_count_b = b->access_count;
-	pos_a = (loff_t)a->sector * td->blocksize;
-	pos_b = (loff_t)b->sector * td->blocksize;
-	pos_help_a = (loff_t)td->internal_devices[disk_a-1].move_help_sector * td->blocksize;
-	pos_help_b = (loff_t)td->internal_devices[disk_b-1].move_help_sector * td->blocksize;
+	put_cpu();
 
-	buffer_a = vmalloc(td->blocksize);
-	if(!buffer_a)return false;
+	return access_count;
+}
 
-	buffer_b = vmalloc(td->blocksize);
-	if(!buffer_b)
+/**
+  * Adds the buffered accesses of all CPUs to the sector indices.
+  * The heat buffers of the other CPUs are accessed without
+  * locking. This is fine because the accesses are only buffered
+  * by the worker thread which also calls this function.
+ **/
+static void td_fold_heat(struct tdisk *td)
+{
+	int cpu;
+	unsigned int i;
+
+	for_each_possible_cpu(cpu)
 	{
-		vfree(buffer_a);
-		return false;
+		struct td_heat_buffer *buffer = &td->heat_buffers[cpu];
+
+		for(i = 0; i < TDISK_HEAT_SLOTS; ++i)
+		{
+			if(buffer->slots[i].sector != 0)
+				td_check_access_count(td, td_fold_heat_slot(td, &buffer->slots[i]), true);
+		}
 	}
+}
 
-	//Count optimized bytes
-	td->bytes_optimized += td->blocksize;
+/**
+  * Drops the buffered accesses of all CPUs
+ **/
+static void td_drop_heat(struct tdisk *td)
+{
+	memset(td->heat_buffers, 0, sizeof(struct td_heat_buffer) * nr_cpu_ids);
+}
 
-	//Reading blocks from both disks
-	ret = read_data(&td->internal_devices[disk_a-1], buffer_a, pos_a, td->blocksize);		//a read op1
-	td->internal_devices[disk_a-1].bytes_read -= td->blocksize;
-	if(ret != 0)
+#else
+#pragma message "Per-CPU heat is disabled"
+#endif //USE_PERCPU_HEAT
+
+/**
+  * Counts an access of the given sector in the heat sketch.
+  * Conservative update is used: only the counters which hold
+  * the current estimate are incremented. This keeps the
+  * overestimation of cold sectors low.
+  * Returns true if the sector is a candidate hot sector.
+ **/
+static bool td_sketch_add(struct td_heat_sketch *sketch, sector_t logical_sector)
+{
+	unsigned int row;
+	unsigned int columns[TDISK_SKETCH_DEPTH];
+	__u16 estimate = (__u16)-1;
+
+	for(row = 0; row < TDISK_SKETCH_DEPTH; ++row)
 	{
-		printk(KERN_WARNING "tDisk: Swap error: reading %llu, disk: %u, ret: %d\n", logical_a, disk_a, ret);
-		goto out;
+		columns[row] = jhash_1word((__u32)logical_sector, row) & (TDISK_SKETCH_WIDTH - 1);
+		estimate = min(estimate, sketch->counters[row][columns[row]]);
 	}
 
-	ret = read_data(&td->internal_devices[disk_b-1], buffer_b, pos_b, td->blocksize);		//b read op1
-	td->internal_devices[disk_b-1].bytes_read -= td->blocksize;
-	if(ret != 0)
+	if(estimate != (__u16)-1)
 	{
-		printk(KERN_WARNING "tDisk: Swap error: reading %llu, disk: %u, ret: %d\n", logical_b, disk_b, ret);
-		goto out;
+		for(row = 0; row < TDISK_SKETCH_DEPTH; ++row)
+		{
+			if(sketch->counters[row][columns[row]] == estimate)
+				sketch->counters[row][columns[row]]++;
+		}
+
+		estimate++;
 	}
 
+	return (estimate >= TDISK_SKETCH_HOT_THRESHOLD);
+}
 
+/**
+  * Halves all counters of the heat sketch if the
+  * aging interval is over
+ **/
+static void td_sketch_age(struct td_heat_sketch *sketch)
+{
+	unsigned int row;
+	unsigned int column;
 
-	ret = write_data(&td->internal_devices[disk_a-1], buffer_a, pos_help_a, td->blocksize);
-	td->internal_devices[disk_a-1].bytes_written -= td->blocksize;
-	if(ret != 0)
+	if(time_before(jiffies, sketch->aging_start + SKETCH_AGING_INTERVAL))return;
+
+	for(row = 0; row < TDISK_SKETCH_DEPTH; ++row)
 	{
-		printk(KERN_WARNING "tDisk: Swap-help error: writing %llu, disk: %u, ret: %d\n", logical_a, disk_a, ret);
-		goto out;
+		for(column = 0; column < TDISK_SKETCH_WIDTH; ++column)
+			sketch->counters[row][column] >>= 1;
 	}
 
-	a->disk = disk_a;
-	a->access_count = access_count_a;
-	a->sector = td->internal_devices[disk_a-1].move_help_sector;
-	td_perform_index_operation(td, WRITE, logical_a, a, do_disk_operation, false);
+	sketch->aging_start = jiffies;
+}
 
-	ret = write_data(&td->internal_devices[disk_a-1], buffer_b, pos_a, td->blocksize);
-	td->internal_devices[disk_a-1].bytes_written -= td->blocksize;
-	if(ret != 0)
+/**
+  * Performs the given index operation. This can be:
+  *  - READ: reads the physical sector index for the given logical sector
+  *  - WRITE: stores the given physical sector index for the given logical
+  *    sector. The data are also stored to each physical disk
+  *  - COMPARE: Compares the given physical sector index with the actual one.
+  *    This is useful to compare individual disks for consistency.
+  * The flag do_disk_operation can be used to define whether the data
+  * should be written or not. Usually it is a good idea to write the data
+  * immediately to disk to prevent data loss, but in case there are multiple
+  * index operations to write it is better to write them all at once.
+  * The flag update_access_count can be used to define whether the access
+  * count of the specific sector should be updated. This is useful e.g. when
+  * sectors are moved - this shouldn't influence the access count variable.
+  * heat is the amount which is added to the access count in this case
+  * (@see td_request_heat). The sector is marked as used even if it is 0.
+  * If the operation is READ, then the access_count of the sector is retured
+  * as it was before the operation. e.g. if the sector was unused, the sector
+  * is set to be used but the original value (unused) is retuned.
+ **/
+int td_perform_index_operation(struct tdisk *td, int direction, sector_t logical_sector, struct sector_index *physical_sector, bool do_disk_operation, bool update_access_count, unsigned int heat)
+{
+	int ret = 0;
+	struct sector_index *actual;
+
+	if(logical_sector >= td->max_sectors)return 1;
+
+	actual = td_index(td, logical_sector);
+
+	//MY_BUG_ON(direction == WRITE && physical_sector->disk == 0, PRINT_INT(physical_sector->disk), PRINT_ULL(logical_sector));
+	MY_BUG_ON(direction == READ && actual->disk == 0, PRINT_INT(actual->disk), PRINT_ULL(logical_sector));
+
+	//index operation
+	if(direction == READ)
+		(*physical_sector) = (*actual);
+	else if(direction == COMPARE)
 	{
-		printk(KERN_WARNING "tDisk: Swap error: writing %llu, disk: %u, ret: %d\n", logical_a, disk_a, ret);
-		goto out;
+		if(physical_sector->disk != actual->disk || physical_sector->sector != actual->sector)
+			ret = -1;
 	}
+	else if(direction == WRITE)
+	{
+		tdisk_index disk;
 
-	b->disk = disk_a;
-	b->access_count = access_count_b;
-	b->sector = sector_a;
-	td_perform_index_operation(td, WRITE, logical_b, b, do_disk_operation, false);
+		//Memory operation
+		actual->disk = physical_sector->disk;
+		actual->sector = physical_sector->sector;
 
-	ret = write_data(&td->internal_devices[disk_b-1], buffer_a, pos_b, td->blocksize);
-	td->internal_devices[disk_b-1].bytes_written -= td->blocksize;
-	if(ret != 0)
-	{
-		printk(KERN_WARNING "tDisk: Swap error: writing %llu, disk: %u, ret: %d\n", logical_b, disk_b, ret);
-		goto out;
+		//Disk operations
+		if(do_disk_operation)
+		{
+			for(disk = 1; disk <= td->internal_devices_count; ++disk)
+			{
+				td_write_index_to_disk(td, logical_sector, disk);
+			}
+		}
 	}
 
-	a->disk = disk_b;
-	a->access_count = access_count_a;
-	a->sector = sector_b;
-	td_perform_index_operation(td, WRITE, logical_a, a, do_disk_operation, false);
+	//Increment access count
+	if(update_access_count)
+	{
+		__u16 access_count;
+		bool count_exactly = true;
 
- out:
-	vfree(buffer_a);
-	vfree(buffer_b);
+		//Using the heat sketch, only the accesses of
+		//candidate hot sectors are counted in the index
+		if(td->heat_sketch && heat != 0)
+			count_exactly = td_sketch_add(td->heat_sketch, logical_sector);
 
-	return (ret != 0);
-}
+		//The first access marks the sector as used which
+		//needs to be visible immediately
+		if(!SECTOR_USED(READ_ONCE(actual->access_count)))
+		{
+			access_count = td_inc_access_count(actual, heat);
+#ifdef USE_HEAT_SNAPSHOT
+			td_mark_heat_dirty(td, logical_sector);
+#endif //USE_HEAT_SNAPSHOT
+		}
+		else if(!count_exactly || heat == 0)
+			access_count = 0;
+		else
+		{
+#ifdef USE_PERCPU_HEAT
+			//All further accesses are buffered and
+			//added to the index by the optimizer
+			access_count = td_buffer_heat(td, logical_sector, heat);
+#else
+			access_count = td_inc_access_count(actual, heat);
+#ifdef USE_HEAT_SNAPSHOT
+			td_mark_heat_dirty(td, logical_sector);
+#endif //USE_HEAT_SNAPSHOT
+#endif //USE_PERCPU_HEAT
+		}
 
-#ifdef MOVE_SECTORS
+		td_check_access_count(td, access_count, do_disk_operation);
+	}
+
+	return ret;
+}
 
 /**
-  * This is the callback which is used to sort the
-  * devices according to its performance
+  * This is the heuristic function that calculates the
+  * speed of a device
  **/
-static int td_sort_devices_callback(const void *a, const void *b)
+inline static unsigned long long td_get_device_performance(const struct td_internal_device *d)
 {
-	const struct sorted_internal_device *d_a = a;
-	const struct sorted_internal_device *d_b = b;
-
-	unsigned long long performance_a = td_get_device_performance(d_a->dev);
-	unsigned long long performance_b = td_get_device_performance(d_b->dev);
-
-	if(performance_a == performance_b)return 0;
-	else if(performance_a > performance_b)return 1;
-	else return -1;
+	return (d->performance.avg_read_time_cycles + d->performance.avg_write_time_cycles) >> 1;
 }
 
 /**
-  * Inserts the internal devices in the given array
-  * in an ordered manner
+  * Returns the tier the given logical sector is pinned
+  * to or TDISK_PIN_NONE (@see td_pin_range)
  **/
-static void td_insert_sorted_internal_devices(struct tdisk *td)
+static __u32 td_sector_pin(const struct tdisk *td, sector_t logical_sector)
 {
 	unsigned int i;
 
-	for(i = 0; i < td->internal_devices_count; ++i)
+	for(i = 0; i < td->pin_count; ++i)
 	{
-		INIT_LIST_HEAD(&td->sorted_devices[i].preferred_blocks);
-		td->sorted_devices[i].dev = &td->internal_devices[i];
-		td->sorted_devices[i].available_blocks = td->internal_devices[i].size_blocks;
-		td->sorted_devices[i].amount_blocks = 0;
+		if(logical_sector >= td->pins.pins[i].first_sector && logical_sector <= td->pins.pins[i].last_sector)
+			return td->pins.pins[i].tier;
 	}
 
-	//Sort array
-	sort(td->sorted_devices, td->internal_devices_count, sizeof(struct sorted_internal_device), &td_sort_devices_callback, NULL);
+	return TDISK_PIN_NONE;
 }
 
 /**
-  * Finds the corresponding sorted device of the given
-  * td_internal_device
+  * Checks whether the given logical sector is a cache sector
+  * which should be stored on the fastest disk
  **/
-static struct sorted_internal_device* td_find_sorted_device(struct sorted_internal_device *sorted_devices, struct td_internal_device *desired_device, unsigned int devices)
+inline static bool td_is_reserved_cache_sector(const struct tdisk *td, sector_t logical_sector)
 {
-	unsigned int i;
+#ifdef ADAPTIVE_CACHE_RESERVE
+	return (logical_sector >= td->size_blocks && logical_sector < td->size_blocks + td->reserve_sectors);
+#else
+	return (logical_sector >= td->size_blocks);
+#endif //ADAPTIVE_CACHE_RESERVE
+}
 
-	for(i = 0; i < devices; ++i)
+#ifdef ADAPTIVE_CACHE_RESERVE
+
+/**
+  * Calculates the amount of cache sectors which should be kept
+  * on the fastest disk. It is calculated using the highest
+  * amount of newly used sectors per CACHE_RESERVE_WINDOW which
+  * slowly decays. This way, the optimizer only moves as many
+  * sectors away from the fastest disk as are needed for the
+  * next expected write burst.
+ **/
+static void td_update_cache_reserve(struct tdisk *td)
+{
+	sector_t reserve;
+
+	if(time_before(jiffies, td->reserve_window_start + CACHE_RESERVE_WINDOW))return;
+	td->reserve_window_start = jiffies;
+
+	td->allocation_burst -= td->allocation_burst >> CACHE_RESERVE_DECAY_SHIFT;
+	if(td->allocated_sectors > td->allocation_burst)td->allocation_burst = td->allocated_sectors;
+	td->allocated_sectors = 0;
+
+	reserve = td->allocation_burst * CACHE_RESERVE_HEADROOM;
+	if(reserve > td->cache_sectors)reserve = td->cache_sectors;
+
+	if(reserve != td->reserve_sectors)
 	{
-		if(sorted_devices[i].dev == desired_device)
-		{
-			return &sorted_devices[i];
-		}
+		printk(KERN_DEBUG "tDisk: Cache reserve changed from %llu to %llu sectors\n", (unsigned long long)td->reserve_sectors, (unsigned long long)reserve);
+		td->reserve_sectors = reserve;
+
+		//Index needs to be resorted
+		td->access_count_resort = 0;
 	}
-	return NULL;
 }
 
 /**
-  * This function returns the sector_index in the given
-  * disk with the lowest access count.
-  * This is used when swapping a (high access) sector from a slower
-  * disk with a (lowest possible) sector from a faster disk.
-  * A sector with a lower access count has a lower probability
-  * of being moved to a faster disk in the near future.
+  * Resets the cache reserve. Until enough sectors were
+  * used, all cache sectors are reserved
  **/
-static struct sorted_sector_index* td_find_sector_index(struct sorted_internal_device *device, tdisk_index disk)
+static void td_reset_cache_reserve(struct tdisk *td)
 {
-	struct sorted_sector_index *item;
-	struct sorted_sector_index *lowest = NULL;
+	td->reserve_sectors = td->cache_sectors;
+	td->allocation_burst = td->cache_sectors;
+	td->allocated_sectors = 0;
+	td->reserve_window_start = jiffies;
+}
 
-	list_for_each_entry(item, &device->preferred_blocks, device_assigned)
-	{
-		if(item->physical_sector->disk == disk)
-		{
-			if(lowest == NULL || ACCESS_COUNT(item->physical_sector->access_count) < ACCESS_COUNT(lowest->physical_sector->access_count))
-				lowest = item;
-		}
-	}
+#else
+#pragma message "Adaptive cache reserve is disabled"
+#endif //ADAPTIVE_CACHE_RESERVE
+
+#ifdef USE_COMPRESSION
 
-	return lowest;
+/**
+  * Frees the compression buffers
+ **/
+static void td_free_compression(struct tdisk *td)
+{
+	if(td->current_block)vfree(td->current_block);
+	if(td->compress_buffer)vfree(td->compress_buffer);
+	if(td->compress_workmem)vfree(td->compress_workmem);
+
+	td->current_block = NULL;
+	td->compress_buffer = NULL;
+	td->compress_workmem = NULL;
+	td->current_block_device = NULL;
 }
 
 /**
-  * This is an optimizing function for assigning sectors
-  * properly to their devices. Obviously it is possible that
-  * two or more sectors have the same access count (or
-  * acceptable variation). So it is also possible that sector
-  * a and sector b have the same access count but are stored on
-  * the wrong disks (according to the sorting algorithm). So if
-  * they have the same access count they can simply be ignored.
+  * Allocates the compression buffers if they
+  * are not yet allocated
  **/
-static struct sorted_sector_index* td_find_sector_index_acc(struct tdisk *td, struct sorted_internal_device *device, tdisk_index disk, __u16 access_count, bool is_cache_sector, bool is_faster)
+static int td_alloc_compression(struct tdisk *td)
 {
-	struct sorted_sector_index *item;
-	struct sorted_sector_index *ret = NULL;
+	if(td->current_block)return 0;
 
-	list_for_each_entry(item, &device->preferred_blocks, device_assigned)
-	{
-		sector_t logical_sector = (sector_t)(item->physical_sector - td->indices);
-		bool swap_is_cache_sector = (logical_sector > td->size_blocks);
+	td->current_block = vmalloc(td->blocksize);
+	td->compress_buffer = vmalloc(td->blocksize);
+	td->compress_workmem = vmalloc(TD_COMPRESS_WORKMEM);
+	td->current_block_device = NULL;
+	td->current_block_dirty = false;
 
-		if(is_faster)
-		{
-			if(item->physical_sector->disk == disk && is_cache_sector == swap_is_cache_sector && (is_cache_sector || ACCESS_COUNT(item->physical_sector->access_count) <= access_count))
-			{
-				if(ret == NULL || ACCESS_COUNT(item->physical_sector->access_count) > ACCESS_COUNT(ret->physical_sector->access_count))
-					ret = item;
-			}
-		}
-		else
-		{
-			if(item->physical_sector->disk == disk && is_cache_sector == swap_is_cache_sector && (is_cache_sector || ACCESS_COUNT(item->physical_sector->access_count) >= access_count))
-			{
-				if(ret == NULL || ACCESS_COUNT(item->physical_sector->access_count) < ACCESS_COUNT(ret->physical_sector->access_count))
-					ret = item;
-			}
-		}
+	if(!td->current_block || !td->compress_buffer || !td->compress_workmem)
+	{
+		td_free_compression(td);
+		return -ENOMEM;
 	}
 
-	return ret;
+	return 0;
 }
 
 /**
-  * This function assigns the sorted sectors to the sorted devices
-  * and tries to optimize it using the function td_find_sector_index_acc
-  * The result of this function is the base of the sectors to be swapped
+  * Reads the block at the given position of the given compressed
+  * device. compressed is taken from the index of the block and
+  * defines whether it needs to be decompressed.
+  * The compression mutex must be held.
  **/
-static void td_assign_sectors(struct tdisk *td)
+static int __td_read_compressed_block(struct tdisk *td, struct td_internal_device *device, u8 *buffer, loff_t position, bool compressed)
 {
-	sector_t missing = td->size_blocks + td->cache_sectors;
-	unsigned int sorted_disk;
-	struct sorted_sector_index *sector;
-	struct sorted_sector_index *item_safe;
-
-	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
-		INIT_LIST_HEAD(&td->sorted_devices[sorted_disk-1].preferred_blocks);
-
-	sorted_disk = 1;
+	struct td_compressed_block *header = (struct td_compressed_block*)td->compress_buffer;
+	unsigned int length = min_t(unsigned int, PAGE_SIZE, td->blocksize);
+	unsigned int compressed_length;
+	int ret;
 
-	//Iterating over all sorted sectors in the tDisk (!!!)
-	//and assigning them to the corresponding internal device
-	//The sectors are processed according to access count
-	//and assigned to devices according to performance
-	list_for_each_entry(sector, &td->sorted_sectors_head, total_sorted)
+	//The block which is currently accessed is the newest version
+	if(td->current_block_device == device && td->current_block_position == position)
 	{
-		//Not processing unused sectors
-		if(sector->physical_sector->disk == 0)continue;
-
-		//Count missing sectors
-		missing--;
+		if(buffer != td->current_block)memcpy(buffer, td->current_block, td->blocksize);
+		return 0;
+	}
 
-		//Here the counter available_blocks of the sorted_internal_device
-		//is used to assign the sectors. If there are no more free sectors
-		//the next sorted device is used
-		while(td->sorted_devices[sorted_disk-1].available_blocks == 0)
-		{
-			sorted_disk++;
-			MY_BUG_ON(sorted_disk > td->internal_devices_count, PRINT_UINT(sorted_disk), PRINT_ULL(missing));
-		}
+	if(!compressed)return read_data(device, buffer, position, td->blocksize);
 
-		td->sorted_devices[sorted_disk-1].available_blocks--;
+	//The first page contains the header and often all the data
+	ret = read_data(device, td->compress_buffer, position, length);
+	if(ret)return ret;
 
-		//Adding sector to device's preferred blocks
-		INIT_LIST_HEAD(&sector->device_assigned);
-		list_add(&sector->device_assigned, &td->sorted_devices[sorted_disk-1].preferred_blocks);
+	compressed_length = le32_to_cpu(header->length);
+	if(compressed_length > td->blocksize - sizeof(struct td_compressed_block))goto out_corrupt;
 
-		//Here, the amount of correctly assigned blocks is counted.
-		//The memory offset is used to convert from sorted device
-		//to actual device
-		if(sector->physical_sector->disk == DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices))
-			td->sorted_devices[sorted_disk-1].amount_blocks++;
+	if(sizeof(struct td_compressed_block) + compressed_length > length)
+	{
+		ret = read_data(device, td->compress_buffer + length, position + length, (unsigned int)(sizeof(struct td_compressed_block) + compressed_length - length));
+		if(ret)return ret;
 	}
 
-	//All blocks must be used
-	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
-	{
-		//MY_BUG_ON(td->sorted_devices[sorted_disk-1].available_blocks != 0,
-		//	PRINT_ULL(td->sorted_devices[sorted_disk-1].available_blocks),
-		//	PRINT_UINT(DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices)));
+	if(crc32_le(~0, (u8*)(header + 1), compressed_length) != le32_to_cpu(header->crc))goto out_corrupt;
+	if(td_decompress((u8*)(header + 1), compressed_length, buffer, td->blocksize))goto out_corrupt;
 
-		if(td->sorted_devices[sorted_disk-1].available_blocks != 0)
-		{
-			printk(KERN_ERR "tDisk: While assigning sectors: available_blocks (%llu) of disk %u is not 0 as it should be\n",
-				td->sorted_devices[sorted_disk-1].available_blocks,
-				DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices));
-		}
-	}
+	return 0;
 
-	//Trying to optimize a bit...
-	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
-	{
-		//Iterating over each element and looking
-		//for wrong elements. If there is another
-		//wrong element in the corresponding disk
-		//with the same access count it is just a
-		//matter of the sorting algorithm and can
-		//simply be swapped.
-		list_for_each_entry_safe(sector, item_safe, &td->sorted_devices[sorted_disk-1].preferred_blocks, device_assigned)
-		{
-			//Actual internal device calculated using memory offset
-			tdisk_index current_disk = DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices);
+ out_corrupt:
+	printk_ratelimited(KERN_ERR "tDisk: Compressed block at byte %lld is corrupt\n", position);
+	return -EIO;
+}
 
-			MY_BUG_ON(sector->physical_sector->disk == 0 || sector->physical_sector->disk > td->internal_devices_count, PRINT_INT(sector->physical_sector->disk));
+/**
+  * Compresses the given block and writes it to the given
+  * position of the given compressed device. The block is
+  * stored uncompressed if this doesn't save at least one page.
+  * compressed returns how the block was stored.
+  * The compression mutex must be held.
+ **/
+static int __td_write_compressed_block(struct tdisk *td, struct td_internal_device *device, u8 *buffer, loff_t position, bool *compressed)
+{
+	struct td_compressed_block *header = (struct td_compressed_block*)td->compress_buffer;
+	size_t compressed_length = 0;
+	unsigned int length;
+	int ret;
 
-			if(sector->physical_sector->disk != current_disk)
-			{
-				//The sector to swap is only searched in the SLOWER
-				//devices BUT with an equal or HIGHER access count.
+	if(td->blocksize > sizeof(struct td_compressed_block) + PAGE_SIZE)
+		compressed_length = td_compress(buffer, td->blocksize, (u8*)(header + 1), td->blocksize - sizeof(struct td_compressed_block) - PAGE_SIZE, td->compress_workmem);
 
-				//The device offset which is used to only search in slower
-				//devices than the current
-				//unsigned int dev_off = sorted_disk-1+1;
+	(*compressed) = (compressed_length != 0);
+	if(!(*compressed))return write_data(device, buffer, position, td->blocksize);
 
-				//unsigned int dev_length = td->internal_devices_count-dev_off;
+	header->length = cpu_to_le32((__u32)compressed_length);
+	header->crc = cpu_to_le32(crc32_le(~0, (u8*)(header + 1), compressed_length));
 
-				//This is the internal device where the current sector
-				//Should be stored according to its access count.
-				//Since we are just looking just for devices which
-				//Are slower than the current it can also be null
-				struct sorted_internal_device *corresponding = td_find_sorted_device(td->sorted_devices, &td->internal_devices[sector->physical_sector->disk-1], td->internal_devices_count);
-				struct sorted_sector_index *to_swap;
+	length = (unsigned int)(sizeof(struct td_compressed_block) + compressed_length);
+	ret = write_data(device, td->compress_buffer, position, length);
+	if(ret)return ret;
 
-				bool is_faster = corresponding < &td->sorted_devices[sorted_disk-1];
+	//The rest of the block is not needed. This is just a
+	//hint, but sparse files and thin devices get the space back
+	length = round_up(length, PAGE_SIZE);
+	if(length < td->blocksize)device_alloc(device, position + length, td->blocksize - length);
 
-				sector_t logical_sector = (sector_t)(sector->physical_sector - td->indices);
-				bool is_cache_sector = (logical_sector > td->size_blocks);
+	return 0;
+}
 
-				if(!corresponding)continue;
+/**
+  * Compresses the block which is currently accessed and writes
+  * it to the move help sector of its device. Only when the data
+  * is on stable storage the index is changed to point to it, so
+  * a crash leaves either the old or the new block. The old
+  * location becomes the new move help sector.
+  * The compression mutex must be held.
+ **/
+static int __td_write_current_block(struct tdisk *td)
+{
+	struct td_internal_device *device = td->current_block_device;
+	sector_t logical_sector = td->current_block_sector;
+	sector_t new_sector = device->move_help_sector;
+	loff_t position = (loff_t)new_sector * td->blocksize;
+	struct sector_index new_index;
+	sector_t old_sector;
+	bool compressed;
+	int ret;
 
-				//Finds a sector with an equal or higher access count
-				//for the current disk inside the "corresponding"
-				to_swap = td_find_sector_index_acc(td, corresponding, current_disk, ACCESS_COUNT(sector->physical_sector->access_count), is_cache_sector, is_faster);
+	//The indices on the disks may still point to the move
+	//help sector until the index change which released it
+	//is on stable storage
+	if(device->move_help_released)
+	{
+		ret = td_flush_devices(td);
+		if(ret)return ret;
+		device->move_help_released = false;
+	}
 
-				if(to_swap != NULL)
-				{
-					//printk(KERN_DEBUG "tDisk: %u: pre-swapping %u (%u - %u) with %u (%u - %u)\n", current_disk, sector-td->sorted_sectors, sector->physical_sector->disk, sector->physical_sector->access_count, to_swap-td->sorted_sectors, to_swap->physical_sector->disk, to_swap->physical_sector->access_count);
+	ret = __td_write_compressed_block(td, device, td->current_block, position, &compressed);
+	if(ret)return ret;
 
-					//Simply swap those sectors
-					BUG_ON(to_swap->physical_sector->disk != current_disk);
-					//if(sector->physical_sector->disk != sorted_disk)
+	ret = flush_device_range(device, position, td->blocksize);
+	if(ret)return ret;
 
-					list_del_init(&sector->device_assigned);
-					list_del_init(&to_swap->device_assigned);
+	old_sector = td_index(td, logical_sector)->sector;
+	SET_COMPRESSED_SECTOR(td_index(td, logical_sector)->access_count, compressed);
 
-					list_add(&sector->device_assigned, &corresponding->preferred_blocks);
-					list_add(&to_swap->device_assigned, &td->sorted_devices[sorted_disk-1].preferred_blocks);
+	new_index = *td_index(td, logical_sector);
+	new_index.sector = (__u32)new_sector;
+	td_perform_index_operation(td, WRITE, logical_sector, &new_index, true, false, 0);
 
-					corresponding->amount_blocks++;
-					td->sorted_devices[sorted_disk-1].amount_blocks++;
-				}
-				//else printk(KERN_DEBUG "tDisk: %u: Didn't find a sector to swap %u (%u - %u) \n", current_disk, sector-td->sorted_sectors, sector->physical_sector->disk, sector->physical_sector->access_count);
-			}
-		}
-	}
+	device->move_help_sector = old_sector;
+	device->move_help_released = true;
+	td->current_block_position = position;
+
+	//The old block is not needed anymore. This is just a hint
+	device_alloc(device, (loff_t)old_sector * td->blocksize, td->blocksize);
+
+	return 0;
 }
 
 /**
-  * This function checks if the given tDisk is ready.
-  * A tDisk is ready when all internal devices are present
+  * Compresses and writes the block which is currently
+  * accessed if it was changed
  **/
-static bool td_is_ready(struct tdisk *td)
+static int td_flush_current_block(struct tdisk *td)
 {
-	tdisk_index disk;
+	int ret = 0;
 
-	for(disk = 1; disk <= td->internal_devices_count; ++disk)
+	mutex_lock(&td->compression_mutex);
+	if(td->current_block_device && td->current_block_dirty)
 	{
-		if(!device_is_ready(&td->internal_devices[disk-1]))
-			return false;
+		ret = __td_write_current_block(td);
+		td->current_block_dirty = false;
+
+		//Better read it again than using wrong data
+		if(ret)td->current_block_device = NULL;
 	}
+	mutex_unlock(&td->compression_mutex);
 
-	return true;
+	return ret;
 }
 
 /**
-  * This function moves the sector with the
-  * highest access count to the disk with the
-  * best performance.
-  * The function returns true and sets td->access_count_resort
-  * when a sector could be moved.
+  * Forgets the block which is currently accessed
+  * if it is the given block
  **/
-static bool td_move_one_sector(struct tdisk *td)
+static void td_drop_current_block(struct tdisk *td, struct td_internal_device *device, loff_t position)
 {
-	bool swapped = false;
-	unsigned int sorted_disk;
-	struct sorted_sector_index *item;
-	struct sorted_sector_index *to_swap;
-	sector_t correctly_stored;
+	mutex_lock(&td->compression_mutex);
+	if(td->current_block_device == device && td->current_block_position == position)
+		td->current_block_device = NULL;
+	mutex_unlock(&td->compression_mutex);
+}
 
-	//Check if all devices are loaded
-	if(!td_is_ready(td))
-	{
-		//Not all disks are loaded yet
-		printk(KERN_DEBUG "tDisk: Not all disks are ready. Not moving sectors\n");
-		return false;
-	}
+/**
+  * Reads or writes the given bio_vec of the given logical sector
+  * which is stored on a compressed device. The block is kept
+  * decompressed in memory while it is accessed. Written blocks
+  * are compressed again when td_flush_current_block is called
+  * at the end of the request.
+  * Returns the amount of bytes or a negative error code.
+ **/
+static ssize_t td_compressed_bio_vec(struct tdisk *td, sector_t logical_sector, const struct sector_index *physical_sector, struct bio_vec *bvec, unsigned int offset, bool write, bool sector_used)
+{
+	struct td_internal_device *device = &td->internal_devices[physical_sector->disk-1];
+	loff_t position = (loff_t)physical_sector->sector * td->blocksize;
+	void *data;
+	int ret = 0;
 
-	if(td->sorted_devices == NULL)
+	if(offset + bvec->bv_len > td->blocksize)return -EIO;
+
+	mutex_lock(&td->compression_mutex);
+	if(td->current_block_device != device || td->current_block_position != position)
 	{
-		//Create sorted devices
-		td->sorted_devices = vmalloc(sizeof(struct sorted_internal_device) * td->internal_devices_count);
-		if(!td->sorted_devices)
-		{
-			printk(KERN_WARNING "tDisk: Error allocating sorted_devices memory\n");
-			return false;
-		}
+		if(td->current_block_device && td->current_block_dirty)
+			ret = __td_write_current_block(td);
 
-		td_insert_sorted_internal_devices(td);
+		td->current_block_device = NULL;
+		td->current_block_dirty = false;
 
-		//Assigning the sorted sectors to the sorted devices...
-		td_assign_sectors(td);
-	}
+		//Unused sectors don't contain any data
+		if(!ret && sector_used)ret = __td_read_compressed_block(td, device, td->current_block, position, SECTOR_COMPRESSED(physical_sector->access_count));
+		else if(!ret)memset(td->current_block, 0, td->blocksize);
+		if(ret)goto out;
 
-	correctly_stored = 0;
-	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
-	{
-		correctly_stored += td->sorted_devices[sorted_disk-1].amount_blocks;
-		/*printk(KERN_DEBUG "tDisk: Internal disk %u (speed: %u rank --> %llu): Capacity: %llu, Correctly stored: %llu, %u percent\n",
-						td->sorted_devices[sorted_disk-1].dev-td->internal_devices+1,
-						sorted_disk,
-						td_get_device_performance(td->sorted_devices[sorted_disk-1].dev),
-						td->sorted_devices[sorted_disk-1].dev->size_blocks,
-						td->sorted_devices[sorted_disk-1].amount_blocks,
-						(size_t)td->sorted_devices[sorted_disk-1].amount_blocks*100 / (size_t)td->sorted_devices[sorted_disk-1].dev->size_blocks);*/
+		td->current_block_device = device;
+		td->current_block_position = position;
+		td->current_block_sector = logical_sector;
 	}
 
-	//Moving the sector with highest access count to
-	//the disk with the best performance
-	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
+	data = kmap_atomic(bvec->bv_page);
+	if(write)
 	{
-		struct sorted_sector_index *highest = NULL;
-		tdisk_index current_disk_index = DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices);
-		struct sorted_internal_device *other_disk;
-		tdisk_index other_disk_sorted_index;
-
-		if(td->sorted_devices[sorted_disk-1].amount_blocks == td->sorted_devices[sorted_disk-1].dev->size_blocks)
-		{
-			//All blocks are correctly stored. Moving on to slower disk...
-			continue;
-		}
+		memcpy(td->current_block + offset, data + bvec->bv_offset, bvec->bv_len);
+		td->current_block_dirty = true;
+	}
+	else memcpy(data + bvec->bv_offset, td->current_block + offset, bvec->bv_len);
+	kunmap_atomic(data);
 
-		//If we reach this point there is at least one
-		//sector stored on a wrong disk which should be
-		//stored on this disk.
-		//So searching the sector with the highest access
-		//count which gains the best performance.
-		list_for_each_entry(item, &td->sorted_devices[sorted_disk-1].preferred_blocks, device_assigned)
-		{
-			if(item->physical_sector->disk != current_disk_index)
-			{
-				if(highest == NULL || ACCESS_COUNT(item->physical_sector->access_count) > ACCESS_COUNT(highest->physical_sector->access_count))
-					highest = item;
-			}
-		}
+ out:
+	mutex_unlock(&td->compression_mutex);
 
-		//Above there is a continue flag so there must
-		//be a wrong sector. Otherwise it is a bug
-		MY_BUG_ON(!highest, PRINT_ULL(td->sorted_devices[sorted_disk-1].amount_blocks), PRINT_ULL(td->sorted_devices[sorted_disk-1].dev->size_blocks));
-		other_disk = td_find_sorted_device(td->sorted_devices, &td->internal_devices[highest->physical_sector->disk-1], td->internal_devices_count);
+	return ret ? ret : (ssize_t)bvec->bv_len;
+}
 
-		BUG_ON(!other_disk);
-		other_disk_sorted_index = DEVICE_INDEX(other_disk, td->sorted_devices);
+#else
+#pragma message "Compression is disabled"
+#endif //USE_COMPRESSION
 
-		//Now looking at the disk where the current highest
-		//sector is stored for a block that belongs to
-		//the current disk
-		to_swap = td_find_sector_index(&td->sorted_devices[other_disk_sorted_index-1], current_disk_index);
+/**
+  * Reads the block at the given position of the given internal
+  * device. Blocks of compressed devices are decompressed if
+  * compressed is set in their index (@see SECTOR_COMPRESSED).
+ **/
+static int td_read_block(struct tdisk *td, struct td_internal_device *device, u8 *buffer, loff_t position, bool compressed)
+{
+#ifdef USE_COMPRESSION
+	if(device->compress)
+	{
+		int ret;
 
-		//If no sector was found it means we have a circual dependency
-		//So we just skip to the next disk and proceed
-		while(to_swap == NULL && other_disk_sorted_index < td->internal_devices_count)
-		{
-			if(++other_disk_sorted_index != sorted_disk)
-				to_swap = td_find_sector_index(&td->sorted_devices[other_disk_sorted_index-1], current_disk_index);
-		}
+		mutex_lock(&td->compression_mutex);
+		ret = __td_read_compressed_block(td, device, buffer, position, compressed);
+		mutex_unlock(&td->compression_mutex);
 
-		if(to_swap != NULL)
-		{
-			//OK, now we found a sector of the possibly fastest disk
-			//which is stored on the possibly slowest disk. When we
-			//swap those sectors we gain the highest possible performance.
+		return ret;
+	}
+#endif //USE_COMPRESSION
 
-			sector_t logical_a = (sector_t)(highest-td->sorted_sectors);
-			sector_t logical_b = (sector_t)(to_swap-td->sorted_sectors);
-			struct sector_index *a = highest->physical_sector;
-			struct sector_index *b = to_swap->physical_sector;
+	return read_data(device, buffer, position, td->blocksize);
+}
 
-			//printk(KERN_DEBUG "tDisk: swapping logical sectors %llu (disk: %u, access: %u) and %llu (disk: %u, access: %u): %llu/%llu\n",
-			//		logical_a, a->disk, a->access_count, logical_b, b->disk, b->access_count, correctly_stored, td->size_blocks);
+/**
+  * Writes the given block to the given position of the given
+  * internal device. Blocks of compressed devices are compressed.
+  * compressed returns how the block was stored, it needs to be
+  * set in the index of the block (@see SET_COMPRESSED_SECTOR).
+ **/
+static int td_write_block(struct tdisk *td, struct td_internal_device *device, u8 *buffer, loff_t position, bool *compressed)
+{
+	(*compressed) = false;
 
-			td_swap_sectors(td, logical_a, a, logical_b, b, true);
+#ifdef USE_COMPRESSION
+	if(device->compress)
+	{
+		int ret;
 
-			if(td->sorted_devices[sorted_disk-1].dev == &td->internal_devices[a->disk-1])
-				td->sorted_devices[sorted_disk-1].amount_blocks++;
-			if(td->sorted_devices[other_disk_sorted_index-1].dev == &td->internal_devices[b->disk-1])
-				td->sorted_devices[other_disk_sorted_index-1].amount_blocks++;
+		mutex_lock(&td->compression_mutex);
+		if(td->current_block_device == device && td->current_block_position == position)
+			td->current_block_device = NULL;
 
-			td->access_count_resort = 1;
-			swapped = true;
-			break;
-		}
+		ret = __td_write_compressed_block(td, device, buffer, position, compressed);
+		mutex_unlock(&td->compression_mutex);
 
-		if(swapped)break;
+		return ret;
 	}
+#endif //USE_COMPRESSION
 
-	return swapped;
+	return write_data(device, buffer, position, td->blocksize);
 }
 
-#else
-#pragma message "Moving sectors is disabled"
-#endif //MOVE_SECTORS
+/**
+  * Swaps the physical location of the two given logical
+  * sectors without moving any data. The indices are written
+  * to both of the involved disks.
+ **/
+static void td_swap_indices(struct tdisk *td, sector_t logical_a, sector_t logical_b)
+{
+	bool compressed_a = SECTOR_COMPRESSED(td_index(td, logical_a)->access_count);
 
-#ifdef MEASURE_PING_PERFORMANCE
+	swap(td_index(td, logical_a)->disk, td_index(td, logical_b)->disk);
+	swap(td_index(td, logical_a)->sector, td_index(td, logical_b)->sector);
 
-void td_measure_device_performance(struct td_internal_device *device, loff_t size)
+	//The compressed flag belongs to the physical location
+	SET_COMPRESSED_SECTOR(td_index(td, logical_a)->access_count, SECTOR_COMPRESSED(td_index(td, logical_b)->access_count));
+	SET_COMPRESSED_SECTOR(td_index(td, logical_b)->access_count, compressed_a);
+
+	td_write_index_to_disk(td, logical_a, td_index(td, logical_a)->disk);
+	td_write_index_to_disk(td, logical_b, td_index(td, logical_a)->disk);
+	td_write_index_to_disk(td, logical_a, td_index(td, logical_b)->disk);
+	td_write_index_to_disk(td, logical_b, td_index(td, logical_b)->disk);
+}
+
+/**
+  * This function moves the used sector a to the physical location
+  * of the unused sector b. Sector b gets the old location of
+  * sector a. Since the unused sector doesn't contain any data
+  * only one sector needs to be copied.
+  * Just like td_swap_sectors it returns true on error.
+ **/
+static bool td_move_sector(struct tdisk *td, sector_t logical_a, struct sector_index *a, sector_t logical_b, struct sector_index *b, bool do_disk_operation, unsigned int *copied_blocks)
 {
-	struct timespec startTime;
-	struct timespec endTime;
-	unsigned long time = jiffies;
-	char *buffer = vmalloc(1048576);
-	unsigned int counter = 0;
-	unsigned int elapsed;
+	int ret;
+	tdisk_index disk_a = a->disk;
+	tdisk_index disk_b = b->disk;
+	sector_t sector_a = a->sector;
+	sector_t sector_b = b->sector;
+	bool compressed;
+	u8 *buffer;
 
-	if(!buffer)
+	buffer = vmalloc(td->blocksize);
+	if(!buffer)return true;
+
+	//Count optimized bytes
+	td->bytes_optimized += td->blocksize;
+
+	ret = td_read_block(td, &td->internal_devices[disk_a-1], buffer, (loff_t)sector_a * td->blocksize, SECTOR_COMPRESSED(a->access_count));
+	td->internal_devices[disk_a-1].bytes_read -= td->blocksize;
+	if(ret != 0)
 	{
-		printk(KERN_ERR "tDisk: Unable to get memory to measure device performance\n");
-		return;
+		printk(KERN_WARNING "tDisk: Move error: reading %llu, disk: %u, ret: %d\n", logical_a, disk_a, ret);
+		goto out;
 	}
 
-	getnstimeofday(&startTime);
+	//The unused sector is parked at the move help sector so
+	//that two indices never point to the same location
+	b->sector = td->internal_devices[disk_b-1].move_help_sector;
+	td_perform_index_operation(td, WRITE, logical_b, b, do_disk_operation, false, 0);
 
-	while(jiffies-time < HZ*5)
+	ret = td_write_block(td, &td->internal_devices[disk_b-1], buffer, (loff_t)sector_b * td->blocksize, &compressed);
+	td->internal_devices[disk_b-1].bytes_written -= td->blocksize;
+	if(ret != 0)
 	{
-		read_data(device, buffer, counter*1048576, 1048576);
-		counter++;
-		if(counter*1048576 > size)break;
+		printk(KERN_WARNING "tDisk: Move error: writing %llu, disk: %u, ret: %d\n", logical_a, disk_b, ret);
+
+		b->sector = sector_b;
+		td_perform_index_operation(td, WRITE, logical_b, b, do_disk_operation, false, 0);
+		goto out;
 	}
 
-	getnstimeofday(&endTime);
-	update_performance(READ, &startTime, &endTime, counter, &device->performance);
+	a->disk = disk_b;
+	a->sector = sector_b;
+	SET_COMPRESSED_SECTOR(a->access_count, compressed);
+	td_perform_index_operation(td, WRITE, logical_a, a, do_disk_operation, false, 0);
 
-	elapsed = (unsigned)(endTime.tv_sec-startTime.tv_sec);
-	if(elapsed == 0)elapsed = 1;
-	printk(KERN_DEBUG "tDisk: read %u MiB --> %u MiB/s\n", counter, counter/elapsed);
+	b->disk = disk_a;
+	b->sector = sector_a;
+	td_perform_index_operation(td, WRITE, logical_b, b, do_disk_operation, false, 0);
+	if(copied_blocks)(*copied_blocks) = 1;
 
+ out:
 	vfree(buffer);
-}
 
-#else
-#pragma message "Ping performance measurement is disabled"
-#endif //MEASURE_PING_PERFORMANCE
+	return (ret != 0);
+}
 
 /**
-  * This callback is used by the list_sort to determine the
-  * order of a sector index
+  * This function physically swaps the two given sectors.
+  * This means it reads the data of both sectors, stores
+  * sector a in sector b and vice versa and updates the
+  * indices. If copied_blocks is not NULL it returns how many
+  * blocks were copied to their new location. This is 0 if
+  * only the indices were swapped or an error occurred.
  **/
-int td_sector_index_callback_total(void *priv, struct list_head *a, struct list_head *b)
+static bool td_swap_sectors(struct tdisk *td, sector_t logical_a, struct sector_index *a, sector_t logical_b, struct sector_index *b, bool do_disk_operation, unsigned int *copied_blocks)
 {
-	struct sorted_sector_index *i_a = list_entry(a, struct sorted_sector_index, total_sorted);
-	struct sorted_sector_index *i_b = list_entry(b, struct sorted_sector_index, total_sorted);
-
-	if(i_a->physical_sector->disk == 0 && i_b->physical_sector->disk == 0)return 0;
-	if(i_a->physical_sector->disk == 0)return 1;
-	if(i_b->physical_sector->disk == 0)return -1;
+	int ret;
+	loff_t pos_a;
+	loff_t pos_b;
+	loff_t pos_help_a;
+	loff_t pos_help_b;
+	tdisk_index disk_a;
+	tdisk_index disk_b;
+	sector_t sector_b;
+	sector_t sector_a;
+	u16 access_count_a;
+	u16 access_count_b;
+	bool compressed;
+	u8 *buffer_a;
+	u8 *buffer_b;
 
-	return ACCESS_COUNT(i_b->physical_sector->access_count) - ACCESS_COUNT(i_a->physical_sector->access_count);
-}
+	if(copied_blocks)(*copied_blocks) = 0;
 
-inline static bool compare_sectors(struct tdisk *td, struct sector_index *a, struct sector_index *b)
-{
-	sector_t logical_a = (sector_t)(a - td->indices);
-	sector_t logical_b = (sector_t)(b - td->indices);
+	//Unused sectors don't contain any data. So if both sectors
+	//are unused only the indices are swapped, otherwise only the
+	//used sector is moved
+	if(!SECTOR_USED(a->access_count) && !SECTOR_USED(b->access_count))
+	{
+		swap(a->disk, b->disk);
+		swap(a->sector, b->sector);
+		td_perform_index_operation(td, WRITE, logical_a, a, do_disk_operation, false, 0);
+		td_perform_index_operation(td, WRITE, logical_b, b, do_disk_operation, false, 0);
+		return false;
+	}
+	else if(!SECTOR_USED(b->access_count))
+		return td_move_sector(td, logical_a, a, logical_b, b, do_disk_operation, copied_blocks);
+	else if(!SECTOR_USED(a->access_count))
+		return td_move_sector(td, logical_b, b, logical_a, a, do_disk_operation, copied_blocks);
+
+	//Swap sectors in case disk b is better. This speeds up the swapping process
+	if(td_get_device_performance(&td->internal_devices[a->disk-1]) > td_get_device_performance(&td->internal_devices[b->disk-1]))
+	{
+		swap(a, b);
+		swap(logical_a, logical_b);
+	}
+
+	disk_a = a->disk;
+	disk_b = b->disk;
+	sector_b = b->sector;
+	sector_a = a->sector;
+	access_count_a = a->access_count;
+	access_count_b = b->access_count;
+	pos_a = (loff_t)a->sector * td->blocksize;
+	pos_b = (loff_t)b->sector * td->blocksize;
+	pos_help_a = (loff_t)td->internal_devices[disk_a-1].move_help_sector * td->blocksize;
+	pos_help_b = (loff_t)td->internal_devices[disk_b-1].move_help_sector * td->blocksize;
+
+	buffer_a = vmalloc(td->blocksize);
+	if(!buffer_a)return false;
+
+	buffer_b = vmalloc(td->blocksize);
+	if(!buffer_b)
+	{
+		vfree(buffer_a);
+		return false;
+	}
+
+	//Count optimized bytes
+	td->bytes_optimized += td->blocksize;
+
+	//Reading blocks from both disks
+	ret = td_read_block(td, &td->internal_devices[disk_a-1], buffer_a, pos_a, SECTOR_COMPRESSED(access_count_a));		//a read op1
+	td->internal_devices[disk_a-1].bytes_read -= td->blocksize;
+	if(ret != 0)
+	{
+		printk(KERN_WARNING "tDisk: Swap error: reading %llu, disk: %u, ret: %d\n", logical_a, disk_a, ret);
+		goto out;
+	}
+
+	ret = td_read_block(td, &td->internal_devices[disk_b-1], buffer_b, pos_b, SECTOR_COMPRESSED(access_count_b));		//b read op1
+	td->internal_devices[disk_b-1].bytes_read -= td->blocksize;
+	if(ret != 0)
+	{
+		printk(KERN_WARNING "tDisk: Swap error: reading %llu, disk: %u, ret: %d\n", logical_b, disk_b, ret);
+		goto out;
+	}
+
+
+
+	ret = td_write_block(td, &td->internal_devices[disk_a-1], buffer_a, pos_help_a, &compressed);
+	td->internal_devices[disk_a-1].bytes_written -= td->blocksize;
+	if(ret != 0)
+	{
+		printk(KERN_WARNING "tDisk: Swap-help error: writing %llu, disk: %u, ret: %d\n", logical_a, disk_a, ret);
+		goto out;
+	}
+
+	SET_COMPRESSED_SECTOR(access_count_a, compressed);
+	a->disk = disk_a;
+	a->access_count = access_count_a;
+	a->sector = td->internal_devices[disk_a-1].move_help_sector;
+	td_perform_index_operation(td, WRITE, logical_a, a, do_disk_operation, false, 0);
+
+	ret = td_write_block(td, &td->internal_devices[disk_a-1], buffer_b, pos_a, &compressed);
+	td->internal_devices[disk_a-1].bytes_written -= td->blocksize;
+	if(ret != 0)
+	{
+		printk(KERN_WARNING "tDisk: Swap error: writing %llu, disk: %u, ret: %d\n", logical_a, disk_a, ret);
+		goto out;
+	}
+
+	SET_COMPRESSED_SECTOR(access_count_b, compressed);
+	b->disk = disk_a;
+	b->access_count = access_count_b;
+	b->sector = sector_a;
+	td_perform_index_operation(td, WRITE, logical_b, b, do_disk_operation, false, 0);
+	if(copied_blocks)(*copied_blocks) = 1;
+
+	ret = td_write_block(td, &td->internal_devices[disk_b-1], buffer_a, pos_b, &compressed);
+	td->internal_devices[disk_b-1].bytes_written -= td->blocksize;
+	if(ret != 0)
+	{
+		printk(KERN_WARNING "tDisk: Swap error: writing %llu, disk: %u, ret: %d\n", logical_b, disk_b, ret);
+		goto out;
+	}
+
+	SET_COMPRESSED_SECTOR(access_count_a, compressed);
+	a->disk = disk_b;
+	a->access_count = access_count_a;
+	a->sector = sector_b;
+	td_perform_index_operation(td, WRITE, logical_a, a, do_disk_operation, false, 0);
+	if(copied_blocks)(*copied_blocks) = 2;
+
+ out:
+	vfree(buffer_a);
+	vfree(buffer_b);
+
+	return (ret != 0);
+}
+
+#ifdef MOVE_SECTORS
+
+/**
+  * This is the callback which is used to sort the
+  * devices according to its performance
+ **/
+static int td_sort_devices_callback(const void *a, const void *b)
+{
+	const struct sorted_internal_device *d_a = a;
+	const struct sorted_internal_device *d_b = b;
+
+	unsigned long long performance_a = td_get_device_performance(d_a->dev);
+	unsigned long long performance_b = td_get_device_performance(d_b->dev);
+
+	if(performance_a == performance_b)return 0;
+	else if(performance_a > performance_b)return 1;
+	else return -1;
+}
+
+/**
+  * Inserts the internal devices in the given array
+  * in an ordered manner
+ **/
+static void td_insert_sorted_internal_devices(struct tdisk *td)
+{
+	unsigned int i;
+
+	for(i = 0; i < td->internal_devices_count; ++i)
+	{
+		td->sorted_devices[i].dev = &td->internal_devices[i];
+		td->sorted_devices[i].available_blocks = td->internal_devices[i].size_blocks;
+		td->sorted_devices[i].amount_blocks = 0;
+	}
+
+	//Sort array
+	sort(td->sorted_devices, td->internal_devices_count, sizeof(struct sorted_internal_device), &td_sort_devices_callback, NULL);
+}
+
+/**
+  * Finds the corresponding sorted device of the given
+  * td_internal_device
+ **/
+static struct sorted_internal_device* td_find_sorted_device(struct sorted_internal_device *sorted_devices, struct td_internal_device *desired_device, unsigned int devices)
+{
+	unsigned int i;
+
+	for(i = 0; i < devices; ++i)
+	{
+		if(sorted_devices[i].dev == desired_device)
+		{
+			return &sorted_devices[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+  * This function finds the logical sector which is assigned
+  * to the given sorted device, is stored on the given disk
+  * and has the lowest access count.
+  * This is used when swapping a (high access) sector from a slower
+  * disk with a (lowest possible) sector from a faster disk.
+  * A sector with a lower access count has a lower probability
+  * of being moved to a faster disk in the near future.
+  * Returns false if no such sector exists.
+ **/
+static bool td_find_sector_index(struct tdisk *td, tdisk_index sorted_disk, tdisk_index disk, sector_t *lowest)
+{
+	struct sorted_internal_device *device = &td->sorted_devices[sorted_disk-1];
+	sector_t pos;
+	bool found = false;
+
+	for(pos = device->first_sector; pos < device->first_sector + device->sector_count; ++pos)
+	{
+		sector_t logical_sector = td->device_sectors[pos];
+		struct sector_index *item = td_index(td, logical_sector);
+
+		if(item->disk != disk)continue;
+
+		if(!found || ACCESS_COUNT(item->access_count) < ACCESS_COUNT(td_index(td, *lowest)->access_count))
+		{
+			(*lowest) = logical_sector;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+/**
+  * This is an optimizing function for assigning sectors
+  * properly to their devices. Obviously it is possible that
+  * two or more sectors have the same access count (or
+  * acceptable variation). So it is also possible that sector
+  * a and sector b have the same access count but are stored on
+  * the wrong disks (according to the sorting algorithm). So if
+  * they have the same access count they can simply be ignored.
+  * The position of the found sector in td->device_sectors
+  * is returned in ret.
+ **/
+static bool td_find_sector_index_acc(struct tdisk *td, tdisk_index sorted_disk, tdisk_index disk, __u16 access_count, bool is_cache_sector, bool is_faster, sector_t *ret)
+{
+	struct sorted_internal_device *device = &td->sorted_devices[sorted_disk-1];
+	sector_t pos;
+	bool found = false;
+
+	for(pos = device->first_sector; pos < device->first_sector + device->sector_count; ++pos)
+	{
+		sector_t logical_sector = td->device_sectors[pos];
+		struct sector_index *item = td_index(td, logical_sector);
+		bool swap_is_cache_sector;
+
+		swap_is_cache_sector = td_is_reserved_cache_sector(td, logical_sector);
+
+		if(is_faster)
+		{
+			if(item->disk == disk && is_cache_sector == swap_is_cache_sector && (is_cache_sector || ACCESS_COUNT(item->access_count) <= access_count))
+			{
+				if(!found || ACCESS_COUNT(item->access_count) > ACCESS_COUNT(td_index(td, td->device_sectors[*ret])->access_count))
+				{
+					(*ret) = pos;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			if(item->disk == disk && is_cache_sector == swap_is_cache_sector && (is_cache_sector || ACCESS_COUNT(item->access_count) >= access_count))
+			{
+				if(!found || ACCESS_COUNT(item->access_count) < ACCESS_COUNT(td_index(td, td->device_sectors[*ret])->access_count))
+				{
+					(*ret) = pos;
+					found = true;
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+/**
+  * Assigns the given logical sector to the given sorted device
+ **/
+inline static void td_assign_sector(struct tdisk *td, sector_t logical_sector, unsigned int sorted_disk)
+{
+	td->sorted_devices[sorted_disk-1].available_blocks--;
+
+	//Adding sector to device's preferred blocks
+	td->assigned_devices[logical_sector] = (tdisk_index)sorted_disk;
+
+	//Here, the amount of correctly assigned blocks is counted.
+	//The memory offset is used to convert from sorted device
+	//to actual device
+	if(td_index(td, logical_sector)->disk == DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices))
+		td->sorted_devices[sorted_disk-1].amount_blocks++;
+}
+
+/**
+  * Groups the logical sectors by their assigned sorted device
+  * in td->device_sectors so that the sectors of a single device
+  * can be iterated without looking at all other sectors.
+ **/
+static void td_group_assigned_sectors(struct tdisk *td)
+{
+	unsigned int sorted_disk;
+	sector_t first_sector = 0;
+	sector_t logical_sector;
+
+	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
+		td->sorted_devices[sorted_disk-1].sector_count = 0;
+
+	for(logical_sector = 0; logical_sector < td->max_sectors; ++logical_sector)
+	{
+		if(td->assigned_devices[logical_sector] != 0)
+			td->sorted_devices[td->assigned_devices[logical_sector]-1].sector_count++;
+	}
+
+	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
+	{
+		td->sorted_devices[sorted_disk-1].first_sector = first_sector;
+		first_sector += td->sorted_devices[sorted_disk-1].sector_count;
+
+		//Counting again while filling
+		td->sorted_devices[sorted_disk-1].sector_count = 0;
+	}
+
+	for(logical_sector = 0; logical_sector < td->max_sectors; ++logical_sector)
+	{
+		struct sorted_internal_device *device;
+
+		if(td->assigned_devices[logical_sector] == 0)continue;
+
+		device = &td->sorted_devices[td->assigned_devices[logical_sector]-1];
+		td->device_sectors[device->first_sector + device->sector_count++] = (__u32)logical_sector;
+	}
+}
+
+/**
+  * This function assigns the sorted sectors to the sorted devices
+  * and tries to optimize it using the function td_find_sector_index_acc
+  * The result of this function is the base of the sectors to be swapped
+ **/
+static void td_assign_sectors(struct tdisk *td)
+{
+	sector_t missing = td->size_blocks + td->cache_sectors;
+	unsigned int sorted_disk;
+	unsigned int pass;
+	sector_t i;
+	sector_t logical_sector;
+
+	memset(td->assigned_devices, 0, (size_t)(sizeof(tdisk_index) * td->max_sectors));
+
+	//Sectors which are pinned to a tier are assigned first.
+	//They are assigned to the slowest device which is at
+	//least as fast as the tier and has space left.
+	for(i = 0; i < td->max_sectors && td->pin_count != 0; ++i)
+	{
+		__u32 tier;
+
+		logical_sector = td->sorted_sectors[i];
+		if(td_peek_index(td, logical_sector)->disk == 0)continue;
+
+		tier = td_sector_pin(td, logical_sector);
+		if(tier == TDISK_PIN_NONE || tier == TDISK_PIN_NEVER_PROMOTE)continue;
+
+		for(sorted_disk = min_t(unsigned int, tier, td->internal_devices_count); sorted_disk > 0; --sorted_disk)
+		{
+			if(td->sorted_devices[sorted_disk-1].available_blocks != 0)
+			{
+				td_assign_sector(td, logical_sector, sorted_disk);
+				missing--;
+				break;
+			}
+		}
+	}
+
+	sorted_disk = 1;
+
+	//Iterating over all sorted sectors in the tDisk (!!!)
+	//and assigning them to the corresponding internal device
+	//The sectors are processed according to access count
+	//and assigned to devices according to performance.
+	//Sectors which should never be promoted are assigned
+	//in a second pass to the remaining (slowest) blocks
+	for(pass = 1; pass <= 2; ++pass)
+	{
+		for(i = 0; i < td->max_sectors; ++i)
+		{
+			const struct sector_index *sector;
+
+			logical_sector = td->sorted_sectors[i];
+			sector = td_peek_index(td, logical_sector);
+
+			//Not processing unused and pinned sectors
+			if(sector->disk == 0 || td->assigned_devices[logical_sector] != 0)continue;
+			if(td->pin_count != 0 && (td_sector_pin(td, logical_sector) == TDISK_PIN_NEVER_PROMOTE) != (pass == 2))continue;
+
+			//Count missing sectors
+			missing--;
+
+			//Here the counter available_blocks of the sorted_internal_device
+			//is used to assign the sectors. If there are no more free sectors
+			//the next sorted device is used
+			while(td->sorted_devices[sorted_disk-1].available_blocks == 0)
+			{
+				sorted_disk++;
+				MY_BUG_ON(sorted_disk > td->internal_devices_count, PRINT_UINT(sorted_disk), PRINT_ULL(missing));
+			}
+
+			td_assign_sector(td, logical_sector, sorted_disk);
+		}
+
+		if(td->pin_count == 0)break;
+	}
+
+	//All blocks must be used
+	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
+	{
+		//MY_BUG_ON(td->sorted_devices[sorted_disk-1].available_blocks != 0,
+		//	PRINT_ULL(td->sorted_devices[sorted_disk-1].available_blocks),
+		//	PRINT_UINT(DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices)));
+
+		if(td->sorted_devices[sorted_disk-1].available_blocks != 0)
+		{
+			printk(KERN_ERR "tDisk: While assigning sectors: available_blocks (%llu) of disk %u is not 0 as it should be\n",
+				td->sorted_devices[sorted_disk-1].available_blocks,
+				DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices));
+		}
+	}
+
+	td_group_assigned_sectors(td);
+
+	//Trying to optimize a bit...
+	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
+	{
+		struct sorted_internal_device *device = &td->sorted_devices[sorted_disk-1];
+
+		//Iterating over each element and looking
+		//for wrong elements. If there is another
+		//wrong element in the corresponding disk
+		//with the same access count it is just a
+		//matter of the sorting algorithm and can
+		//simply be swapped.
+		for(i = device->first_sector; i < device->first_sector + device->sector_count; ++i)
+		{
+			//Actual internal device calculated using memory offset
+			tdisk_index current_disk = DEVICE_INDEX(device->dev, td->internal_devices);
+			struct sector_index *sector;
+
+			logical_sector = td->device_sectors[i];
+			sector = td_index(td, logical_sector);
+
+			MY_BUG_ON(sector->disk == 0 || sector->disk > td->internal_devices_count, PRINT_INT(sector->disk));
+
+			//The assignment of pinned sectors is fixed
+			if(td->pin_count != 0 && td_sector_pin(td, logical_sector) != TDISK_PIN_NONE)continue;
+
+			if(sector->disk != current_disk)
+			{
+				//The sector to swap is only searched in the SLOWER
+				//devices BUT with an equal or HIGHER access count.
+
+				//The device offset which is used to only search in slower
+				//devices than the current
+				//unsigned int dev_off = sorted_disk-1+1;
+
+				//unsigned int dev_length = td->internal_devices_count-dev_off;
+
+				//This is the internal device where the current sector
+				//Should be stored according to its access count.
+				//Since we are just looking just for devices which
+				//Are slower than the current it can also be null
+				struct sorted_internal_device *corresponding = td_find_sorted_device(td->sorted_devices, &td->internal_devices[sector->disk-1], td->internal_devices_count);
+				sector_t to_swap;
+				sector_t to_swap_pos;
+
+				bool is_faster = corresponding < &td->sorted_devices[sorted_disk-1];
+
+				bool is_cache_sector = td_is_reserved_cache_sector(td, logical_sector);
+
+				if(!corresponding)continue;
+
+				//Finds a sector with an equal or higher access count
+				//for the current disk inside the "corresponding"
+				if(td_find_sector_index_acc(td, DEVICE_INDEX(corresponding, td->sorted_devices), current_disk, ACCESS_COUNT(sector->access_count), is_cache_sector, is_faster, &to_swap_pos) &&
+					(td->pin_count == 0 || td_sector_pin(td, td->device_sectors[to_swap_pos]) == TDISK_PIN_NONE))
+				{
+					to_swap = td->device_sectors[to_swap_pos];
+
+					//printk(KERN_DEBUG "tDisk: %u: pre-swapping %llu (%u - %u) with %llu (%u - %u)\n", current_disk, logical_sector, sector->disk, sector->access_count, to_swap, td_index(td, to_swap)->disk, td_index(td, to_swap)->access_count);
+
+					//Simply swap those sectors
+					BUG_ON(td_index(td, to_swap)->disk != current_disk);
+
+					td->assigned_devices[logical_sector] = DEVICE_INDEX(corresponding, td->sorted_devices);
+					td->assigned_devices[to_swap] = (tdisk_index)sorted_disk;
+					td->device_sectors[i] = (__u32)to_swap;
+					td->device_sectors[to_swap_pos] = (__u32)logical_sector;
+
+					corresponding->amount_blocks++;
+					td->sorted_devices[sorted_disk-1].amount_blocks++;
+				}
+				//else printk(KERN_DEBUG "tDisk: %u: Didn't find a sector to swap %llu (%u - %u) \n", current_disk, logical_sector, sector->disk, sector->access_count);
+			}
+		}
+	}
+}
+
+#ifdef USE_MIGRATION_BUDGET
+
+/**
+  * Returns the whole disk where the given file is stored.
+  * 0 is returned if the file is not stored on a local disk
+ **/
+static dev_t td_get_backing_dev(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev;
+
+	if(S_ISBLK(inode->i_mode))bdev = inode->i_bdev;
+	else bdev = inode->i_sb->s_bdev;
+
+	if(!bdev)return 0;
+
+	//Partitions of the same disk share the budget
+	if(bdev->bd_contains)bdev = bdev->bd_contains;
+
+	return bdev->bd_dev;
+}
+
+/**
+  * Returns the migration budget of the given disk.
+  * td_migration_lock needs to be held
+ **/
+static struct td_migration_budget* td_find_migration_budget(dev_t dev)
+{
+	unsigned int i;
+
+	if(dev == 0)return NULL;
+
+	for(i = 0; i < TDISK_MAX_MIGRATION_BUDGETS; ++i)
+	{
+		if(td_migration_budgets[i].dev == dev)
+			return &td_migration_budgets[i];
+	}
+
+	return NULL;
+}
+
+/**
+  * Adds the given internal device to the migration
+  * budget of its disk
+ **/
+static void td_register_migration_device(struct td_internal_device *device)
+{
+	struct td_migration_budget *budget;
+	unsigned int i;
+
+	if(device->backing_dev == 0)return;
+
+	spin_lock(&td_migration_lock);
+
+	budget = td_find_migration_budget(device->backing_dev);
+	for(i = 0; !budget && i < TDISK_MAX_MIGRATION_BUDGETS; ++i)
+	{
+		if(td_migration_budgets[i].dev != 0)continue;
+
+		budget = &td_migration_budgets[i];
+		memset(budget, 0, sizeof(struct td_migration_budget));
+		budget->dev = device->backing_dev;
+		budget->bytes_left = MIGRATION_BUDGET_BYTES;
+		budget->interval_start = jiffies;
+		budget->owner = -1;
+	}
+
+	if(budget)budget->users++;
+	else printk(KERN_WARNING "tDisk: No migration budget available for disk %u:%u\n", MAJOR(device->backing_dev), MINOR(device->backing_dev));
+
+	spin_unlock(&td_migration_lock);
+}
+
+/**
+  * Removes the given internal device from the migration
+  * budget of its disk
+ **/
+static void td_unregister_migration_device(struct td_internal_device *device)
+{
+	struct td_migration_budget *budget;
+
+	spin_lock(&td_migration_lock);
+
+	budget = td_find_migration_budget(device->backing_dev);
+	if(budget && --budget->users == 0)budget->dev = 0;
+
+	spin_unlock(&td_migration_lock);
+}
+
+/**
+  * Checks whether the given tDisk may move sectors now.
+  * This is the case if all of its disks which are shared
+  * with other internal devices have budget left and no
+  * other tDisk with more misplaced blocks moves sectors
+  * on them. Otherwise the tDisk claims the disks so that
+  * it is preferred as soon as they have budget again.
+ **/
+static bool td_acquire_migration_budget(struct tdisk *td)
+{
+	tdisk_index disk;
+	bool allowed = true;
+
+	spin_lock(&td_migration_lock);
+
+	for(disk = 1; disk <= td->internal_devices_count; ++disk)
+	{
+		struct td_migration_budget *budget = td_find_migration_budget(td->internal_devices[disk-1].backing_dev);
+
+		//The budget only matters for shared disks
+		if(!budget || budget->users < 2)continue;
+
+		while(time_after_eq(jiffies, budget->interval_start + MIGRATION_BUDGET_INTERVAL))
+		{
+			budget->interval_start += MIGRATION_BUDGET_INTERVAL;
+			budget->bytes_left += MIGRATION_BUDGET_BYTES;
+			if(budget->bytes_left >= MIGRATION_BUDGET_BYTES)
+			{
+				budget->bytes_left = MIGRATION_BUDGET_BYTES;
+				budget->interval_start = jiffies;
+			}
+		}
+
+		//Another tDisk needs the disk more urgently. If both have
+		//the same amount of misplaced blocks the lower number wins
+		if(budget->owner != td->number && time_before(jiffies, budget->owner_claim + MIGRATION_CLAIM_TIMEOUT) &&
+			(budget->owner_misplaced > td->misplaced_blocks || (budget->owner_misplaced == td->misplaced_blocks && budget->owner < td->number)))
+		{
+			allowed = false;
+			continue;
+		}
+
+		budget->owner = td->number;
+		budget->owner_misplaced = td->misplaced_blocks;
+		budget->owner_claim = jiffies;
+
+		if(budget->bytes_left <= 0)allowed = false;
+	}
+
+	spin_unlock(&td_migration_lock);
+
+	return allowed;
+}
+
+/**
+  * Charges the bytes which were moved on the given
+  * internal device to the budget of its disk
+ **/
+static void td_charge_migration_budget(struct td_internal_device *device, __s64 bytes)
+{
+	struct td_migration_budget *budget;
+
+	spin_lock(&td_migration_lock);
+
+	budget = td_find_migration_budget(device->backing_dev);
+	if(budget)budget->bytes_left -= bytes;
+
+	spin_unlock(&td_migration_lock);
+}
+
+#else
+#pragma message "Migration budget is disabled"
+#endif //USE_MIGRATION_BUDGET
+
+/**
+  * This function checks if the given tDisk is ready.
+  * A tDisk is ready when all internal devices are present
+ **/
+static bool td_is_ready(struct tdisk *td)
+{
+	tdisk_index disk;
+
+	for(disk = 1; disk <= td->internal_devices_count; ++disk)
+	{
+		if(!device_is_ready(&td->internal_devices[disk-1]))
+			return false;
+	}
+
+	return true;
+}
+
+#ifdef USE_HEAT_SNAPSHOT
+
+/**
+  * Writes the next chunk of sector indices whose heat changed
+  * to all internal devices. The sector indices contain the
+  * access count, so they are read again as heat when the
+  * internal devices are added. A new snapshot is started
+  * every HEAT_SNAPSHOT_INTERVAL.
+  * The function returns true when a chunk was written.
+ **/
+static bool td_write_heat_snapshot(struct tdisk *td)
+{
+	unsigned long chunk;
+	sector_t logical_sector;
+	sector_t length;
+	tdisk_index disk;
+
+	if(td->heat_snapshot_cursor >= TDISK_HEAT_SNAPSHOT_CHUNKS)
+	{
+		if(time_before(jiffies, td->heat_snapshot_start + HEAT_SNAPSHOT_INTERVAL))return false;
+		if(!td_is_ready(td))return false;
+
+#ifdef USE_PERCPU_HEAT
+		//The buffered accesses are part of the snapshot
+		td_fold_heat(td);
+#endif //USE_PERCPU_HEAT
+
+		td->heat_snapshot_start = jiffies;
+		td->heat_snapshot_cursor = 0;
+	}
+
+	chunk = find_next_bit(td->heat_snapshot_dirty, TDISK_HEAT_SNAPSHOT_CHUNKS, td->heat_snapshot_cursor);
+	logical_sector = (sector_t)chunk << td->heat_snapshot_shift;
+
+	if(chunk >= TDISK_HEAT_SNAPSHOT_CHUNKS || logical_sector >= td->max_sectors)
+	{
+		//Snapshot finished
+		td->heat_snapshot_cursor = TDISK_HEAT_SNAPSHOT_CHUNKS;
+		return false;
+	}
+
+	clear_bit(chunk, td->heat_snapshot_dirty);
+	td->heat_snapshot_cursor = chunk + 1;
+	length = min_t(sector_t, (sector_t)1 << td->heat_snapshot_shift, td->max_sectors - logical_sector);
+
+	for(disk = 1; disk <= td->internal_devices_count; ++disk)
+	{
+		if(td_write_indices_to_disk(td, logical_sector, length, disk))
+		{
+			//Trying again with the next snapshot
+			printk_ratelimited(KERN_WARNING "tDisk: Error writing heat snapshot of sectors %llu-%llu to disk %u\n", logical_sector, logical_sector + length - 1, disk);
+			set_bit(chunk, td->heat_snapshot_dirty);
+		}
+	}
+
+	return true;
+}
+
+#endif //USE_HEAT_SNAPSHOT
+
+/**
+  * This function moves the sector with the
+  * highest access count to the disk with the
+  * best performance.
+  * The function returns true and sets td->access_count_resort
+  * when a sector could be moved.
+ **/
+static bool td_move_one_sector(struct tdisk *td)
+{
+	bool swapped = false;
+	unsigned int sorted_disk;
+	sector_t pos;
+	sector_t correctly_stored;
+
+	//Check if all devices are loaded
+	if(!td_is_ready(td))
+	{
+		//Not all disks are loaded yet
+		printk(KERN_DEBUG "tDisk: Not all disks are ready. Not moving sectors\n");
+		return false;
+	}
+
+	if(td->sorted_devices == NULL)
+	{
+		//Create sorted devices
+		td->sorted_devices = vmalloc(sizeof(struct sorted_internal_device) * td->internal_devices_count);
+		if(!td->sorted_devices)
+		{
+			printk(KERN_WARNING "tDisk: Error allocating sorted_devices memory\n");
+			return false;
+		}
+
+		td->device_sectors = vmalloc((size_t)(sizeof(__u32) * td->max_sectors));
+		if(!td->device_sectors)
+		{
+			printk(KERN_WARNING "tDisk: Error allocating device_sectors memory\n");
+			vfree(td->sorted_devices);
+			td->sorted_devices = NULL;
+			return false;
+		}
+
+		td_insert_sorted_internal_devices(td);
+
+		//Assigning the sorted sectors to the sorted devices...
+		td_assign_sectors(td);
+	}
+
+	correctly_stored = 0;
+	td->misplaced_blocks = 0;
+	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
+	{
+		correctly_stored += td->sorted_devices[sorted_disk-1].amount_blocks;
+		td->misplaced_blocks += td->sorted_devices[sorted_disk-1].dev->size_blocks - td->sorted_devices[sorted_disk-1].amount_blocks;
+		/*printk(KERN_DEBUG "tDisk: Internal disk %u (speed: %u rank --> %llu): Capacity: %llu, Correctly stored: %llu, %u percent\n",
+						td->sorted_devices[sorted_disk-1].dev-td->internal_devices+1,
+						sorted_disk,
+						td_get_device_performance(td->sorted_devices[sorted_disk-1].dev),
+						td->sorted_devices[sorted_disk-1].dev->size_blocks,
+						td->sorted_devices[sorted_disk-1].amount_blocks,
+						(size_t)td->sorted_devices[sorted_disk-1].amount_blocks*100 / (size_t)td->sorted_devices[sorted_disk-1].dev->size_blocks);*/
+	}
+
+	//Moving the sector with highest access count to
+	//the disk with the best performance
+	for(sorted_disk = 1; sorted_disk <= td->internal_devices_count; ++sorted_disk)
+	{
+		bool found = false;
+		sector_t highest = 0;
+		sector_t to_swap = 0;
+		tdisk_index current_disk_index = DEVICE_INDEX(td->sorted_devices[sorted_disk-1].dev, td->internal_devices);
+		struct sorted_internal_device *other_disk;
+		tdisk_index other_disk_sorted_index;
+
+		if(td->sorted_devices[sorted_disk-1].amount_blocks == td->sorted_devices[sorted_disk-1].dev->size_blocks)
+		{
+			//All blocks are correctly stored. Moving on to slower disk...
+			continue;
+		}
+
+		//If we reach this point there is at least one
+		//sector stored on a wrong disk which should be
+		//stored on this disk.
+		//So searching the sector with the highest access
+		//count which gains the best performance.
+		for(pos = td->sorted_devices[sorted_disk-1].first_sector; pos < td->sorted_devices[sorted_disk-1].first_sector + td->sorted_devices[sorted_disk-1].sector_count; ++pos)
+		{
+			sector_t logical_sector = td->device_sectors[pos];
+			struct sector_index *item = td_index(td, logical_sector);
+
+			if(item->disk != current_disk_index)
+			{
+				if(!found || ACCESS_COUNT(item->access_count) > ACCESS_COUNT(td_index(td, highest)->access_count))
+				{
+					highest = logical_sector;
+					found = true;
+				}
+			}
+		}
+
+		//Above there is a continue flag so there must
+		//be a wrong sector. Otherwise it is a bug
+		MY_BUG_ON(!found, PRINT_ULL(td->sorted_devices[sorted_disk-1].amount_blocks), PRINT_ULL(td->sorted_devices[sorted_disk-1].dev->size_blocks));
+		other_disk = td_find_sorted_device(td->sorted_devices, &td->internal_devices[td_index(td, highest)->disk-1], td->internal_devices_count);
+
+		BUG_ON(!other_disk);
+		other_disk_sorted_index = DEVICE_INDEX(other_disk, td->sorted_devices);
+
+		//Now looking at the disk where the current highest
+		//sector is stored for a block that belongs to
+		//the current disk
+		found = td_find_sector_index(td, other_disk_sorted_index, current_disk_index, &to_swap);
+
+		//If no sector was found it means we have a circual dependency
+		//So we just skip to the next disk and proceed
+		while(!found && other_disk_sorted_index < td->internal_devices_count)
+		{
+			if(++other_disk_sorted_index != sorted_disk)
+				found = td_find_sector_index(td, other_disk_sorted_index, current_disk_index, &to_swap);
+		}
+
+		if(found)
+		{
+			//OK, now we found a sector of the possibly fastest disk
+			//which is stored on the possibly slowest disk. When we
+			//swap those sectors we gain the highest possible performance.
+
+			sector_t logical_a = highest;
+			sector_t logical_b = to_swap;
+			struct sector_index *a = td_index(td, logical_a);
+			struct sector_index *b = td_index(td, logical_b);
+			unsigned int copied_blocks;
+			TRACE_TIME(start);
+
+			//printk(KERN_DEBUG "tDisk: swapping logical sectors %llu (disk: %u, access: %u) and %llu (disk: %u, access: %u): %llu/%llu\n",
+			//		logical_a, a->disk, a->access_count, logical_b, b->disk, b->access_count, correctly_stored, td->size_blocks);
+
+			TRACE_START(start);
+			td_swap_sectors(td, logical_a, a, logical_b, b, true, &copied_blocks);
+			TRACE_SPAN(&td->debug, TDISK_TRACE_MIGRATION, logical_a, a->disk, start);
+
+#ifdef USE_PERF_COUNTERS
+			if(copied_blocks != 0)td_count_migration(td, (__u64)copied_blocks * td->blocksize);
+#endif //USE_PERF_COUNTERS
+
+#ifdef USE_MIGRATION_BUDGET
+			//Every copied block is read from one of the
+			//disks and written to the other one
+			td_charge_migration_budget(&td->internal_devices[a->disk-1], (__s64)copied_blocks * td->blocksize);
+			td_charge_migration_budget(&td->internal_devices[b->disk-1], (__s64)copied_blocks * td->blocksize);
+#endif //USE_MIGRATION_BUDGET
+
+			if(td->sorted_devices[sorted_disk-1].dev == &td->internal_devices[a->disk-1])
+				td->sorted_devices[sorted_disk-1].amount_blocks++;
+			if(td->sorted_devices[other_disk_sorted_index-1].dev == &td->internal_devices[b->disk-1])
+				td->sorted_devices[other_disk_sorted_index-1].amount_blocks++;
+
+			td->access_count_resort = 1;
+			swapped = true;
+			break;
+		}
+
+		if(swapped)break;
+	}
+
+	return swapped;
+}
+
+#else
+#pragma message "Moving sectors is disabled"
+#endif //MOVE_SECTORS
+
+#ifdef MEASURE_PING_PERFORMANCE
+
+void td_measure_device_performance(struct td_internal_device *device, loff_t size)
+{
+	struct timespec startTime;
+	struct timespec endTime;
+	unsigned long time = jiffies;
+	char *buffer = vmalloc(1048576);
+	unsigned int counter = 0;
+	unsigned int elapsed;
+
+	if(!buffer)
+	{
+		printk(KERN_ERR "tDisk: Unable to get memory to measure device performance\n");
+		return;
+	}
+
+	getnstimeofday(&startTime);
+
+	while(jiffies-time < HZ*5)
+	{
+		read_data(device, buffer, counter*1048576, 1048576);
+		counter++;
+		if(counter*1048576 > size)break;
+	}
+
+	getnstimeofday(&endTime);
+	update_performance(READ, &startTime, &endTime, counter, &device->performance);
+
+	elapsed = (unsigned)(endTime.tv_sec-startTime.tv_sec);
+	if(elapsed == 0)elapsed = 1;
+	printk(KERN_DEBUG "tDisk: read %u MiB --> %u MiB/s\n", counter, counter/elapsed);
+
+	vfree(buffer);
+}
+
+#else
+#pragma message "Ping performance measurement is disabled"
+#endif //MEASURE_PING_PERFORMANCE
+
+/**
+  * Returns the heat of the given sector which is used to sort
+  * the sectors. Blocks where only some regions are accessed only
+  * get the part of the access count of their accessed regions.
+  * An empty bitmap means nothing is known (e.g. after loading)
+ **/
+inline static unsigned int td_sector_heat(const struct tdisk *td, const struct sector_index *index)
+{
+	unsigned int heat = ACCESS_COUNT(index->access_count);
+
+#ifdef USE_SUB_BLOCK_HEAT
+	if(td->region_count > 1 && index->regions != 0)
+		heat = heat * hweight8(index->regions) / td->region_count;
+#else
+#pragma message "Sub-block heat is disabled"
+#endif //USE_SUB_BLOCK_HEAT
+
+	return heat;
+}
+
+inline static bool compare_sectors(struct tdisk *td, sector_t logical_a, sector_t logical_b)
+{
+	const struct sector_index *a = td_peek_index(td, logical_a);
+	const struct sector_index *b = td_peek_index(td, logical_b);
+
+	//Obviously, used sectors are "larger" than unused sectors
+	if(a->disk != 0 && b->disk == 0)return true;
+	if(a->disk == 0 && b->disk != 0)return false;
+
+	//This condition is used for the cache functionality.
+	//Since the cache sectors are stored at the end of the tdisk we
+	//need to calculate the logical sector in order to find out
+	//if the sector is a cache sector.
+	//The reason why we need to do all this is because cache sectors
+	//Should be stored on the fastest disk to proovide the highest
+	//possible write performance...
+	if(td_is_reserved_cache_sector(td, logical_a))
+	{
+		if(!td_is_reserved_cache_sector(td, logical_b))return true;
+		else return false;
+	}
+	else if(td_is_reserved_cache_sector(td, logical_b))return false;
+
+	//Obviously, sectors with a higher access count are "larger"
+	if(td_sector_heat(td, a) > td_sector_heat(td, b))return true;
+
+	return false;
+}
+
+/**
+  * This function sorts all the sector indices
+  * This is useful at the loading time
+ **/
+bool td_reorganize_all_indices(struct tdisk *td)
+{
+	sector_t i;
+	sector_t j;
+	__u32 item;
+
+	unsigned long start_time = jiffies;
+
+	bool did_something = false;
+
+	//Insertion sort of the logical sectors. The access
+	//counts change slowly so the array is almost sorted
+	for(i = 1; i < td->max_sectors; ++i)
+	{
+		item = td->sorted_sectors[i];
+
+		for(j = i; j > 0 && compare_sectors(td, item, td->sorted_sectors[j-1]); --j)
+			td->sorted_sectors[j] = td->sorted_sectors[j-1];
+
+		if(j != i)
+		{
+			td->sorted_sectors[j] = item;
+			did_something = true;
+		}
+
+		if((jiffies - start_time) >= HZ && did_something)return did_something;
+	}
+
+	return did_something;
+}
+
+/**
+  * Checks if the given disk header is compatible with the current driver.
+  * It returns one of the following values:
+  *  - 0 if the header is compatible (current driver version is higher or equal)
+  *  - 1 if the given header was from an entirely new disk. This means it needs to be initialized
+  *  - -1 if the the header was from a driver with a greater minor version than the
+  *    current driver. It may be compatible...
+  *  - -2 if the the header was from a driver with a greater major version than the
+  *    current driver. It may be compatible but probably not...
+ **/
+static int td_is_compatible_header(struct tdisk *td, struct tdisk_header *header)
+{
+	if(strcmp(header->driver_name, DRIVER_NAME " \x44\x61\x6E\x6B\x65 \x56\x61\x74\x65\x72\x6C\x65") != 0)return 1;
+
+	if(header->major_version == DRIVER_MAJOR_VERSION)
+	{
+		if(header->minor_version > DRIVER_MINOR_VERSION)return -1;
+	}
+	else if(header->major_version > DRIVER_MAJOR_VERSION)return -2;
+
+	return 0;
+}
+
+/**
+  * Returns the index format of the given (compatible) header.
+  * The index version is stored in the header since the driver
+  * version 1.1. Before, the legacy format was used.
+ **/
+static __u32 td_get_index_version(struct tdisk_header *header)
+{
+	if(header->major_version == 1 && header->minor_version == 0)
+		return TDISK_INDEX_VERSION_LEGACY;
+
+	return header->index_version;
+}
+
+/**
+  * Calculates the amount of sectors which can be stored
+  * in the index area of a disk which was created using
+  * the legacy index format. This way the header size stays
+  * the same and the data doesn't need to be moved.
+ **/
+static sector_t td_get_migrated_max_sectors(struct tdisk *td, sector_t legacy_max_sectors)
+{
+	loff_t header_size_byte = (loff_t)sizeof(struct tdisk_header) + (loff_t)legacy_max_sectors * sizeof(struct legacy_sector_index);
+	loff_t header_size = header_size_byte;
+
+	if(__div64_32(&header_size, td->blocksize))header_size++;
+
+	return __div64_32_nomod(header_size*td->blocksize - td->index_offset_byte, sizeof(struct disk_sector_index));
+}
+
+/**
+  * Reads the td header from the given device
+  * and measures the disk performance if perf != NULL
+ **/
+static int td_read_header(struct tdisk *td, struct td_internal_device *device, struct tdisk_header *header, bool first_device, int *index_operation_to_do, bool format)
+{
+	int error;
+
+	error = read_data(device, header, 0, sizeof(struct tdisk_header));
+	if(error)return error;
+
+	//printk(KERN_DEBUG "tDisk: Header: driver: %s, minor: %u, major: %u\n", header->driver_name, header->major_version, header->minor_version);
+	switch(td_is_compatible_header(td, header))
+	{
+	case 1:
+		//Entirely new disk.
+		header->disk_index = (tdisk_index)(td->internal_devices_count + 1);	//+1 because 0 means unused
+		header->index_version = TDISK_INDEX_VERSION;
+		(*index_operation_to_do) = WRITE;
+		break;
+	case 0:
+		//OK, compatible header.
+		//Either same or lower (compatible) driver version
+		//Disk was already part of a tDisk.
+		//So doing nothing to preserve indices etc.
+	case -1:
+		//Oops, the disk was part of a tdisk
+		//But using a driver with a higher minor number
+		//Assuming that user space knows if it's compatible...
+		//Doing nothing
+	case -2:
+		//Oops, the disk was part of a tdisk
+		//But using a driver with a higher major number
+		//Assuming that user space knows if it's compatible...
+		//Doing nothing
+
+		if(first_device)
+			(*index_operation_to_do) = READ;
+		else
+			(*index_operation_to_do) = COMPARE;
+
+#ifdef MEASURE_PERFORMANCE
+		device->performance = header->performance;
+#else
+//#pragma message "Performance measurement is disabled"
+#endif //MEASURE_PERFORMANCE
+		break;
+	default:
+		//Bug
+		printk(KERN_ERR "tDisk: Bug in td_is_compatible_header function\n");
+		BUG_ON(td_is_compatible_header(td, header));
+		(*index_operation_to_do) = 123456;
+		break;
+	}
+
+	if((*index_operation_to_do) != WRITE && format == true)
+	{
+		printk(KERN_INFO "tDisk: device was part of a tDisk but formatting as you requested\n");
+		(*index_operation_to_do) = WRITE;
+		header->disk_index = (tdisk_index)(td->internal_devices_count + 1);
+		header->index_version = TDISK_INDEX_VERSION;
+	}
+
+	if((*index_operation_to_do) != WRITE)
+	{
+		//Since the driver version 2.0 the blocksize is stored
+		//in a new field so that older drivers reject the disk
+		if(header->major_version < 2)header->blocksize = header->legacy_blocksize;
+
+		header->index_version = td_get_index_version(header);
+
+		//Older formats detected compressed blocks by a magic
+		//number which can't be told apart from the user data
+		if((header->flags & TDISK_HEADER_FLAG_COMPRESS) && header->index_version < TDISK_INDEX_VERSION_COMPRESSED)
+		{
+			printk(KERN_ERR "tDisk: device stores compressed blocks in an outdated format\n");
+			return -EINVAL;
+		}
+
+		switch(header->index_version)
+		{
+		case TDISK_INDEX_VERSION_LEGACY:
+			//The indices are converted when they are read
+			printk(KERN_INFO "tDisk: device uses the legacy index format. Migrating...\n");
+			header->current_max_sectors = td_get_migrated_max_sectors(td, header->current_max_sectors);
+			break;
+		case TDISK_INDEX_VERSION_COMPACT:
+			//The pin table is written to the reserved area
+			//when the header is updated
+			printk(KERN_INFO "tDisk: device has no pin table. Migrating...\n");
+			break;
+		case TDISK_INDEX_VERSION_PINNED:
+			//The access counts are limited when they are read
+			printk(KERN_INFO "tDisk: device has no staged flags. Migrating...\n");
+			break;
+		case TDISK_INDEX_VERSION_STAGED:
+			//The access counts are limited when they are read
+			printk(KERN_INFO "tDisk: device has no compressed flags. Migrating...\n");
+			break;
+		case TDISK_INDEX_VERSION_COMPRESSED:
+			break;
+		case TDISK_INDEX_VERSION_MIGRATING:
+			//The indices are taken from the other devices
+			if(first_device)
+			{
+				printk(KERN_ERR "tDisk: device was being migrated when the system crashed. Please add another device of this tDisk first\n");
+				return -EINVAL;
+			}
+			printk(KERN_WARNING "tDisk: device was being migrated when the system crashed. Restoring its indices...\n");
+			break;
+		default:
+			printk(KERN_ERR "tDisk: Unknown index version %u\n", header->index_version);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/**
+  * Writes the td header to the given device
+  * and measures the disk performance if perf != NULL
+  * The header is written using the given index version
+ **/
+static int td_write_header(struct td_internal_device *device, struct tdisk_header *header, __u32 index_version)
+{
+	int ret;
+
+	memset(header->driver_name, 0, sizeof(header->driver_name));
+	strcpy(header->driver_name, DRIVER_NAME " \x44\x61\x6E\x6B\x65 \x56\x61\x74\x65\x72\x6C\x65");
+	header->driver_name[sizeof(header->driver_name)-1] = 0;
+	header->major_version = DRIVER_MAJOR_VERSION;
+	header->minor_version = DRIVER_MINOR_VERSION;
+	header->index_version = index_version;
+	header->legacy_blocksize = 0;
+	header->flags = device->compress ? TDISK_HEADER_FLAG_COMPRESS : 0;
+	memset(header->placeholder, 0, sizeof(header->placeholder));
+
+	ret = write_data(device, header, 0, sizeof(struct tdisk_header));
+
+	if(ret)printk(KERN_ERR "tDisk: Error writing header: %d\n", ret);
+
+	return ret;
+}
+
+/**
+  * Reads the pin table from the given device
+ **/
+static int td_read_pins(struct tdisk *td, struct td_internal_device *device)
+{
+	int ret;
+
+	BUILD_BUG_ON(sizeof(struct td_pin_table) > TDISK_HEADER_RESERVED);
+
+	ret = read_data(device, &td->pins, sizeof(struct tdisk_header), sizeof(struct td_pin_table));
+	if(ret)
+	{
+		printk(KERN_ERR "tDisk: Error reading pin table: %d\n", ret);
+		memset(&td->pins, 0, sizeof(struct td_pin_table));
+		td->pin_count = 0;
+		return ret;
+	}
+
+	for(td->pin_count = 0; td->pin_count < TDISK_MAX_PINS; ++td->pin_count)
+	{
+		if(td->pins.pins[td->pin_count].tier == TDISK_PIN_NONE)break;
+	}
+
+	return ret;
+}
+
+/**
+  * Writes the pin table to the given device
+ **/
+static int td_write_pins(struct tdisk *td, struct td_internal_device *device)
+{
+	int ret;
+
+	ret = write_data(device, &td->pins, sizeof(struct tdisk_header), sizeof(struct td_pin_table));
+
+	if(ret)printk(KERN_ERR "tDisk: Error writing pin table: %d\n", ret);
+
+	return ret;
+}
+
+/**
+  * Converts the given index which was read from disk
+  * to the in-memory format
+ **/
+static int td_convert_index(struct tdisk *td, const u8 *entry, sector_t sector, __u32 index_version, struct sector_index *index)
+{
+	memset(index, 0, sizeof(struct sector_index));
+
+	if(index_version == TDISK_INDEX_VERSION_LEGACY)
+	{
+		const struct legacy_sector_index *legacy = (const struct legacy_sector_index*)entry;
+
+		if(legacy->sector > (__u32)-1)
+		{
+			printk(KERN_ERR "tDisk: Can't migrate physical sector %llu of logical sector %llu\n", legacy->sector, sector);
+			return -EINVAL;
+		}
+
+		index->sector = (__u32)legacy->sector;
+		index->access_count = legacy->access_count;
+		index->disk = legacy->disk;
+
+		//Older versions only stored the used flag when the initial
+		//optimization moved the sector and cleared it together with
+		//the access count. So the disk doesn't know which sectors are
+		//unused and every assigned sector may hold data. The indices
+		//of the cache sectors only point to stale locations.
+		if(sector < td->size_blocks && index->disk != 0)
+			SET_USED_SECTOR(index->access_count);
+	}
+	else
+	{
+		const struct disk_sector_index *compact = (const struct disk_sector_index*)entry;
+
+		index->sector = compact->sector;
+		index->access_count = compact->access_count;
+		index->disk = compact->disk;
+	}
+
+	//Older formats used the flags for the access count
+	if(index_version < TDISK_INDEX_VERSION_STAGED && SECTOR_STAGED(index->access_count))
+	{
+		SET_UNSTAGED_SECTOR(index->access_count);
+		SET_ACCESS_COUNT(index->access_count, MAX_ACCESS_COUNT);
+	}
+	if(index_version < TDISK_INDEX_VERSION_COMPRESSED && SECTOR_COMPRESSED(index->access_count))
+	{
+		SET_COMPRESSED_SECTOR(index->access_count, false);
+		SET_ACCESS_COUNT(index->access_count, MAX_ACCESS_COUNT);
+	}
+
+	return 0;
+}
+
+/**
+  * Compares the given index which was read from the device
+  * with the given disk index with the index in memory
+ **/
+static void td_compare_index(struct tdisk *td, sector_t sector, struct sector_index *index, tdisk_index disk_index)
+{
+	int internal_ret = td_perform_index_operation(td, COMPARE, sector, index, false, false, 0);
+
+	//The used flag is only stored on the disk where the
+	//sector was stored when it was used for the first time.
+	//So it is sufficient if one disk knows it's used
+	if(SECTOR_USED(index->access_count))
+		td_index(td, sector)->access_count |= 1;
+
+	//The staged and compressed flags are written to the disk
+	//where the sector is stored, so this disk knows them best
+	if(index->disk == disk_index)
+	{
+		if(SECTOR_STAGED(index->access_count))SET_STAGED_SECTOR(td_index(td, sector)->access_count);
+		else SET_UNSTAGED_SECTOR(td_index(td, sector)->access_count);
+
+		SET_COMPRESSED_SECTOR(td_index(td, sector)->access_count, SECTOR_COMPRESSED(index->access_count));
+	}
+
+	if(internal_ret == -1)
+	{
+		//We have the rule that if the index doesn't match, each disk
+		//has priority of it's own index
+		if(index->disk == disk_index)
+		{
+			//Replace index value
+			td_perform_index_operation(td, WRITE, sector, index, false, false, 0);
+		}
+		else printk_ratelimited(KERN_WARNING "tDisk: Disk index doesn't match. Probably wrong or corrupt disk attached. Pay attention before you write to disk!\n");
+	}
+}
+
+/**
+  * Reads all the sector indices from the device in chunks.
+  * Indices which are stored in an older format are converted.
+  * Depending on the operation, they are either stored in
+  * memory (READ) or compared with the indices in memory
+  * (COMPARE, @see td_compare_index).
+ **/
+static int td_read_all_indices(struct tdisk *td, struct td_internal_device *device, __u32 index_version, int operation, tdisk_index disk_index)
+{
+	int ret = 0;
+	loff_t skip = td->index_offset_byte;
+	size_t entry_size = sizeof(struct disk_sector_index);
+	sector_t sectors = td->max_sectors;
+	sector_t sector;
+	sector_t length;
+	u8 *buffer;
+
+	//The legacy format stores the indices right after the header
+	if(index_version == TDISK_INDEX_VERSION_LEGACY)
+	{
+		skip = sizeof(struct tdisk_header);
+		entry_size = sizeof(struct legacy_sector_index);
+		sectors = __div64_32_nomod((uint64_t)(td->header_size * td->blocksize - skip), sizeof(struct legacy_sector_index));
+	}
+
+	buffer = kmalloc(entry_size * INDEX_WRITE_ENTRIES, GFP_KERNEL);
+	if(!buffer)return -ENOMEM;
+
+	for(sector = 0; sector < sectors && !ret; sector += length)
+	{
+		sector_t i;
+
+		length = min_t(sector_t, sectors - sector, INDEX_WRITE_ENTRIES);
+
+		ret = read_data(device, buffer, skip + (loff_t)(sector * entry_size), (unsigned int)(length * entry_size));
+
+		for(i = 0; i < length && !ret; ++i)
+		{
+			struct sector_index index;
+
+			ret = td_convert_index(td, &buffer[i * entry_size], sector + i, index_version, &index);
+			if(ret)break;
+
+			if(sector + i >= td->max_sectors)
+			{
+				//The migrated index area is too small
+				if(index.disk != 0)
+				{
+					printk(KERN_ERR "tDisk: Can't migrate logical sector %llu because the index is full\n", sector + i);
+					ret = -EINVAL;
+				}
+				continue;
+			}
+
+			//Unused indices don't need a page in memory
+			if(index.sector == 0 && index.state == 0 && !td_index_page(td, sector + i))continue;
+
+			if(operation == READ)(*td_index(td, sector + i)) = index;
+			else td_compare_index(td, sector + i, &index, disk_index);
+		}
+	}
+
+	if(ret)printk(KERN_ERR "tDisk: Error reading all disk indices: %d\n", ret);
+	else printk(KERN_DEBUG "tDisk: Success reading all disk indices\n");
+
+	kfree(buffer);
+
+	return ret;
+}
+
+#ifdef USE_INITIAL_OPTIMIZATION
+/**
+  * This function finds a sector which is unused and
+  * has the better performance than the given one.
+ **/
+sector_t td_find_sector_for_better_performance(struct tdisk *td, sector_t sector)
+{
+	tdisk_index i;
+	tdisk_index j;
+	tdisk_index disk = td_index(td, sector)->disk;
+	unsigned long long original_device_performance = td_get_device_performance(&td->internal_devices[disk-1]);
+	tdisk_index better_devices[TDISK_MAX_PHYSICAL_DISKS];
+	sector_t current_sector;
 
-	//Obviously, used sectors are "larger" than unused sectors
-	if(a->disk != 0 && b->disk == 0)return true;
-	if(a->disk == 0 && b->disk != 0)return false;
+	memset(better_devices, 0, sizeof(tdisk_index)*TDISK_MAX_PHYSICAL_DISKS);
 
-	//This condition is used for the cache functionality.
-	//Since the cache sectors are stored at the end of the tdisk we
-	//need to calculate the logical sector in order to find out
-	//if the sector is a cache sector.
-	//The reason why we need to do all this is because cache sectors
-	//Should be stored on the fastest disk to proovide the highest
-	//possible write performance...
-	if(logical_a >= td->size_blocks)
+	//Assigning devices with better performance to better_devices
+	//in an ordered mode
+	for(i = 1; i <= td->internal_devices_count; ++i)
 	{
-		if(logical_b < td->size_blocks)return true;
-		else return false;
+		unsigned long long current_device_performance;
+
+		if(i == disk)continue;
+		current_device_performance = td_get_device_performance(&td->internal_devices[i-1]);
+
+		//The current device is slower than the original
+		//device. It doesn't make sense to use it
+		if(current_device_performance > original_device_performance)
+			continue;
+
+		for(j = td->internal_devices_count; j > 0; --j)
+		{
+			if(better_devices[j-1] != 0)
+			{
+				if(td_get_device_performance(&td->internal_devices[better_devices[j-1] - 1]) > current_device_performance)
+					swap(better_devices[j-1], better_devices[j]);
+				else break;
+			}
+		}
+
+		better_devices[j] = i;
 	}
-	else if(logical_b >= td->size_blocks)return false;
 
-	//Obviously, sectors with a higher access count are "larger"
-	if(ACCESS_COUNT(a->access_count) > ACCESS_COUNT(b->access_count))return true;
+	//No faster device found
+	if(better_devices[0] == 0)return sector;
 
-	return false;
+	//Try to find a free sector from a better device
+	for(current_sector = 0; current_sector < td->max_sectors; ++current_sector)
+	{
+		if(td_index(td, current_sector)->disk == 0)break;
+
+		//A potential better sector must be resided on a different disk,
+		//not an unused disk (== 0) but an unused sector
+		if(td_index(td, current_sector)->disk == disk ||
+			SECTOR_USED(td_index(td, current_sector)->access_count))continue;
+
+		for(j = 0; j < td->internal_devices_count && better_devices[j] != 0; ++j)
+		{
+			//Original sector is better than current sector
+			if(td_index(td, sector)->disk == better_devices[j])break;
+
+			//Current sector is better. Swapping
+			if(td_index(td, current_sector)->disk == better_devices[j])
+			{
+				//Better sector found
+				sector = current_sector;
+
+				//Sector from best device found.
+				//Exiting loop
+				if(j == 0)current_sector = td->max_sectors;
+
+				//If we didn't find a free sector from the best disk yet
+				//we keep on searching... In some cases it really
+				//makes a huge difference using the fastest disk
+				break;
+			}
+		}
+	}
+
+	return sector;
 }
+#else
+#pragma message "Initial optimization is disabled"
+#endif //USE_INITIAL_OPTIMIZATION
+
+#ifdef USE_WRITE_BACK_CACHE
 
 /**
-  * This function sorts all the sector indices
-  * This is useful at the loading time
+  * The maximum amount of cache sectors which are checked
+  * for a free and fast sector when a sector is staged
  **/
-bool td_reorganize_all_indices(struct tdisk *td)
+#define WRITE_BACK_CACHE_SCAN 1024
+
+/**
+  * Frees the list of the sectors which are currently staged in
+  * the write back cache, e.g. because the cache sectors change.
+  * The staged sectors stay marked in their indices, so the list
+  * is rebuilt when it is needed (@see td_load_staged_sectors).
+ **/
+static void td_drop_staged_sectors(struct tdisk *td)
 {
-	//Sort entire arry
-	//list_sort(NULL, &td->sorted_sectors_head, &td_sector_index_callback_total);
+	if(td->staged_sectors != NULL)vfree(td->staged_sectors);
+	td->staged_sectors = NULL;
+	td->staged_count = 0;
+	td->staging_cursor = 0;
+	td->destaging_cursor = 0;
+}
 
-	struct sorted_sector_index *item_safe;
-	struct sorted_sector_index *item;
-	struct sorted_sector_index *prev;
+/**
+  * Clears the staged flags of the given staged sector and the
+  * cache sector which holds its original location. Both indices
+  * are written to the disks where the sectors are stored.
+ **/
+static void td_clear_staged_flags(struct tdisk *td, sector_t sector, sector_t cache_sector)
+{
+	SET_UNSTAGED_SECTOR(td_index(td, sector)->access_count);
+	SET_UNSTAGED_SECTOR(td_index(td, cache_sector)->access_count);
 
-	unsigned long start_time = jiffies;
+	td_write_index_to_disk(td, sector, td_index(td, sector)->disk);
+	td_write_index_to_disk(td, cache_sector, td_index(td, cache_sector)->disk);
+}
 
-	bool did_something = false;
-	bool moved = true;
-	while(moved)
+/**
+  * Builds the list of the staged sectors from the staged flags
+  * of the indices. Each staged sector is assigned to a flagged
+  * cache sector. The exact pairs don't matter because the
+  * flagged cache sectors only point to locations which hold stale
+  * data. Flags without a partner (e.g. because the system crashed
+  * while the indices were written) are cleared.
+  * The function returns false if there is not enough memory.
+ **/
+static bool td_load_staged_sectors(struct tdisk *td)
+{
+	sector_t sector;
+	sector_t slot = 0;
+
+	if(td->staged_sectors != NULL)return true;
+
+	td->staged_sectors = vzalloc(sizeof(sector_t) * td->cache_sectors);
+	if(!td->staged_sectors)
+	{
+		printk_ratelimited(KERN_WARNING "tDisk: Error allocating write back cache memory\n");
+		return false;
+	}
+	td->staged_count = 0;
+	td->staging_cursor = 0;
+	td->destaging_cursor = 0;
+
+	for(sector = 0; sector < td->size_blocks; ++sector)
 	{
-		moved = false;
-		list_for_each_entry_safe(item, item_safe, &td->sorted_sectors_head, total_sorted)
+		if(!SECTOR_STAGED(td_index(td, sector)->access_count))continue;
+
+		while(slot < td->cache_sectors && !SECTOR_STAGED(td_index(td, td->size_blocks + slot)->access_count))
+			slot++;
+
+		if(slot == td->cache_sectors)
 		{
-			//printk_ratelimited(KERN_DEBUG "tDisk sorting logical sector %u\n", item-td->sorted_sectors);
-			if(likely(item->total_sorted.prev != &td->sorted_sectors_head))
-			{
-				bool move = false;
-				prev = list_entry(item->total_sorted.prev, struct sorted_sector_index, total_sorted);
+			SET_UNSTAGED_SECTOR(td_index(td, sector)->access_count);
+			td_write_index_to_disk(td, sector, td_index(td, sector)->disk);
+			continue;
+		}
 
-				while(compare_sectors(td, item->physical_sector, prev->physical_sector))
-				{
-					move = true;
-					if(unlikely(prev->total_sorted.prev == &td->sorted_sectors_head))break;
-					prev = list_entry(prev->total_sorted.prev, struct sorted_sector_index, total_sorted);
-				}
+		td->staged_sectors[slot++] = sector + 1;
+		td->staged_count++;
+	}
 
-				if(move)
-				{
-					did_something = true;
-					moved = true;
-					list_del_init(&item->total_sorted);
+	for(; slot < td->cache_sectors; ++slot)
+	{
+		sector = td->size_blocks + slot;
+		if(!SECTOR_STAGED(td_index(td, sector)->access_count))continue;
 
-					if(unlikely(prev->total_sorted.prev == &td->sorted_sectors_head))
-					{
-						list_add(&item->total_sorted, &td->sorted_sectors_head);
-					}
-					else
-					{
-						list_add(&item->total_sorted, &prev->total_sorted);
-					}
-				}
-			}
+		SET_UNSTAGED_SECTOR(td_index(td, sector)->access_count);
+		td_write_index_to_disk(td, sector, td_index(td, sector)->disk);
+	}
+
+	if(td->staged_count != 0)printk(KERN_DEBUG "tDisk: %llu sectors are staged in the write back cache\n", td->staged_count);
+
+	return true;
+}
+
+/**
+  * This function stages the given (used) logical sector in a
+  * cache sector which is stored on a faster disk. Only the
+  * indices are swapped, no data is copied. This means the
+  * caller must overwrite the entire sector afterwards.
+  * The function returns true if the sector was staged.
+ **/
+static bool td_stage_sector(struct tdisk *td, sector_t sector)
+{
+	tdisk_index i;
+	sector_t checked;
+	bool faster_device = false;
+	tdisk_index disk = td_index(td, sector)->disk;
+	unsigned long long original_device_performance = td_get_device_performance(&td->internal_devices[disk-1]);
 
-			if((jiffies - start_time) >= HZ && did_something)return did_something;
+	if(td->cache_sectors == 0 || td->modifying)return false;
+	if(td->staged_count >= td->cache_sectors)return false;
+
+	//Check if there is a faster device at all
+	for(i = 1; i <= td->internal_devices_count; ++i)
+	{
+		if(i != disk && td_get_device_performance(&td->internal_devices[i-1]) < original_device_performance)
+		{
+			faster_device = true;
+			break;
 		}
 	}
+	if(!faster_device)return false;
 
-	return did_something;
+	if(!td_load_staged_sectors(td))return false;
+
+	for(checked = 0; checked < td->cache_sectors && checked < WRITE_BACK_CACHE_SCAN; ++checked)
+	{
+		sector_t slot = td->staging_cursor;
+		sector_t cache_sector = td->size_blocks + slot;
+		tdisk_index cache_disk = td_index(td, cache_sector)->disk;
+
+		if(++td->staging_cursor == td->cache_sectors)td->staging_cursor = 0;
+
+		//The cache sector must be free and stored on a faster disk
+		if(td->staged_sectors[slot] != 0)continue;
+		if(cache_disk == 0 || cache_disk == disk || SECTOR_USED(td_index(td, cache_sector)->access_count))continue;
+		if(td_get_device_performance(&td->internal_devices[cache_disk-1]) >= original_device_performance)continue;
+
+		//The flags are written together with the swapped indices
+		SET_STAGED_SECTOR(td_index(td, sector)->access_count);
+		SET_STAGED_SECTOR(td_index(td, cache_sector)->access_count);
+		td_swap_indices(td, sector, cache_sector);
+
+		td->staged_sectors[slot] = sector + 1;
+		td->staged_count++;
+
+		return true;
+	}
+
+	return false;
 }
 
 /**
-  * Checks if the given disk header is compatible with the current driver.
-  * It returns one of the following values:
-  *  - 0 if the header is compatible (current driver version is higher or equal)
-  *  - 1 if the given header was from an entirely new disk. This means it needs to be initialized
-  *  - -1 if the the header was from a driver with a greater minor version than the
-  *    current driver. It may be compatible...
-  *  - -2 if the the header was from a driver with a greater major version than the
-  *    current driver. It may be compatible but probably not...
+  * Stops writing the given logical sector back, e.g. because it
+  * was discarded. Its index keeps pointing to the cache sector
+  * which is safe, it's up to the optimizer to move it.
  **/
-static int td_is_compatible_header(struct tdisk *td, struct tdisk_header *header)
+static void td_unstage_sector(struct tdisk *td, sector_t sector)
 {
-	if(strcmp(header->driver_name, DRIVER_NAME " \x44\x61\x6E\x6B\x65 \x56\x61\x74\x65\x72\x6C\x65") != 0)return 1;
+	sector_t slot;
 
-	if(header->major_version == DRIVER_MAJOR_VERSION)
+	if(!SECTOR_STAGED(td_index(td, sector)->access_count))return;
+	if(!td_load_staged_sectors(td))return;
+
+	for(slot = 0; slot < td->cache_sectors; ++slot)
 	{
-		if(header->minor_version > DRIVER_MINOR_VERSION)return -1;
+		if(td->staged_sectors[slot] == sector + 1)
+		{
+			td->staged_sectors[slot] = 0;
+			td->staged_count--;
+			td_clear_staged_flags(td, sector, td->size_blocks + slot);
+			return;
+		}
 	}
-	else if(header->major_version > DRIVER_MAJOR_VERSION)return -2;
-
-	return 0;
 }
 
 /**
-  * Reads the td header from the given device
-  * and measures the disk performance if perf != NULL
+  * This function writes one staged sector back to its original
+  * location which is now held by the cache sector. Afterwards the
+  * cache sector is stored on the fast disk again.
+  * The function returns true if a sector was written back.
  **/
-static int td_read_header(struct tdisk *td, struct td_internal_device *device, struct tdisk_header *header, bool first_device, int *index_operation_to_do, bool format)
+static bool td_destage_one_sector(struct tdisk *td)
 {
-	int error;
+	sector_t slot;
+	sector_t sector;
+	sector_t cache_sector;
+	struct td_internal_device *staged_device;
+	struct td_internal_device *home_device;
+	bool compressed;
+	u8 *buffer;
+	int ret;
+	TRACE_TIME(start);
 
-	error = read_data(device, header, 0, sizeof(struct tdisk_header));
-	if(error)return error;
+	if(td->staged_sectors == NULL || td->staged_count == 0)return false;
 
-	//printk(KERN_DEBUG "tDisk: Header: driver: %s, minor: %u, major: %u\n", header->driver_name, header->major_version, header->minor_version);
-	switch(td_is_compatible_header(td, header))
+	//The cursor continues where the last sector was found, so the
+	//slots are scanned only once for all the staged sectors
+	for(slot = 0; slot < td->cache_sectors; ++slot)
 	{
-	case 1:
-		//Entirely new disk.
-		header->disk_index = (tdisk_index)(td->internal_devices_count + 1);	//+1 because 0 means unused
-		(*index_operation_to_do) = WRITE;
-		break;
-	case 0:
-		//OK, compatible header.
-		//Either same or lower (compatible) driver version
-		//Disk was already part of a tDisk.
-		//So doing nothing to preserve indices etc.
-	case -1:
-		//Oops, the disk was part of a tdisk
-		//But using a driver with a higher minor number
-		//Assuming that user space knows if it's compatible...
-		//Doing nothing
-	case -2:
-		//Oops, the disk was part of a tdisk
-		//But using a driver with a higher major number
-		//Assuming that user space knows if it's compatible...
-		//Doing nothing
+		if(td->staged_sectors[td->destaging_cursor] != 0)break;
+		if(++td->destaging_cursor == td->cache_sectors)td->destaging_cursor = 0;
+	}
 
-		if(first_device)
-			(*index_operation_to_do) = READ;
-		else
-			(*index_operation_to_do) = COMPARE;
+	if(slot == td->cache_sectors)
+	{
+		//The counter is out of sync
+		td_drop_staged_sectors(td);
+		return false;
+	}
+
+	slot = td->destaging_cursor;
+	sector = td->staged_sectors[slot] - 1;
+	cache_sector = td->size_blocks + slot;
+	td->staged_sectors[slot] = 0;
+	td->staged_count--;
+
+	//The flags are stored with the swapped indices or
+	//cleared explicitly if the sector is not written back
+	SET_UNSTAGED_SECTOR(td_index(td, sector)->access_count);
+	SET_UNSTAGED_SECTOR(td_index(td, cache_sector)->access_count);
+
+	staged_device = &td->internal_devices[td_index(td, sector)->disk-1];
+	home_device = &td->internal_devices[td_index(td, cache_sector)->disk-1];
+
+	//Meanwhile the optimizer could have moved one of the sectors.
+	//It only makes sense to write the sector back if its original
+	//location is still slower than the current one
+	if(td_get_device_performance(home_device) <= td_get_device_performance(staged_device))
+	{
+		td_clear_staged_flags(td, sector, cache_sector);
+		return true;
+	}
+
+	buffer = vmalloc(td->blocksize);
+	if(!buffer)
+	{
+		td_clear_staged_flags(td, sector, cache_sector);
+		return false;
+	}
+
+	TRACE_START(start);
+	ret = td_read_block(td, staged_device, buffer, (loff_t)td_index(td, sector)->sector * td->blocksize, SECTOR_COMPRESSED(td_index(td, sector)->access_count));
+	staged_device->bytes_read -= td->blocksize;
+	if(ret != 0)
+	{
+		printk(KERN_WARNING "tDisk: Write back error: reading %llu, ret: %d\n", sector, ret);
+		td_clear_staged_flags(td, sector, cache_sector);
+		goto out;
+	}
+
+	ret = td_write_block(td, home_device, buffer, (loff_t)td_index(td, cache_sector)->sector * td->blocksize, &compressed);
+	home_device->bytes_written -= td->blocksize;
+	if(ret != 0)
+	{
+		printk(KERN_WARNING "tDisk: Write back error: writing %llu, ret: %d\n", sector, ret);
+		td_clear_staged_flags(td, sector, cache_sector);
+		goto out;
+	}
+
+	//Only now the indices can be swapped. If the system crashes
+	//before, the index still points to the staged sector
+	SET_COMPRESSED_SECTOR(td_index(td, cache_sector)->access_count, compressed);
+	td_swap_indices(td, sector, cache_sector);
+	td->bytes_optimized += td->blocksize;
+	TRACE_SPAN(&td->debug, TDISK_TRACE_MIGRATION, sector, td_index(td, sector)->disk, start);
+
+#ifdef USE_PERF_COUNTERS
+	td_count_migration(td, td->blocksize);
+#endif //USE_PERF_COUNTERS
+
+#ifdef USE_MIGRATION_BUDGET
+	td_charge_migration_budget(staged_device, td->blocksize);
+	td_charge_migration_budget(home_device, td->blocksize);
+#endif //USE_MIGRATION_BUDGET
+
+ out:
+	vfree(buffer);
+
+	return (ret == 0);
+}
 
-#ifdef MEASURE_PERFORMANCE
-		device->performance = header->performance;
 #else
-//#pragma message "Performance measurement is disabled"
-#endif //MEASURE_PERFORMANCE
-		break;
-	default:
-		//Bug
-		printk(KERN_ERR "tDisk: Bug in td_is_compatible_header function\n");
-		BUG_ON(td_is_compatible_header(td, header));
-		(*index_operation_to_do) = 123456;
-		break;
+#pragma message "Write back cache is disabled"
+#endif //USE_WRITE_BACK_CACHE
+
+#ifdef USE_SUB_BLOCK_HEAT
+
+/**
+  * Marks the regions of the given sector which are
+  * covered by the given range as accessed. The state is only
+  * written if a new region is accessed.
+ **/
+static void td_touch_regions(struct tdisk *td, sector_t logical_sector, unsigned int offset, unsigned int length)
+{
+	struct sector_index *index = td_index(td, logical_sector);
+	unsigned int first = offset / td->region_size;
+	unsigned int last = (offset + length - 1) / td->region_size;
+	__u8 regions = (__u8)(((1U << (last + 1)) - 1) & ~((1U << first) - 1));
+	struct sector_index old_index;
+	struct sector_index new_index;
+
+	if(td->region_count <= 1 || (READ_ONCE(index->regions) & regions) == regions)return;
+
+	do
+	{
+		old_index.state = READ_ONCE(index->state);
+		new_index.state = old_index.state;
+		new_index.regions |= regions;
 	}
+	while(cmpxchg(&index->state, old_index.state, new_index.state) != old_index.state);
+}
+
+/**
+  * Forgets the accessed regions of all sectors
+  * if the aging interval is over
+ **/
+static void td_age_regions(struct tdisk *td)
+{
+	sector_t sector;
 
-	if((*index_operation_to_do) != WRITE && format == true)
+	if(td->region_count <= 1 || time_before(jiffies, td->regions_aging_start + REGIONS_AGING_INTERVAL))return;
+
+	for(sector = 0; sector < td->max_sectors; ++sector)
 	{
-		printk(KERN_INFO "tDisk: device was part of a tDisk but formatting as you requested\n");
-		(*index_operation_to_do) = WRITE;
-		header->disk_index = (tdisk_index)(td->internal_devices_count + 1);
+		if(td_index_page(td, sector))td_index(td, sector)->regions = 0;
 	}
 
-	return 0;
+	td->regions_aging_start = jiffies;
 }
 
 /**
-  * Writes the td header to the given device
-  * and measures the disk performance if perf != NULL
+  * Returns the read cache entry for the given page
  **/
-static int td_write_header(struct td_internal_device *device, struct tdisk_header *header)
+inline static struct td_read_cache_entry* td_read_cache_entry(struct tdisk *td, sector_t logical_sector, unsigned int page)
 {
-	int ret;
+	return &td->read_cache[hash_32((__u32)logical_sector ^ (page << 24) ^ (page >> 8), READ_CACHE_SHIFT)];
+}
 
-	memset(header->driver_name, 0, sizeof(header->driver_name));
-	strcpy(header->driver_name, DRIVER_NAME " \x44\x61\x6E\x6B\x65 \x56\x61\x74\x65\x72\x6C\x65");
-	header->driver_name[sizeof(header->driver_name)-1] = 0;
-	header->major_version = DRIVER_MAJOR_VERSION;
-	header->minor_version = DRIVER_MINOR_VERSION;
+/**
+  * Copies the given page from the read cache if it is cached.
+  * Only entire pages are cached. Returns true on a cache hit.
+ **/
+static bool td_read_cache_get(struct tdisk *td, sector_t logical_sector, unsigned int offset, struct bio_vec *bvec)
+{
+	struct td_read_cache_entry *entry;
+	void *target;
+	void *source;
 
-	ret = write_data(device, header, 0, sizeof(struct tdisk_header));
+	if(!td->read_cache || (offset & ~PAGE_MASK) || bvec->bv_len != PAGE_SIZE)return false;
 
-	if(ret)printk(KERN_ERR "tDisk: Error writing header: %d\n", ret);
+	entry = td_read_cache_entry(td, logical_sector, offset >> PAGE_SHIFT);
+	if(entry->sector != (__u32)(logical_sector + 1) || entry->page != (offset >> PAGE_SHIFT))return false;
 
-	return ret;
+	target = kmap_atomic(bvec->bv_page);
+	source = kmap_atomic(entry->data);
+	memcpy(target + bvec->bv_offset, source, PAGE_SIZE);
+	kunmap_atomic(source);
+	kunmap_atomic(target);
+
+	flush_dcache_page(bvec->bv_page);
+
+	return true;
 }
 
 /**
-  * Reads all the sector indices from the device and
-  * stores them in data.
+  * Stores the given page which was just read in the read cache.
+  * This is only done for hot blocks where only one region is
+  * accessed. These blocks have a low heat and are probably not
+  * moved to a faster disk, but their hot page is still fast.
  **/
-static int td_read_all_indices(struct tdisk *td, struct td_internal_device *device, u8 *data)
+static void td_read_cache_put(struct tdisk *td, sector_t logical_sector, unsigned int offset, struct bio_vec *bvec)
 {
-	int ret = 0;
-	loff_t skip = sizeof(struct tdisk_header);
-	loff_t length = td->header_size * td->blocksize - skip;
-	unsigned int u_length = (unsigned int)length;
+	struct sector_index *index = td_index(td, logical_sector);
+	struct td_read_cache_entry *entry;
+	void *target;
+	void *source;
 
-	BUG_ON(length != u_length);
+	if(!td->read_cache || (offset & ~PAGE_MASK) || bvec->bv_len != PAGE_SIZE)return;
+	if(hweight8(index->regions) != 1 || ACCESS_COUNT(index->access_count) < READ_CACHE_MIN_ACCESS_COUNT)return;
 
-	ret = read_data(device, data, skip, u_length);
+	entry = td_read_cache_entry(td, logical_sector, offset >> PAGE_SHIFT);
+	if(!entry->data)
+	{
+		entry->data = alloc_page(GFP_NOIO);
+		if(!entry->data)return;
+	}
 
-	if(ret)printk(KERN_ERR "tDisk: Error reading all disk indices: %d\n", ret);
-	else printk(KERN_DEBUG "tDisk: Success reading all disk indices\n");
+	target = kmap_atomic(entry->data);
+	source = kmap_atomic(bvec->bv_page);
+	memcpy(target, source + bvec->bv_offset, PAGE_SIZE);
+	kunmap_atomic(source);
+	kunmap_atomic(target);
 
-	return ret;
+	entry->sector = (__u32)(logical_sector + 1);
+	entry->page = offset >> PAGE_SHIFT;
 }
 
-#ifdef USE_INITIAL_OPTIMIZATION
 /**
-  * This function finds a sector which is unused and
-  * has the better performance than the given one.
+  * Removes the pages of the given range from the read cache.
+  * This is called when the data is written or discarded
  **/
-sector_t td_find_sector_for_better_performance(struct tdisk *td, sector_t sector)
+static void td_read_cache_invalidate(struct tdisk *td, sector_t logical_sector, unsigned int offset, unsigned int length)
 {
-	tdisk_index i;
-	tdisk_index j;
-	tdisk_index disk = td->indices[sector].disk;
-	unsigned long long original_device_performance = td_get_device_performance(&td->internal_devices[disk-1]);
-	tdisk_index better_devices[TDISK_MAX_PHYSICAL_DISKS];
-	sector_t current_sector;
+	unsigned int page;
 
-	memset(better_devices, 0, sizeof(tdisk_index)*TDISK_MAX_PHYSICAL_DISKS);
+	if(!td->read_cache || length == 0)return;
 
-	//Assigning devices with better performance to better_devices
-	//in an ordered mode
-	for(i = 1; i <= td->internal_devices_count; ++i)
+	for(page = offset >> PAGE_SHIFT; page <= (offset + length - 1) >> PAGE_SHIFT; ++page)
 	{
-		unsigned long long current_device_performance;
+		struct td_read_cache_entry *entry = td_read_cache_entry(td, logical_sector, page);
 
-		if(i == disk)continue;
-		current_device_performance = td_get_device_performance(&td->internal_devices[i-1]);
+		if(entry->sector == (__u32)(logical_sector + 1) && entry->page == page)
+			entry->sector = 0;
+	}
+}
 
-		//The current device is slower than the original
-		//device. It doesn't make sense to use it
-		if(current_device_performance > original_device_performance)
-			continue;
+/**
+  * Frees the read cache and all its pages
+ **/
+static void td_free_read_cache(struct tdisk *td)
+{
+	unsigned int i;
 
-		for(j = td->internal_devices_count; j > 0; --j)
-		{
-			if(better_devices[j-1] != 0)
-			{
-				if(td_get_device_performance(&td->internal_devices[better_devices[j-1] - 1]) > current_device_performance)
-					swap(better_devices[j-1], better_devices[j]);
-				else break;
-			}
-		}
+	if(!td->read_cache)return;
 
-		better_devices[j] = i;
+	for(i = 0; i < READ_CACHE_ENTRIES; ++i)
+	{
+		if(td->read_cache[i].data)
+			__free_page(td->read_cache[i].data);
 	}
 
-	//No faster device found
-	if(better_devices[0] == 0)return sector;
+	vfree(td->read_cache);
+	td->read_cache = NULL;
+}
 
-	//Try to find a free sector from a better device
-	for(current_sector = 0; current_sector < td->max_sectors; ++current_sector)
+#else
+#pragma message "Sub-block heat is disabled"
+#endif //USE_SUB_BLOCK_HEAT
+
+/**
+  * This function handles discard requests. The given range is
+  * deallocated on the internal devices and sectors which are
+  * discarded entirely are marked as unused again. This way they
+  * can be used for new data by the initial optimization and they
+  * don't need to be copied anymore when they are moved.
+ **/
+static int td_discard(struct tdisk *td, loff_t pos_byte, loff_t length)
+{
+	int ret = 0;
+	struct sector_index physical_sector;
+
+	while(length > 0)
 	{
-		if(td->indices[current_sector].disk == 0)break;
+		struct td_internal_device *device;
+		loff_t sector_div = pos_byte;
+		loff_t offset = __div64_32(&sector_div, td->blocksize);
+		sector_t sector = (sector_t)sector_div;
+		loff_t current_length = td->blocksize - offset;
 
-		//A potential better sector must be resided on a different disk,
-		//not an unused disk (== 0) but an unused sector
-		if(td->indices[current_sector].disk == disk ||
-			SECTOR_USED(td->indices[current_sector].access_count))continue;
+		if(current_length > length)current_length = length;
 
-		for(j = 0; j < td->internal_devices_count && better_devices[j] != 0; ++j)
+		if(unlikely(sector >= td->size_blocks))
 		{
-			//Original sector is better than current sector
-			if(td->indices[sector].disk == better_devices[j])break;
+			printk_ratelimited(KERN_ERR "tDisk: requested sector %llu beyond disk size %llu\n", sector, td->size_blocks);
+			return -EIO;
+		}
 
-			//Current sector is better. Swapping
-			if(td->indices[current_sector].disk == better_devices[j])
-			{
-				//Better sector found
-				sector = current_sector;
+		//Fetch physical index without affecting the access count
+		ret = td_perform_index_operation(td, READ, sector, &physical_sector, false, false, 0);
+		if(ret != 0 || physical_sector.disk == 0 || physical_sector.disk > td->internal_devices_count)
+		{
+			printk_ratelimited(KERN_ERR "tDisk: found invalid disk index for discarding logical sector %llu: %u\n", sector, physical_sector.disk);
+			return -EIO;
+		}
 
-				//Sector from best device found.
-				//Exiting loop
-				if(j == 0)current_sector = td->max_sectors;
+		device = &td->internal_devices[physical_sector.disk - 1];	//-1 because 0 means unused
+		if(!device_is_ready(device))
+		{
+			printk_ratelimited(KERN_DEBUG "tDisk: Device %u is not ready. Probably not yet loaded...\n", physical_sector.disk);
+			return -EIO;
+		}
 
-				//If we didn't find a free sector from the best disk yet
-				//we keep on searching... In some cases it really
-				//makes a huge difference using the fastest disk
-				break;
-			}
+#ifdef USE_COMPRESSION
+		//Parts of compressed blocks can't be discarded
+		if(device->compress && current_length != td->blocksize)
+			ret = 0;
+		else if(device->compress)
+		{
+			td_drop_current_block(td, device, (loff_t)physical_sector.sector*td->blocksize);
+			ret = device_alloc(device, (loff_t)physical_sector.sector*td->blocksize, td->blocksize);
+		}
+		else
+#endif //USE_COMPRESSION
+		ret = device_alloc(device, (loff_t)physical_sector.sector*td->blocksize + offset, (unsigned int)current_length);
+
+		//Discard is just a hint for the internal devices
+		if(ret == -EOPNOTSUPP || ret == -EINVAL)ret = 0;
+		if(ret)break;
+
+#ifdef USE_SUB_BLOCK_HEAT
+		td_read_cache_invalidate(td, sector, (unsigned int)offset, (unsigned int)current_length);
+#endif //USE_SUB_BLOCK_HEAT
+
+		//The entire sector was discarded. Its data is not needed anymore.
+		//This is only stored in memory. In case the system crashes the
+		//sector is still marked as used which is always safe.
+		if(offset == 0 && current_length == td->blocksize)
+		{
+			RESET_ACCESS_COUNT(td_index(td, sector)->access_count);
+			SET_UNUSED_SECTOR(td_index(td, sector)->access_count);
+
+#ifdef USE_WRITE_BACK_CACHE
+			//The freed block must not be written back
+			td_unstage_sector(td, sector);
+#endif //USE_WRITE_BACK_CACHE
 		}
+
+		pos_byte += current_length;
+		length -= current_length;
+		cond_resched();
 	}
 
-	return sector;
+	return ret;
+}
+
+/**
+  * Returns the heat which is added to the access count
+  * of the sectors accessed by the given request.
+  * Sectors which are needed by latency-sensitive
+  * requests get hotter faster
+ **/
+static unsigned int td_request_heat(struct request *rq)
+{
+	switch(IOPRIO_PRIO_CLASS(req_get_ioprio(rq)))
+	{
+	case IOPRIO_CLASS_RT:
+		return HEAT_WEIGHT_RT;
+	case IOPRIO_CLASS_IDLE:
+		return HEAT_WEIGHT_IDLE;
+	case IOPRIO_CLASS_NONE:
+	case IOPRIO_CLASS_BE:
+	default:
+		return HEAT_WEIGHT_BE;
+	}
 }
-#else
-#pragma message "Initial optimization is disabled"
-#endif //USE_INITIAL_OPTIMIZATION
 
 /**
   * This function does the actual device operations. It extracts
@@ -1204,6 +3447,26 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 	loff_t pos_byte;
 	int ret = 0;
 	struct sector_index physical_sector;
+	unsigned int heat = td_request_heat(rq);
+
+	//The range which still needs to be flushed for FUA requests
+	bool fua = (rq->cmd_flags & REQ_WRITE) && (rq->cmd_flags & REQ_FUA);
+	bool index_changed = false;
+	struct td_internal_device *fua_device = NULL;
+	loff_t fua_start = 0;
+	loff_t fua_end = 0;
+
+	//The run of newly used sectors whose indices still need
+	//to be written. The indices of logically consecutive sectors
+	//are stored consecutively, so the whole run is written at once
+	sector_t run_start = 0;
+	sector_t run_length = 0;
+	tdisk_index run_disk = 0;
+
+#ifdef USE_COMPRESSION
+	//Whether a block of a compressed device was written
+	bool compressed_written = false;
+#endif //USE_COMPRESSION
 
 	pos_byte = (loff_t)blk_rq_pos(rq) << 9;
 
@@ -1211,6 +3474,10 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 	if((rq->cmd_flags & REQ_WRITE) && (rq->cmd_flags & REQ_FLUSH))
 		return td_flush_devices(td);
 
+	//Handle discard operations
+	if((rq->cmd_flags & REQ_WRITE) && (rq->cmd_flags & REQ_DISCARD))
+		return td_discard(td, pos_byte, (loff_t)blk_rq_bytes(rq));
+
 	//Normal file operations
 	rq_for_each_segment(bvec, rq, iter)
 	{
@@ -1219,6 +3486,11 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 		loff_t offset = __div64_32(&sector_div, td->blocksize);
 		sector_t sector = (sector_t)sector_div;
 		loff_t actual_pos_byte;
+		bool sector_used;
+#ifdef USE_PERF_COUNTERS
+		struct timespec start;
+#endif //USE_PERF_COUNTERS
+		TRACE_TIME(trace_start);
 
 		if(unlikely(sector >= td->size_blocks))
 		{
@@ -1228,16 +3500,33 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 		}
 
 		//Fetch physical index
-		ret = td_perform_index_operation(td, READ, sector, &physical_sector, true, true);
+		TRACE_START(trace_start);
+		ret = td_perform_index_operation(td, READ, sector, &physical_sector, true, true, heat);
 		if(ret != 0)
 		{
 			printk_ratelimited(KERN_ERR "tDisk: Error reading logical sector index: %llu\n", sector);
 			ret = -EIO;
 			break;
 		}
+		TRACE_SPAN(&td->debug, TDISK_TRACE_INDEX_LOOKUP, sector, physical_sector.disk, trace_start);
+
+		//Whether the sector was already used before this request
+		sector_used = SECTOR_USED(physical_sector.access_count);
+
+#ifdef USE_SUB_BLOCK_HEAT
+		td_touch_regions(td, sector, (unsigned int)offset, bvec.bv_len);
+#endif //USE_SUB_BLOCK_HEAT
+
+#ifdef ADAPTIVE_CACHE_RESERVE
+		//Counting newly used sectors for the cache reserve
+		if(!sector_used)
+			td->allocated_sectors++;
+#else
+#pragma message "Adaptive cache reserve is disabled"
+#endif //ADAPTIVE_CACHE_RESERVE
 
 #ifdef USE_INITIAL_OPTIMIZATION
-		if(!SECTOR_USED(physical_sector.access_count))
+		if(!sector_used && td_sector_pin(td, sector) != TDISK_PIN_NEVER_PROMOTE)
 		{
 			//If the sector is not yet used we can try to find a
 			//faster disk to gain some performance
@@ -1246,24 +3535,45 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 
 			if(sector != better_sector)
 			{
-				//printk(KERN_DEBUG "tDisk: optimizing sector %llu by using disk %u instead of %u\n", sector, td->indices[better_sector].disk, td->indices[sector].disk);
+				//printk(KERN_DEBUG "tDisk: optimizing sector %llu by using disk %u instead of %u\n", sector, td_index(td, better_sector)->disk, td_index(td, sector)->disk);
 
-				swap(td->indices[better_sector].disk, td->indices[sector].disk);
-				swap(td->indices[better_sector].sector, td->indices[sector].sector);
+				td_swap_indices(td, sector, better_sector);
+				index_changed = true;
 
-				td_write_index_to_disk(td, sector, td->indices[sector].disk);
-				td_write_index_to_disk(td, better_sector, td->indices[sector].disk);
-				td_write_index_to_disk(td, sector, td->indices[better_sector].disk);
-				td_write_index_to_disk(td, better_sector, td->indices[better_sector].disk);
+#ifdef USE_PERF_COUNTERS
+				td_get_cpu_counters(td)->initial_placements++;
+				put_cpu();
+#endif //USE_PERF_COUNTERS
 
 				//Re- reading swapped index but without affecting access count
-				td_perform_index_operation(td, READ, sector, &physical_sector, false, false);
+				td_perform_index_operation(td, READ, sector, &physical_sector, false, false, 0);
+				TRACE_POINT(&td->debug, TDISK_TRACE_REMAP, sector, physical_sector.disk, 0);
 			}
 		}
 #else
 #pragma message "Initial optimization is disabled"
 #endif //USE_INITIAL_OPTIMIZATION
 
+#ifdef USE_WRITE_BACK_CACHE
+		if(sector_used && (rq->cmd_flags & REQ_WRITE) && td_sector_pin(td, sector) != TDISK_PIN_NEVER_PROMOTE)
+		{
+			//If the entire sector is overwritten by this request
+			//there is no need to copy the old data. So the sector
+			//can be staged in a cache sector of a faster disk and
+			//is written back to the slower disk in idle time
+			if(offset == 0 && pos_byte + td->blocksize <= ((loff_t)blk_rq_pos(rq) << 9) + blk_rq_bytes(rq) && td_stage_sector(td, sector))
+			{
+				index_changed = true;
+
+				//Re- reading staged index but without affecting access count
+				td_perform_index_operation(td, READ, sector, &physical_sector, false, false, 0);
+				TRACE_POINT(&td->debug, TDISK_TRACE_REMAP, sector, physical_sector.disk, 0);
+			}
+		}
+#else
+#pragma message "Write back cache is disabled"
+#endif //USE_WRITE_BACK_CACHE
+
 		//Calculate actual position in the physical disk
 		actual_pos_byte = (loff_t)physical_sector.sector*td->blocksize + offset;
 
@@ -1282,16 +3592,43 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 			break;
 		}
 
-		if((rq->cmd_flags & REQ_WRITE) && (rq->cmd_flags & REQ_DISCARD))
+		if(!sector_used)
 		{
-			//Handle discard operations
-			len = (ssize_t)bvec.bv_len;
-			ret = device_alloc(device, actual_pos_byte, bvec.bv_len);
-			if(ret)break;
+			//The sector is used from now on. This needs to be stored
+			//before the request completes because the data of unused
+			//sectors is not copied when they are moved
+			if(run_length != 0 && (run_disk != physical_sector.disk || run_start + run_length != sector))
+			{
+				td_write_indices_to_disk(td, run_start, run_length, run_disk);
+				run_length = 0;
+			}
+
+			if(run_length == 0)
+			{
+				run_start = sector;
+				run_disk = physical_sector.disk;
+			}
+
+			run_length++;
+			index_changed = true;
 		}
-		else if(rq->cmd_flags & REQ_WRITE)
+
+#ifdef USE_PERF_COUNTERS
+		getnstimeofday(&start);
+#endif //USE_PERF_COUNTERS
+		TRACE_START(trace_start);
+
+		if(rq->cmd_flags & REQ_WRITE)
 		{
 			//Do write operation
+#ifdef USE_COMPRESSION
+			if(device->compress)
+			{
+				len = td_compressed_bio_vec(td, sector, &physical_sector, &bvec, (unsigned int)offset, true, sector_used);
+				compressed_written = true;
+			}
+			else
+#endif //USE_COMPRESSION
 			len = write_bio_vec(device, &bvec, &actual_pos_byte);
 
 			if(unlikely((size_t)len != bvec.bv_len))
@@ -1302,10 +3639,52 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 				else ret = (int)len;
 				break;
 			}
+
+#ifdef USE_PERF_COUNTERS
+			td_count_device_access(device, &start);
+#endif //USE_PERF_COUNTERS
+			TRACE_SPAN(&td->debug, td_device_trace_type(device), sector, physical_sector.disk, trace_start);
+
+#ifdef USE_SUB_BLOCK_HEAT
+			td_read_cache_invalidate(td, sector, (unsigned int)offset, bvec.bv_len);
+#endif //USE_SUB_BLOCK_HEAT
+
+#ifdef USE_COMPRESSION
+			//Compressed blocks are written at the end of the request
+			if(fua && !device->compress)
+#else
+			if(fua)
+#endif //USE_COMPRESSION
+			{
+				//FUA data needs to be on stable storage before the
+				//request is completed. Consecutive segments on the
+				//same device are flushed at once
+				if(fua_device != device || fua_end != actual_pos_byte - len)
+				{
+					if(fua_device)ret = flush_device_range(fua_device, fua_start, fua_end - fua_start);
+					if(ret)break;
+
+					fua_device = device;
+					fua_start = actual_pos_byte - len;
+				}
+				fua_end = actual_pos_byte;
+			}
+		}
+#ifdef USE_SUB_BLOCK_HEAT
+		else if(td_read_cache_get(td, sector, (unsigned int)offset, &bvec))
+		{
+			//The page was served from the read cache
+			len = bvec.bv_len;
 		}
+#endif //USE_SUB_BLOCK_HEAT
 		else
 		{
 			//Do read operation
+#ifdef USE_COMPRESSION
+			if(device->compress)
+				len = td_compressed_bio_vec(td, sector, &physical_sector, &bvec, (unsigned int)offset, false, sector_used);
+			else
+#endif //USE_COMPRESSION
 			len = read_bio_vec(device, &bvec, &actual_pos_byte);
 
 			if(len < 0)
@@ -1322,12 +3701,45 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 				__rq_for_each_bio(bio, rq)zero_fill_bio(bio);
 				break;
 			}
+
+#ifdef USE_PERF_COUNTERS
+			td_count_device_access(device, &start);
+#endif //USE_PERF_COUNTERS
+			TRACE_SPAN(&td->debug, td_device_trace_type(device), sector, physical_sector.disk, trace_start);
+
+#ifdef USE_SUB_BLOCK_HEAT
+			td_read_cache_put(td, sector, (unsigned int)offset, &bvec);
+#endif //USE_SUB_BLOCK_HEAT
 		}
 
 		pos_byte += len;
 		cond_resched();
 	}
 
+	//Write the indices of the remaining newly used sectors
+	if(run_length != 0)td_write_indices_to_disk(td, run_start, run_length, run_disk);
+
+#ifdef USE_COMPRESSION
+	//The written block of a compressed device is compressed now
+	if(compressed_written)
+	{
+		int flush_ret = td_flush_current_block(td);
+		if(!ret)ret = flush_ret;
+	}
+#endif //USE_COMPRESSION
+
+	if(fua && ret == 0)
+	{
+		//If the index was changed the indices need
+		//to be flushed as well
+#ifdef USE_COMPRESSION
+		if(index_changed || compressed_written)ret = td_flush_devices(td);
+#else
+		if(index_changed)ret = td_flush_devices(td);
+#endif //USE_COMPRESSION
+		else if(fua_device)ret = flush_device_range(fua_device, fua_start, fua_end - fua_start);
+	}
+
 	return ret;
 }
 
@@ -1339,14 +3751,14 @@ static int td_do_disk_operation(struct tdisk *td, struct request *rq)
 void td_write_index_to_disk_async(struct tdisk *td, sector_t logical_sector, tdisk_index disk, void *private_data, void (*callback)(void*,long))
 {
 	struct sector_index *actual;
-	loff_t position = td->index_offset_byte + (loff_t)logical_sector * (loff_t)sizeof(struct sector_index);
-	unsigned int length = sizeof(struct sector_index);
+	loff_t position = td->index_offset_byte + (loff_t)logical_sector * (loff_t)sizeof(struct disk_sector_index);
+	unsigned int length = sizeof(struct disk_sector_index);
 
-	if(position + length > td->header_size * td->blocksize)
+	if(logical_sector >= td->max_sectors)
 	{
 		if(callback)callback(private_data, -ENOMEM);
 	}
-	actual = &td->indices[logical_sector];
+	actual = td_index(td, logical_sector);
 
 	write_data_async(&td->internal_devices[disk-1], actual, position, length, private_data, callback);
 }
@@ -1403,6 +3815,7 @@ static void td_do_disk_operation_async(struct tdisk *td, struct request *rq)
 	loff_t pos_byte;
 	int ret;
 	struct sector_index physical_sector;
+	unsigned int heat = td_request_heat(rq);
 
 	struct multi_aio_data *multi_data;
 
@@ -1441,7 +3854,7 @@ static void td_do_disk_operation_async(struct tdisk *td, struct request *rq)
 		}
 
 		//Fetch physical index
-		ret = td_perform_index_operation(td, READ, sector, &physical_sector, true, true);
+		ret = td_perform_index_operation(td, READ, sector, &physical_sector, true, true, heat);
 		if(ret != 0)
 		{
 			printk_ratelimited(KERN_ERR "tDisk: Error reading logical sector index: %llu\n", sector);
@@ -1450,7 +3863,7 @@ static void td_do_disk_operation_async(struct tdisk *td, struct request *rq)
 		}
 
 #ifdef USE_INITIAL_OPTIMIZATION
-		if(!SECTOR_USED(physical_sector.access_count))
+		if(!SECTOR_USED(physical_sector.access_count) && td_sector_pin(td, sector) != TDISK_PIN_NEVER_PROMOTE)
 		{
 			//If the sector is not yet used we can try to find a
 			//faster disk to gain some performance
@@ -1459,18 +3872,24 @@ static void td_do_disk_operation_async(struct tdisk *td, struct request *rq)
 
 			if(sector != better_sector)
 			{
-				//printk(KERN_DEBUG "tDisk: optimizing sector %llu by using disk %u instead of %u\n", sector, td->indices[better_sector].disk, td->indices[sector].disk);
+				//printk(KERN_DEBUG "tDisk: optimizing sector %llu by using disk %u instead of %u\n", sector, td_index(td, better_sector)->disk, td_index(td, sector)->disk);
+
+				swap(td_index(td, better_sector)->disk, td_index(td, sector)->disk);
+				swap(td_index(td, better_sector)->sector, td_index(td, sector)->sector);
 
-				swap(td->indices[better_sector].disk, td->indices[sector].disk);
-				swap(td->indices[better_sector].sector, td->indices[sector].sector);
+#ifdef USE_PERF_COUNTERS
+				td_get_cpu_counters(td)->initial_placements++;
+				put_cpu();
+#endif //USE_PERF_COUNTERS
 
-				td_write_index_to_disk_async(td, sector, td->indices[sector].disk);
-				td_write_index_to_disk_async(td, better_sector, td->indices[sector].disk);
-				td_write_index_to_disk_async(td, sector, td->indices[better_sector].disk);
-				td_write_index_to_disk_async(td, better_sector, td->indices[better_sector].disk);
+				td_write_index_to_disk_async(td, sector, td_index(td, sector)->disk);
+				td_write_index_to_disk_async(td, better_sector, td_index(td, sector)->disk);
+				td_write_index_to_disk_async(td, sector, td_index(td, better_sector)->disk);
+				td_write_index_to_disk_async(td, better_sector, td_index(td, better_sector)->disk);
 
 				//Re- reading swapped index but without affecting access count
-				td_perform_index_operation(td, READ, sector, &physical_sector, false, false);
+				td_perform_index_operation(td, READ, sector, &physical_sector, false, false, 0);
+				TRACE_POINT(&td->debug, TDISK_TRACE_REMAP, sector, physical_sector.disk, 0);
 			}
 		}
 #else
@@ -1559,10 +3978,17 @@ static void td_reread_partitions(struct tdisk *td, struct block_device *bdev)
  **/
 int td_get_max_sectors_header_increase(struct tdisk *td, sector_t max_sectors)
 {
-	sector_t header_size_byte_help = td->index_offset_byte + max_sectors * sizeof(struct sector_index);
+	sector_t header_size_byte_help = td->index_offset_byte + max_sectors * sizeof(struct disk_sector_index);
 	size_t header_size_byte = (size_t)header_size_byte_help;
 	size_t new_header_size;
 
+	//The sorted sectors are stored as 32 bit values
+	if(unlikely(max_sectors > (__u32)-1))
+	{
+		printk(KERN_WARNING "tDisk: can't hold more than %u sectors\n", (__u32)-1);
+		return -1;
+	}
+
 	//Check if we can actually hold the index in memory...
 	if(unlikely(header_size_byte_help != header_size_byte))
 	{
@@ -1576,6 +4002,58 @@ int td_get_max_sectors_header_increase(struct tdisk *td, sector_t max_sectors)
 	return (int)(new_header_size - td->header_size);
 }
 
+/**
+  * The index of the sectors whose page is not allocated yet
+ **/
+const struct sector_index td_unused_index;
+
+/**
+  * Allocates the given page of the sector indices. This is
+  * done when one of its indices is used for the first time.
+  * The page is small, so the allocation doesn't fail.
+ **/
+struct sector_index* td_alloc_index_page(struct tdisk *td, sector_t page)
+{
+	struct sector_index *new_page = kzalloc((size_t)(sizeof(struct sector_index) * TDISK_INDEX_PAGE_ENTRIES), GFP_NOIO | __GFP_NOFAIL);
+	struct sector_index *old_page;
+
+	//The page may be allocated at the same time by an ioctl
+	old_page = cmpxchg(&td->index_table->pages[page], NULL, new_page);
+	if(old_page)
+	{
+		kfree(new_page);
+		return old_page;
+	}
+
+	return new_page;
+}
+
+/**
+  * Frees the index pages of the given table in the range [first, last)
+ **/
+static void td_free_index_pages(struct td_index_table *table, sector_t first, sector_t last)
+{
+	sector_t page;
+
+	for(page = first; page < last; ++page)
+		if(table->pages[page])kfree(table->pages[page]);
+}
+
+/**
+  * Frees the index table and all its pages
+ **/
+static void td_free_index_table(struct tdisk *td)
+{
+	struct td_index_table *table = td->index_table;
+
+	if(table == NULL)return;
+
+	td->index_table = NULL;
+
+	td_free_index_pages(table, 0, TDISK_INDEX_PAGES(table->sectors));
+	vfree(table);
+}
+
 /**
   * This function resets the already resized sector
   * indices and sorted sectors if an error occurred
@@ -1583,10 +4061,23 @@ int td_get_max_sectors_header_increase(struct tdisk *td, sector_t max_sectors)
  **/
 void td_reset_sectors(struct tdisk *td)
 {
-	if(td->indices != NULL)vfree(td->indices);
+	td_free_index_table(td);
 	if(td->sorted_sectors != NULL)vfree(td->sorted_sectors);
+	if(td->assigned_devices != NULL)vfree(td->assigned_devices);
+	td->sorted_sectors = NULL;
+	td->assigned_devices = NULL;
+	td->sorted_capacity = 0;
 	td->max_sectors = 0;
 	td->header_size = 0;
+
+	memset(&td->pins, 0, sizeof(struct td_pin_table));
+	td->pin_count = 0;
+
+#ifdef USE_HEAT_SNAPSHOT
+	bitmap_zero(td->heat_snapshot_dirty, TDISK_HEAT_SNAPSHOT_CHUNKS);
+	td->heat_snapshot_shift = 0;
+	td_resize_heat_snapshot(td);
+#endif //USE_HEAT_SNAPSHOT
 }
 
 /**
@@ -1602,60 +4093,109 @@ int td_set_max_sectors(struct tdisk *td, sector_t max_sectors)
 	sector_t j;
 
 	//Just casting and hoping that it was previously checked using td_get_max_sectors_header_increase
-	size_t header_size_byte = (size_t)(td->index_offset_byte + max_sectors * sizeof(struct sector_index));
+	size_t header_size_byte = (size_t)(td->index_offset_byte + max_sectors * sizeof(struct disk_sector_index));
 
 	size_t new_header_size = header_size_byte/td->blocksize + ((header_size_byte%td->blocksize == 0) ? 0 : 1);
 
-	struct sector_index *new_indices;
-	struct sorted_sector_index *new_sorted_sectors;
+	struct td_index_table *old_table = td->index_table;
+	struct td_index_table *new_table;
+	sector_t new_capacity;
+	sector_t new_pages;
+	__u32 *new_sorted_sectors;
+	tdisk_index *new_assigned_devices;
 
 	//Simply casting. If header_size_byte didn't overflow, this shouln'd overflow as well
-	sector_t new_max_sectors = __div64_32_nomod(new_header_size*td->blocksize - td->index_offset_byte, sizeof(struct sector_index));
+	sector_t new_max_sectors = __div64_32_nomod(new_header_size*td->blocksize - td->index_offset_byte, sizeof(struct disk_sector_index));
 
 	if(td->header_size == new_header_size)return 0;
 
+	//The sorted sectors are stored as 32 bit values
+	if(new_max_sectors > (__u32)-1)new_max_sectors = (__u32)-1;
+
 	//New max sectors must be greater or equal than before
 	MY_BUG_ON(td->max_sectors > new_max_sectors, PRINT_ULL(td->max_sectors), PRINT_ULL(new_max_sectors));
 
-	//Allocate disk indices
-	ret = -ENOMEM;
-	new_indices = vmalloc((size_t)(sizeof(struct sector_index) * new_max_sectors));
-	if(!new_indices)goto out;
+	//The arrays grow geometrically so that adding devices
+	//only costs the added sectors in the long run
+	if(new_max_sectors > td->sorted_capacity)
+	{
+		new_capacity = max_t(sector_t, new_max_sectors, 2 * td->sorted_capacity);
+		if(new_capacity > (__u32)-1)new_capacity = (__u32)-1;
+
+		//Allocate the page table of the disk indices. Only the
+		//pointers to the existing pages are copied. The new
+		//pages are allocated when they are used (@see td_index)
+		ret = -ENOMEM;
+		new_pages = TDISK_INDEX_PAGES(new_capacity);
+		new_table = vmalloc(sizeof(struct td_index_table) + (size_t)(sizeof(struct sector_index*) * new_pages));
+		if(!new_table)goto out;
+
+		new_table->sectors = new_capacity;
+		memset(new_table->pages, 0, (size_t)(sizeof(struct sector_index*) * new_pages));
+		if(old_table)memcpy(new_table->pages, old_table->pages, (size_t)(sizeof(struct sector_index*) * TDISK_INDEX_PAGES(old_table->sectors)));
+
+		//Allocate sorted disk indices
+		ret = -ENOMEM;
+		new_sorted_sectors = vmalloc((size_t)(sizeof(__u32) * new_capacity));
+		if(!new_sorted_sectors)goto out_free_index_table;
+
+		//Allocate device assignments
+		ret = -ENOMEM;
+		new_assigned_devices = vmalloc((size_t)(sizeof(tdisk_index) * new_capacity));
+		if(!new_assigned_devices)goto out_free_sorted_sectors;
+
+		//The order of the existing sectors is kept
+		if(td->max_sectors != 0)
+		{
+			memcpy(new_sorted_sectors, td->sorted_sectors, (size_t)(sizeof(__u32) * td->max_sectors));
+			memcpy(new_assigned_devices, td->assigned_devices, (size_t)(sizeof(tdisk_index) * td->max_sectors));
+		}
+
+		td->index_table = new_table;
+
+		swap(new_sorted_sectors, td->sorted_sectors);
+		swap(new_assigned_devices, td->assigned_devices);
+		td->sorted_capacity = new_capacity;
 
-	//Allocate sorted disk indices
-	ret = -ENOMEM;
-	new_sorted_sectors = vmalloc((size_t)(sizeof(struct sorted_sector_index) * new_max_sectors));
-	if(!new_sorted_sectors)goto out_free_indices;
+		if(new_assigned_devices)vfree(new_assigned_devices);
+		if(new_sorted_sectors)vfree(new_sorted_sectors);
 
-	memset(new_indices, 0, (size_t)(sizeof(struct sector_index) * new_max_sectors));
-	memset(new_sorted_sectors, 0, (size_t)(sizeof(struct sorted_sector_index) * new_max_sectors));
+		//The pages are still used by the new table
+		if(old_table)vfree(old_table);
+	}
 
-	//Copy old indices
-	memcpy(new_indices, td->indices, (size_t)(td->max_sectors * sizeof(struct sector_index)));
-	memcpy(new_sorted_sectors, td->sorted_sectors, (size_t)(td->max_sectors * sizeof(struct sorted_sector_index)));
+	//The new sectors are unused, so they are sorted to the end
+	for(j = td->max_sectors; j < new_max_sectors; ++j)
+	{
+		td->sorted_sectors[j] = (__u32)j;
+		td->assigned_devices[j] = 0;
+	}
 
-	//TODO lock index spinlock
-	swap(new_indices, td->indices);
-	swap(new_sorted_sectors, td->sorted_sectors);
 	swap(new_max_sectors, td->max_sectors);
 	swap(new_header_size, td->header_size);
 
-	//Insert sorted indices
-	INIT_LIST_HEAD(&td->sorted_sectors_head);
-	for(j = 0; j < td->max_sectors; ++j)
-	{
-		INIT_LIST_HEAD(&td->sorted_sectors[j].total_sorted);
-		td->sorted_sectors[j].physical_sector = &td->indices[j];
+	ret = (int)(td->header_size - new_header_size);
+
+#ifdef USE_HEAT_SNAPSHOT
+	td_resize_heat_snapshot(td);
+#endif //USE_HEAT_SNAPSHOT
 
-		list_add(&td->sorted_sectors[j].total_sorted, &td->sorted_sectors_head);
+	//The sectors are assigned to the devices again
+	//the next time they are moved
+	if(td->sorted_devices)
+	{
+		vfree(td->sorted_devices);
+		vfree(td->device_sectors);
+		td->sorted_devices = NULL;
+		td->device_sectors = NULL;
 	}
-	//TODO unlock index spinlock
 
-	ret = (int)(td->header_size - new_header_size);
+	return ret;
 
+ out_free_sorted_sectors:
 	vfree(new_sorted_sectors);
- out_free_indices:
-	vfree(new_indices);
+ out_free_index_table:
+	vfree(new_table);
  out:
 	return ret;
 }
@@ -1723,6 +4263,7 @@ static int set_device_parameters(struct td_internal_device *new_device, struct i
 	memcpy(new_device->path, parameters.path, TDISK_MAX_INTERNAL_DEVICE_NAME);
 
 	new_device->file = fget(parameters.fd);
+	new_device->compress = (parameters.compress != 0);
 
 	return 0;
 }
@@ -1760,7 +4301,7 @@ static sector_t find_move_help_sector(struct tdisk *td, tdisk_index disk, sector
 
 		for(sector = 0; sector < td->max_sectors; ++sector)
 		{
-			if(td->indices[sector].disk == disk && td->indices[sector].sector == current_sector)
+			if(td_peek_index(td, sector)->disk == disk && td_peek_index(td, sector)->sector == current_sector)
 			{
 				found = true;
 				break;
@@ -1818,6 +4359,13 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 	}
 	spin_unlock(&td->tdisk_lock);
 
+#ifdef USE_WRITE_BACK_CACHE
+	//The cache sectors change when a disk is added
+	td_drop_staged_sectors(td);
+#else
+#pragma message "Write back cache is disabled"
+#endif //USE_WRITE_BACK_CACHE
+
 	error = -EFAULT;
 	memset(&new_device, 0, sizeof(struct td_internal_device));
 	if(set_device_parameters(&new_device, arg) != 0)
@@ -1829,7 +4377,6 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 	{
 #ifdef USE_FILES
 	case internal_device_type_file:
-		DEBUG_POINT(&td->debug, "tDisk: Adding new internal device file: %s (Path: %s)\n", new_device.name, new_device.path);
 		printk(KERN_INFO "tDisk: Adding new internal device file: %s (Path: %s)\n", new_device.name, new_device.path);
 		error = -EBADF;
 		if(!new_device.file)goto out;
@@ -1843,6 +4390,10 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 
 		//File size in bytes
 		device_size = file_get_size(new_device.file);
+
+#ifdef USE_MIGRATION_BUDGET
+		new_device.backing_dev = td_get_backing_dev(new_device.file);
+#endif //USE_MIGRATION_BUDGET
 		break;
 #else
 #pragma message "Files are disabled"
@@ -1850,7 +4401,6 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 
 #ifdef USE_PLUGINS
 	case internal_device_type_plugin:
-		DEBUG_POINT(&td->debug, "tDisk: Adding new internal device plugin: %s (Path: %s)\n", new_device.name, new_device.path);
 		printk(KERN_INFO "tDisk: Adding new internal device plugin: %s (Path: %s)\n", new_device.name, new_device.path);
 
 		//Plugin size in bytes
@@ -1866,6 +4416,12 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 		goto out;
 	}
 
+#ifdef USE_PERF_COUNTERS
+	error = -ENOMEM;
+	new_device.stats = vzalloc(sizeof(struct tdisk_device_stats) * nr_cpu_ids);
+	if(!new_device.stats)goto out_putf;
+#endif //USE_PERF_COUNTERS
+
 #ifdef MEASURE_PING_PERFORMANCE
 	td_measure_device_performance(&new_device, device_size);
 
@@ -1883,6 +4439,22 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 		goto out_putf;
 	}
 
+	//Once a device stores compressed blocks it stays compressed
+	if(index_operation_to_do != WRITE && (header.flags & TDISK_HEADER_FLAG_COMPRESS))
+		new_device.compress = true;
+
+	if(new_device.compress)
+	{
+#ifdef USE_COMPRESSION
+		error = td_alloc_compression(td);
+		if(error)goto out_putf;
+#else
+		printk(KERN_ERR "tDisk: Can't add compressed device because compression is disabled\n");
+		error = -EINVAL;
+		goto out_putf;
+#endif //USE_COMPRESSION
+	}
+
 	//Calculate new max_sectors of tDisk
 	if(index_operation_to_do == WRITE)
 	{
@@ -1947,12 +4519,18 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 			goto out_putf;
 		}
 
-		//Resize sector indices an sorted sectors
+		//Resize sector indices an sorted sectors. The worker
+		//thread is stopped because it uses the indices
+		//(@see td_index)
+		td_stop_worker_thread(td);
 		additional_sectors = td_set_max_sectors(td, new_max_sectors);
+		if(additional_sectors < 0)td_reset_sectors(td);
+		td_start_worker_thread(td);
+
 		if(additional_sectors < 0)
 		{
 			error = additional_sectors;
-			goto out_reset_sectors;
+			goto out_putf;
 		}
 		else if(additional_sectors == 0)printk(KERN_ERR "tDisk: sector increase was neccessary but was not performed!\n");
 	}
@@ -1965,6 +4543,13 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 
 	//Calculate actual device size
 	new_device.size_blocks = __div64_32_nomod((uint64_t)device_size, td->blocksize) - 1;	//-1 to leave one sector for movement
+
+	//Physical sectors are stored as 32 bit values
+	if(new_device.size_blocks + td->header_size >= (__u32)-1)
+	{
+		printk(KERN_WARNING "tDisk: Device is too big, only %u blocks can be used\n", (__u32)-1);
+		new_device.size_blocks = (__u32)-1 - td->header_size - 1;
+	}
 	printk(KERN_DEBUG "tDisk: new device size in blocks: %llu\n", new_device.size_blocks);
 
 	error = 0;
@@ -1985,10 +4570,10 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 			physical_sector->disk = (tdisk_index)(header.disk_index);
 			physical_sector->sector = td->header_size + sector;
 
-			if(td->indices[td->size_blocks+td->cache_sectors].disk != 0)
+			if(td_index(td, td->size_blocks+td->cache_sectors)->disk != 0)
 				printk(KERN_WARNING "tDisk: Sector %llu was already used!\n", td->size_blocks+td->cache_sectors);
 
-			internal_ret = td_perform_index_operation(td, WRITE, td->size_blocks+td->cache_sectors, physical_sector, false, false);
+			internal_ret = td_perform_index_operation(td, WRITE, td->size_blocks+td->cache_sectors, physical_sector, false, false, 0);
 			if(internal_ret == 1)
 			{
 				//This should be impossible since we increase the index everytime it is necessary
@@ -2012,7 +4597,8 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 		header.blocksize = td->blocksize;
 		header.size_blocks = td->size_blocks;
 		header.current_max_sectors = td->max_sectors;
-		td_write_header(&new_device, &header);
+		td_write_header(&new_device, &header, TDISK_INDEX_VERSION);
+		td_write_pins(td, &new_device);
 
 		//Write indices
 		td_write_all_indices(td, &new_device);
@@ -2025,41 +4611,39 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 
 		break;
 	case COMPARE:
-		//Reading all indices into temporary memory
-		physical_sector = vmalloc((size_t)(sizeof(struct sector_index) * td->max_sectors));
-		td_read_all_indices(td, &new_device, (u8*)physical_sector);
-
-		//Now comparing all sector indices
-		for(sector = 0; sector < td->max_sectors; ++sector)
+		//The indices of a device which was being migrated are
+		//incomplete. They are written again below using the
+		//indices of the other devices
+		if(header.index_version == TDISK_INDEX_VERSION_MIGRATING)
 		{
-			int internal_ret = td_perform_index_operation(td, COMPARE, sector, &physical_sector[sector], false, false);
-			if(internal_ret == -1)
-			{
-				//We have the rule that if the index doesn't match, each disk
-				//has priority of it's own index
-				if(physical_sector[sector].disk == header.disk_index)
-				{
-					//Replace index value
-					td_perform_index_operation(td, WRITE, sector, &physical_sector[sector], false, false);
-				}
-				else printk_ratelimited(KERN_WARNING "tDisk: Disk index doesn't match. Probably wrong or corrupt disk attached. Pay attention before you write to disk!\n");
-			}
+			new_device.move_help_sector = find_move_help_sector(td, header.disk_index, new_device.size_blocks+1);
+			break;
 		}
 
-		new_device.move_help_sector = find_move_help_sector(td, header.disk_index, new_device.size_blocks+1);
+		//Comparing all sector indices while they are read
+		error = td_read_all_indices(td, &new_device, header.index_version, COMPARE, header.disk_index);
+		if(error)goto out_putf;
 
-		vfree(physical_sector);
+		new_device.move_help_sector = find_move_help_sector(td, header.disk_index, new_device.size_blocks+1);
 		break;
 	case READ:
 		//reading all indices from disk
-		td_read_all_indices(td, &new_device, (u8*)td->indices);
+		error = td_read_all_indices(td, &new_device, header.index_version, READ, header.disk_index);
+		if(error)goto out_reset_sectors;
+
+		//The first device defines the pinned ranges
+		if(header.index_version >= TDISK_INDEX_VERSION_PINNED)
+		{
+			error = td_read_pins(td, &new_device);
+			if(error)goto out_reset_sectors;
+		}
 
 		for(sector = 0; sector < td->max_sectors; ++sector)
 		{
-			if(td->indices[sector].disk > td->internal_devices_count)
-				td->internal_devices_count = td->indices[sector].disk;
+			if(td_peek_index(td, sector)->disk > td->internal_devices_count)
+				td->internal_devices_count = td_peek_index(td, sector)->disk;
 
-			if(td->indices[sector].disk != 0 && sector >= td->size_blocks)
+			if(td_peek_index(td, sector)->disk != 0 && sector >= td->size_blocks)
 				td->cache_sectors++;
 		}
 		new_device.move_help_sector = find_move_help_sector(td, header.disk_index, new_device.size_blocks+1);
@@ -2080,6 +4664,30 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 
 	printk(KERN_DEBUG "tDisk: move_help_sector is %llu\n", new_device.move_help_sector);
 
+	//Disks using an old index format are converted immediately
+	//because single indices are written in the current format.
+	//Newer formats only use areas and bits which are ignored by
+	//the previous format, so the header is written last. The
+	//legacy indices are overwritten in a different layout, so
+	//the device is marked as migrating until they are complete
+	if(index_operation_to_do != WRITE && header.index_version != TDISK_INDEX_VERSION)
+	{
+		header.current_max_sectors = td->max_sectors;
+		if(header.index_version == TDISK_INDEX_VERSION_LEGACY)
+		{
+			error = td_write_header(&new_device, &header, TDISK_INDEX_VERSION_MIGRATING);
+			if(error && first_device)
+			{
+				td->internal_devices_count = 0;
+				goto out_reset_sectors;
+			}
+			if(error)goto out_putf;
+		}
+		td_write_pins(td, &new_device);
+		td_write_all_indices(td, &new_device);
+		td_write_header(&new_device, &header, TDISK_INDEX_VERSION);
+	}
+
 	if(additional_sectors != 0 && !first_device)
 	{
 		//Header size increased. Let's create available sectors
@@ -2102,31 +4710,31 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 
 		for(sector = 0; sector < td->max_sectors; ++sector)
 		{
-			if(td->indices[sector].disk != header.disk_index && td->indices[sector].disk != 0)
+			if(td_index(td, sector)->disk != header.disk_index && td_index(td, sector)->disk != 0)
 			{
 				//sector is not a sector of the current disk (=header.disk_index) but it's used (!= 0)
 
-				if(td->indices[sector].sector < td->header_size)
+				if(td_index(td, sector)->sector < td->header_size)
 				{
 					//This sector needs to be moved
 
 					bool moved = false;
-					disk = td->indices[sector].disk;
+					disk = td_index(td, sector)->disk;
 
-					for(search = td->max_sectors; search > sector; --search)
+					for(search = td->max_sectors - 1; search > sector; --search)
 					{
-						if(td->indices[search].disk == header.disk_index)
+						if(td_index(td, search)->disk == header.disk_index)
 						{
 							//Appropriate block found
-							printk(KERN_DEBUG "tDisk: Moved header block %llu (disk: %u, sector: %llu) to %llu (disk: %u, sector: %llu)",
-									sector, td->indices[sector].disk, td->indices[sector].sector, search, td->indices[search].disk, td->indices[search].sector);
+							printk(KERN_DEBUG "tDisk: Moved header block %llu (disk: %u, sector: %u) to %llu (disk: %u, sector: %u)",
+									sector, td_index(td, sector)->disk, td_index(td, sector)->sector, search, td_index(td, search)->disk, td_index(td, search)->sector);
 
-							td_swap_sectors(td, sector, &td->indices[sector], search, &td->indices[search], true);
+							td_swap_sectors(td, sector, td_index(td, sector), search, td_index(td, search), true, NULL);
 
 							//Resetting moved-block values
-							td->indices[search].disk = 0;
-							td->indices[search].sector = 0;
-							td->indices[search].access_count = 0;
+							td_index(td, search)->disk = 0;
+							td_index(td, search)->sector = 0;
+							td_index(td, search)->access_count = 0;
 
 							//Set disks size
 							td->size_blocks--;
@@ -2136,7 +4744,7 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 							break;
 						}
 					}
-					MY_BUG_ON(!moved, PRINT_INT(td->indices[sector].disk), PRINT_ULL(td->indices[sector].sector), PRINT_ULL(search));
+					MY_BUG_ON(!moved, PRINT_INT(td_index(td, sector)->disk), PRINT_UINT(td_index(td, sector)->sector), PRINT_ULL(search));
 				}
 			}
 		}
@@ -2153,6 +4761,9 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 	}
 
 	td->internal_devices[header.disk_index-1] = new_device;
+#ifdef USE_MIGRATION_BUDGET
+	td_register_migration_device(&new_device);
+#endif //USE_MIGRATION_BUDGET
 	printk(KERN_DEBUG "tDisk: new physical disk %u: size: %llu bytes. Logical size(%llu)\n", header.disk_index, device_size, td->size_blocks*td->blocksize);
 
 	//let user-space know about this change
@@ -2170,6 +4781,12 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
 		printk(KERN_DEBUG "tDisk: Device not yet ready. Not reading partition table\n");
 	}
 
+#ifdef ADAPTIVE_CACHE_RESERVE
+	td_reset_cache_reserve(td);
+#else
+#pragma message "Adaptive cache reserve is disabled"
+#endif //ADAPTIVE_CACHE_RESERVE
+
 	//Grab the block_device to prevent its destruction
 	if(first_device)bdgrab(bdev);
 	td->modifying = false;
@@ -2178,6 +4795,9 @@ static int td_add_disk(struct tdisk *td, fmode_t mode, struct block_device *bdev
  out_reset_sectors:
 	td_reset_sectors(td);
  out_putf:
+#ifdef USE_PERF_COUNTERS
+	if(new_device.stats)vfree(new_device.stats);
+#endif //USE_PERF_COUNTERS
 	if(new_device.file)fput(new_device.file);
  out:
 	td->modifying = false;
@@ -2222,6 +4842,18 @@ static int td_remove_disk(struct tdisk *td, tdisk_index disk)
 	//queue to prevent any data loss
 	td_stop_worker_thread(td);
 
+#ifdef USE_WRITE_BACK_CACHE
+	//The cache sectors change when a disk is removed
+	td_drop_staged_sectors(td);
+#else
+#pragma message "Write back cache is disabled"
+#endif //USE_WRITE_BACK_CACHE
+
+#ifdef USE_COMPRESSION
+	//The internal devices are renumbered afterwards
+	td->current_block_device = NULL;
+#endif //USE_COMPRESSION
+
 	if(disk == 0 || !device_is_ready(&td->internal_devices[disk-1]))
 	{
 		printk(KERN_WARNING "tDisk: Can't remove device %u because it is not ready\n", disk);
@@ -2232,12 +4864,12 @@ static int td_remove_disk(struct tdisk *td, tdisk_index disk)
 	//Move all sectors which belong to the internal device to the end of the tDisk
 	for(sector = 0; sector < td->max_sectors; ++sector)
 	{
-		if(td->indices[sector].disk == disk)
+		if(td_peek_index(td, sector)->disk == disk)
 		{
 			//This sector needs to be moved to the end
 
 			//Find sector at the end which can be swapped
-			while(td->indices[sector_rev].disk == 0 || td->indices[sector_rev].disk == disk)
+			while(td_peek_index(td, sector_rev)->disk == 0 || td_peek_index(td, sector_rev)->disk == disk)
 			{
 				if(unlikely(sector_rev == 0))break;
 				sector_rev--;
@@ -2246,15 +4878,15 @@ static int td_remove_disk(struct tdisk *td, tdisk_index disk)
 			if(sector >= sector_rev)
 			{
 				//Make sector "empty". look below for more details
-				td->indices[sector].disk = 0;
-				td->indices[sector].access_count = 0;
-				td->indices[sector].sector = 0;
+				td_index(td, sector)->disk = 0;
+				td_index(td, sector)->access_count = 0;
+				td_index(td, sector)->sector = 0;
 
 				amount_sectors_removed++;
 				continue;
 			}
 
-			if(td->indices[sector_rev].disk == 0 || td->indices[sector_rev].disk == disk)
+			if(td_index(td, sector_rev)->disk == 0 || td_index(td, sector_rev)->disk == disk)
 			{
 				//No sector found
 				printk(KERN_WARNING "tDisk: No sector found at the end while removing disk %d\n", disk);
@@ -2262,19 +4894,19 @@ static int td_remove_disk(struct tdisk *td, tdisk_index disk)
 				goto out;
 			}
 
-			if(!SECTOR_USED(td->indices[sector].access_count) && !SECTOR_USED(td->indices[sector_rev].access_count))
+			if(!SECTOR_USED(td_index(td, sector)->access_count) && !SECTOR_USED(td_index(td, sector_rev)->access_count))
 			{
 				//Both sectors are unused. We can simply swap
 				//the indices instead of copying data
-				swap(td->indices[sector].disk, td->indices[sector_rev].disk);
-				swap(td->indices[sector].access_count, td->indices[sector_rev].access_count);
-				swap(td->indices[sector].sector, td->indices[sector_rev].sector);
-				td_perform_index_operation(td, WRITE, sector, &td->indices[sector], false, false);
-				td_perform_index_operation(td, WRITE, sector_rev, &td->indices[sector_rev], false, false);
+				swap(td_index(td, sector)->disk, td_index(td, sector_rev)->disk);
+				swap(td_index(td, sector)->access_count, td_index(td, sector_rev)->access_count);
+				swap(td_index(td, sector)->sector, td_index(td, sector_rev)->sector);
+				td_perform_index_operation(td, WRITE, sector, td_index(td, sector), false, false, 0);
+				td_perform_index_operation(td, WRITE, sector_rev, td_index(td, sector_rev), false, false, 0);
 			}
 			else
 			{
-				error = td_swap_sectors(td, sector, &td->indices[sector], sector_rev, &td->indices[sector_rev], false);
+				error = td_swap_sectors(td, sector, td_index(td, sector), sector_rev, td_index(td, sector_rev), false, NULL);
 				if(error)
 				{
 					printk(KERN_WARNING "tDisk: Error swapping sectors %llu and %llu when removing disk %u\n", sector, sector_rev, disk);
@@ -2288,176 +4920,631 @@ static int td_remove_disk(struct tdisk *td, tdisk_index disk)
 			//this will be the first point where data is lost. But
 			//we assume that the user either modified the partition table
 			//or resized the filesystem before.
-			td->indices[sector_rev].disk = 0;
-			td->indices[sector_rev].access_count = 0;
-			td->indices[sector_rev].sector = 0;
+			td_index(td, sector_rev)->disk = 0;
+			td_index(td, sector_rev)->access_count = 0;
+			td_index(td, sector_rev)->sector = 0;
 
 			amount_sectors_removed++;
 		}
 	}
 
-	MY_BUG_ON(td->internal_devices[disk-1].size_blocks != amount_sectors_removed, PRINT_ULL(td->internal_devices[disk-1].size_blocks), PRINT_ULL(amount_sectors_removed));
+	MY_BUG_ON(td->internal_devices[disk-1].size_blocks != amount_sectors_removed, PRINT_ULL(td->internal_devices[disk-1].size_blocks), PRINT_ULL(amount_sectors_removed));
+
+	//All the sectors are now moved at the end of the tDisk and the 
+	//disk is set to 0 which makes them "empty".
+	//Now we decrement all disk indices with an id higher than the
+	//disk which was removed
+	for(sector = 0; sector < td->max_sectors; ++sector)
+	{
+		if(td_peek_index(td, sector)->disk > disk)
+			td_index(td, sector)->disk--;
+	}
+
+	//Invalidate header
+	memset(&invalid_header, 0, sizeof(struct tdisk_header));
+	write_data(&td->internal_devices[disk-1], &invalid_header, 0, sizeof(struct tdisk_header));
+
+#ifdef USE_MIGRATION_BUDGET
+	td_unregister_migration_device(&td->internal_devices[disk-1]);
+#endif //USE_MIGRATION_BUDGET
+
+#ifdef USE_PERF_COUNTERS
+	if(td->internal_devices[disk-1].stats)vfree(td->internal_devices[disk-1].stats);
+	td->internal_devices[disk-1].stats = NULL;
+#endif //USE_PERF_COUNTERS
+
+	//Release file if any
+	if(td->internal_devices[disk-1].file)
+	{
+		gfp_t gfp = td->internal_devices[disk-1].old_gfp_mask;
+		mapping_set_gfp_mask(td->internal_devices[disk-1].file->f_mapping, gfp);
+		fput(td->internal_devices[disk-1].file);
+		td->internal_devices[disk-1].file = NULL;
+	}
+
+	//Now we remove the internal device from the array
+	for(i = disk; i < td->internal_devices_count; ++i)
+		td->internal_devices[i-1] = td->internal_devices[i];
+	td->internal_devices_count--;
+
+	//Write all disk indices
+	for(i = 1; i <= td->internal_devices_count; ++i)
+		td_write_all_indices(td, &td->internal_devices[i-1]);
+
+	//Set new size
+	new_disk_size = 0;
+	for(i = 1; i <= td->internal_devices_count; ++i)
+		new_disk_size += td->internal_devices[i].size_blocks;
+	new_disk_size -= __div64_32_nomod(new_disk_size * td->percent_cache, 100);
+	td->size_blocks = new_disk_size;
+
+	//let user-space know about this change
+	set_capacity(td->kernel_disk, (td->size_blocks*td->blocksize) >> 9);
+	bd_set_size(td->block_device, (loff_t)td->size_blocks*td->blocksize);
+	//kobject_uevent(&disk_to_dev(td->block_device->bd_disk)->kobj, KOBJ_CHANGE);	//GPL only
+
+ out:
+ 	//Index needs to be resorted
+ 	td->access_count_resort = 0;
+
+	td->modifying = false;
+
+	//Starting queue again
+	td_start_worker_thread(td);
+	td_reread_partitions(td, td->block_device);
+
+	return error;
+}
+
+/**
+  * This function transfers device status information
+  * to user space
+ **/
+static int td_get_status(struct tdisk *td, struct tdisk_info __user *arg)
+{
+	struct tdisk_info info;
+
+	memset(&info, 0, sizeof(info));
+	//info.block_device = huge_encode_dev(td->block_device);
+	info.max_sectors = td->max_sectors;
+	info.size_blocks = td->size_blocks;
+	info.blocksize = td->blocksize;
+	info.number = (__u32)td->number;
+	info.flags = (__u32)td->flags;
+	info.internaldevices = td->internal_devices_count;
+
+	if(copy_to_user(arg, &info, sizeof(info)) != 0)
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+  * This function transfers information about the internal
+  * devices to user space
+ **/
+static int td_get_device_info(struct tdisk *td, struct internal_device_info __user *arg)
+{
+	struct internal_device_info info;
+
+	if(copy_from_user(&info, arg, sizeof(struct internal_device_info)) != 0)
+		return -EFAULT;
+
+	if(info.disk == 0 || info.disk > td->internal_devices_count)
+		return -EINVAL;
+
+	info.type = td->internal_devices[info.disk-1].type;
+	memcpy(info.name, td->internal_devices[info.disk-1].name, TDISK_MAX_INTERNAL_DEVICE_NAME);
+	memcpy(info.path, td->internal_devices[info.disk-1].path, TDISK_MAX_INTERNAL_DEVICE_NAME);
+	info.performance = td->internal_devices[info.disk-1].performance;
+	info.size = td->internal_devices[info.disk-1].size_blocks * td->blocksize;
+	info.bytes_read = td->internal_devices[info.disk-1].bytes_read;
+	info.bytes_written = td->internal_devices[info.disk-1].bytes_written;
+
+	if(copy_to_user(arg, &info, sizeof(info)) != 0)
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+  * This function transfers information about the given
+  * logical sector to user space
+ **/
+static int td_get_sector_index(struct tdisk *td, struct physical_sector_index __user *arg)
+{
+	struct physical_sector_index index;
+	struct sector_index *actual;
+
+	if(copy_from_user(&index, arg, sizeof(struct physical_sector_index)) != 0)
+		return -EFAULT;
+
+	if(index.sector >= td->max_sectors)return -EINVAL;
+	actual = td_index(td, index.sector);
+
+	index.disk = actual->disk;
+	index.sector = actual->sector;
+	index.access_count = ACCESS_COUNT(actual->access_count);
+	index.used = SECTOR_USED(actual->access_count);
+
+	if(copy_to_user(arg, &index, sizeof(struct physical_sector_index)) != 0)
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+  * This function transfers information about all
+  * logical sectors to user space
+ **/
+static int td_get_all_sector_indices(struct tdisk *td, struct sector_info __user *arg)
+{
+	const struct sector_index *pos;
+	struct sector_info info;
+	sector_t sorted_index;
+
+	for(sorted_index = 0; sorted_index < td->max_sectors; ++sorted_index)
+	{
+		pos = td_peek_index(td, td->sorted_sectors[sorted_index]);
+
+		info.physical_sector.disk = pos->disk;
+		info.physical_sector.sector = pos->sector;
+		info.physical_sector.access_count = ACCESS_COUNT(pos->access_count);
+		info.physical_sector.used = SECTOR_USED(pos->access_count);
+		info.access_sorted_index = sorted_index;
+		info.logical_sector = td->sorted_sectors[sorted_index];
+
+		if(copy_to_user(&arg[sorted_index], &info, sizeof(struct sector_info)) != 0)
+			return -EFAULT;
+	}
+
+	return 0;
+}
+
+/**
+  * Fills the given compact entry with the sector
+  * index of the given logical sector
+ **/
+static void td_fill_sector_entry(struct tdisk *td, struct tdisk_sector_entry *entry, sector_t logical_sector)
+{
+	const struct sector_index *actual = td_peek_index(td, logical_sector);
+
+	entry->logical_sector = (__u32)logical_sector;
+	entry->sector = actual->sector;
+	entry->access_count = ACCESS_COUNT(actual->access_count);
+	entry->disk = actual->disk;
+	entry->used = SECTOR_USED(actual->access_count);
+}
+
+/**
+  * This function transfers a page of sector indices to
+  * user space using one single copy operation
+  * (@see struct tdisk_sector_indices)
+ **/
+static int td_get_sector_indices(struct tdisk *td, struct tdisk_sector_indices __user *arg)
+{
+	struct tdisk_sector_indices request;
+	struct tdisk_sector_entry *entries;
+	struct tdisk_sector_entry __user *user_entries;
+	__u32 i;
+	int ret;
+
+	if(copy_from_user(&request, arg, sizeof(struct tdisk_sector_indices)) != 0)
+		return -EFAULT;
+
+	if(request.mode != TDISK_SECTORS_SORTED && request.mode != TDISK_SECTORS_LIST)return -EINVAL;
+	user_entries = (struct tdisk_sector_entry __user *)(unsigned long)request.entries;
+
+	if(request.count > TDISK_MAX_SECTOR_ENTRIES)request.count = TDISK_MAX_SECTOR_ENTRIES;
+	if(request.mode == TDISK_SECTORS_SORTED)
+	{
+		if(request.first >= td->max_sectors)request.count = 0;
+		else if(request.count > td->max_sectors - request.first)request.count = (__u32)(td->max_sectors - request.first);
+	}
+
+	//Nothing to transfer
+	if(request.count == 0)
+		return put_user(request.count, &arg->count);
+
+	entries = vmalloc(sizeof(struct tdisk_sector_entry) * request.count);
+	if(!entries)return -ENOMEM;
+
+	if(request.mode == TDISK_SECTORS_LIST)
+	{
+		ret = -EFAULT;
+		if(copy_from_user(entries, user_entries, sizeof(struct tdisk_sector_entry) * request.count) != 0)
+			goto out;
+
+		ret = -EINVAL;
+		for(i = 0; i < request.count; ++i)
+		{
+			if(entries[i].logical_sector >= td->max_sectors)goto out;
+			td_fill_sector_entry(td, &entries[i], entries[i].logical_sector);
+		}
+	}
+	else
+	{
+		for(i = 0; i < request.count; ++i)
+			td_fill_sector_entry(td, &entries[i], td->sorted_sectors[request.first + i]);
+	}
+
+	ret = -EFAULT;
+	if(copy_to_user(user_entries, entries, sizeof(struct tdisk_sector_entry) * request.count) != 0)
+		goto out;
+
+	ret = put_user(request.count, &arg->count);
+
+ out:
+	vfree(entries);
+	return ret;
+}
+
+/**
+  * Returns the bucket of the heat histogram of the
+  * given access count (@see TDISK_HEAT_HISTOGRAM_BUCKETS)
+ **/
+inline static unsigned int td_heat_bucket(__u16 access_count)
+{
+	return min_t(unsigned int, fls(access_count), TDISK_HEAT_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+  * This function transfers the amount of used and free
+  * blocks and the heat histogram of all internal devices
+  * to user space. All of them are calculated in one pass
+  * over the sector indices.
+ **/
+static int td_get_usage(struct tdisk *td, struct tdisk_usage __user *arg)
+{
+	struct tdisk_usage request;
+	struct tdisk_device_usage *devices;
+	sector_t logical_sector;
+	__u32 count;
+	int ret;
+
+	if(copy_from_user(&request, arg, sizeof(struct tdisk_usage)) != 0)
+		return -EFAULT;
+
+	count = min_t(__u32, request.count, td->internal_devices_count);
+	request.count = td->internal_devices_count;
+
+	devices = vzalloc(sizeof(struct tdisk_device_usage) * TDISK_MAX_PHYSICAL_DISKS);
+	if(!devices)return -ENOMEM;
+
+	for(logical_sector = 0; logical_sector < td->max_sectors; logical_sector += TDISK_INDEX_PAGE_ENTRIES)
+	{
+		sector_t i;
+		sector_t length = min_t(sector_t, td->max_sectors - logical_sector, TDISK_INDEX_PAGE_ENTRIES);
+		const struct sector_index *page = td_index_page(td, logical_sector);
+
+		if(!page)continue;
+
+		for(i = 0; i < length; ++i)
+		{
+			struct sector_index index;
+			struct tdisk_device_usage *device;
+
+			index.state = READ_ONCE(page[i].state);
+			if(index.disk == 0)continue;
+
+			device = &devices[index.disk-1];
+			if(!SECTOR_USED(index.access_count))
+			{
+				device->free_blocks++;
+				continue;
+			}
+
+			device->used_blocks++;
+			device->heat_histogram[td_heat_bucket(ACCESS_COUNT(index.access_count))]++;
+		}
+
+		cond_resched();
+	}
+
+	ret = -EFAULT;
+	if(count != 0 && copy_to_user((struct tdisk_device_usage __user *)(unsigned long)request.devices, devices, sizeof(struct tdisk_device_usage) * count) != 0)
+		goto out;
+
+	if(copy_to_user(arg, &request, sizeof(struct tdisk_usage)) != 0)
+		goto out;
+
+	ret = 0;
+
+ out:
+	vfree(devices);
+	return ret;
+}
+
+#ifdef USE_PERF_COUNTERS
+
+/**
+  * This function transfers the performance counters of the
+  * tDisk and all internal devices to user space. The counters
+  * of all CPUs are summed up.
+ **/
+static int td_get_stats(struct tdisk *td, struct tdisk_stats __user *arg)
+{
+	struct tdisk_stats stats;
+	struct tdisk_device_stats *devices = NULL;
+	__u32 count;
+	int cpu;
+	unsigned int i;
+	int ret = 0;
+
+	if(copy_from_user(&stats, arg, sizeof(struct tdisk_stats)) != 0)
+		return -EFAULT;
 
-	//All the sectors are now moved at the end of the tDisk and the 
-	//disk is set to 0 which makes them "empty".
-	//Now we decrement all disk indices with an id higher than the
-	//disk which was removed
-	for(sector = 0; sector < td->max_sectors; ++sector)
+	count = min_t(__u32, stats.count, td->internal_devices_count);
+	if(count != 0)
 	{
-		if(td->indices[sector].disk > disk)
-			td->indices[sector].disk--;
+		devices = kcalloc(count, sizeof(struct tdisk_device_stats), GFP_KERNEL);
+		if(!devices)return -ENOMEM;
 	}
 
-	//Invalidate header
-	memset(&invalid_header, 0, sizeof(struct tdisk_header));
-	write_data(&td->internal_devices[disk-1], &invalid_header, 0, sizeof(struct tdisk_header));
+	stats.requests = 0;
+	stats.migrations = 0;
+	stats.migrated_bytes = 0;
+	stats.initial_placements = 0;
+	memset(stats.latency_histogram, 0, sizeof(stats.latency_histogram));
 
-	//Release file if any
-	if(td->internal_devices[disk-1].file)
+	for_each_possible_cpu(cpu)
 	{
-		gfp_t gfp = td->internal_devices[disk-1].old_gfp_mask;
-		mapping_set_gfp_mask(td->internal_devices[disk-1].file->f_mapping, gfp);
-		fput(td->internal_devices[disk-1].file);
-		td->internal_devices[disk-1].file = NULL;
-	}
+		struct td_counters *counters = &td->counters[cpu];
 
-	//Now we remove the internal device from the array
-	for(i = disk; i < td->internal_devices_count; ++i)
-		td->internal_devices[i-1] = td->internal_devices[i];
-	td->internal_devices_count--;
+		stats.requests += counters->requests;
+		stats.migrations += counters->migrations;
+		stats.migrated_bytes += counters->migrated_bytes;
+		stats.initial_placements += counters->initial_placements;
+		for(i = 0; i < TDISK_LATENCY_BUCKETS; ++i)
+			stats.latency_histogram[i] += counters->latency_histogram[i];
 
-	//Write all disk indices
-	for(i = 1; i <= td->internal_devices_count; ++i)
-		td_write_all_indices(td, &td->internal_devices[i-1]);
+		for(i = 0; i < count; ++i)
+		{
+			struct tdisk_device_stats *device_stats;
+			unsigned int j;
 
-	//Set new size
-	new_disk_size = 0;
-	for(i = 1; i <= td->internal_devices_count; ++i)
-		new_disk_size += td->internal_devices[i].size_blocks;
-	new_disk_size -= __div64_32_nomod(new_disk_size * td->percent_cache, 100);
-	td->size_blocks = new_disk_size;
+			//Devices which are not loaded yet don't have counters
+			if(!td->internal_devices[i].stats)continue;
+			device_stats = &td->internal_devices[i].stats[cpu];
 
-	//let user-space know about this change
-	set_capacity(td->kernel_disk, (td->size_blocks*td->blocksize) >> 9);
-	bd_set_size(td->block_device, (loff_t)td->size_blocks*td->blocksize);
-	//kobject_uevent(&disk_to_dev(td->block_device->bd_disk)->kobj, KOBJ_CHANGE);	//GPL only
+			devices[i].hits += device_stats->hits;
+			for(j = 0; j < TDISK_LATENCY_BUCKETS; ++j)
+				devices[i].latency_histogram[j] += device_stats->latency_histogram[j];
+		}
+	}
 
- out:
- 	//Index needs to be resorted
- 	td->access_count_resort = 0;
+	stats.count = td->internal_devices_count;
 
-	td->modifying = false;
+	if(count != 0 && copy_to_user((struct tdisk_device_stats __user *)(unsigned long)stats.devices, devices, sizeof(struct tdisk_device_stats) * count) != 0)
+		ret = -EFAULT;
+	else if(copy_to_user(arg, &stats, sizeof(struct tdisk_stats)) != 0)
+		ret = -EFAULT;
 
-	//Starting queue again
-	td_start_worker_thread(td);
-	td_reread_partitions(td, td->block_device);
+	kfree(devices);
 
-	return error;
+	return ret;
 }
 
+#endif //USE_PERF_COUNTERS
+
+#ifdef USE_IO_CAPTURE
+
 /**
-  * This function transfers device status information
-  * to user space
+  * Records the given request if the requests of the tDisk
+  * are captured. This is only called by the worker thread.
  **/
-static int td_get_status(struct tdisk *td, struct tdisk_info __user *arg)
+static void td_capture_request(struct tdisk *td, struct request *rq)
 {
-	struct tdisk_info info;
+	struct td_io_capture *capture;
+	struct tdisk_io_record *record;
+	u64 head;
 
-	memset(&info, 0, sizeof(info));
-	//info.block_device = huge_encode_dev(td->block_device);
-	info.max_sectors = td->max_sectors;
-	info.size_blocks = td->size_blocks;
-	info.blocksize = td->blocksize;
-	info.number = (__u32)td->number;
-	info.flags = (__u32)td->flags;
-	info.internaldevices = td->internal_devices_count;
+	//Flushes don't transfer any data
+	if(blk_rq_bytes(rq) == 0 || (rq->cmd_flags & REQ_DISCARD))return;
 
-	if(copy_to_user(arg, &info, sizeof(info)) != 0)
-		return -EFAULT;
+	if(ACCESS_ONCE(td->io_capturing))
+	{
+		capture = td->io_capture;
+		head = capture->head;
 
-	return 0;
+		if(head - ACCESS_ONCE(capture->tail) >= TDISK_MAX_IO_RECORDS)
+		{
+			//The ring is full
+			capture->lost++;
+		}
+		else
+		{
+			record = &capture->records[head & (TDISK_MAX_IO_RECORDS - 1)];
+			record->time = td_trace_clock();
+			record->position = (__u64)blk_rq_pos(rq) << 9;
+			record->length = blk_rq_bytes(rq);
+			record->direction = (rq->cmd_flags & REQ_WRITE) ? TDISK_IO_WRITE : TDISK_IO_READ;
+			record->priority = IOPRIO_PRIO_CLASS(req_get_ioprio(rq));
+			record->reserved = 0;
+
+			//The record needs to be complete before it is visible
+			smp_wmb();
+			ACCESS_ONCE(capture->head) = head + 1;
+		}
+	}
 }
 
 /**
-  * This function transfers information about the internal
-  * devices to user space
+  * Starts or stops capturing the requests of the tDisk.
+  * When the capture is started, the records which were
+  * not drained yet are dropped.
  **/
-static int td_get_device_info(struct tdisk *td, struct internal_device_info __user *arg)
+static int td_set_io_capture(struct tdisk *td, bool enable)
 {
-	struct internal_device_info info;
+	if(!enable)
+	{
+		ACCESS_ONCE(td->io_capturing) = false;
 
-	if(copy_from_user(&info, arg, sizeof(struct internal_device_info)) != 0)
-		return -EFAULT;
+		//Wait until the worker thread finished the requests
+		//which it may still record
+		flush_kthread_worker_timeout(&td->worker_timeout);
+		return 0;
+	}
 
-	if(info.disk == 0 || info.disk > td->internal_devices_count)
-		return -EINVAL;
+	if(td->io_capturing)return 0;
 
-	info.type = td->internal_devices[info.disk-1].type;
-	memcpy(info.name, td->internal_devices[info.disk-1].name, TDISK_MAX_INTERNAL_DEVICE_NAME);
-	memcpy(info.path, td->internal_devices[info.disk-1].path, TDISK_MAX_INTERNAL_DEVICE_NAME);
-	info.performance = td->internal_devices[info.disk-1].performance;
-	info.size = td->internal_devices[info.disk-1].size_blocks * td->blocksize;
-	info.bytes_read = td->internal_devices[info.disk-1].bytes_read;
-	info.bytes_written = td->internal_devices[info.disk-1].bytes_written;
+	if(!td->io_capture)
+	{
+		td->io_capture = vmalloc(sizeof(struct td_io_capture));
+		if(!td->io_capture)return -ENOMEM;
+	}
 
-	if(copy_to_user(arg, &info, sizeof(info)) != 0)
-		return -EFAULT;
+	td->io_capture->head = 0;
+	td->io_capture->tail = 0;
+	td->io_capture->lost = 0;
+
+	smp_wmb();
+	ACCESS_ONCE(td->io_capturing) = true;
+
+	printk(KERN_INFO "tDisk: Capturing requests of disk %d\n", td->number);
 
 	return 0;
 }
 
 /**
-  * This function transfers information about the given
-  * logical sector to user space
+  * This function transfers the captured requests to user
+  * space. The records are removed from the ring.
  **/
-static int td_get_sector_index(struct tdisk *td, struct physical_sector_index __user *arg)
+static int td_get_io_capture(struct tdisk *td, struct tdisk_io_capture __user *arg)
 {
-	struct physical_sector_index index;
+	struct tdisk_io_capture info;
+	struct tdisk_io_record *records = NULL;
+	struct td_io_capture *capture = td->io_capture;
+	u64 head;
+	u64 i;
+	int ret = 0;
 
-	if(copy_from_user(&index, arg, sizeof(struct physical_sector_index)) != 0)
+	if(copy_from_user(&info, arg, sizeof(struct tdisk_io_capture)) != 0)
 		return -EFAULT;
 
-	if(index.sector >= td->max_sectors)return -EINVAL;
+	if(!capture)
+	{
+		info.count = 0;
+		info.lost = 0;
+		goto out_copy;
+	}
 
-	index.disk = td->sorted_sectors[index.sector].physical_sector->disk;
-	index.sector = td->sorted_sectors[index.sector].physical_sector->sector;
-	index.access_count = ACCESS_COUNT(td->sorted_sectors[index.sector].physical_sector->access_count);
-	index.used = SECTOR_USED(td->sorted_sectors[index.sector].physical_sector->access_count);
+	head = ACCESS_ONCE(capture->head);
 
-	if(copy_to_user(arg, &index, sizeof(struct physical_sector_index)) != 0)
-		return -EFAULT;
+	//Pairs with smp_wmb in td_capture_request
+	smp_rmb();
 
-	return 0;
+	info.count = (__u32)min_t(u64, min_t(u64, info.count, TDISK_MAX_IO_RECORDS), head - capture->tail);
+	info.lost = ACCESS_ONCE(capture->lost);
+
+	if(info.count != 0)
+	{
+		records = vmalloc(sizeof(struct tdisk_io_record) * info.count);
+		if(!records)return -ENOMEM;
+
+		for(i = 0; i < info.count; ++i)
+			records[i] = capture->records[(capture->tail + i) & (TDISK_MAX_IO_RECORDS - 1)];
+
+		//The records need to be copied before they can be reused
+		smp_mb();
+		ACCESS_ONCE(capture->tail) = capture->tail + info.count;
+
+		if(copy_to_user((struct tdisk_io_record __user *)(unsigned long)info.records, records, sizeof(struct tdisk_io_record) * info.count) != 0)
+			ret = -EFAULT;
+	}
+
+ out_copy:
+	if(ret == 0 && copy_to_user(arg, &info, sizeof(struct tdisk_io_capture)) != 0)
+		ret = -EFAULT;
+
+	if(records)vfree(records);
+
+	return ret;
 }
 
+#else
+#pragma message "I/O capture is disabled"
+#endif //USE_IO_CAPTURE
+
+#ifdef USE_MISS_RATIO_CURVE
+
 /**
-  * This function transfers information about all
-  * logical sectors to user space
+  * Records the reuse distances of the blocks of the given
+  * request if they are tracked. This is only called by
+  * the worker thread.
  **/
-static int td_get_all_sector_indices(struct tdisk *td, struct sector_info __user *arg)
+static void td_track_reuse_distance(struct tdisk *td, struct request *rq)
 {
-	struct sorted_sector_index *pos;
-	struct sector_info info;
-	sector_t sorted_index = 0;
+	const bool write = (rq->cmd_flags & REQ_WRITE);
+	const u64 pos_byte = (u64)blk_rq_pos(rq) << 9;
+	sector_t block;
+	sector_t last;
 
-	list_for_each_entry(pos, &td->sorted_sectors_head, total_sorted)
+	//Flushes and discards don't access any data
+	if(blk_rq_bytes(rq) == 0 || (rq->cmd_flags & REQ_DISCARD))return;
+
+	block = (sector_t)__div64_32_nomod(pos_byte, td->blocksize);
+	last = (sector_t)__div64_32_nomod(pos_byte + blk_rq_bytes(rq) - 1, td->blocksize);
+
+	if(ACCESS_ONCE(td->mrc_tracking))
 	{
-		info.physical_sector.disk = pos->physical_sector->disk;
-		info.physical_sector.sector = pos->physical_sector->sector;
-		info.physical_sector.access_count = ACCESS_COUNT(pos->physical_sector->access_count);
-		info.physical_sector.used = SECTOR_USED(pos->physical_sector->access_count);
-		info.access_sorted_index = sorted_index;
-		info.logical_sector = (__u64)(pos - td->sorted_sectors);
+		for(; block <= last; ++block)
+			td_mrc_access(td->mrc, block, write);
+	}
+}
 
-		if(copy_to_user(&arg[sorted_index], &info, sizeof(struct sector_info)) != 0)
-			return -EFAULT;
+/**
+  * Starts or stops tracking the reuse distances of the
+  * tDisk. Starting the tracking resets the histograms.
+ **/
+static int td_set_mrc_tracking(struct tdisk *td, bool enable)
+{
+	ACCESS_ONCE(td->mrc_tracking) = false;
+
+	//Wait until the worker thread finished the requests
+	//which it may still track
+	flush_kthread_worker_timeout(&td->worker_timeout);
 
-		sorted_index++;
+	if(!enable)return 0;
+
+	if(!td->mrc)
+	{
+		td->mrc = vmalloc(sizeof(struct td_mrc));
+		if(!td->mrc)return -ENOMEM;
 	}
 
+	td_mrc_reset(td->mrc, td->size_blocks);
+
+	smp_wmb();
+	ACCESS_ONCE(td->mrc_tracking) = true;
+
+	printk(KERN_INFO "tDisk: Tracking reuse distances of disk %d\n", td->number);
+
+	return 0;
+}
+
+/**
+  * This function transfers the reuse distance
+  * histograms to user space.
+ **/
+static int td_get_mrc(struct tdisk *td, struct tdisk_mrc __user *arg)
+{
+	//The reuse distances were never tracked
+	if(!td->mrc)
+		return clear_user(arg, sizeof(struct tdisk_mrc)) ? -EFAULT : 0;
+
+	//The worker thread may update the histograms in the
+	//meantime. This only affects the most recent accesses
+	if(copy_to_user(arg, &td->mrc->result, sizeof(struct tdisk_mrc)) != 0)
+		return -EFAULT;
+
 	return 0;
 }
 
+#else
+#pragma message "Miss ratio curve is disabled"
+#endif //USE_MISS_RATIO_CURVE
+
 /**
   * This function clears the access count of all
   * sectors. This is just for debugging purposes.
@@ -2466,32 +5553,130 @@ static int td_clear_access_count(struct tdisk *td)
 {
 	sector_t i;
 
+#ifdef USE_PERCPU_HEAT
+	td_drop_heat(td);
+#endif //USE_PERCPU_HEAT
+
+	if(td->heat_sketch)
+		memset(td->heat_sketch->counters, 0, sizeof(td->heat_sketch->counters));
+
+	//The used flag is kept because the data of
+	//unused sectors is not copied when they are moved
 	for(i = 0; i < td->max_sectors; ++i)
 	{
-		RESET_ACCESS_COUNT(td->sorted_sectors[i].physical_sector->access_count);
-		SET_UNUSED_SECTOR(td->sorted_sectors[i].physical_sector->access_count);
+		if(td_index_page(td, i))RESET_ACCESS_COUNT(td_index(td, i)->access_count);
+	}
+
+#ifdef USE_HEAT_SNAPSHOT
+	bitmap_fill(td->heat_snapshot_dirty, TDISK_HEAT_SNAPSHOT_CHUNKS);
+#endif //USE_HEAT_SNAPSHOT
+
+	return 0;
+}
+
+/**
+  * Pins the given range to a tier (@see struct tdisk_pin).
+  * Pins which overlap the range are replaced. The pins
+  * are stored on all internal devices.
+ **/
+static int td_pin_range(struct tdisk *td, struct tdisk_pin __user *arg)
+{
+	struct tdisk_pin pin;
+	sector_t first_sector;
+	sector_t last_sector;
+	unsigned int overlapping = 0;
+	unsigned int i;
+	tdisk_index disk;
+
+	if(copy_from_user(&pin, arg, sizeof(struct tdisk_pin)) != 0)
+		return -EFAULT;
+
+	if(pin.length == 0 || pin.offset >= (__u64)td->size_blocks * td->blocksize || pin.length > (__u64)td->size_blocks * td->blocksize - pin.offset)
+		return -EINVAL;
+
+	if(pin.tier != TDISK_PIN_NEVER_PROMOTE && pin.tier > td->internal_devices_count)
+		return -EINVAL;
+
+	//The pins need to be stored on all devices
+	if(!td_is_ready(td))
+		return -EBUSY;
+
+	first_sector = __div64_32_nomod(pin.offset, td->blocksize);
+	last_sector = __div64_32_nomod(pin.offset + pin.length - 1, td->blocksize);
+
+	for(i = 0; i < td->pin_count; ++i)
+	{
+		if(td->pins.pins[i].first_sector <= last_sector && td->pins.pins[i].last_sector >= first_sector)
+			overlapping++;
+	}
+
+	if(pin.tier != TDISK_PIN_NONE && td->pin_count - overlapping == TDISK_MAX_PINS)
+		return -ENOSPC;
+
+	//The worker thread uses the pins to assign the sectors
+	td_stop_worker_thread(td);
+
+	for(i = 0; i < td->pin_count; )
+	{
+		if(td->pins.pins[i].first_sector <= last_sector && td->pins.pins[i].last_sector >= first_sector)
+		{
+			td->pins.pins[i] = td->pins.pins[--td->pin_count];
+			memset(&td->pins.pins[td->pin_count], 0, sizeof(struct td_pin));
+		}
+		else ++i;
+	}
+
+	if(pin.tier != TDISK_PIN_NONE)
+	{
+		td->pins.pins[td->pin_count].first_sector = first_sector;
+		td->pins.pins[td->pin_count].last_sector = last_sector;
+		td->pins.pins[td->pin_count].tier = pin.tier;
+		td->pin_count++;
 	}
 
+	for(disk = 1; disk <= td->internal_devices_count; ++disk)
+		td_write_pins(td, &td->internal_devices[disk-1]);
+
+	//The sectors need to be assigned again
+	td->access_count_resort = 0;
+
+	td_start_worker_thread(td);
+
 	return 0;
 }
 
 /**
-  * This function retrieves the next debug info
+  * This function drains the trace records of all CPUs
+  * to user space
  **/
 static int td_get_debug(struct tdisk *td, struct tdisk_debug_info __user *arg)
 {
 	struct tdisk_debug_info info;
+	struct tdisk_trace_record *records = NULL;
+	__u32 size;
+	int ret = 0;
 
 	if(copy_from_user(&info, arg, sizeof(struct tdisk_debug_info)) != 0)
 		return -EFAULT;
 
-	get_next_debug_point(&td->debug, info.id, &info);
-	info.hz = HZ;
+	size = min_t(__u32, info.count, TDISK_MAX_TRACE_RECORDS);
+	if(size != 0)
+	{
+		records = vmalloc(sizeof(struct tdisk_trace_record) * size);
+		if(!records)return -ENOMEM;
+	}
+
+	info.lost = 0;
+	td_trace_drain(&td->debug, records, size, &info.count, &info.lost);
 
-	if(copy_to_user(arg, &info, sizeof(struct tdisk_debug_info)) != 0)
-		return -EFAULT;
+	if(info.count != 0 && copy_to_user((struct tdisk_trace_record __user *)(unsigned long)info.records, records, sizeof(struct tdisk_trace_record) * info.count) != 0)
+		ret = -EFAULT;
+	else if(copy_to_user(arg, &info, sizeof(struct tdisk_debug_info)) != 0)
+		ret = -EFAULT;
 
-	return 0;
+	if(records)vfree(records);
+
+	return ret;
 }
 
 /**
@@ -2529,6 +5714,36 @@ static int td_ioctl(struct block_device *bdev, fmode_t mode, unsigned int cmd, u
 	case TDISK_REMOVE_DISK:
 		err = td_remove_disk(td, (tdisk_index)arg);
 		break;
+	case TDISK_PIN_RANGE:
+		err = td_pin_range(td, (struct tdisk_pin __user *) arg);
+		break;
+	case TDISK_GET_SECTOR_INDICES:
+		err = td_get_sector_indices(td, (struct tdisk_sector_indices __user *) arg);
+		break;
+	case TDISK_GET_USAGE:
+		err = td_get_usage(td, (struct tdisk_usage __user *) arg);
+		break;
+#ifdef USE_PERF_COUNTERS
+	case TDISK_GET_STATS:
+		err = td_get_stats(td, (struct tdisk_stats __user *) arg);
+		break;
+#endif //USE_PERF_COUNTERS
+#ifdef USE_IO_CAPTURE
+	case TDISK_SET_IO_CAPTURE:
+		err = td_set_io_capture(td, arg != 0);
+		break;
+	case TDISK_GET_IO_CAPTURE:
+		err = td_get_io_capture(td, (struct tdisk_io_capture __user *) arg);
+		break;
+#endif //USE_IO_CAPTURE
+#ifdef USE_MISS_RATIO_CURVE
+	case TDISK_SET_MRC_TRACKING:
+		err = td_set_mrc_tracking(td, arg != 0);
+		break;
+	case TDISK_GET_MRC:
+		err = td_get_mrc(td, (struct tdisk_mrc __user *) arg);
+		break;
+#endif //USE_MISS_RATIO_CURVE
 	case CDROM_GET_CAPABILITY:
 		//Udev sends it and we don't want to spam dmesg
 		err = -ENOTTY;
@@ -2562,11 +5777,19 @@ static int td_compat_ioctl(struct block_device *bdev, fmode_t mode, unsigned int
 	case TDISK_GET_ALL_SECTOR_INDICES:
 	case TDISK_CLEAR_ACCESS_COUNT:
 	case TDISK_GET_DEBUG_INFO:
+	case TDISK_PIN_RANGE:
+	case TDISK_GET_SECTOR_INDICES:
+	case TDISK_GET_USAGE:
+	case TDISK_GET_STATS:
+	case TDISK_GET_IO_CAPTURE:
+	case TDISK_GET_MRC:
 	case CDROM_GET_CAPABILITY:
 		arg = (unsigned long)compat_ptr((compat_uptr_t)arg);
 		err = td_ioctl(bdev, mode, cmd, arg);
 		break;
 	case TDISK_REMOVE_DISK:
+	case TDISK_SET_IO_CAPTURE:
+	case TDISK_SET_MRC_TRACKING:
 		err = td_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -2728,6 +5951,12 @@ static enum worker_status td_queue_work(void *private_data, struct kthread_work
 {
 	struct tdisk *td = private_data;
 
+#ifdef ADAPTIVE_CACHE_RESERVE
+	td_update_cache_reserve(td);
+#else
+#pragma message "Adaptive cache reserve is disabled"
+#endif //ADAPTIVE_CACHE_RESERVE
+
 	//Since we are not using the standard kthread_work_fn
 	//It is possible that this funtion is called without work.
 	//The reason behind this is that we can reorganize the indices
@@ -2736,6 +5965,23 @@ static enum worker_status td_queue_work(void *private_data, struct kthread_work
 	{
 		struct td_command *cmd = container_of(work, struct td_command, td_work);
 		int ret = 0;
+		TRACE_TIME(trace_start);
+#ifdef USE_PERF_COUNTERS
+		struct timespec start;
+
+		getnstimeofday(&start);
+#endif //USE_PERF_COUNTERS
+
+		TRACE_START(trace_start);
+		TRACE_POINT(&td->debug, TDISK_TRACE_REQUEST_START, blk_rq_pos(cmd->rq), 0, blk_rq_bytes(cmd->rq));
+
+#ifdef USE_IO_CAPTURE
+		td_capture_request(td, cmd->rq);
+#endif //USE_IO_CAPTURE
+
+#ifdef USE_MISS_RATIO_CURVE
+		td_track_reuse_distance(td, cmd->rq);
+#endif //USE_MISS_RATIO_CURVE
 
 		if((cmd->rq->cmd_flags & REQ_WRITE) && (td->flags & TD_FLAGS_READ_ONLY))
 			ret = -EIO;
@@ -2750,6 +5996,18 @@ static enum worker_status td_queue_work(void *private_data, struct kthread_work
 #endif //ASYNC_OPERATIONS
 		}
 
+#ifdef USE_PERF_COUNTERS
+		//Asynchronous requests are counted when they are queued
+		{
+			struct td_counters *counters = td_get_cpu_counters(td);
+
+			counters->requests++;
+			counters->latency_histogram[td_latency_bucket(&start)]++;
+			put_cpu();
+		}
+#endif //USE_PERF_COUNTERS
+		TRACE_SPAN(&td->debug, TDISK_TRACE_REQUEST_END, blk_rq_pos(cmd->rq), 0, trace_start);
+
 #ifdef ASYNC_OPERATIONS
 		//if(ret != -EIOCBQUEUED)
 		//{
@@ -2801,12 +6059,64 @@ static enum worker_status td_queue_work(void *private_data, struct kthread_work
 		//No work to do. This means we have reached the timeout
 		//and have now the opportunity to organize the sectors.
 
+#ifdef USE_HEAT_SNAPSHOT
+		//The heat snapshot only writes the indices, so it
+		//doesn't need a migration budget
+		if(td_write_heat_snapshot(td))
+		{
+			td->optimizing = false;
+			return secondary_work_to_do;
+		}
+#endif //USE_HEAT_SNAPSHOT
+
+#ifdef USE_WRITE_BACK_CACHE
+		//The staged sectors are found again after
+		//they were dropped, e.g. because a disk was added
+		if(td->cache_sectors != 0)td_load_staged_sectors(td);
+#endif //USE_WRITE_BACK_CACHE
+
+#ifdef USE_MIGRATION_BUDGET
+		//Sorting doesn't need a budget, only moving and
+		//writing back sectors
+		if((td->staged_count != 0 || td->access_count_resort != 0) && !td_acquire_migration_budget(td))
+		{
+			td->optimizing = false;
+			return secondary_work_to_do;
+		}
+#else
+#pragma message "Migration budget is disabled"
+#endif //USE_MIGRATION_BUDGET
+
+#ifdef USE_WRITE_BACK_CACHE
+		//Staged sectors are written back before anything else
+		//is optimized
+		if(td->staged_count != 0)
+		{
+			td_destage_one_sector(td);
+			td->optimizing = false;
+			return secondary_work_to_do;
+		}
+#else
+#pragma message "Write back cache is disabled"
+#endif //USE_WRITE_BACK_CACHE
+
 		if(td->access_count_resort == 0)
 		{
 			bool still_to_sort;
 
 			printk(KERN_DEBUG "tDisk: nothing to do anymore. Sorting sectors\n");
 
+#ifdef USE_PERCPU_HEAT
+			td_fold_heat(td);
+#endif //USE_PERCPU_HEAT
+
+			if(td->heat_sketch)
+				td_sketch_age(td->heat_sketch);
+
+#ifdef USE_SUB_BLOCK_HEAT
+			td_age_regions(td);
+#endif //USE_SUB_BLOCK_HEAT
+
 			still_to_sort = td_reorganize_all_indices(td);
 
 			if(still_to_sort)
@@ -2820,7 +6130,9 @@ static enum worker_status td_queue_work(void *private_data, struct kthread_work
 				if(td->sorted_devices != NULL)
 				{
 					vfree(td->sorted_devices);
+					vfree(td->device_sectors);
 					td->sorted_devices = NULL;
+					td->device_sectors = NULL;
 				}
 
 				//Setting to true so the next time we will do move operations
@@ -2866,9 +6178,16 @@ int tdisk_add(struct tdisk **t, struct tdisk_add_parameters *params)
 		return -EINVAL;
 	}
 
+	if(params->heat_tracking != heat_tracking_exact && params->heat_tracking != heat_tracking_sketch)
+	{
+		printk(KERN_WARNING"tDisk: Failed to add tDisk. Invalid heat tracking %u\n", params->heat_tracking);
+		return -EINVAL;
+	}
+
 	//Calculate header size which consists
-	//of a header, disk mappings and indices
-	header_size_byte = sizeof(struct tdisk_header);
+	//of a header, the reserved area which holds
+	//the pin table, disk mappings and indices
+	header_size_byte = sizeof(struct tdisk_header) + TDISK_HEADER_RESERVED;
 
 	err = -ENOMEM;
 	td = kzalloc(sizeof(struct tdisk), GFP_KERNEL);
@@ -2877,6 +6196,25 @@ int tdisk_add(struct tdisk **t, struct tdisk_add_parameters *params)
 	td->size_blocks = 0;
 	td->percent_cache = params->percent_cache;
 
+#ifdef USE_PERCPU_HEAT
+	td->heat_buffers = vzalloc(sizeof(struct td_heat_buffer) * nr_cpu_ids);
+	if(!td->heat_buffers)goto out_free_dev;
+#endif //USE_PERCPU_HEAT
+
+#ifdef USE_PERF_COUNTERS
+	td->counters = vzalloc(sizeof(struct td_counters) * nr_cpu_ids);
+	if(!td->counters)goto out_free_dev;
+#endif //USE_PERF_COUNTERS
+
+	if(init_debug_struct(&td->debug) != 0)goto out_free_dev;
+
+	if(params->heat_tracking == heat_tracking_sketch)
+	{
+		td->heat_sketch = vzalloc(sizeof(struct td_heat_sketch));
+		if(!td->heat_sketch)goto out_free_dev;
+		td->heat_sketch->aging_start = jiffies;
+	}
+
 	//allocate id, if id >= 0, we're requesting that specific id
 	if(params->minornumber >= 0)
 	{
@@ -2913,11 +6251,46 @@ int tdisk_add(struct tdisk **t, struct tdisk_add_parameters *params)
 
 	queue_flag_set_unlocked(QUEUE_FLAG_NOMERGES, td->queue);
 
+	//Discards are passed to the internal devices
+	td->queue->limits.discard_granularity = params->blocksize;
+	blk_queue_max_discard_sectors(td->queue, UINT_MAX >> 9);
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, td->queue);
+
+	//The tDisk has a volatile write cache (the internal devices)
+	//and supports FUA requests natively
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,7,0)
+	queue_flag_set_unlocked(QUEUE_FLAG_WC, td->queue);
+	queue_flag_set_unlocked(QUEUE_FLAG_FUA, td->queue);
+#else
+	td->queue->flush_flags = REQ_FLUSH | REQ_FUA;
+#endif //LINUX_VERSION_CODE >= KERNEL_VERSION(4,7,0)
+
 	disk = td->kernel_disk = alloc_disk(1);
 	if(!disk)goto out_free_queue;
 
 	td->blocksize = params->blocksize;
 	td->index_offset_byte = header_size_byte;
+
+#ifdef USE_HEAT_SNAPSHOT
+	td_resize_heat_snapshot(td);
+	td->heat_snapshot_cursor = TDISK_HEAT_SNAPSHOT_CHUNKS;
+	td->heat_snapshot_start = jiffies;
+#endif //USE_HEAT_SNAPSHOT
+
+#ifdef USE_SUB_BLOCK_HEAT
+	//A region is at least one page
+	td->region_count = min_t(unsigned int, TDISK_MAX_REGIONS, td->blocksize >> PAGE_SHIFT);
+	if(td->region_count == 0)td->region_count = 1;
+	td->region_size = td->blocksize / td->region_count;
+	td->regions_aging_start = jiffies;
+
+	if(td->region_count > 1)
+	{
+		err = -ENOMEM;
+		td->read_cache = vzalloc(sizeof(struct td_read_cache_entry) * READ_CACHE_ENTRIES);
+		if(!td->read_cache)goto out_free_queue;
+	}
+#endif //USE_SUB_BLOCK_HEAT
 	err = td_set_max_sectors(td, 0);
 	if(err < 0)goto out_free_queue;
 
@@ -2931,10 +6304,11 @@ int tdisk_add(struct tdisk **t, struct tdisk_add_parameters *params)
 		goto out_free_queue;
 	}
 
-	init_debug_struct(&td->debug);
-
 	disk->flags |= GENHD_FL_EXT_DEVT;
 	mutex_init(&td->ctl_mutex);
+#ifdef USE_COMPRESSION
+	mutex_init(&td->compression_mutex);
+#endif //USE_COMPRESSION
 	atomic_set(&td->refcount, 0);
 	td->number		= params->minornumber;
 	spin_lock_init(&td->tdisk_lock);
@@ -2948,18 +6322,28 @@ int tdisk_add(struct tdisk **t, struct tdisk_add_parameters *params)
 	add_disk(disk);
 	*t = td;
 
-	DEBUG_POINT(&td->debug, "tDisk: new disk %s: blocksize: %u, header size: %u sec\n", disk->disk_name, params->blocksize, td->header_size);
 	printk(KERN_DEBUG "tDisk: new disk %s: blocksize: %u, header size: %u sec\n", disk->disk_name, params->blocksize, td->header_size);
 
 	return td->number;
 
 out_free_queue:
+#ifdef USE_SUB_BLOCK_HEAT
+	td_free_read_cache(td);
+#endif //USE_SUB_BLOCK_HEAT
 	blk_cleanup_queue(td->queue);
 out_cleanup_tags:
 	blk_mq_free_tag_set(&td->tag_set);
 out_free_idr:
 	idr_remove(&td_index_idr, params->minornumber);
 out_free_dev:
+	if(td->heat_sketch)vfree(td->heat_sketch);
+#ifdef USE_PERCPU_HEAT
+	if(td->heat_buffers)vfree(td->heat_buffers);
+#endif //USE_PERCPU_HEAT
+#ifdef USE_PERF_COUNTERS
+	if(td->counters)vfree(td->counters);
+#endif //USE_PERF_COUNTERS
+	free_debug_struct(&td->debug);
 	kfree(td);
 out:
 	return err;
@@ -2985,6 +6369,11 @@ int tdisk_remove(struct tdisk *td)
 	if(td->internal_devices_count)
 		td_stop_worker_thread(td);
 
+#ifdef USE_PERCPU_HEAT
+	//The buffered accesses are stored as well
+	td_fold_heat(td);
+#endif //USE_PERCPU_HEAT
+
 	//Write header and indices to all files
 	for(i = 1; i <= td->internal_devices_count; ++i)
 	{
@@ -3000,9 +6389,18 @@ int tdisk_remove(struct tdisk *td)
 		gfp_t gfp = td->internal_devices[i-1].old_gfp_mask;
 
 		//Write current performance and index values to file
-		td_write_header(&td->internal_devices[i-1], &header);
+		td_write_header(&td->internal_devices[i-1], &header, TDISK_INDEX_VERSION);
+		td_write_pins(td, &td->internal_devices[i-1]);
 		td_write_all_indices(td, &td->internal_devices[i-1]);
 
+#ifdef USE_MIGRATION_BUDGET
+		td_unregister_migration_device(&td->internal_devices[i-1]);
+#endif //USE_MIGRATION_BUDGET
+
+#ifdef USE_PERF_COUNTERS
+		if(td->internal_devices[i-1].stats)vfree(td->internal_devices[i-1].stats);
+#endif //USE_PERF_COUNTERS
+
 		if(file)
 		{
 			mapping_set_gfp_mask(file->f_mapping, gfp);
@@ -3027,7 +6425,31 @@ int tdisk_remove(struct tdisk *td)
 	put_disk(td->kernel_disk);
 
 	vfree(td->sorted_sectors);
-	vfree(td->indices);
+	vfree(td->assigned_devices);
+	if(td->sorted_devices)vfree(td->sorted_devices);
+	if(td->device_sectors)vfree(td->device_sectors);
+	td_free_index_table(td);
+	if(td->staged_sectors)vfree(td->staged_sectors);
+	if(td->heat_sketch)vfree(td->heat_sketch);
+#ifdef USE_SUB_BLOCK_HEAT
+	td_free_read_cache(td);
+#endif //USE_SUB_BLOCK_HEAT
+#ifdef USE_COMPRESSION
+	td_free_compression(td);
+#endif //USE_COMPRESSION
+#ifdef USE_PERCPU_HEAT
+	vfree(td->heat_buffers);
+#endif //USE_PERCPU_HEAT
+#ifdef USE_PERF_COUNTERS
+	vfree(td->counters);
+#endif //USE_PERF_COUNTERS
+#ifdef USE_IO_CAPTURE
+	if(td->io_capture)vfree(td->io_capture);
+#endif //USE_IO_CAPTURE
+#ifdef USE_MISS_RATIO_CURVE
+	if(td->mrc)vfree(td->mrc);
+#endif //USE_MISS_RATIO_CURVE
+	free_debug_struct(&td->debug);
 	kfree(td);
 
 	return 0;
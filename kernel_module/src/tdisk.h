@@ -10,8 +10,10 @@
 
 #include <tdisk/config.h>
 #include <tdisk/interface.h>
+#include "helpers.h"
 #include "worker_timeout.h"
 #include "tdisk_debug.h"
+#include "tdisk_mrc.h"
 
 #pragma GCC system_header
 #include <linux/atomic.h>
@@ -19,7 +21,12 @@
 #include <linux/blk-mq.h>
 #include <linux/blkdev.h>
 #include <linux/cdrom.h>
+#include <linux/crc32.h>
 #include <linux/delay.h>
+#include <linux/hash.h>
+#include <linux/highmem.h>
+#include <linux/ioprio.h>
+#include <linux/jhash.h>
 #include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/list_sort.h>
@@ -42,44 +49,316 @@ struct __attribute__((packed)) tdisk_header
 	__u32 major_version;
 	__u32 minor_version;
 	struct device_performance performance;
-	__u32 blocksize;
+	__u32 legacy_blocksize;	//The blocksize before driver version 2.0. Always 0 so that older drivers reject the disk
 	__u64 size_blocks;
 	__u64 current_max_sectors;
 	tdisk_index disk_index;	//disk index in the tdisk
-	char placeholder[21];	//For future releases (total 128 Byte)
+	__u32 index_version;	//The format of the indices (since driver version 1.1)
+	__u8 flags;				//TDISK_HEADER_FLAG_*
+	__u32 blocksize;		//Since driver version 2.0
+	char placeholder[12];	//For future releases (total 128 Byte)
 }; //end struct tdisk_header
 
 /**
-  * A index represents the physical location of a logical sector
+  * The blocks of the internal device are stored compressed
  **/
-struct __attribute__((packed)) sector_index
+#define TDISK_HEADER_FLAG_COMPRESS 1
+
+/**
+  * The header of a block which is stored compressed. It is
+  * followed by the compressed data (@see td_compress). Whether
+  * a block is stored compressed is stored in its sector index
+ **/
+struct __attribute__((packed)) td_compressed_block
+{
+	__le32 length;	//Length of the compressed data
+	__le32 crc;		//crc32 of the compressed data
+}; //end struct td_compressed_block
+
+/**
+  * The index format of the driver version 1.0 which
+  * used struct legacy_sector_index
+ **/
+#define TDISK_INDEX_VERSION_LEGACY 0
+
+/**
+  * The compact index format using struct sector_index.
+  * The indices are stored after the reserved area
+  * (@see TDISK_HEADER_RESERVED)
+ **/
+#define TDISK_INDEX_VERSION_COMPACT 1
+
+/**
+  * The compact index format which stores the pin table
+  * (struct td_pin_table) in the reserved area
+ **/
+#define TDISK_INDEX_VERSION_PINNED 2
+
+/**
+  * Same as TDISK_INDEX_VERSION_PINNED but the highest bit of
+  * the access count marks sectors which are staged in the write
+  * back cache. Older formats used it for the access count.
+ **/
+#define TDISK_INDEX_VERSION_STAGED 3
+
+/**
+  * Same as TDISK_INDEX_VERSION_STAGED but the second highest
+  * bit of the access count marks sectors which are stored
+  * compressed. Older formats used it for the access count.
+ **/
+#define TDISK_INDEX_VERSION_COMPRESSED 4
+
+/**
+  * Marks a device whose legacy indices are being overwritten
+  * by indices in the current format. The indices of such a
+  * device are incomplete and need to be taken from the other
+  * devices of the tDisk.
+ **/
+#define TDISK_INDEX_VERSION_MIGRATING 0xFFFFFFFF
+
+/**
+  * The index format which is written by the current driver
+ **/
+#define TDISK_INDEX_VERSION TDISK_INDEX_VERSION_COMPRESSED
+
+/**
+  * A range of logical sectors which is pinned to a tier
+  * (@see struct tdisk_pin). A tier of TDISK_PIN_NONE
+  * means the pin is not used
+ **/
+struct __attribute__((packed)) td_pin
+{
+	__u64 first_sector;
+	__u64 last_sector;
+	__u32 tier;
+}; //end struct td_pin
+
+/**
+  * The pinned ranges as they are stored on the internal
+  * devices in the reserved area right after the header
+ **/
+struct __attribute__((packed)) td_pin_table
+{
+	struct td_pin pins[TDISK_MAX_PINS];
+}; //end struct td_pin_table
+
+/**
+  * The amount of bytes between the header and the indices
+  * which are reserved for future releases. Legacy disks
+  * store their indices right after the header.
+ **/
+#define TDISK_HEADER_RESERVED 640
+
+/**
+  * A index represents the physical location of a logical sector.
+  * In memory, the access count and the disk share one aligned
+  * 32 bit word so that the access count can be updated atomically.
+  * The layout matches struct disk_sector_index up to the disk.
+ **/
+struct sector_index
 {
 	//The physical sector on the disk where the logic sector is stored
-	__u64 sector;
+	__u32 sector;
+
+	union
+	{
+		struct
+		{
+			//This variable stores the access count of the physical sector
+			__u16 access_count;
+
+			//The disk where the logical sector is stored
+			tdisk_index disk;
+
+			//Bitmap of the sub-block regions which were
+			//accessed. It is not stored on disk
+			__u8 regions;
+		};
+
+		//Used for atomic updates of the access count
+		__u32 state;
+	};
+}; //end struct sector_index;
 
-	//This variable stores the access count of the physical sector
+/**
+  * A index as it is stored on the internal devices
+  * (TDISK_INDEX_VERSION_COMPACT)
+ **/
+struct __attribute__((packed)) disk_sector_index
+{
+	__u32 sector;
 	__u16 access_count;
+	tdisk_index disk;
+}; //end struct disk_sector_index
+
+/**
+  * The sector indices are stored in memory in pages of
+  * 2^TDISK_INDEX_PAGE_SHIFT indices. A page is allocated when
+  * one of its indices is used for the first time (@see td_index)
+ **/
+#define TDISK_INDEX_PAGE_SHIFT 9
+
+/**
+  * The amount of sector indices per page
+ **/
+#define TDISK_INDEX_PAGE_ENTRIES ((sector_t)1 << TDISK_INDEX_PAGE_SHIFT)
+
+/**
+  * Calculates the amount of pages which are needed
+  * to store the given amount of sector indices
+ **/
+#define TDISK_INDEX_PAGES(sectors) (((sectors) + TDISK_INDEX_PAGE_ENTRIES - 1) >> TDISK_INDEX_PAGE_SHIFT)
+
+/**
+  * The amount of chunks in which the sector indices are split
+  * to keep track of the changed heat (@see td_write_heat_snapshot)
+ **/
+#define TDISK_HEAT_SNAPSHOT_CHUNKS 4096
+
+#ifdef USE_IO_CAPTURE
+
+/**
+  * The ring of the captured requests. Only the worker thread
+  * writes new records and only the reader advances the tail,
+  * so no lock is needed (@see td_capture_request)
+ **/
+struct td_io_capture
+{
+	u64 head;
+	u64 tail;
+	u64 lost;
+	struct tdisk_io_record records[TDISK_MAX_IO_RECORDS];
+}; //end struct td_io_capture
+
+#endif //USE_IO_CAPTURE
 
-	//The disk where the logical sector is stored
+/**
+  * The table of the index pages. It is only replaced or
+  * freed while the worker thread is stopped, which is the
+  * only thread that looks up indices while the tDisk is
+  * in use. Other lookups happen in ioctls which are
+  * serialized with td_add_disk by the ctl_mutex.
+ **/
+struct td_index_table
+{
+	//The amount of sector indices the table can hold
+	sector_t sectors;
+
+	struct sector_index *pages[0];
+}; //end struct td_index_table
+
+/**
+  * The amount of slots of the per-CPU heat buffers
+ **/
+#define TDISK_HEAT_SLOTS_SHIFT 6
+#define TDISK_HEAT_SLOTS (1 << TDISK_HEAT_SLOTS_SHIFT)
+
+/**
+  * Buffered accesses of one logical sector
+ **/
+struct td_heat_slot
+{
+	//The logical sector + 1 (0 means the slot is free)
+	__u32 sector;
+
+	//The amount of accesses which are not yet added to the index
+	__u32 delta;
+}; //end struct td_heat_slot
+
+/**
+  * The heat buffer of one CPU
+ **/
+struct td_heat_buffer
+{
+	struct td_heat_slot slots[TDISK_HEAT_SLOTS];
+}; //end struct td_heat_buffer
+
+/**
+  * The maximum amount of sub-block regions of a block
+  * (bits of sector_index.regions)
+ **/
+#define TDISK_MAX_REGIONS 8
+
+/**
+  * A page of the read cache
+ **/
+struct td_read_cache_entry
+{
+	//The logical sector + 1 (0 means the entry is free)
+	__u32 sector;
+
+	//The page inside the logical sector
+	__u32 page;
+
+	struct page *data;
+}; //end struct td_read_cache_entry
+
+/**
+  * The size of the count-min sketch which is used
+  * for heat_tracking_sketch
+ **/
+#define TDISK_SKETCH_DEPTH 4
+#define TDISK_SKETCH_WIDTH_SHIFT 12
+#define TDISK_SKETCH_WIDTH (1 << TDISK_SKETCH_WIDTH_SHIFT)
+
+/**
+  * The estimated amount of accesses at which a sector is
+  * a candidate hot sector and its accesses are counted exactly
+ **/
+#define TDISK_SKETCH_HOT_THRESHOLD 4
+
+/**
+  * A count-min sketch which estimates the accesses of all
+  * sectors using a fixed amount of memory
+ **/
+struct td_heat_sketch
+{
+	//The time when the counters were halved the last time
+	unsigned long aging_start;
+
+	__u16 counters[TDISK_SKETCH_DEPTH][TDISK_SKETCH_WIDTH];
+}; //end struct td_heat_sketch
+
+/**
+  * The sector index as it was stored by the driver version 1.0.
+  * It is only used to migrate existing disks
+ **/
+struct __attribute__((packed)) legacy_sector_index
+{
+	__u64 sector;
+	__u16 access_count;
 	tdisk_index disk;
-}; //end struct sector_index;
+}; //end struct legacy_sector_index
+
+/**
+  * The maximum amount of physical disks for which
+  * a migration budget is kept
+ **/
+#define TDISK_MAX_MIGRATION_BUDGETS 32
 
 /**
-  * A sorted_sector_index represents a physical sector
-  * sorted according to the access_count.
-  * This struct is used for two purposes:
-  *  - total_sorted: represents the physical sector
-  *    sorted by all all physical sectors of th tDisk
-  *  - device_assigned: is used to assign the
-  *    sorted sectors to the sorted devices. This way
-  *    one object can be used for both purposes
+  * The migration budget of a physical disk which is
+  * shared by several internal devices
  **/
-struct sorted_sector_index
+struct td_migration_budget
 {
-	struct sector_index *physical_sector;
-	struct list_head total_sorted;
-	struct list_head device_assigned;
-}; //end struct mapped sector index
+	//The whole disk (0 means the entry is free)
+	dev_t dev;
+
+	//The amount of internal devices stored on the disk
+	unsigned int users;
+
+	//The bytes which can still be moved in the current
+	//interval. It gets negative if a move exceeds the budget
+	__s64 bytes_left;
+	unsigned long interval_start;
+
+	//The tDisk which currently moves sectors on the disk
+	//and its amount of misplaced blocks
+	int owner;
+	sector_t owner_misplaced;
+	unsigned long owner_claim;
+}; //end struct td_migration_budget
 
 /**
   * A td_internal_device represents an underlying
@@ -107,20 +386,61 @@ struct td_internal_device
 	 **/
 	__u64 bytes_read;
 	__u64 bytes_written;
+
+	/**
+	  * Whether the device was written since it was flushed
+	 **/
+	bool dirty;
+
+	/**
+	  * Whether the blocks are stored compressed (@see td_write_block)
+	 **/
+	bool compress;
+
+	/**
+	  * Whether the move help sector was the location of a compressed
+	  * block whose new index may not yet be on stable storage
+	  * (@see __td_write_current_block)
+	 **/
+	bool move_help_released;
+
+	/**
+	  * The whole disk where the device is stored or 0 if it is
+	  * unknown (@see td_acquire_migration_budget)
+	 **/
+	dev_t backing_dev;
+
+#ifdef USE_PERF_COUNTERS
+	/**
+	  * The performance counters, indexed by CPU (@see td_get_stats)
+	 **/
+	struct tdisk_device_stats *stats;
+#endif //USE_PERF_COUNTERS
 }; //end struct td_internal_device
 
+#ifdef USE_PERF_COUNTERS
+
+/**
+  * The performance counters of a tDisk. They are
+  * counted per CPU (@see td_get_stats)
+ **/
+struct td_counters
+{
+	__u64 requests;
+	__u64 migrations;
+	__u64 migrated_bytes;
+	__u64 initial_placements;
+	__u64 latency_histogram[TDISK_LATENCY_BUCKETS];
+}; //end struct td_counters
+
+#endif //USE_PERF_COUNTERS
+
 /**
   * This struct represents an internal device but sorted
   * accorting to its performance
  **/
 struct sorted_internal_device
 {
-	/**
-	  * The blocks which should be - according to performance
-	  * and block access count - stored on the device
-	 **/
-	struct list_head preferred_blocks;
-
 	/**
 	  * The actual device
 	 **/
@@ -136,6 +456,13 @@ struct sorted_internal_device
 	 **/
 	sector_t amount_blocks;
 
+	/**
+	  * The position and the amount of the logical sectors
+	  * in tdisk::device_sectors which are assigned to this device
+	 **/
+	sector_t first_sector;
+	sector_t sector_count;
+
 }; //end struct sorted_internal_device
 
 /**
@@ -158,11 +485,76 @@ struct tdisk {
 	unsigned int	percent_cache;
 	sector_t		cache_sectors;
 
+	//Only allocated for heat_tracking_sketch
+	struct td_heat_sketch	*heat_sketch;
+
+#ifdef USE_SUB_BLOCK_HEAT
+	//Each block is split into region_count regions
+	//of region_size bytes (@see sector_index.regions)
+	unsigned int			region_count;
+	unsigned int			region_size;
+	unsigned long			regions_aging_start;
+
+	//Caches the pages of blocks where only one region is hot.
+	//It is only allocated if a block has more than one region
+	struct td_read_cache_entry	*read_cache;
+#endif //USE_SUB_BLOCK_HEAT
+
+#ifdef USE_COMPRESSION
+	//The block of a compressed device which is currently
+	//accessed. It is kept decompressed in memory and compressed
+	//again after the request (@see td_compressed_bio_vec)
+	struct mutex			compression_mutex;
+	u8						*current_block;
+	struct td_internal_device	*current_block_device;
+	loff_t					current_block_position;
+	sector_t				current_block_sector;
+	bool					current_block_dirty;
+
+	//Only allocated when a compressed device is added
+	u8						*compress_buffer;
+	void					*compress_workmem;
+#endif //USE_COMPRESSION
+
+	//The write back cache. staged_sectors[i] holds the logical
+	//sector (+1 because 0 means unused) which is currently staged
+	//in the cache sector size_blocks+i. It is rebuilt from the
+	//staged flags of the indices (@see td_load_staged_sectors)
+	sector_t		*staged_sectors;
+	sector_t		staged_count;
+	sector_t		staging_cursor;
+	sector_t		destaging_cursor;
+
+	//The part of the cache sectors which is kept on the fastest
+	//disk. It depends on the amount of newly used sectors
+	sector_t		reserve_sectors;
+	sector_t		allocated_sectors;
+	sector_t		allocation_burst;
+	unsigned long	reserve_window_start;
+
 	//The internal devices
 	tdisk_index						internal_devices_count;
 	struct td_internal_device		internal_devices[TDISK_MAX_PHYSICAL_DISKS];
 	struct sorted_internal_device	*sorted_devices;
 
+	//The amount of blocks which are not stored on their assigned
+	//device. It is used to prioritize tDisks which share a disk
+	sector_t				misplaced_blocks;
+
+	//The pinned ranges. The first pin_count pins are used
+	struct td_pin_table		pins;
+	unsigned int			pin_count;
+
+#ifdef USE_HEAT_SNAPSHOT
+	//Each bit marks a chunk of 2^heat_snapshot_shift sector
+	//indices whose heat changed since the last snapshot
+	//(@see td_write_heat_snapshot)
+	unsigned long			heat_snapshot_dirty[BITS_TO_LONGS(TDISK_HEAT_SNAPSHOT_CHUNKS)];
+	unsigned int			heat_snapshot_shift;
+	unsigned long			heat_snapshot_cursor;
+	unsigned long			heat_snapshot_start;
+#endif //USE_HEAT_SNAPSHOT
+
 	spinlock_t				tdisk_lock;
 	struct mutex			ctl_mutex;
 
@@ -179,16 +571,79 @@ struct tdisk {
 
 	unsigned int index_offset_byte;
 	unsigned int header_size;		//Size in sectors of the index where the header and sectors are stored. Located at the beginning of the disk
-	struct sector_index *indices;	//The indices need to be stored in memory
+	struct td_index_table *index_table;	//The indices need to be stored in memory (@see td_index)
+
+	sector_t sorted_capacity;		//The amount of sectors which fit in sorted_sectors and assigned_devices
+	__u32 *sorted_sectors;			//The logical sectors sorted according to their access count
+	tdisk_index *assigned_devices;	//The sorted device (+1 because 0 means unassigned) where each logical sector should be stored
+	__u32 *device_sectors;			//The logical sectors grouped by their assigned device (@see sorted_internal_device::first_sector)
+
+#ifdef USE_PERCPU_HEAT
+	struct td_heat_buffer *heat_buffers;	//The buffered accesses, indexed by CPU (@see td_buffer_heat)
+#endif //USE_PERCPU_HEAT
+
+#ifdef USE_PERF_COUNTERS
+	struct td_counters *counters;	//The performance counters, indexed by CPU (@see td_get_stats)
+#endif //USE_PERF_COUNTERS
+
+#ifdef USE_IO_CAPTURE
+	struct td_io_capture *io_capture;	//The captured requests. Allocated when the capture is started the first time
+	bool io_capturing;					//Whether the requests are currently captured
+#endif //USE_IO_CAPTURE
 
-	struct list_head sorted_sectors_head;
-	struct sorted_sector_index *sorted_sectors;	//The sectors sorted according to their access count;
+#ifdef USE_MISS_RATIO_CURVE
+	struct td_mrc *mrc;		//The tracked reuse distances. Allocated when the tracking is started the first time
+	bool mrc_tracking;		//Whether the reuse distances are currently tracked
+#endif //USE_MISS_RATIO_CURVE
 
 	int access_count_resort;		//Keeps track if the access_count was updated during a file request and needs to be resorted
 
 	struct debug_struct debug;	//Used to save debugging info
 };
 
+/**
+  * The index of the sectors whose page is not allocated yet
+ **/
+extern const struct sector_index td_unused_index;
+
+struct sector_index* td_alloc_index_page(struct tdisk *td, sector_t page);
+
+/**
+  * Returns the index page of the given logical sector or
+  * NULL if none of its indices was used yet
+ **/
+inline static struct sector_index* td_index_page(const struct tdisk *td, sector_t logical_sector)
+{
+	return ACCESS_ONCE(td->index_table->pages[logical_sector >> TDISK_INDEX_PAGE_SHIFT]);
+}
+
+/**
+  * Returns the sector index of the given logical sector.
+  * Its page is allocated if it doesn't exist yet
+ **/
+inline static struct sector_index* td_index(struct tdisk *td, sector_t logical_sector)
+{
+	struct sector_index *page = td_index_page(td, logical_sector);
+
+	if(unlikely(!page))page = td_alloc_index_page(td, logical_sector >> TDISK_INDEX_PAGE_SHIFT);
+
+	return &page[logical_sector & (TDISK_INDEX_PAGE_ENTRIES - 1)];
+}
+
+/**
+  * Returns the sector index of the given logical sector
+  * without allocating its page. This is used to look at
+  * all sectors of the tDisk
+ **/
+inline static const struct sector_index* td_peek_index(const struct tdisk *td, sector_t logical_sector)
+{
+	const struct sector_index *page = td_index_page(td, logical_sector);
+
+	if(!page)return &td_unused_index;
+
+	return &page[logical_sector & (TDISK_INDEX_PAGE_ENTRIES - 1)];
+}
+
 /**
   * A td_command is used by the worker thread to
   * process a request.
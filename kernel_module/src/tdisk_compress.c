@@ -0,0 +1,145 @@
+/**
+  *
+  * tDisk Driver
+  * @author Thomas Sparber (2015-2016)
+  *
+ **/
+
+#include <tdisk/config.h>
+#include "tdisk_compress.h"
+
+/**
+  * The shortest repeated data which is stored as a match
+ **/
+#define TD_COMPRESS_MIN_MATCH 4
+
+/**
+  * The longest match which fits into one control byte
+ **/
+#define TD_COMPRESS_MAX_MATCH (0x7F + TD_COMPRESS_MIN_MATCH)
+
+/**
+  * The most bytes which are copied as is after one control byte
+ **/
+#define TD_COMPRESS_MAX_LITERALS 0x80
+
+/**
+  * The furthest distance of a match
+ **/
+#define TD_COMPRESS_MAX_DISTANCE 0xFFFF
+
+/**
+  * Appends the given amount of bytes which couldn't
+  * be compressed. Returns false if dst is full.
+ **/
+static bool td_compress_literals(const u8 *src, size_t length, u8 *dst, size_t dst_len, size_t *out)
+{
+	while(length > 0)
+	{
+		size_t current_length = min_t(size_t, length, TD_COMPRESS_MAX_LITERALS);
+
+		if(dst_len - *out < current_length + 1)return false;
+
+		dst[(*out)++] = (u8)(current_length - 1);
+		memcpy(dst + *out, src, current_length);
+
+		*out += current_length;
+		src += current_length;
+		length -= current_length;
+	}
+
+	return true;
+}
+
+size_t td_compress(const u8 *src, size_t src_len, u8 *dst, size_t dst_len, void *workmem)
+{
+	//The positions (+1) where the hashed four bytes were seen the last time
+	u32 *table = workmem;
+	size_t literals = 0;
+	size_t out = 0;
+	size_t in = 0;
+
+	memset(table, 0, TD_COMPRESS_WORKMEM);
+
+	while(in + TD_COMPRESS_MIN_MATCH <= src_len)
+	{
+		u32 hash = hash_32(get_unaligned_le32(src + in), TD_COMPRESS_HASH_SHIFT);
+		size_t candidate = table[hash];
+		size_t length = 0;
+		size_t distance;
+
+		table[hash] = (u32)(in + 1);
+
+		if(candidate != 0 && in - (candidate - 1) <= TD_COMPRESS_MAX_DISTANCE)
+		{
+			--candidate;
+			while(in + length < src_len && length < TD_COMPRESS_MAX_MATCH && src[candidate + length] == src[in + length])
+				++length;
+		}
+
+		if(length < TD_COMPRESS_MIN_MATCH)
+		{
+			++literals;
+			++in;
+			continue;
+		}
+
+		if(!td_compress_literals(src + in - literals, literals, dst, dst_len, &out))return 0;
+		literals = 0;
+
+		if(dst_len - out < 3)return 0;
+
+		distance = in - candidate;
+		dst[out++] = (u8)(0x80 | (length - TD_COMPRESS_MIN_MATCH));
+		dst[out++] = (u8)(distance & 0xFF);
+		dst[out++] = (u8)(distance >> 8);
+
+		in += length;
+	}
+
+	//The remaining bytes are too short for a match
+	literals += src_len - in;
+	if(!td_compress_literals(src + src_len - literals, literals, dst, dst_len, &out))return 0;
+
+	return out;
+}
+
+int td_decompress(const u8 *src, size_t src_len, u8 *dst, size_t dst_len)
+{
+	size_t out = 0;
+	size_t in = 0;
+
+	while(in < src_len)
+	{
+		u8 control = src[in++];
+
+		if(control < 0x80)
+		{
+			size_t length = (size_t)control + 1;
+
+			if(length > src_len - in || length > dst_len - out)return -EINVAL;
+
+			memcpy(dst + out, src + in, length);
+			in += length;
+			out += length;
+		}
+		else
+		{
+			size_t length = (size_t)(control & 0x7F) + TD_COMPRESS_MIN_MATCH;
+			size_t distance;
+
+			if(src_len - in < 2)return -EINVAL;
+
+			distance = (size_t)src[in] | ((size_t)src[in+1] << 8);
+			in += 2;
+
+			if(distance == 0 || distance > out || length > dst_len - out)return -EINVAL;
+
+			//The match may overlap the bytes it produces
+			for(; length > 0; --length, ++out)
+				dst[out] = dst[out - distance];
+		}
+	}
+
+	return (out == dst_len) ? 0 : -EINVAL;
+}
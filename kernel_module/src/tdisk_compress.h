@@ -0,0 +1,51 @@
+/**
+  *
+  * tDisk Driver
+  * @author Thomas Sparber (2015-2016)
+  *
+ **/
+
+#ifndef TDISK_COMPRESS_H
+#define TDISK_COMPRESS_H
+
+#include <tdisk/config.h>
+
+#pragma GCC system_header
+#include <linux/errno.h>
+#include <linux/hash.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <asm/unaligned.h>
+
+/**
+  * The size of the hash table (2^x entries) which is
+  * used to find repeated data
+ **/
+#define TD_COMPRESS_HASH_SHIFT 12
+
+/**
+  * The amount of memory td_compress needs to work
+ **/
+#define TD_COMPRESS_WORKMEM (sizeof(u32) << TD_COMPRESS_HASH_SHIFT)
+
+/**
+  * Compresses src_len bytes of src to dst. The compressed data
+  * is a sequence of runs which start with a control byte:
+  *  - 0x00-0x7F: The next (control+1) bytes are copied as is
+  *  - 0x80-0xFF: (control&0x7F)+4 bytes are
+  *    repeated from the output. The following two bytes (little
+  *    endian) define how many bytes back they start.
+  * Returns the length of the compressed data or 0 if it
+  * doesn't fit into dst_len bytes.
+ **/
+size_t td_compress(const u8 *src, size_t src_len, u8 *dst, size_t dst_len, void *workmem);
+
+/**
+  * Decompresses src_len bytes of src which were compressed using
+  * td_compress. Returns -EINVAL if the data is corrupt or doesn't
+  * decompress to exactly dst_len bytes.
+ **/
+int td_decompress(const u8 *src, size_t src_len, u8 *dst, size_t dst_len);
+
+#endif //TDISK_COMPRESS_H
@@ -8,56 +8,73 @@
 #include <tdisk/config.h>
 #include "tdisk_debug.h"
 
-void debug_point(struct debug_struct *ds, const char *file, int line, const char *function, const char *message, ...)
+/**
+  * This is just a hack in case the kernel was compiled
+  * with CONFIG_DEBUG_LOCK_ALLOC. Then mutex_lock is replaced
+  * with mutex_lock_nested which we can't use in a non GPL module...
+  * The function is then implemented in helpers.c
+ **/
+#ifdef mutex_lock
+#undef mutex_lock
+extern void mutex_lock(struct mutex *lock);
+#endif //mutex_lock
+
+int init_debug_struct(struct debug_struct *ds)
+{
+	mutex_init(&ds->drain_mutex);
+
+	ds->rings = vzalloc(sizeof(struct td_trace_ring) * nr_cpu_ids);
+	if(!ds->rings)return -ENOMEM;
+
+	return 0;
+}
+
+void free_debug_struct(struct debug_struct *ds)
 {
-	va_list args;
-	struct td_debug_info *info;
-
-	//Find new td_debug_info
-	spin_lock(&ds->counter_lock);
-	if(ds->current_debug_info >= AMOUNT_MEASURE_POINTS)
-		ds->current_debug_info = 0;
-	info = &ds->info[ds->current_debug_info];
-	info->id = ds->id_counter++;
-	ds->current_debug_info++;
-	spin_unlock(&ds->counter_lock);
-
-	//Save debug info
-	info->file = file;
-	info->line = line;
-	info->function = function;
-	info->time_jiffies = get_jiffies_64();
-
-	//Save custom message
-	va_start(args, message);
-	vsnprintf(info->message, sizeof(info->message), message, args);
-	va_end(args);
+	if(ds->rings)vfree(ds->rings);
+	ds->rings = NULL;
 }
 
-void get_next_debug_point(struct debug_struct *ds, u64 current_id, struct tdisk_debug_info *out)
+void td_trace_drain(struct debug_struct *ds, struct tdisk_trace_record *out, __u32 size, __u32 *count, __u64 *lost)
 {
-	int i;
-	int converted_i;
-	struct td_debug_info info;
+	int cpu;
+	__u32 copied = 0;
 
-	current_id++;
+	mutex_lock(&ds->drain_mutex);
 
-	//Find new td_debug_info
-	spin_lock(&ds->counter_lock);
-	for(i = 0; i < AMOUNT_MEASURE_POINTS; ++i)
+	for_each_possible_cpu(cpu)
 	{
-		converted_i = i + ds->current_debug_info;
-		if(converted_i >= AMOUNT_MEASURE_POINTS)converted_i -= AMOUNT_MEASURE_POINTS;
+		struct td_trace_ring *ring = &ds->rings[cpu];
+		u64 head = ACCESS_ONCE(ring->head);
+		u64 sequence;
 
-		if(ds->info[converted_i].id >= current_id)break;
+		smp_rmb();
+
+		//The oldest records were already overwritten
+		if(head - ring->tail > TRACE_RING_SIZE)
+		{
+			(*lost) += head - TRACE_RING_SIZE - ring->tail;
+			ring->tail = head - TRACE_RING_SIZE;
+		}
+
+		for(sequence = ring->tail; sequence != head && copied < size; ++sequence)
+		{
+			const struct tdisk_trace_record *record = &ring->records[sequence & TRACE_RING_MASK];
+
+			out[copied] = (*record);
+			smp_rmb();
+
+			//The record was overwritten while it was copied
+			if(out[copied].sequence != sequence || ACCESS_ONCE(record->sequence) != sequence)
+				(*lost)++;
+			else
+				copied++;
+		}
+
+		ring->tail = sequence;
 	}
-	info = ds->info[converted_i];
-	spin_unlock(&ds->counter_lock);
-
-	out->id = info.id;
-	memcpy(out->file, info.file, sizeof(out->file));
-	out->line = info.line;
-	memcpy(out->function, info.function, sizeof(out->function));
-	memcpy(out->message, info.message, sizeof(out->message));
-	out->time = info.time_jiffies;
+
+	mutex_unlock(&ds->drain_mutex);
+
+	(*count) = copied;
 }
@@ -12,92 +12,152 @@
 #include <tdisk/interface.h>
 
 #pragma GCC system_header
-#include <linux/jiffies.h>
-#include <linux/spinlock.h>
-#include <linux/string.h>
+#include <linux/cpumask.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/smp.h>
+#include <linux/time.h>
+#include <linux/timekeeping.h>
 #include <linux/types.h>
-
-#define AMOUNT_MEASURE_POINTS 10
-
-#define DEBUG_POINTS_ENABLED
+#include <linux/vmalloc.h>
 
 /**
-  * This struct is used to store information about the current
-  * operations of a program
+  * The amount of trace records of each CPU (2^x).
+  * Older records are overwritten if they are not
+  * drained in time
  **/
-struct td_debug_info
-{
-	/** The id of the debug info **/
-	u64 id;
+#define TRACE_RING_SHIFT 10
+#define TRACE_RING_SIZE (1 << TRACE_RING_SHIFT)
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
 
-	/** The current source file **/
-	const char *file;
+/**
+  * The sequence number of a record which is currently
+  * being written
+ **/
+#define TRACE_INVALID_SEQUENCE (~0ULL)
 
-	/** The current line in the file **/
-	int line;
+#define TRACE_POINTS_ENABLED
 
-	/** The current function **/
-	const char *function;
+/**
+  * This struct holds the trace records of one CPU.
+  * Only the CPU itself writes to the ring, so no lock
+  * is needed. The reader detects records which were
+  * overwritten while it copied them using the sequence
+  * number of the records.
+ **/
+struct td_trace_ring
+{
+	/** The sequence number of the next record **/
+	u64 head;
 
-	/** A custom message **/
-	char message[256];
+	/** The sequence number of the next record to drain **/
+	u64 tail;
 
-	/** The time of the debugging info **/
-	u64 time_jiffies;
+	/** The trace records **/
+	struct tdisk_trace_record records[TRACE_RING_SIZE];
 
-}; //end struct td_debug_info
+} ____cacheline_aligned_in_smp; //end struct td_trace_ring
 
 /**
   * This struct holds the data for saving debug info
  **/
 struct debug_struct
 {
-	/** The atomic id counter **/
-	u64 id_counter;
-
-	/** This spinlock is used to synchronize access to the counter and info **/
-	spinlock_t counter_lock;
-
-	/** The stored debug info **/
-	struct td_debug_info info[AMOUNT_MEASURE_POINTS];
+	/** The trace ring of each possible CPU **/
+	struct td_trace_ring *rings;
 
-	/** The current index of the debug info **/
-	int current_debug_info;
+	/** Serializes the readers of the rings **/
+	struct mutex drain_mutex;
 
 }; //end struct debug_struct
 
-#ifdef DEBUG_POINTS_ENABLED
+#ifdef TRACE_POINTS_ENABLED
 /**
-  * This macro can be used to set debug points.
-  * These debug points are stored in the debug info.
-  * The file, line and function are stored and an
-  * additional custom text.
+  * These macros can be used to set trace points.
+  * TRACE_TIME declares a timestamp which is set
+  * using TRACE_START. TRACE_SPAN records the time
+  * which elapsed since then, TRACE_POINT records
+  * the given value.
  **/
-#define DEBUG_POINT(ds, msg, ...) debug_point(ds, __FILE__, __LINE__, __FUNCTION__, msg, __VA_ARGS__)
+#define TRACE_TIME(var) u64 var = 0
+#define TRACE_START(var) var = td_trace_clock()
+#define TRACE_POINT(ds, type, sector, disk, value) td_trace_point(ds, type, sector, disk, value)
+#define TRACE_SPAN(ds, type, sector, disk, start) td_trace_point(ds, type, sector, disk, td_trace_clock() - (start))
 #else
-/** Disables debug points **/
-#define DEBUG_POINT(...)
-#endif //DEBUG_POINTS_ENABLED
+/** Disables trace points **/
+#define TRACE_TIME(var) u64 var __maybe_unused = 0
+#define TRACE_START(var)
+#define TRACE_POINT(...)
+#define TRACE_SPAN(...)
+#endif //TRACE_POINTS_ENABLED
 
 /**
   * Initializes a debug struct
  **/
-inline static void init_debug_struct(struct debug_struct *ds)
+int init_debug_struct(struct debug_struct *ds);
+
+/**
+  * Frees the trace rings of a debug struct
+ **/
+void free_debug_struct(struct debug_struct *ds);
+
+/**
+  * Returns the time in nanoseconds of a monotonic clock.
+  * Unlike the time of day it never jumps, so the spans and
+  * the order of the records stay correct. ktime_get_ns and
+  * local_clock are exported GPL only.
+ **/
+inline static u64 td_trace_clock(void)
 {
-	ds->id_counter = 1;
-	spin_lock_init(&ds->counter_lock);
-	memset(ds->info, 0, sizeof(ds->info));
-	ds->current_debug_info = 0;
+	struct timespec now;
+
+	getrawmonotonic(&now);
+	return (u64)timespec_to_ns(&now);
 }
 
 /**
-  * This function is called by the DEBUG_POINT macro.
+  * Writes a trace record to the ring of the current CPU.
+  * This function is called by the TRACE_POINT and
+  * TRACE_SPAN macros.
  **/
-void debug_point(struct debug_struct *ds, const char *file, int line, const char *function, const char *message, ...);
+inline static void td_trace_point(struct debug_struct *ds, __u8 type, u64 sector, tdisk_index disk, u64 value)
+{
+	struct td_trace_ring *ring;
+	struct tdisk_trace_record *record;
+	int cpu;
+	u64 sequence;
+
+	if(unlikely(!ds->rings))return;
+
+	cpu = get_cpu();
+	ring = &ds->rings[cpu];
+	sequence = ring->head;
+	record = &ring->records[sequence & TRACE_RING_MASK];
+
+	//Invalidate the record while it is written
+	record->sequence = TRACE_INVALID_SEQUENCE;
+	smp_wmb();
+
+	record->time = td_trace_clock();
+	record->sector = sector;
+	record->value = (__u32)min_t(u64, value, U32_MAX);
+	record->cpu = (__u16)cpu;
+	record->type = type;
+	record->disk = disk;
+
+	smp_wmb();
+	record->sequence = sequence;
+	ACCESS_ONCE(ring->head) = sequence + 1;
+
+	put_cpu();
+}
 
 /**
-  * Retrieves the next debug info
+  * Drains the trace records of all CPUs. count is set to the
+  * amount of copied records and lost is increased by the
+  * amount of records which were overwritten before they
+  * could be drained.
  **/
-void get_next_debug_point(struct debug_struct *ds, u64 current_id, struct tdisk_debug_info *out);
+void td_trace_drain(struct debug_struct *ds, struct tdisk_trace_record *out, __u32 size, __u32 *count, __u64 *lost);
 
 #endif //TDISK_DEBUG_H
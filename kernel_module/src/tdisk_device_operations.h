@@ -32,6 +32,7 @@ inline static int write_data(struct td_internal_device *device, void *data, loff
 
 	//Record bytes written
 	device->bytes_written += length;
+	device->dirty = true;
 
 	switch(device->type)
 	{
@@ -144,6 +145,7 @@ inline static int write_bio_vec(struct td_internal_device *device, struct bio_ve
 
 	//Record bytes written
 	device->bytes_written += bvec->bv_len;
+	device->dirty = true;
 
 	switch(device->type)
 	{
@@ -247,6 +249,7 @@ inline static void write_data_async(struct td_internal_device *device, void *dat
 {
 	//Record bytes written
 	device->bytes_written += length;
+	device->dirty = true;
 
 	switch(device->type)
 	{
@@ -327,6 +330,7 @@ inline static void write_bio_vec_async(struct td_internal_device *device, struct
 {
 	//Record bytes written
 	device->bytes_written += length;
+	device->dirty = true;
 
 	switch(device->type)
 	{
@@ -401,6 +405,37 @@ inline static void read_bio_vec_async(struct td_internal_device *device, struct
 
 #endif //ASYNC_OPERATIONS
 
+/**
+  * Generic function that starts flushing a device without
+  * waiting for it. flush_device needs to be called afterwards.
+  * The device can be a file or a plugin.
+ **/
+inline static int start_flush_device(struct td_internal_device *device)
+{
+	switch(device->type)
+	{
+#ifdef USE_FILES
+	case internal_device_type_file:
+		if(unlikely(!device->file))return -ENODEV;
+		return file_start_flush(device->file);
+#else
+#pragma message "Files are disabled"
+#endif //USE_FILES
+
+#ifdef USE_PLUGINS
+	case internal_device_type_plugin:
+		return 0;
+#else
+#pragma message "Plugins are disabled"
+#endif //USE_PLUGINS
+
+	default:
+		printk(KERN_ERR "tDisk: Invalid internal device type: %d\n", device->type);
+		MY_BUG_ON(true, PRINT_INT(device->type));
+		return -EINVAL;
+	}
+}
+
 /**
   * Generic function that flushes a device.
   * The device can be a file or a plugin.
@@ -431,6 +466,37 @@ inline static int flush_device(struct td_internal_device *device)
 	}
 }
 
+/**
+  * Generic function that flushes the given range of a device.
+  * It is used for FUA requests.
+  * The device can be a file or a plugin.
+ **/
+inline static int flush_device_range(struct td_internal_device *device, loff_t position, loff_t length)
+{
+	switch(device->type)
+	{
+#ifdef USE_FILES
+	case internal_device_type_file:
+		if(unlikely(!device->file))return -ENODEV;
+		return file_flush_range(device->file, position, length);
+#else
+#pragma message "Files are disabled"
+#endif //USE_FILES
+
+#ifdef USE_PLUGINS
+	case internal_device_type_plugin:
+		return plugin_flush(device->name);
+#else
+#pragma message "Plugins are disabled"
+#endif //USE_PLUGINS
+
+	default:
+		printk(KERN_ERR "tDisk: Invalid internal device type: %d\n", device->type);
+		MY_BUG_ON(true, PRINT_INT(device->type));
+		return -EINVAL;
+	}
+}
+
 /**
   * Generic function that allocs space on a device.
   * The device can be a file or a plugin.
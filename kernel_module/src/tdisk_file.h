@@ -15,6 +15,7 @@
 
 #pragma GCC system_header
 #include <linux/aio.h>
+#include <linux/blkdev.h>
 #include <linux/falloc.h>
 #include <linux/fs.h>
 #include <linux/file.h>
@@ -47,6 +48,19 @@ inline static int file_alloc(struct file *file, loff_t pos, unsigned int length)
 	//We use punch hole to reclaim the free space used by the image a.k.a. discard.
 	int ret = 0;
 	int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	struct inode *inode = file->f_mapping->host;
+
+	//Block devices are discarded directly
+	if(S_ISBLK(inode->i_mode))
+	{
+		truncate_inode_pages_range(file->f_mapping, pos, pos + length - 1);
+		ret = blkdev_issue_discard(I_BDEV(inode), (sector_t)(pos >> 9), (sector_t)(length >> 9), GFP_KERNEL, 0);
+
+		if(unlikely(ret && ret != -EINVAL && ret != -EOPNOTSUPP))
+			ret = -EIO;
+
+		return ret;
+	}
 
 	if((!file->f_op->fallocate))
 		return -EOPNOTSUPP;
@@ -59,6 +73,15 @@ inline static int file_alloc(struct file *file, loff_t pos, unsigned int length)
 	return ret;
 }
 
+/**
+  * Starts writing back the dirty pages of the given
+  * file without waiting for them
+ **/
+inline static int file_start_flush(struct file *file)
+{
+	return filemap_fdatawrite(file->f_mapping);
+}
+
 /**
   * Flushes the given file
  **/
@@ -67,6 +90,16 @@ inline static int file_flush(struct file *file)
 	return vfs_fsync(file, 0);
 }
 
+/**
+  * Flushes the data of the given range of the given file
+  * (like O_DSYNC). For block devices this also flushes the
+  * volatile cache of the device.
+ **/
+inline static int file_flush_range(struct file *file, loff_t pos, loff_t length)
+{
+	return vfs_fsync_range(file, pos, pos + length - 1, 1);
+}
+
 /**
   * This function writes the given bio_vec to
   * file at the given position.
@@ -0,0 +1,227 @@
+/**
+  *
+  * tDisk Driver
+  * @author Thomas Sparber (2015-2016)
+  *
+ **/
+
+#include <tdisk/config.h>
+#include "helpers.h"
+#include "tdisk_mrc.h"
+
+/**
+  * Returns the amount of nodes of the given subtree
+ **/
+inline static u32 td_mrc_subtree_size(struct rb_node *node)
+{
+	return node ? rb_entry(node, struct td_mrc_block, node)->subtree_size : 0;
+}
+
+/**
+  * Calculates the subtree size of the given block.
+  * This is used by the augmented rbtree callbacks
+ **/
+inline static u32 td_mrc_compute_subtree_size(struct td_mrc_block *b)
+{
+	return 1 + td_mrc_subtree_size(b->node.rb_left) + td_mrc_subtree_size(b->node.rb_right);
+}
+
+RB_DECLARE_CALLBACKS(static, td_mrc_callbacks, struct td_mrc_block, node, u32, subtree_size, td_mrc_compute_subtree_size)
+
+/**
+  * Returns the mask of the hash bits which need to be 0
+  * for a sampled block
+ **/
+inline static u32 td_mrc_sampling_mask(const struct td_mrc *mrc)
+{
+	return (u32)((1ULL << mrc->result.sampling_shift) - 1);
+}
+
+/**
+  * Returns the hash bucket of the given block
+ **/
+inline static struct hlist_head* td_mrc_bucket(struct td_mrc *mrc, sector_t block)
+{
+	return &mrc->buckets[(u32)hash_64((u64)block, TD_MRC_BLOCKS_SHIFT)];
+}
+
+/**
+  * Returns the tracked block or NULL if the block is not tracked
+ **/
+static struct td_mrc_block* td_mrc_find(struct td_mrc *mrc, sector_t block)
+{
+	struct td_mrc_block *b;
+
+	hlist_for_each_entry(b, td_mrc_bucket(mrc, block), hash)
+	{
+		if(b->block == block)return b;
+	}
+
+	return NULL;
+}
+
+/**
+  * Inserts the given block as the most recently used block
+ **/
+static void td_mrc_insert(struct td_mrc *mrc, struct td_mrc_block *b)
+{
+	struct rb_node **link = &mrc->lru.rb_node;
+	struct rb_node *parent = NULL;
+
+	//The new node is always the rightmost node, so the
+	//subtree size of all nodes on the way increases
+	while(*link)
+	{
+		parent = *link;
+		rb_entry(parent, struct td_mrc_block, node)->subtree_size++;
+		link = &parent->rb_right;
+	}
+
+	b->subtree_size = 1;
+	rb_link_node(&b->node, parent, link);
+	rb_insert_augmented(&b->node, &mrc->lru, &td_mrc_callbacks);
+}
+
+/**
+  * Returns the amount of tracked blocks which were
+  * accessed after the given block
+ **/
+static u32 td_mrc_distance(struct td_mrc_block *b)
+{
+	struct rb_node *node = &b->node;
+	struct rb_node *parent;
+	u32 distance = td_mrc_subtree_size(node->rb_right);
+
+	while((parent = rb_parent(node)))
+	{
+		if(parent->rb_left == node)
+			distance += 1 + td_mrc_subtree_size(parent->rb_right);
+
+		node = parent;
+	}
+
+	return distance;
+}
+
+/**
+  * Stops tracking the given block
+ **/
+static void td_mrc_remove(struct td_mrc *mrc, struct td_mrc_block *b)
+{
+	rb_erase_augmented(&b->node, &mrc->lru, &td_mrc_callbacks);
+	RB_CLEAR_NODE(&b->node);
+
+	hlist_del(&b->hash);
+	hlist_add_head(&b->hash, &mrc->free);
+
+	mrc->result.sampled_blocks--;
+}
+
+/**
+  * Halves the sampling rate and stops tracking the
+  * blocks which are not sampled anymore
+ **/
+static void td_mrc_lower_rate(struct td_mrc *mrc)
+{
+	unsigned int i;
+	u32 mask;
+
+	mrc->result.sampling_shift++;
+	mask = td_mrc_sampling_mask(mrc);
+
+	for(i = 0; i < TD_MRC_BLOCKS; ++i)
+	{
+		struct td_mrc_block *b = &mrc->blocks[i];
+
+		if(!RB_EMPTY_NODE(&b->node) && (b->sample_hash & mask))
+			td_mrc_remove(mrc, b);
+	}
+}
+
+/**
+  * Adds an access with the given reuse distance (in blocks)
+  * to the histograms. Misses have a reuse distance of U64_MAX
+ **/
+static void td_mrc_count(struct td_mrc *mrc, u64 distance, bool write)
+{
+	//Each sampled access represents 2^sampling_shift accesses
+	const u64 weight = 1ULL << mrc->result.sampling_shift;
+	u64 bucket = U64_MAX;
+
+	if(distance != U64_MAX)
+		bucket = __div64_32_nomod(distance, (u32)mrc->result.bucket_blocks);
+
+	if(bucket >= TDISK_MRC_BUCKETS)
+	{
+		if(write)mrc->result.write_misses += weight;
+		else mrc->result.read_misses += weight;
+	}
+	else
+	{
+		if(write)mrc->result.write_histogram[bucket] += weight;
+		else mrc->result.read_histogram[bucket] += weight;
+	}
+}
+
+void td_mrc_reset(struct td_mrc *mrc, sector_t size_blocks)
+{
+	unsigned int i;
+
+	memset(&mrc->result, 0, sizeof(struct tdisk_mrc));
+	mrc->result.bucket_blocks = max_t(u64, 1, __div64_32_nomod((u64)size_blocks + TDISK_MRC_BUCKETS - 1, TDISK_MRC_BUCKETS));
+
+	mrc->lru = RB_ROOT;
+	INIT_HLIST_HEAD(&mrc->free);
+
+	for(i = 0; i < TD_MRC_BLOCKS; ++i)
+		INIT_HLIST_HEAD(&mrc->buckets[i]);
+
+	for(i = 0; i < TD_MRC_BLOCKS; ++i)
+	{
+		RB_CLEAR_NODE(&mrc->blocks[i].node);
+		hlist_add_head(&mrc->blocks[i].hash, &mrc->free);
+	}
+}
+
+void td_mrc_access(struct td_mrc *mrc, sector_t block, bool write)
+{
+	struct td_mrc_block *b;
+	const u32 sample_hash = jhash_2words((u32)block, (u32)((u64)block >> 32), 0);
+
+	if(sample_hash & td_mrc_sampling_mask(mrc))return;
+
+	b = td_mrc_find(mrc, block);
+	if(b)
+	{
+		//The distance between sampled blocks is scaled
+		//to the distance between all blocks
+		const u64 distance = (u64)td_mrc_distance(b) << mrc->result.sampling_shift;
+
+		td_mrc_count(mrc, distance, write);
+		rb_erase_augmented(&b->node, &mrc->lru, &td_mrc_callbacks);
+		td_mrc_insert(mrc, b);
+		return;
+	}
+
+	//All blocks are used, so the sampling rate
+	//is lowered until there is a free block
+	while(hlist_empty(&mrc->free))
+	{
+		if(mrc->result.sampling_shift == TD_MRC_MAX_SAMPLING_SHIFT)return;
+
+		td_mrc_lower_rate(mrc);
+		if(sample_hash & td_mrc_sampling_mask(mrc))return;
+	}
+
+	td_mrc_count(mrc, U64_MAX, write);
+
+	b = hlist_entry(mrc->free.first, struct td_mrc_block, hash);
+	hlist_del(&b->hash);
+	hlist_add_head(&b->hash, td_mrc_bucket(mrc, block));
+
+	b->block = block;
+	b->sample_hash = sample_hash;
+	mrc->result.sampled_blocks++;
+
+	td_mrc_insert(mrc, b);
+}
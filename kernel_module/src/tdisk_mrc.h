@@ -0,0 +1,89 @@
+/**
+  *
+  * tDisk Driver
+  * @author Thomas Sparber (2015-2016)
+  *
+ **/
+
+#ifndef TDISK_MRC_H
+#define TDISK_MRC_H
+
+#include <tdisk/config.h>
+#include <tdisk/interface.h>
+
+#pragma GCC system_header
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/rbtree_augmented.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+/**
+  * The max amount of blocks (2^x) whose reuse distance
+  * is tracked. If more blocks are sampled, the sampling
+  * rate is halved
+ **/
+#define TD_MRC_BLOCKS_SHIFT 13
+#define TD_MRC_BLOCKS (1 << TD_MRC_BLOCKS_SHIFT)
+
+/**
+  * The lowest sampling rate (one of 2^x blocks)
+ **/
+#define TD_MRC_MAX_SAMPLING_SHIFT 24
+
+/**
+  * A block whose reuse distance is tracked
+ **/
+struct td_mrc_block
+{
+	//The blocks are sorted by their last access. The
+	//most recently used block is the rightmost node
+	struct rb_node node;
+
+	//Links the block into its hash bucket or the free list
+	struct hlist_node hash;
+
+	sector_t block;
+
+	//Decides whether the block is sampled
+	u32 sample_hash;
+
+	//The amount of nodes of the subtree of this node. It is
+	//used to count the blocks which were accessed afterwards
+	u32 subtree_size;
+}; //end struct td_mrc_block
+
+/**
+  * This struct tracks the reuse distances of a spatial
+  * sample of the blocks (SHARDS). A block is sampled if
+  * the lowest sampling_shift bits of its hash are 0, so
+  * the same blocks are always sampled. It is only used
+  * by the worker thread, so no lock is needed.
+ **/
+struct td_mrc
+{
+	//The histograms which are transferred to user space
+	struct tdisk_mrc result;
+
+	struct rb_root lru;
+	struct hlist_head free;
+	struct hlist_head buckets[TD_MRC_BLOCKS];
+	struct td_mrc_block blocks[TD_MRC_BLOCKS];
+}; //end struct td_mrc
+
+/**
+  * Resets the histograms and the tracked blocks. The
+  * histograms are split into buckets so that all blocks
+  * of the tDisk fit.
+ **/
+void td_mrc_reset(struct td_mrc *mrc, sector_t size_blocks);
+
+/**
+  * Records an access of the given logical block
+ **/
+void td_mrc_access(struct td_mrc *mrc, sector_t block, bool write);
+
+#endif //TDISK_MRC_H
@@ -10,6 +10,17 @@
 
 #ifdef USE_NETLINK
 
+/**
+  * This is just a hack in case the kernel was compiled
+  * with CONFIG_DEBUG_LOCK_ALLOC. Then mutex_lock is replaced
+  * with mutex_lock_nested which we can't use in a non GPL module...
+  * The function is then implemented in helpers.c
+ **/
+#ifdef mutex_lock
+#undef mutex_lock
+extern void mutex_lock(struct mutex *lock);
+#endif //mutex_lock
+
 /**
   * Defines the operation SIZE which can be used to
   * get the size of a plugin disk. This is a similar operation
@@ -23,13 +34,91 @@
 spinlock_t plugin_lock;
 
 /**
-  * Defines a registered plugin which just has a name
-  * and a netlink port
+  * The limits of the messages of a plugin. They are
+  * negotiated when the plugin registers
+ **/
+struct plugin_limits
+{
+	/** The max length of the data of a message **/
+	unsigned int max_length;
+
+	/** The max amount of outstanding messages **/
+	unsigned int window;
+}; //end struct plugin_limits
+
+#ifdef USE_PLUGIN_RING
+/**
+  * The shared ring of a plugin (@see NLTD_RING_DEVICE).
+  * It is created using the device and used as soon as
+  * the plugin with the same name registers. The ring is
+  * freed when the device is closed and all requests which
+  * use it are finished.
+ **/
+struct plugin_ring
+{
+	char name[NLTD_MAX_NAME];
+
+	/** The memory which is mapped by the plugin **/
+	struct nltd_ring_header *header;
+	struct nltd_ring_sqe *sq;
+	struct nltd_ring_cqe *cq;
+	char *data;
+	unsigned long size;
+
+	u32 entries;
+	u32 slot_size;
+
+	/**
+	  * The indices of the kernel module. They are not read
+	  * from the shared memory which can be changed by the plugin
+	 **/
+	u32 sq_tail;
+	u32 cq_head;
+
+	/** Protects the submission queue and the used slots **/
+	spinlock_t lock;
+
+	/** The data slots which are used by a request **/
+	unsigned long used_slots[BITS_TO_LONGS(NLTD_RING_MAX_ENTRIES)];
+
+	/** Senders wait here for a free data slot **/
+	struct semaphore free_slots;
+
+	/** Serializes the processing of the completion queue **/
+	struct mutex complete_mutex;
+
+	/** The plugin waits here for submission entries (poll) **/
+	wait_queue_head_t wait;
+
+	/** The device, the plugin and each request hold a reference **/
+	atomic_t users;
+
+	/** Is set when the device is closed **/
+	bool dead;
+
+	struct list_head list;
+}; //end struct plugin_ring
+
+/**
+  * The list which holds all rings. It is protected
+  * by plugin_lock
+ **/
+LIST_HEAD(plugin_rings);
+#endif //USE_PLUGIN_RING
+
+/**
+  * Defines a registered plugin which has a name,
+  * a netlink port and the limits of its messages
  **/
 struct tdisk_plugin
 {
 	char name[NLTD_MAX_NAME];
 	u32 port;
+	struct plugin_limits limits;
+#ifdef USE_PLUGIN_RING
+	/** The ring of the plugin or NULL if netlink is used **/
+	struct plugin_ring *ring;
+#endif //USE_PLUGIN_RING
 	struct list_head list;
 }; //end struct tdisk_plugin
 
@@ -83,6 +172,12 @@ struct pending_request
 	/** The length of the buffer **/
 	size_t buffer_length;
 
+#ifdef USE_PLUGIN_RING
+	/** The ring and data slot which are used for the request **/
+	struct plugin_ring *ring;
+	u32 slot;
+#endif //USE_PLUGIN_RING
+
 	struct list_head list;
 }; //end struct pending_request
 
@@ -130,6 +225,91 @@ void sync_request_callback(void *data, long ret)
 	complete(&sync->done);
 }
 
+/**
+  * This struct is used for synchronous plugin operations
+  * which are split into several messages. Up to window
+  * messages are sent before an answer is awaited. The
+  * answers can arrive in any order.
+ **/
+struct sync_window
+{
+	/** The free slots of the window **/
+	struct semaphore slots;
+
+	/** The amount of outstanding messages + 1 for the sender **/
+	atomic_t pending;
+
+	/** The last error of the messages **/
+	long ret;
+
+	struct completion done;
+}; //end struct sync_window
+
+/**
+  * This internal callback is called for each message of
+  * a struct sync_window. It frees the slot of the message
+  * and wakes up the sender after the last message.
+ **/
+void sync_window_callback(void *data, long ret)
+{
+	struct sync_window *window = data;
+
+	if(ret < 0)ACCESS_ONCE(window->ret) = ret;
+	up(&window->slots);
+
+	//The window is on the stack of the sender which returns
+	//when pending is 0, so it must not be used afterwards
+	if(atomic_dec_and_test(&window->pending))
+		complete(&window->done);
+}
+
+#ifdef USE_PLUGIN_RING
+/**
+  * Drops a reference of the given ring. The ring
+  * is freed when the last reference is dropped
+ **/
+static void nltd_ring_put(struct plugin_ring *ring)
+{
+	if(!atomic_dec_and_test(&ring->users))return;
+
+	vfree(ring->header);
+	kfree(ring);
+}
+
+/**
+  * Frees the given data slot of the ring
+ **/
+static void nltd_ring_free_slot(struct plugin_ring *ring, u32 slot)
+{
+	spin_lock_irq(&ring->lock);
+	__clear_bit(slot, ring->used_slots);
+	spin_unlock_irq(&ring->lock);
+
+	up(&ring->free_slots);
+}
+#endif //USE_PLUGIN_RING
+
+/**
+  * Calls the callback of the given request with the
+  * given return value and frees the request.
+  * If the request used a ring, its data slot is freed.
+ **/
+static void finish_request(struct pending_request *req, long ret)
+{
+	if(req->callback)
+		req->callback(req->userobject, ret);
+
+#ifdef USE_PLUGIN_RING
+	if(req->ring)
+	{
+		nltd_ring_free_slot(req->ring, req->slot);
+		nltd_ring_put(req->ring);
+	}
+#endif //USE_PLUGIN_RING
+
+	kfree(req);
+}
+
 /**
   * This function is called for each NLTD_CMD_REGISTER
   * request to register a plugin in the kernel module.
@@ -141,20 +321,63 @@ static int genl_register(struct sk_buff *skb, struct genl_info *info)
 	bool found = false;
 	char *name;
 	size_t name_length;
+	struct plugin_limits limits;
 	struct tdisk_plugin *plugin;
+#ifdef USE_PLUGIN_RING
+	struct plugin_ring *r;
+	struct plugin_ring *ring = NULL;
+	struct plugin_ring *old_ring = NULL;
+#endif //USE_PLUGIN_RING
 
 	if(!info->attrs[NLTD_PLUGIN_NAME])return -EINVAL;
 	name = nla_data(info->attrs[NLTD_PLUGIN_NAME]);
 	name_length = strlen(name);
 
+	//Plugins which don't send their limits get one page
+	//at a time as in older versions
+	limits.max_length = (unsigned int)PAGE_SIZE;
+	limits.window = 1;
+
+	if(info->attrs[NLTD_PLUGIN_MAX_LENGTH])
+		limits.max_length = clamp_t(u32, nla_get_u32(info->attrs[NLTD_PLUGIN_MAX_LENGTH]), 512, NLTD_MAX_MESSAGE_LENGTH);
+
+	if(info->attrs[NLTD_PLUGIN_WINDOW])
+		limits.window = clamp_t(u32, nla_get_u32(info->attrs[NLTD_PLUGIN_WINDOW]), 1, NLTD_MAX_WINDOW);
+
 	//Check if plugin is already registers
 	spin_lock_irq(&plugin_lock);
+
+#ifdef USE_PLUGIN_RING
+	//The plugin wants to use the ring which
+	//it created with the same name
+	if(info->attrs[NLTD_PLUGIN_RING] && nla_get_u32(info->attrs[NLTD_PLUGIN_RING]))
+	{
+		list_for_each_entry(r, &plugin_rings, list)
+		{
+			if(strncmp(name, r->name, NLTD_MAX_NAME) == 0)
+			{
+				//The messages are not limited by netlink anymore
+				ring = r;
+				atomic_inc(&ring->users);
+				limits.max_length = ring->slot_size;
+				limits.window = min(limits.window, ring->entries);
+				break;
+			}
+		}
+	}
+#endif //USE_PLUGIN_RING
+
 	list_for_each_entry(plugin, &registered_plugins, list)
 	{
 		if(name_length == strlen(name) && strncmp(name, plugin->name, name_length) == 0)
 		{
 			//Same plugin registered again. Updating port
 			plugin->port = info->snd_portid;
+			plugin->limits = limits;
+#ifdef USE_PLUGIN_RING
+			old_ring = plugin->ring;
+			plugin->ring = ring;
+#endif //USE_PLUGIN_RING
 			found = true;
 			break;
 		}
@@ -166,12 +389,23 @@ static int genl_register(struct sk_buff *skb, struct genl_info *info)
 		plugin = kmalloc(sizeof(struct tdisk_plugin), GFP_KERNEL);
 		memcpy(plugin->name, name, NLTD_MAX_NAME);
 		plugin->port = info->snd_portid;
+		plugin->limits = limits;
+#ifdef USE_PLUGIN_RING
+		plugin->ring = ring;
+#endif //USE_PLUGIN_RING
 
 		list_add(&plugin->list, &registered_plugins);
 	}
 	spin_unlock_irq(&plugin_lock);
 
-	printk(KERN_INFO "tDisk: Plugin %s registered\n", name);
+#ifdef USE_PLUGIN_RING
+	if(old_ring)nltd_ring_put(old_ring);
+
+	if(info->attrs[NLTD_PLUGIN_RING] && !ring)
+		printk(KERN_WARNING "tDisk: Plugin %s has no ring. Using netlink\n", name);
+#endif //USE_PLUGIN_RING
+
+	printk(KERN_INFO "tDisk: Plugin %s registered (%u bytes per message, %u outstanding messages)\n", name, limits.max_length, limits.window);
 	return 0;
 }
 
@@ -186,6 +420,9 @@ static int genl_unregister(struct sk_buff *skb, struct genl_info *info)
 	size_t name_length;
 	struct tdisk_plugin *n;
 	struct tdisk_plugin *plugin;
+#ifdef USE_PLUGIN_RING
+	struct plugin_ring *ring = NULL;
+#endif //USE_PLUGIN_RING
 
 	if(!info->attrs[NLTD_PLUGIN_NAME])return -EINVAL;
 	name = nla_data(info->attrs[NLTD_PLUGIN_NAME]);
@@ -199,6 +436,9 @@ static int genl_unregister(struct sk_buff *skb, struct genl_info *info)
 		{
 			//Delete plugin from global list
 			list_del(&plugin->list);
+#ifdef USE_PLUGIN_RING
+			ring = plugin->ring;
+#endif //USE_PLUGIN_RING
 			kfree(plugin);
 			printk(KERN_INFO "tDisk: Plugin %s unregistered\n", name);
 			found = true;
@@ -207,6 +447,10 @@ static int genl_unregister(struct sk_buff *skb, struct genl_info *info)
 	}
 	spin_unlock_irq(&plugin_lock);
 
+#ifdef USE_PLUGIN_RING
+	if(ring)nltd_ring_put(ring);
+#endif //USE_PLUGIN_RING
+
 	if(!found)
 	{
 		printk(KERN_WARNING "tDisk: Unable to unregister plugin %s. Not found\n", name);
@@ -268,8 +512,10 @@ static struct pending_request* pop_request(u32 request_number)
 
 /**
   * Gets the port of the plugin with the given name.
+  * If limits is not NULL, it is set to the limits of
+  * the plugin's messages
  **/
-static u32 get_plugin_port(const char *name)
+static u32 get_plugin_port(const char *name, struct plugin_limits *limits)
 {
 	u32 port = 0;
 	struct tdisk_plugin *plugin;
@@ -281,6 +527,7 @@ static u32 get_plugin_port(const char *name)
 		if(name_length == strlen(plugin->name) && strncmp(name, plugin->name, name_length) == 0)
 		{
 			port = plugin->port;
+			if(limits)(*limits) = plugin->limits;
 			break;
 		}
 	}
@@ -291,9 +538,38 @@ static u32 get_plugin_port(const char *name)
 
 int nltd_is_registered(const char *plugin)
 {
-	return (get_plugin_port(plugin) != 0);
+	return (get_plugin_port(plugin, NULL) != 0);
 }
 
+#ifdef USE_PLUGIN_RING
+/**
+  * Gets the ring of the plugin with the given name.
+  * A reference of the ring is taken which needs to be
+  * dropped using nltd_ring_put. NULL is returned if
+  * the plugin doesn't use a ring.
+ **/
+static struct plugin_ring* get_plugin_ring(const char *name)
+{
+	struct plugin_ring *ring = NULL;
+	struct tdisk_plugin *plugin;
+	size_t name_length = strlen(name);
+
+	spin_lock_irq(&plugin_lock);
+	list_for_each_entry(plugin, &registered_plugins, list)
+	{
+		if(name_length == strlen(plugin->name) && strncmp(name, plugin->name, name_length) == 0)
+		{
+			ring = plugin->ring;
+			if(ring)atomic_inc(&ring->users);
+			break;
+		}
+	}
+	spin_unlock_irq(&plugin_lock);
+
+	return ring;
+}
+#endif //USE_PLUGIN_RING
+
 /**
   * Gets the name of the plugin with the given port.
   * The string pointed to by the return value
@@ -390,13 +666,185 @@ static int genl_finished(struct sk_buff *skb, struct genl_info *info)
 	}
 
 	//Finally call callback that the request finished
-	if(req->callback)
-		req->callback(req->userobject, ret);
+	finish_request(req, ret);
+	return 0;
+}
 
-	kfree(req);
+#ifdef USE_PLUGIN_RING
+/**
+  * This function sends a request using the ring of
+  * the plugin. It waits for a free data slot, copies
+  * the data of a write request into the slot and adds
+  * a submission entry. The reference of the ring is
+  * passed to the request.
+ **/
+static int nltd_ring_send(struct plugin_ring *ring, loff_t offset, char *buffer, unsigned int length, int operation, plugin_callback callback, void *userobject)
+{
+	int err;
+	u32 cmd;
+	u32 slot;
+	u32 seq_nr;
+	struct nltd_ring_sqe *sqe;
+	struct pending_request *req;
+
+	err = -EINVAL;
+	if(operation == READ)cmd = NLTD_CMD_READ;
+	else if(operation == SIZE)cmd = NLTD_CMD_SIZE;
+	else if(operation == WRITE)cmd = NLTD_CMD_WRITE;
+	else goto error;
+
+	if(length > ring->slot_size)goto error;
+
+	//Wait for a free data slot
+	down(&ring->free_slots);
+
+	spin_lock_irq(&ring->lock);
+	if(ring->dead)
+	{
+		//Wake up the next sender which fails as well
+		spin_unlock_irq(&ring->lock);
+		up(&ring->free_slots);
+		err = -ENODEV;
+		goto error;
+	}
+	slot = (u32)find_first_zero_bit(ring->used_slots, ring->entries);
+	__set_bit(slot, ring->used_slots);
+	spin_unlock_irq(&ring->lock);
+
+	//Create request in request list and set values
+	//This is needed to identify the answer later on
+	req = create_request();
+	if(!req)
+	{
+		nltd_ring_free_slot(ring, slot);
+		err = -ENOMEM;
+		goto error;
+	}
+
+	req->type = operation;
+	req->callback = callback;
+	req->userobject = userobject;
+	req->buffer = buffer;
+	req->buffer_length = length;
+	req->ring = ring;
+	req->slot = slot;
+	seq_nr = req->seq_nr;
+
+	if(operation == WRITE)
+		memcpy(ring->data + (size_t)slot * ring->slot_size, buffer, length);
+
+	spin_lock_irq(&ring->lock);
+	if(ring->dead)
+	{
+		spin_unlock_irq(&ring->lock);
+		err = -ENODEV;
+		goto request_failure;
+	}
+
+	sqe = &ring->sq[ring->sq_tail & (ring->entries - 1)];
+	sqe->offset = (u64)offset;
+	sqe->request_number = seq_nr;
+	sqe->length = length;
+	sqe->slot = slot;
+	sqe->cmd = cmd;
+
+	//The entry and the data need to be visible
+	//before the plugin sees the new tail
+	smp_wmb();
+	ACCESS_ONCE(ring->header->sq_tail) = ++ring->sq_tail;
+	spin_unlock_irq(&ring->lock);
+
+	wake_up_interruptible(&ring->wait);
 	return 0;
+
+ request_failure:
+	//The callback is called below
+	req = pop_request(seq_nr);
+	if(req)
+	{
+		nltd_ring_free_slot(ring, slot);
+		kfree(req);
+	}
+ error:
+	printk_ratelimited(KERN_WARNING "tDisk: Error sending ring request: %d. Operation: %s, Offset: %llu, Length: %u\n",
+			err,
+			(operation == READ ? "READ" : (operation == WRITE ? "WRITE" : (operation == SIZE ? "SIZE" : "UNKNOWN"))),
+			offset,
+			length);
+
+	if(callback)callback(userobject, err);
+	nltd_ring_put(ring);
+
+	return err;
 }
 
+/**
+  * Processes the completion entries of the given ring.
+  * The data of read and size requests is copied from the
+  * data slots and the requests are finished.
+  * Returns the amount of finished requests.
+ **/
+static int nltd_ring_complete(struct plugin_ring *ring)
+{
+	u32 tail;
+	int amount = 0;
+
+	mutex_lock(&ring->complete_mutex);
+
+	tail = ACCESS_ONCE(ring->header->cq_tail);
+
+	//The entries and the data need to be
+	//read after the tail
+	smp_rmb();
+
+	if(tail - ring->cq_head > ring->entries)
+	{
+		printk_ratelimited(KERN_WARNING "tDisk: Probably broken plugin: %s - invalid completion queue tail %u (head: %u)\n", ring->name, tail, ring->cq_head);
+		mutex_unlock(&ring->complete_mutex);
+		return -EINVAL;
+	}
+
+	while(ring->cq_head != tail)
+	{
+		struct pending_request *req;
+		const struct nltd_ring_cqe cqe = ring->cq[ring->cq_head & (ring->entries - 1)];
+		long ret = cqe.ret;
+
+		ring->cq_head++;
+
+		req = pop_request(cqe.request_number);
+		if(!req)
+		{
+			printk_ratelimited(KERN_WARNING "tDisk: Plugin %s finished a request I didn't know of: %u\n", ring->name, cqe.request_number);
+			continue;
+		}
+
+		if(req->ring != ring)
+		{
+			printk_ratelimited(KERN_WARNING "tDisk: Probably broken plugin: %s - finished request %u of another plugin\n", ring->name, cqe.request_number);
+			ret = -EIO;
+		}
+		else if(req->type != WRITE && ret >= 0 && cqe.length > 0)
+		{
+			//The slot of the request is used, the one of the
+			//answer can't be trusted
+			const size_t length = min_t(size_t, min_t(size_t, cqe.length, ring->slot_size), req->buffer_length);
+			memcpy(req->buffer, ring->data + (size_t)req->slot * ring->slot_size, length);
+		}
+
+		if(ret < 0)printk(KERN_DEBUG "tDisk: received error message %ld\n", ret);
+
+		finish_request(req, ret);
+		amount++;
+	}
+
+	ACCESS_ONCE(ring->header->cq_head) = ring->cq_head;
+	mutex_unlock(&ring->complete_mutex);
+
+	return amount;
+}
+#endif //USE_PLUGIN_RING
+
 /**
   * This function sends a message asynchronously.
   * It allocates a message object, sets all the
@@ -409,21 +857,37 @@ int nltd_send_async(const char *plugin, loff_t offset, char *buffer, unsigned in
 	void *hdr;
 	struct sk_buff *msg;
 	struct pending_request *req = NULL;
-	u32 port = get_plugin_port(plugin);
+	struct plugin_limits limits;
+#ifdef USE_PLUGIN_RING
+	struct plugin_ring *ring;
+#endif //USE_PLUGIN_RING
+	u32 port = get_plugin_port(plugin, &limits);
 	unsigned int msg_size = (unsigned int)
-							(sizeof(__u32) /*u32 -> req_nr*/ +
-							sizeof(__u64) /*u64 -> offset*/ +
-							sizeof(__u32) /*u32 -> length*/ +
-							length) /* buffer */;
+							(nla_total_size(sizeof(__u32)) /*u32 -> req_nr*/ +
+							nla_total_size(sizeof(__u64)) + sizeof(__u32) /*u64 -> offset + alignment*/ +
+							nla_total_size(sizeof(__u32)) /*u32 -> length*/ +
+							nla_total_size((int)length)) /* buffer */;
 
 	if(msg_size < PAGE_SIZE)msg_size = PAGE_SIZE;
 
-	if(length > PAGE_SIZE)printk_ratelimited(KERN_WARNING "tDisk: Warning when sending nl msg: length (%d) is larger than PAGE_SIZE(%lu)\n", length, PAGE_SIZE);
-
 	//0 means plugin is not registered
 	err = -ENODEV;
 	if(port == 0)goto error;
 
+	//The plugin can't handle such large messages
+	err = -EINVAL;
+	if(operation != SIZE && length > limits.max_length)
+	{
+		printk_ratelimited(KERN_WARNING "tDisk: length (%u) is larger than the max message length of plugin %s (%u)\n", length, plugin, limits.max_length);
+		goto error;
+	}
+
+#ifdef USE_PLUGIN_RING
+	//Plugins with a ring don't get netlink messages
+	ring = get_plugin_ring(plugin);
+	if(ring)return nltd_ring_send(ring, offset, buffer, length, operation, callback, userobject);
+#endif //USE_PLUGIN_RING
+
 	//Allocate message
 	err = -ENOMEM;
 	msg = genlmsg_new(msg_size, 0);
@@ -531,48 +995,53 @@ void nltd_write_async(const char *plugin, loff_t offset, char *buffer, unsigned
 	nltd_send_async(plugin, offset, buffer, length, WRITE, callback, userobject);
 }
 
-int nltd_read_sync(const char *plugin, loff_t offset, char *buffer, unsigned int length)
+/**
+  * Transfers the given data synchronously. The data is
+  * split into messages of the max length of the plugin.
+  * Up to window messages are sent before the sender waits
+  * for an answer, so the round trips of the messages overlap.
+ **/
+static int nltd_transfer_sync(const char *plugin, loff_t offset, char *buffer, unsigned int length, int operation)
 {
 	unsigned int pos;
+	struct plugin_limits limits;
+	struct sync_window window;
 
-	for(pos = 0; pos < length; pos += (unsigned int)PAGE_SIZE)
-	{
-		unsigned int currentLength = min((unsigned int)PAGE_SIZE, length-pos);
+	if(get_plugin_port(plugin, &limits) == 0)return -EIO;
 
-		struct sync_request sync = {
-			0,
-			COMPLETION_INITIALIZER_ONSTACK(sync.done),
-		};
+	sema_init(&window.slots, (int)limits.window);
+	atomic_set(&window.pending, 1);
+	window.ret = 0;
+	init_completion(&window.done);
 
-		nltd_read_async(plugin, offset+pos, buffer+pos, currentLength, sync_request_callback, &sync);
-		wait_for_completion(&sync.done);
+	for(pos = 0; pos < length; pos += limits.max_length)
+	{
+		unsigned int currentLength = min(limits.max_length, length-pos);
 
-		if(sync.ret < 0)return -EIO;
+		//Wait until an outstanding message is answered
+		down(&window.slots);
+		if(ACCESS_ONCE(window.ret) < 0)break;
+
+		atomic_inc(&window.pending);
+		nltd_send_async(plugin, offset+pos, buffer+pos, currentLength, operation, sync_window_callback, &window);
 	}
 
+	//Wait for all outstanding messages
+	if(!atomic_dec_and_test(&window.pending))
+		wait_for_completion(&window.done);
+
+	if(window.ret < 0)return -EIO;
 	return 0;
 }
 
-int nltd_write_sync(const char *plugin, loff_t offset, char *buffer, unsigned int length)
+int nltd_read_sync(const char *plugin, loff_t offset, char *buffer, unsigned int length)
 {
-	unsigned int pos;
-
-	for(pos = 0; pos < length; pos += (unsigned int)PAGE_SIZE)
-	{
-		unsigned int currentLength = min((unsigned int)PAGE_SIZE, length-pos);
-
-		struct sync_request sync = {
-			0,
-			COMPLETION_INITIALIZER_ONSTACK(sync.done),
-		};
-
-		nltd_write_async(plugin, offset+pos, buffer+pos, currentLength, sync_request_callback, &sync);
-		wait_for_completion(&sync.done);
-
-		if(sync.ret < 0)return -EIO;
-	}
+	return nltd_transfer_sync(plugin, offset, buffer, length, READ);
+}
 
-	return 0;
+int nltd_write_sync(const char *plugin, loff_t offset, char *buffer, unsigned int length)
+{
+	return nltd_transfer_sync(plugin, offset, buffer, length, WRITE);
 }
 
 loff_t nltd_get_size(const char *plugin)
@@ -655,8 +1124,7 @@ int clear_timed_out_requests(void *data)
 		{
 			unsigned long time = jiffies_to_msecs((unsigned long)request->started);
 			printk(KERN_DEBUG "tDisk: Timing out request %u: start-time: %lus %lums\n", request->seq_nr, time/1000, (time%1000));
-			if(request->callback)request->callback(request->userobject, -ETIMEDOUT);
-			kfree(request);
+			finish_request(request, -ETIMEDOUT);
 			amount++;
 		}
 
@@ -688,6 +1156,228 @@ static struct genl_ops genl_tdisk_ops[] = {
 	}
 };
 
+#ifdef USE_PLUGIN_RING
+/**
+  * Creates the ring for the given file (TDISK_PLUGIN_RING_SETUP).
+  * The amount of entries and the slot size are adjusted to
+  * valid values and written back together with the size
+  * of the mapping.
+ **/
+static int nltd_ring_setup(struct file *file, struct nltd_ring_setup __user *user_setup)
+{
+	bool exists = false;
+	u32 sq_offset;
+	u32 cq_offset;
+	u64 data_offset;
+	struct plugin_ring *r;
+	struct plugin_ring *ring;
+	struct nltd_ring_setup setup;
+
+	if(copy_from_user(&setup, user_setup, sizeof(struct nltd_ring_setup)))
+		return -EFAULT;
+
+	setup.name[NLTD_MAX_NAME-1] = 0;
+	setup.entries = (u32)roundup_pow_of_two(clamp_t(u32, setup.entries, 1, NLTD_RING_MAX_ENTRIES));
+	setup.slot_size = (u32)PAGE_ALIGN(clamp_t(u32, setup.slot_size, PAGE_SIZE, NLTD_RING_MAX_SLOT_SIZE));
+
+	//The header, the queues and the data
+	//slots start on separate pages
+	sq_offset = (u32)PAGE_SIZE;
+	cq_offset = sq_offset + setup.entries * (u32)sizeof(struct nltd_ring_sqe);
+	data_offset = PAGE_ALIGN(cq_offset + setup.entries * (u32)sizeof(struct nltd_ring_cqe));
+	setup.size = data_offset + (u64)setup.entries * setup.slot_size;
+
+	ring = kzalloc(sizeof(struct plugin_ring), GFP_KERNEL);
+	if(!ring)return -ENOMEM;
+
+	ring->header = vmalloc_user((unsigned long)setup.size);
+	if(!ring->header)
+	{
+		kfree(ring);
+		return -ENOMEM;
+	}
+
+	memcpy(ring->name, setup.name, NLTD_MAX_NAME);
+	ring->sq = (struct nltd_ring_sqe*)((char*)ring->header + sq_offset);
+	ring->cq = (struct nltd_ring_cqe*)((char*)ring->header + cq_offset);
+	ring->data = (char*)ring->header + data_offset;
+	ring->size = (unsigned long)setup.size;
+	ring->entries = setup.entries;
+	ring->slot_size = setup.slot_size;
+	spin_lock_init(&ring->lock);
+	sema_init(&ring->free_slots, (int)setup.entries);
+	mutex_init(&ring->complete_mutex);
+	init_waitqueue_head(&ring->wait);
+	atomic_set(&ring->users, 1);
+
+	ring->header->entries = setup.entries;
+	ring->header->slot_size = setup.slot_size;
+	ring->header->sq_offset = sq_offset;
+	ring->header->cq_offset = cq_offset;
+	ring->header->data_offset = data_offset;
+
+	//Only one ring per file and plugin name
+	spin_lock_irq(&plugin_lock);
+	list_for_each_entry(r, &plugin_rings, list)
+	{
+		if(strncmp(setup.name, r->name, NLTD_MAX_NAME) == 0)
+		{
+			exists = true;
+			break;
+		}
+	}
+
+	if(!exists && !file->private_data)
+	{
+		list_add(&ring->list, &plugin_rings);
+		file->private_data = ring;
+		ring = NULL;
+	}
+	spin_unlock_irq(&plugin_lock);
+
+	if(ring)
+	{
+		nltd_ring_put(ring);
+		return -EEXIST;
+	}
+
+	if(copy_to_user(user_setup, &setup, sizeof(struct nltd_ring_setup)))
+		return -EFAULT;
+
+	printk(KERN_INFO "tDisk: Created ring for plugin %s (%u entries, %u bytes per slot)\n", setup.name, setup.entries, setup.slot_size);
+	return 0;
+}
+
+/**
+  * This function handles the ioctl calls
+  * of the td-plugin device
+ **/
+static long nltd_ring_ioctl(struct file *file, unsigned int cmd, unsigned long parm)
+{
+	struct plugin_ring *ring = ACCESS_ONCE(file->private_data);
+
+	switch(cmd)
+	{
+	case TDISK_PLUGIN_RING_SETUP:
+		return nltd_ring_setup(file, (struct nltd_ring_setup __user *)parm);
+	case TDISK_PLUGIN_RING_COMPLETE:
+		if(!ring)return -EINVAL;
+		return nltd_ring_complete(ring);
+	default:
+		return -EINVAL;
+	}
+}
+
+#ifdef CONFIG_COMPAT
+/**
+  * This function handles the ioctl calls
+  * of the td-plugin device. Compatibility version.
+ **/
+static long nltd_ring_compat_ioctl(struct file *file, unsigned int cmd, unsigned long parm)
+{
+	if(cmd == TDISK_PLUGIN_RING_SETUP)
+		parm = (unsigned long)compat_ptr((compat_uptr_t)parm);
+
+	return nltd_ring_ioctl(file, cmd, parm);
+}
+#endif //CONFIG_COMPAT
+
+/**
+  * Maps the ring of the given file into the plugin
+ **/
+static int nltd_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct plugin_ring *ring = ACCESS_ONCE(file->private_data);
+
+	if(!ring)return -EINVAL;
+	if(vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > ring->size)return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->header, 0);
+}
+
+/**
+  * The device is readable if the ring
+  * contains submission entries
+ **/
+static unsigned int nltd_ring_poll(struct file *file, poll_table *wait)
+{
+	struct plugin_ring *ring = ACCESS_ONCE(file->private_data);
+
+	if(!ring)return POLLERR;
+
+	poll_wait(file, &ring->wait, wait);
+
+	if(ACCESS_ONCE(ring->header->sq_head) != ACCESS_ONCE(ring->header->sq_tail))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+/**
+  * Detaches the ring of the given file from its plugin.
+  * Further requests of the plugin use netlink again. The
+  * requests which were not finished by the plugin are
+  * timed out by the timeout thread.
+ **/
+static int nltd_ring_release(struct inode *inode, struct file *file)
+{
+	int references = 1;
+	struct tdisk_plugin *plugin;
+	struct plugin_ring *ring = file->private_data;
+
+	if(!ring)return 0;
+
+	spin_lock_irq(&plugin_lock);
+	list_del(&ring->list);
+	list_for_each_entry(plugin, &registered_plugins, list)
+	{
+		if(plugin->ring == ring)
+		{
+			plugin->ring = NULL;
+			references++;
+		}
+	}
+	spin_unlock_irq(&plugin_lock);
+
+	spin_lock_irq(&ring->lock);
+	ring->dead = true;
+	spin_unlock_irq(&ring->lock);
+
+	//Senders which are waiting for a free
+	//slot wake up each other and fail
+	up(&ring->free_slots);
+
+	while(references--)nltd_ring_put(ring);
+
+	return 0;
+}
+
+/**
+  * Represents the file operations of the td-plugin device
+ **/
+static const struct file_operations nltd_ring_fops = {
+	.open		= nonseekable_open,
+	.release	= nltd_ring_release,
+	.unlocked_ioctl	= nltd_ring_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= nltd_ring_compat_ioctl,
+#endif //CONFIG_COMPAT
+	.mmap		= nltd_ring_mmap,
+	.poll		= nltd_ring_poll,
+	.owner		= THIS_MODULE,
+	.llseek		= noop_llseek,
+};
+
+/**
+  * Misc device operations
+ **/
+static struct miscdevice nltd_ring_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "td-plugin",
+	.fops		= &nltd_ring_fops,
+};
+#endif //USE_PLUGIN_RING
+
 int nltd_register()
 {
 	int ret;
@@ -699,6 +1389,15 @@ int nltd_register()
 
 	timeout_thread = kthread_run(clear_timed_out_requests, NULL, "nltd_timeout");
 
+#ifdef USE_PLUGIN_RING
+	ret = misc_register(&nltd_ring_misc);
+	if(ret)
+	{
+		kthread_stop(timeout_thread);
+		genl_unregister_family(&genl_tdisk_family);
+	}
+#endif //USE_PLUGIN_RING
+
 	return ret;
 }
 
@@ -710,6 +1409,12 @@ void nltd_unregister()
 	struct pending_request *request;	
 	LIST_HEAD(removed);
 
+#ifdef USE_PLUGIN_RING
+	//The rings were already released because
+	//the device holds a reference of the module
+	misc_deregister(&nltd_ring_misc);
+#endif //USE_PLUGIN_RING
+
 	kthread_stop(timeout_thread);
 
 	//Clear all registered plugins
@@ -731,8 +1436,7 @@ void nltd_unregister()
 
 	list_for_each_entry_safe(request, n2, &removed, list)
 	{
-		if(request->callback)request->callback(request->userobject, -ETIMEDOUT);
-		kfree(request);
+		finish_request(request, -ETIMEDOUT);
 	}
 
 	genl_unregister_family(&genl_tdisk_family);
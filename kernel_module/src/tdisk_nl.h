@@ -12,13 +12,24 @@
 #include <tdisk/interface.h>
 
 #pragma GCC system_header
+#include <linux/bitops.h>
+#include <linux/compat.h>
 #include <linux/completion.h>
+#include <linux/fs.h>
 #include <linux/genetlink.h>
 #include <linux/kthread.h>
+#include <linux/log2.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/semaphore.h>
 #include <linux/skbuff.h>
 #include <linux/spinlock.h>
 #include <linux/timer.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 #include <net/genetlink.h>
 #include <net/net_namespace.h>
 #include <net/sock.h>
@@ -39,13 +50,15 @@
 typedef void (*plugin_callback)(void*,long);
 
 /**
-  * Registers the netlink family and starts the timeout thread
+  * Registers the netlink family, starts the timeout thread
+  * and registers the device for the plugin rings
  **/
 int nltd_register(void);
 
 /**
   * Finishes all pending requests, stops the timeout
-  * thread and unregisters the netlink family
+  * thread and unregisters the netlink family and the
+  * device for the plugin rings
  **/
 void nltd_unregister(void);
 
@@ -74,15 +87,17 @@ void nltd_write_async(const char *plugin, loff_t offset, char *buffer, unsigned
 
 /**
   * Synchronously read data from the plugin.
-  * The struct sync_request is used to wait for
-  * completion of the request
+  * The data is split into messages of the max
+  * length of the plugin. Up to window messages
+  * are outstanding at once (@see struct sync_window)
  **/
 int nltd_read_sync(const char *plugin, loff_t offset, char *buffer, unsigned int length);
 
 /**
   * Synchronously write data to the plugin.
-  * The struct sync_request is used to wait for
-  * completion of the request
+  * The data is split into messages of the max
+  * length of the plugin. Up to window messages
+  * are outstanding at once (@see struct sync_window)
  **/
 int nltd_write_sync(const char *plugin, loff_t offset, char *buffer, unsigned int length);
 